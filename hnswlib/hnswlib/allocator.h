@@ -0,0 +1,270 @@
+#pragma once
+
+#include <stdlib.h>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#ifdef __linux__
+#define HNSWLIB_HAS_HUGE_PAGES
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace hnswlib {
+
+// Alignment of the base layer arrays: the cache line and the AVX-512 register size
+static const size_t LEVEL0_ALIGNMENT = 64;
+
+/*
+* Allocates the base layer arrays of HierarchicalNSW (see HierarchicalNSW::setAllocator).
+* allocate() returns memory aligned to at least LEVEL0_ALIGNMENT bytes, or nullptr when there is not enough memory.
+* deallocate() gets the size which was passed to allocate().
+* An allocator is not owned by the indexes using it and must outlive them.
+*/
+class Level0Allocator {
+ public:
+    virtual char *allocate(size_t size) = 0;
+    virtual void deallocate(char *ptr, size_t size) = 0;
+
+    // Granularity of the allocations, every size is rounded up to a multiple of it; 0 if sizes are not rounded
+    virtual size_t pageSize() const {
+        return 0;
+    }
+
+    virtual ~Level0Allocator() {}
+};
+
+
+/*
+* Carves the chunks of a base layer out of slabs of whole pages of an allocator which rounds its allocations
+* up to the page size, so that the chunks of an index share pages instead of taking one each, which matters
+* for 1 GB pages. A slab is returned to the allocator once all of its chunks are freed; the space of the last
+* chunk of a slab is reused when it is freed first, as happens when an index shrinks.
+* Not thread-safe: an index allocates and frees its chunks under its resize lock.
+*/
+class SlabAllocator : public Level0Allocator {
+    struct Slab {
+        char *ptr;
+        size_t size;
+        size_t used;        // bytes carved out from the start
+        size_t num_chunks;  // live allocations
+    };
+
+    Level0Allocator *allocator_;
+    size_t page_size_;
+    std::vector<Slab> slabs_;
+
+    static size_t alignedSize(size_t size) {
+        return (std::max(size, (size_t) 1) + LEVEL0_ALIGNMENT - 1) / LEVEL0_ALIGNMENT * LEVEL0_ALIGNMENT;
+    }
+
+ public:
+    explicit SlabAllocator(Level0Allocator *allocator)
+        : allocator_(allocator), page_size_(std::max(allocator->pageSize(), LEVEL0_ALIGNMENT)) {}
+
+    SlabAllocator(const SlabAllocator &) = delete;
+    SlabAllocator &operator=(const SlabAllocator &) = delete;
+
+    char *allocate(size_t size) {
+        size = alignedSize(size);
+        if (slabs_.empty() || slabs_.back().size - slabs_.back().used < size) {
+            size_t slab_size = (size + page_size_ - 1) / page_size_ * page_size_;
+            char *ptr = allocator_->allocate(slab_size);
+            if (ptr == nullptr)
+                return nullptr;
+            slabs_.push_back(Slab{ptr, slab_size, 0, 0});
+        }
+        Slab &slab = slabs_.back();
+        char *ptr = slab.ptr + slab.used;
+        slab.used += size;
+        slab.num_chunks++;
+        return ptr;
+    }
+
+    void deallocate(char *ptr, size_t size) {
+        size = alignedSize(size);
+        for (size_t i = slabs_.size(); i-- > 0;) {
+            Slab &slab = slabs_[i];
+            if (ptr < slab.ptr || ptr >= slab.ptr + slab.size)
+                continue;
+            if (ptr + size == slab.ptr + slab.used)
+                slab.used -= size;
+            if (--slab.num_chunks == 0) {
+                allocator_->deallocate(slab.ptr, slab.size);
+                slabs_.erase(slabs_.begin() + i);
+            }
+            return;
+        }
+    }
+
+    size_t numSlabs() const {
+        return slabs_.size();
+    }
+
+    ~SlabAllocator() {
+        for (const Slab &slab : slabs_)
+            allocator_->deallocate(slab.ptr, slab.size);
+    }
+};
+
+
+// Aligned heap allocation, the default allocator
+class AlignedAllocator : public Level0Allocator {
+ public:
+    char *allocate(size_t size) {
+        void *ptr = nullptr;
+        size = std::max(size, LEVEL0_ALIGNMENT);
+#ifdef _WIN32
+        ptr = _aligned_malloc(size, LEVEL0_ALIGNMENT);
+#else
+        if (posix_memalign(&ptr, LEVEL0_ALIGNMENT, size) != 0)
+            ptr = nullptr;
+#endif
+        return (char *) ptr;
+    }
+
+    void deallocate(char *ptr, size_t) {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+    static AlignedAllocator *instance() {
+        static AlignedAllocator allocator;
+        return &allocator;
+    }
+};
+
+
+#ifdef HNSWLIB_HAS_HUGE_PAGES
+enum class PageSize {
+    Default,      // 4 KB pages
+    Transparent,  // transparent huge pages, madvise(MADV_HUGEPAGE)
+    Huge2MB,      // pages of the hugetlbfs pool, MAP_HUGETLB
+    Huge1GB
+};
+
+enum class NumaPolicy {
+    Default,     // pages are placed on the node of the thread which touches them first
+    Interleave,  // pages are spread round-robin over all allowed nodes
+    Bind         // all pages are placed on one node
+};
+
+/*
+* Anonymous memory mappings with huge pages and a NUMA placement policy (Linux only).
+*
+* Huge2MB and Huge1GB need pages reserved in the hugetlbfs pool (/proc/sys/vm/nr_hugepages or the
+* hugepagesz= boot parameters). When the pool is exhausted the mapping falls back to transparent huge pages,
+* or allocate() returns nullptr if fallback is false. Sizes are rounded up to the page size, an index carves
+* its chunks out of slabs of whole pages (see SlabAllocator).
+*
+* Interleave gives every socket the same average latency to an index shared by all query threads.
+* Bind places the whole allocation on numa_node. It is meant for per-node replicas of a read-only index:
+* load the index once per node with an allocator bound to that node, and let every query thread
+* use the replica of currentNumaNode().
+*/
+class MmapAllocator : public Level0Allocator {
+    PageSize page_size_;
+    NumaPolicy numa_policy_;
+    int numa_node_;
+    bool fallback_;
+
+    // constants of <numaif.h>, which comes with libnuma
+    static const int MPOL_BIND_MODE = 2;
+    static const int MPOL_INTERLEAVE_MODE = 3;
+    static const unsigned long MPOL_F_MEMS_ALLOWED_FLAG = 1 << 2;
+    static const int MAX_NUMA_NODES = 1024;
+
+    size_t mappingSize(size_t size) const {
+        size_t page = pageSize();
+        size = std::max(size, (size_t) 1);
+        return (size + page - 1) / page * page;
+    }
+
+    void setNumaPolicy(void *ptr, size_t size) const {
+        const size_t bits = 8 * sizeof(unsigned long);
+        unsigned long mask[MAX_NUMA_NODES / bits] = {0};
+        int mode;
+        if (numa_policy_ == NumaPolicy::Interleave) {
+            mode = MPOL_INTERLEAVE_MODE;
+            int current_mode;
+            if (syscall(SYS_get_mempolicy, &current_mode, mask, MAX_NUMA_NODES, nullptr, MPOL_F_MEMS_ALLOWED_FLAG) != 0)
+                throw std::runtime_error("Cannot get the allowed NUMA nodes");
+        } else {
+            mode = MPOL_BIND_MODE;
+            mask[numa_node_ / bits] |= 1UL << (numa_node_ % bits);
+        }
+        if (syscall(SYS_mbind, ptr, size, mode, mask, MAX_NUMA_NODES, 0) != 0)
+            throw std::runtime_error("Cannot set the NUMA policy of the allocation");
+    }
+
+ public:
+    explicit MmapAllocator(
+        PageSize page_size = PageSize::Transparent,
+        NumaPolicy numa_policy = NumaPolicy::Default,
+        int numa_node = 0,
+        bool fallback = true)
+        : page_size_(page_size), numa_policy_(numa_policy), numa_node_(numa_node), fallback_(fallback) {
+        if (numa_policy == NumaPolicy::Bind && (numa_node < 0 || numa_node >= MAX_NUMA_NODES))
+            throw std::runtime_error("Invalid NUMA node");
+    }
+
+    char *allocate(size_t size) {
+        size_t length = mappingSize(size);
+        void *ptr = MAP_FAILED;
+        if (page_size_ == PageSize::Huge2MB || page_size_ == PageSize::Huge1GB) {
+            int page_shift = page_size_ == PageSize::Huge1GB ? 30 : 21;
+            ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (page_shift << MAP_HUGE_SHIFT), -1, 0);
+            if (ptr == MAP_FAILED && !fallback_)
+                return nullptr;
+        }
+        if (ptr == MAP_FAILED) {
+            ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ptr == MAP_FAILED)
+                return nullptr;
+            if (page_size_ != PageSize::Default)
+                madvise(ptr, length, MADV_HUGEPAGE);
+        }
+        if (numa_policy_ != NumaPolicy::Default) {
+            // the pages are not touched yet, so they are all placed by the policy
+            try {
+                setNumaPolicy(ptr, length);
+            } catch (...) {
+                munmap(ptr, length);
+                throw;
+            }
+        }
+        return (char *) ptr;
+    }
+
+    void deallocate(char *ptr, size_t size) {
+        if (ptr != nullptr)
+            munmap(ptr, mappingSize(size));
+    }
+
+    size_t pageSize() const {
+        return page_size_ == PageSize::Huge1GB ? (1 << 30)
+             : page_size_ == PageSize::Default ? (size_t) sysconf(_SC_PAGESIZE)
+             : (2 << 20);
+    }
+};
+
+
+// NUMA node of the CPU the calling thread runs on, 0 if it cannot be determined
+static inline int currentNumaNode() {
+    unsigned int cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+        return 0;
+    return node;
+}
+#endif
+}  // namespace hnswlib
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace hnswlib {
+
+/*
+* Table of chunk pointers which can grow while other threads read it. A full table is replaced by a copy
+* twice as large and the replaced tables are kept until clear(), so a reader which still uses one of them
+* reads valid entries. The chunks themselves are never moved.
+* Only one thread may modify the table at a time.
+*/
+template<typename T>
+class ChunkTable {
+    std::atomic<T **> table_{nullptr};
+    size_t size_{0};
+    size_t capacity_{0};
+    std::vector<std::unique_ptr<T *[]>> tables_;  // the current table is the last one
+
+ public:
+    ChunkTable() {}
+    ChunkTable(const ChunkTable &) = delete;
+    ChunkTable &operator=(const ChunkTable &) = delete;
+
+    inline T *operator[](size_t i) const {
+        return table_.load(std::memory_order_acquire)[i];
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    void set(size_t i, T *chunk) {
+        table_.load(std::memory_order_relaxed)[i] = chunk;
+    }
+
+    void push_back(T *chunk) {
+        if (size_ == capacity_) {
+            size_t capacity = std::max<size_t>(2 * capacity_, 16);
+            std::unique_ptr<T *[]> table(new T *[capacity]);
+            std::copy(table_.load(std::memory_order_relaxed), table_.load(std::memory_order_relaxed) + size_,
+                      table.get());
+            table_.store(table.get(), std::memory_order_release);
+            tables_.push_back(std::move(table));
+            capacity_ = capacity;
+        }
+        set(size_, chunk);
+        size_++;
+    }
+
+    T *back() const {
+        return (*this)[size_ - 1];
+    }
+
+    void pop_back() {
+        size_--;
+    }
+
+    void clear() {
+        table_.store(nullptr);
+        tables_.clear();
+        size_ = 0;
+        capacity_ = 0;
+    }
+};
+
+
+/*
+* Array of value-initialized elements stored in chunks of 2^shift elements. Chunks are never moved:
+* growing appends chunks, so it does not copy the elements and the existing elements can be used
+* by other threads while the array grows. Shrinking frees the chunks beyond the new size and must not
+* run concurrently with readers.
+*/
+template<typename T>
+class ChunkedArray {
+    ChunkTable<T> chunks_;
+    size_t shift_{0};
+    size_t mask_{0};
+    size_t size_{0};
+
+ public:
+    explicit ChunkedArray(size_t shift = 10) {
+        setChunkShift(shift);
+    }
+
+    ChunkedArray(const ChunkedArray &) = delete;
+    ChunkedArray &operator=(const ChunkedArray &) = delete;
+
+    // Removes all elements and sets the chunk size
+    void setChunkShift(size_t shift) {
+        clear();
+        shift_ = shift;
+        mask_ = ((size_t) 1 << shift) - 1;
+    }
+
+    inline T &operator[](size_t i) const {
+        return chunks_[i >> shift_][i & mask_];
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    void resize(size_t size) {
+        size_t num_chunks = (size + mask_) >> shift_;
+        while (chunks_.size() < num_chunks)
+            chunks_.push_back(new T[mask_ + 1]());
+        while (chunks_.size() > num_chunks) {
+            delete[] chunks_.back();
+            chunks_.pop_back();
+        }
+        size_ = size;
+    }
+
+    void clear() {
+        resize(0);
+        chunks_.clear();
+    }
+
+    ~ChunkedArray() {
+        clear();
+    }
+};
+}  // namespace hnswlib
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace hnswlib {
+
+/*
+* Hash map with open addressing and linear probing for integer keys and values. The entries are stored in one
+* flat array without per-entry allocations, packed to sizeof(K) + sizeof(V) bytes (12 bytes for a size_t label
+* and a 32-bit id). The capacity is not limited to powers of two, so reserve() sizes the table for 13 of 16 slots
+* used: about 15 bytes per entry. The capacity must stay below 2^32 slots. Erasing shifts the following entries
+* back instead of leaving tombstones, so lookups do not slow down with churn.
+*
+* The interface is the subset of std::unordered_map used by HierarchicalNSW. The largest value of V marks empty
+* slots and cannot be stored. Iterators and references are invalidated by every insertion and erasure.
+* Not thread-safe.
+*/
+template<typename K, typename V>
+class FlatHashMap {
+ public:
+#pragma pack(push, 4)
+    struct value_type {
+        K first;
+        V second;
+    };
+#pragma pack(pop)
+
+    class iterator {
+        value_type *slot_;
+        value_type *end_;
+
+        void skipEmpty() {
+            while (slot_ != end_ && slot_->second == EMPTY)
+                slot_++;
+        }
+
+     public:
+        iterator(value_type *slot, value_type *end) : slot_(slot), end_(end) {
+            skipEmpty();
+        }
+
+        value_type &operator*() const {
+            return *slot_;
+        }
+
+        value_type *operator->() const {
+            return slot_;
+        }
+
+        iterator &operator++() {
+            slot_++;
+            skipEmpty();
+            return *this;
+        }
+
+        bool operator==(const iterator &other) const {
+            return slot_ == other.slot_;
+        }
+
+        bool operator!=(const iterator &other) const {
+            return slot_ != other.slot_;
+        }
+    };
+
+ private:
+    static const V EMPTY = std::numeric_limits<V>::max();
+    static const size_t MIN_CAPACITY = 16;
+
+    value_type *slots_{nullptr};
+    size_t capacity_{0};
+    size_t size_{0};
+
+    // Fibonacci hashing, the high 32 bits of the product are scaled to the capacity (below 2^32)
+    inline size_t bucket(K key) const {
+        uint64_t hash = ((uint64_t) key * 0x9E3779B97F4A7C15ull) >> 32;
+        return (size_t) ((hash * capacity_) >> 32);
+    }
+
+    inline size_t next(size_t i) const {
+        return i + 1 == capacity_ ? 0 : i + 1;
+    }
+
+    // at most 13 of 16 slots are used
+    static bool overloaded(size_t size, size_t capacity) {
+        return size * 16 > capacity * 13;
+    }
+
+    void rehash(size_t capacity) {
+        value_type *old_slots = slots_;
+        size_t old_capacity = capacity_;
+        slots_ = new value_type[capacity];
+        for (size_t i = 0; i < capacity; i++)
+            slots_[i].second = EMPTY;
+        capacity_ = capacity;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_slots[i].second != EMPTY)
+                slots_[findSlot(old_slots[i].first)] = old_slots[i];
+        }
+        delete[] old_slots;
+    }
+
+    // Slot of the key, or the empty slot where it would be inserted
+    inline size_t findSlot(K key) const {
+        size_t i = bucket(key);
+        while (slots_[i].second != EMPTY && slots_[i].first != key)
+            i = next(i);
+        return i;
+    }
+
+ public:
+    FlatHashMap() {}
+    FlatHashMap(const FlatHashMap &) = delete;
+    FlatHashMap &operator=(const FlatHashMap &) = delete;
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    // Bytes of the slot array
+    size_t memoryUsage() const {
+        return capacity_ * sizeof(value_type);
+    }
+
+    // The slot array of memoryUsage() bytes, which assignSlots takes back, e.g. to store the map in a file
+    const value_type *slots() const {
+        return slots_;
+    }
+
+    /*
+    * Replaces the map by a copy of a slot array taken from slots(). The positions of the entries depend only on
+    * the capacity, so the table is used as it is instead of inserting the entries again.
+    * Returns false and leaves the map empty if the capacity is out of range.
+    */
+    bool assignSlots(const value_type *slots, size_t capacity) {
+        clear();
+        if (capacity == 0)
+            return true;
+        if (capacity < MIN_CAPACITY || capacity >= ((size_t) 1 << 32))
+            return false;
+        slots_ = new value_type[capacity];
+        memcpy(slots_, slots, capacity * sizeof(value_type));
+        capacity_ = capacity;
+        for (size_t i = 0; i < capacity; i++)
+            size_ += slots_[i].second != EMPTY;
+        return true;
+    }
+
+    // Sizes the table for n entries, so that inserting them does not rehash
+    void reserve(size_t n) {
+        if (!overloaded(n, capacity_))
+            return;
+        rehash(std::max((size_t) MIN_CAPACITY, n * 16 / 13 + 1));
+    }
+
+    iterator begin() const {
+        return iterator(slots_, slots_ + capacity_);
+    }
+
+    iterator end() const {
+        return iterator(slots_ + capacity_, slots_ + capacity_);
+    }
+
+    iterator find(K key) const {
+        if (size_ == 0)
+            return end();
+        size_t i = findSlot(key);
+        if (slots_[i].second == EMPTY)
+            return end();
+        return iterator(slots_ + i, slots_ + capacity_);
+    }
+
+    size_t count(K key) const {
+        return find(key) != end();
+    }
+
+    // Inserts the entry if the key is not in the map, returns the entry of the key and whether it was inserted
+    std::pair<iterator, bool> insert(const std::pair<K, V> &entry) {
+        if (overloaded(size_ + 1, capacity_))
+            rehash(std::max((size_t) MIN_CAPACITY, 2 * capacity_));
+        size_t i = findSlot(entry.first);
+        bool inserted = slots_[i].second == EMPTY;
+        if (inserted) {
+            slots_[i].first = entry.first;
+            slots_[i].second = entry.second;
+            size_++;
+        }
+        return std::make_pair(iterator(slots_ + i, slots_ + capacity_), inserted);
+    }
+
+    V &operator[](K key) {
+        return insert(std::make_pair(key, V())).first->second;
+    }
+
+    size_t erase(K key) {
+        if (size_ == 0)
+            return 0;
+        size_t i = findSlot(key);
+        if (slots_[i].second == EMPTY)
+            return 0;
+        // moves back the following entries of the cluster which would not be found past the hole
+        for (size_t j = next(i); slots_[j].second != EMPTY; j = next(j)) {
+            size_t home = bucket(slots_[j].first);
+            // the entry stays if its home slot is cyclically in (i, j]
+            bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+            if (!stays) {
+                slots_[i] = slots_[j];
+                i = j;
+            }
+        }
+        slots_[i].second = EMPTY;
+        size_--;
+        return 1;
+    }
+
+    void clear() {
+        delete[] slots_;
+        slots_ = nullptr;
+        capacity_ = 0;
+        size_ = 0;
+    }
+
+    ~FlatHashMap() {
+        clear();
+    }
+};
+}  // namespace hnswlib
@@ -1,26 +1,68 @@
 #pragma once
 
 #include "visited_list_pool.h"
+#include "mapped_file.h"
+#include "allocator.h"
+#include "chunked_array.h"
+#include "link_list_arena.h"
+#include "parallel_for.h"
+#include "flat_hash_map.h"
+#include "search_stats.h"
 #include "hnswlib.h"
+#include "index_file.h"
+#include "operation_log.h"
 #include <atomic>
 #include <random>
 #include <stdlib.h>
 #include <assert.h>
+#include <unordered_map>
 #include <unordered_set>
 #include <list>
 #include <memory>
+#include <sstream>
+#include <functional>
 
 namespace hnswlib {
 typedef unsigned int tableint;
 typedef unsigned int linklistsizeint;
 
-template<typename dist_t>
+// Priority queue which keeps its memory when cleared, so it can be reused without allocations
+template<typename T, typename Compare>
+class ReusableHeap : public std::priority_queue<T, std::vector<T>, Compare> {
+ public:
+    void reserve(size_t n) {
+        this->c.reserve(n);
+    }
+
+    void clear() {
+        this->c.clear();
+    }
+};
+
+/*
+* Memory layout of the base layer.
+* Interleaved stores every element as [links | vector | label] in one array, which is also the layout of index files.
+* Separate keeps the links, the vectors and the labels in three arrays, so graph traversals only touch links and
+* every vector starts at a 64-byte boundary (the vector size is padded to a multiple of 64 bytes).
+*/
+enum class IndexLayout {
+    Interleaved,
+    Separate
+};
+
+/*
+* DistFunc is the type of the distance: by default the function pointer of the space, or a functor such as
+* L2SqrFixedDim<128> which is called directly, constructed from the space with DistFunc(space).
+*/
+template<typename dist_t, typename DistFunc = DISTFUNC<dist_t>>
 class HierarchicalNSW : public AlgorithmInterface<dist_t> {
  public:
     static const tableint MAX_LABEL_OPERATION_LOCKS = 65536;
     static const unsigned char DELETE_MARK = 0x01;
+    // bound of the dense visited lists held at the same time by one batch of searchKnnBatch
+    static const size_t MAX_BATCH_VISITED_LIST_BYTES = 64 << 20;
 
-    size_t max_elements_{0};
+    std::atomic<size_t> max_elements_{0};  // grown by resizeIndex while other threads search and insert
     mutable std::atomic<size_t> cur_element_count{0};  // current number of elements
     size_t size_data_per_element_{0};
     size_t size_links_per_element_{0};
@@ -32,44 +74,78 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     size_t ef_{ 0 };
 
     double mult_{0.0}, revSize_{0.0};
-    int maxlevel_{0};
 
     std::unique_ptr<VisitedListPool> visited_list_pool_{nullptr};
+    std::unique_ptr<VisitedHashSetPool> visited_set_pool_{nullptr};
+    size_t max_visited_lists_{0};  // limit of visited lists alive at the same time, 0 means unlimited
+    std::shared_ptr<VisitedSetLimit> visited_set_limit_{nullptr};  // shared by both pools
+    VisitedSetType visited_set_type_{VisitedSetType::Auto};
 
     // Locks operations with element by label value
     mutable std::vector<std::mutex> label_op_locks_;
 
-    std::mutex global;
-    std::vector<std::mutex> link_list_locks_;
+    std::mutex global;  // held by the insertions which raise the top level
+    ChunkedArray<std::mutex> link_list_locks_;
+    std::mutex resize_lock_;  // serializes resizeIndex calls
 
-    tableint enterpoint_node_{0};
+    // Entry point of the graph and the top level, see getEntryPoint
+    struct EntryPoint {
+        tableint node;
+        int level;
+    };
+    std::atomic<uint64_t> entry_point_{0};
 
     size_t size_links_level0_{0};
     size_t offsetData_{0}, offsetLevel0_{0}, label_offset_{ 0 };
+    bool store_link_distances_{false};  // the ids of every link list are followed by the distances of the links
 
-    char *data_level0_memory_{nullptr};
-    char **linkLists_{nullptr};
-    std::vector<int> element_levels_;  // keeps level of each element
+    /*
+    * The base layer is stored in chunks of 2^chunk_shift_ elements which are never moved, so growing the index
+    * only appends chunks. Element i is element (i & chunk_mask_) of chunk (i >> chunk_shift_).
+    * For the Interleaved layout the three tables point into the same chunks (links, vectors and labels of
+    * an element are adjacent), for the Separate layout vectors and labels have chunks of their own.
+    */
+    size_t chunk_shift_{0}, chunk_mask_{0};
+    ChunkTable<char> level0_chunks_;
+    ChunkTable<char> vector_chunks_;
+    ChunkTable<char> label_chunks_;
+    ChunkedArray<char *> linkLists_;
+    LinkListArena link_list_arena_;  // memory of the upper-level link lists, unless they are mapped
+
+    IndexLayout layout_{IndexLayout::Interleaved};
+    size_t vector_stride_{0};
+    size_t label_stride_{0};
+    Level0Allocator *allocator_{AlignedAllocator::instance()};
+    std::unique_ptr<SlabAllocator> slab_allocator_{nullptr};  // slabs of allocator_ if it rounds sizes up to pages
+    ChunkedArray<int> element_levels_;  // keeps level of each element
 
     size_t data_size_{0};
 
-    DISTFUNC<dist_t> fstdistfunc_;
+    DistFunc fstdistfunc_;
+    DistFunc query_distfunc_;  // compares a prepared query with a stored vector
+    BATCHDISTFUNC<dist_t> batch_distfunc_{nullptr};  // batch kernel of fstdistfunc_, if the space has one
+    size_t query_size_{0};             // size of a prepared query, 0 if queries are used as they are
+    SpaceInterface<dist_t> *space_{nullptr};
     void *dist_func_param_{nullptr};
 
     mutable std::mutex label_lookup_lock;  // lock for label_lookup_
-    std::unordered_map<labeltype, tableint> label_lookup_;
+    FlatHashMap<labeltype, tableint> label_lookup_;
 
     std::default_random_engine level_generator_;
     std::default_random_engine update_probability_generator_;
 
-    mutable std::atomic<long> metric_distance_computations{0};
-    mutable std::atomic<long> metric_hops{0};
-
     bool allow_replace_deleted_ = false;  // flag to replace deleted elements (marked as deleted) during insertions
 
     std::mutex deleted_elements_lock;  // lock for deleted_elements
     std::unordered_set<tableint> deleted_elements;  // contains internal ids of deleted elements
 
+    // set when the base layer and the link lists point into a memory-mapped index file
+    std::unique_ptr<MappedFile> mapped_file_{nullptr};
+    bool read_only_ = false;  // flag to forbid modifications of a read-only mapped index
+
+    // set while the insertions and deletions are logged, see openOperationLog
+    std::unique_ptr<OperationLog> operation_log_{nullptr};
+
 
     HierarchicalNSW(SpaceInterface<dist_t> *s) {
     }
@@ -80,9 +156,13 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         const std::string &location,
         bool nmslib = false,
         size_t max_elements = 0,
-        bool allow_replace_deleted = false)
+        bool allow_replace_deleted = false,
+        IndexLayout layout = IndexLayout::Interleaved,
+        Level0Allocator *allocator = nullptr)
         : allow_replace_deleted_(allow_replace_deleted) {
-        loadIndex(location, s, max_elements);
+        if (allocator)
+            initAllocator(allocator);
+        loadIndex(location, s, max_elements, layout);
     }
 
 
@@ -92,16 +172,18 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         size_t M = 16,
         size_t ef_construction = 200,
         size_t random_seed = 100,
-        bool allow_replace_deleted = false)
+        bool allow_replace_deleted = false,
+        IndexLayout layout = IndexLayout::Interleaved,
+        Level0Allocator *allocator = nullptr,
+        bool store_link_distances = false)
         : label_op_locks_(MAX_LABEL_OPERATION_LOCKS),
-            link_list_locks_(max_elements),
-            element_levels_(max_elements),
             allow_replace_deleted_(allow_replace_deleted) {
         max_elements_ = max_elements;
+        store_link_distances_ = store_link_distances;
         num_deleted_ = 0;
-        data_size_ = s->get_data_size();
-        fstdistfunc_ = s->get_dist_func();
-        dist_func_param_ = s->get_dist_func_param();
+        if (allocator)
+            initAllocator(allocator);
+        setSpace(s);
         if ( M <= 10000 ) {
             M_ = M;
         } else {
@@ -117,28 +199,25 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         level_generator_.seed(random_seed);
         update_probability_generator_.seed(random_seed + 1);
 
-        size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
+        setLinkListSizes();
         size_data_per_element_ = size_links_level0_ + data_size_ + sizeof(labeltype);
         offsetData_ = size_links_level0_;
         label_offset_ = size_links_level0_ + data_size_;
         offsetLevel0_ = 0;
+        setLayout(layout);
 
-        data_level0_memory_ = (char *) malloc(max_elements_ * size_data_per_element_);
-        if (data_level0_memory_ == nullptr)
-            throw std::runtime_error("Not enough memory");
+        initChunks(max_elements_);
+        resizeElements(max_elements_);
+        // sized for the capacity, so insertions do not rehash while holding label_lookup_lock
+        label_lookup_.reserve(max_elements_);
 
         cur_element_count = 0;
 
-        visited_list_pool_ = std::unique_ptr<VisitedListPool>(new VisitedListPool(1, max_elements));
+        initVisitedSetPools(max_elements);
 
         // initializations for special treatment of the first node
-        enterpoint_node_ = -1;
-        maxlevel_ = -1;
+        setEntryPoint(-1, -1);
 
-        linkLists_ = (char **) malloc(sizeof(void *) * max_elements_);
-        if (linkLists_ == nullptr)
-            throw std::runtime_error("Not enough memory: HierarchicalNSW failed to allocate linklists");
-        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
         mult_ = 1 / log(1.0 * M_);
         revSize_ = 1.0 / mult_;
     }
@@ -149,16 +228,307 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
     void clear() {
-        free(data_level0_memory_);
-        data_level0_memory_ = nullptr;
-        for (tableint i = 0; i < cur_element_count; i++) {
-            if (element_levels_[i] > 0)
-                free(linkLists_[i]);
+        if (mapped_file_) {
+            // level 0 and the link lists are owned by the mapping
+            mapped_file_.reset(nullptr);
+        } else {
+            resizeLevel0(0);
         }
-        free(linkLists_);
-        linkLists_ = nullptr;
+        link_list_arena_.clear();
+        level0_chunks_.clear();
+        vector_chunks_.clear();
+        label_chunks_.clear();
+        linkLists_.clear();
+        label_lookup_.clear();
+        deleted_elements.clear();
         cur_element_count = 0;
+        num_deleted_ = 0;
+        read_only_ = false;
         visited_list_pool_.reset(nullptr);
+        visited_set_pool_.reset(nullptr);
+    }
+
+
+    /*
+    * Sets the sizes of the link lists from maxM0_ and maxM_. With stored link distances the room for the ids of
+    * a list is followed by the bf16 distances of its links, which the pruning of a full list reads instead of
+    * computing them: 2 more bytes per link. The sizes are rounded up to whole ids to keep the lists aligned.
+    */
+    void setLinkListSizes() {
+        size_t link_size = sizeof(tableint) + (store_link_distances_ ? sizeof(uint16_t) : 0);
+        size_links_level0_ = (maxM0_ * link_size + sizeof(tableint) - 1) / sizeof(tableint) * sizeof(tableint) +
+                             sizeof(linklistsizeint);
+        size_links_per_element_ = (maxM_ * link_size + sizeof(tableint) - 1) / sizeof(tableint) * sizeof(tableint) +
+                                  sizeof(linklistsizeint);
+    }
+
+
+    // Sets the sizes of the link lists of an index file, whose level 0 links end at offsetData_
+    void setLinkListSizesFromFile() {
+        store_link_distances_ = false;
+        setLinkListSizes();
+        if (offsetData_ != size_links_level0_) {
+            store_link_distances_ = true;
+            setLinkListSizes();
+            if (offsetData_ != size_links_level0_)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+        }
+    }
+
+
+    /*
+    * Sets the layout of the base layer, size_links_level0_, data_size_, offsetData_ and label_offset_ must be set.
+    * For the Separate layout size_data_per_element_ becomes the size of the links only.
+    */
+    void setLayout(IndexLayout layout) {
+        layout_ = layout;
+        if (layout_ == IndexLayout::Separate) {
+            size_data_per_element_ = size_links_level0_;
+            vector_stride_ = (data_size_ + LEVEL0_ALIGNMENT - 1) / LEVEL0_ALIGNMENT * LEVEL0_ALIGNMENT;
+            label_stride_ = sizeof(labeltype);
+        } else {
+            vector_stride_ = size_data_per_element_;
+            label_stride_ = size_data_per_element_;
+        }
+    }
+
+
+    // Size of an element in index files, which always use the Interleaved layout
+    size_t fileElementSize() const {
+        return layout_ == IndexLayout::Separate ? label_offset_ + sizeof(labeltype) : size_data_per_element_;
+    }
+
+
+    static const size_t MIN_CHUNK_SHIFT = 10;
+    static const size_t MAX_CHUNK_SHIFT = 16;
+
+    // Chooses the chunk size for an index of max_elements elements: the index fits in one chunk if possible
+    void initChunks(size_t max_elements) {
+        chunk_shift_ = MIN_CHUNK_SHIFT;
+        while (chunk_shift_ < MAX_CHUNK_SHIFT && ((size_t) 1 << chunk_shift_) < max_elements)
+            chunk_shift_++;
+        chunk_mask_ = ((size_t) 1 << chunk_shift_) - 1;
+        link_list_locks_.setChunkShift(chunk_shift_);
+        element_levels_.setChunkShift(chunk_shift_);
+        linkLists_.setChunkShift(chunk_shift_);
+    }
+
+
+    size_t chunkSize() const {
+        return chunk_mask_ + 1;
+    }
+
+
+    struct Level0Chunk {
+        char *links;
+        char *vectors;
+        char *labels;
+    };
+
+
+    // Allocates a chunk of the base layer, vectors and labels have their own arrays only for the Separate layout
+    Level0Chunk allocateLevel0Chunk(Level0Allocator *allocator) const {
+        bool separate = layout_ == IndexLayout::Separate;
+        Level0Chunk chunk = {nullptr, nullptr, nullptr};
+        try {
+            chunk.links = allocator->allocate(chunkSize() * size_data_per_element_);
+            if (separate && chunk.links != nullptr) {
+                chunk.vectors = allocator->allocate(chunkSize() * vector_stride_);
+                if (chunk.vectors != nullptr)
+                    chunk.labels = allocator->allocate(chunkSize() * label_stride_);
+            }
+        } catch (...) {
+            freeLevel0Chunk(allocator, chunk);
+            throw;
+        }
+        if (chunk.links == nullptr || (separate && (chunk.vectors == nullptr || chunk.labels == nullptr))) {
+            freeLevel0Chunk(allocator, chunk);
+            throw std::runtime_error("Not enough memory: failed to allocate the base layer");
+        }
+        if (!separate) {
+            chunk.vectors = chunk.links + offsetData_;
+            chunk.labels = chunk.links + label_offset_;
+        }
+        return chunk;
+    }
+
+
+    void freeLevel0Chunk(Level0Allocator *allocator, const Level0Chunk &chunk) const {
+        if (chunk.links)
+            allocator->deallocate(chunk.links, chunkSize() * size_data_per_element_);
+        if (layout_ == IndexLayout::Separate) {
+            if (chunk.vectors)
+                allocator->deallocate(chunk.vectors, chunkSize() * vector_stride_);
+            if (chunk.labels)
+                allocator->deallocate(chunk.labels, chunkSize() * label_stride_);
+        }
+    }
+
+
+    // The vectors and labels are published before the links, so a reader which finds a chunk finds all of it
+    void pushLevel0Chunk(const Level0Chunk &chunk) {
+        vector_chunks_.push_back(chunk.vectors);
+        label_chunks_.push_back(chunk.labels);
+        level0_chunks_.push_back(chunk.links);
+    }
+
+
+    Level0Chunk getLevel0Chunk(size_t i) const {
+        return Level0Chunk{level0_chunks_[i], vector_chunks_[i], label_chunks_[i]};
+    }
+
+
+    // Slabs for the chunks if the allocator rounds every allocation up to its page size
+    static SlabAllocator *newSlabAllocator(Level0Allocator *allocator) {
+        return allocator->pageSize() ? new SlabAllocator(allocator) : nullptr;
+    }
+
+
+    void initAllocator(Level0Allocator *allocator) {
+        allocator_ = allocator;
+        slab_allocator_.reset(newSlabAllocator(allocator));
+    }
+
+
+    // Allocator of the chunks of the base layer
+    Level0Allocator *chunkAllocator() const {
+        return slab_allocator_ ? slab_allocator_.get() : allocator_;
+    }
+
+
+    // Allocates or frees chunks of the base layer so that it holds max_elements elements
+    void resizeLevel0(size_t max_elements) {
+        size_t num_chunks = (max_elements + chunk_mask_) >> chunk_shift_;
+        while (level0_chunks_.size() < num_chunks)
+            pushLevel0Chunk(allocateLevel0Chunk(chunkAllocator()));
+        while (level0_chunks_.size() > num_chunks) {
+            freeLevel0Chunk(chunkAllocator(), getLevel0Chunk(level0_chunks_.size() - 1));
+            level0_chunks_.pop_back();
+            vector_chunks_.pop_back();
+            label_chunks_.pop_back();
+        }
+    }
+
+
+    // Resizes the base layer and the per-element arrays to max_elements elements
+    void resizeElements(size_t max_elements) {
+        resizeLevel0(max_elements);
+        element_levels_.resize(max_elements);
+        linkLists_.resize(max_elements);
+        link_list_locks_.resize(max_elements);
+    }
+
+
+    /*
+    * Sets the allocator of the base layer arrays, e.g. an MmapAllocator for huge pages or NUMA placement,
+    * nullptr restores the default one. The allocator is not owned by the index and must outlive it.
+    * The chunks of a non-empty index are moved to memory of the new allocator.
+    * Must not be called concurrently with other operations.
+    */
+    void setAllocator(Level0Allocator *allocator) {
+        if (mapped_file_)
+            throw std::runtime_error("Cannot move the base layer of a memory-mapped index");
+        Level0Allocator *new_allocator = allocator ? allocator : AlignedAllocator::instance();
+        std::unique_ptr<SlabAllocator> new_slab_allocator(newSlabAllocator(new_allocator));
+        Level0Allocator *new_chunk_allocator = new_slab_allocator ? new_slab_allocator.get() : new_allocator;
+        std::vector<Level0Chunk> new_chunks;
+        try {
+            for (size_t i = 0; i < level0_chunks_.size(); i++)
+                new_chunks.push_back(allocateLevel0Chunk(new_chunk_allocator));
+        } catch (...) {
+            for (const Level0Chunk &chunk : new_chunks)
+                freeLevel0Chunk(new_chunk_allocator, chunk);
+            throw;
+        }
+        for (size_t i = 0; i < new_chunks.size(); i++) {
+            Level0Chunk old_chunk = getLevel0Chunk(i);
+            memcpy(new_chunks[i].links, old_chunk.links, chunkSize() * size_data_per_element_);
+            if (layout_ == IndexLayout::Separate) {
+                memcpy(new_chunks[i].vectors, old_chunk.vectors, chunkSize() * vector_stride_);
+                memcpy(new_chunks[i].labels, old_chunk.labels, chunkSize() * label_stride_);
+            }
+            level0_chunks_.set(i, new_chunks[i].links);
+            vector_chunks_.set(i, new_chunks[i].vectors);
+            label_chunks_.set(i, new_chunks[i].labels);
+            freeLevel0Chunk(chunkAllocator(), old_chunk);
+        }
+        allocator_ = new_allocator;
+        slab_allocator_ = std::move(new_slab_allocator);
+    }
+
+
+    // Copies element internal_id in the layout of index files (links, vector, label) to dst
+    void copyElementTo(tableint internal_id, char *dst) const {
+        if (layout_ == IndexLayout::Interleaved) {
+            memcpy(dst, get_linklist0(internal_id), size_data_per_element_);
+        } else {
+            memcpy(dst, get_linklist0(internal_id), size_links_level0_);
+            memcpy(dst + offsetData_, getDataByInternalId(internal_id), data_size_);
+            memcpy(dst + label_offset_, getExternalLabeLp(internal_id), sizeof(labeltype));
+        }
+    }
+
+
+    // Copies element internal_id from src in the layout of index files
+    void copyElementFrom(tableint internal_id, const char *src) {
+        if (layout_ == IndexLayout::Interleaved) {
+            memcpy(get_linklist0(internal_id), src, size_data_per_element_);
+        } else {
+            memcpy(get_linklist0(internal_id), src, size_links_level0_);
+            memcpy(getDataByInternalId(internal_id), src + offsetData_, data_size_);
+            memcpy(getExternalLabeLp(internal_id), src + label_offset_, sizeof(labeltype));
+        }
+    }
+
+
+
+    void checkWritable() const {
+        if (read_only_)
+            throw std::runtime_error("The index is mapped read-only");
+    }
+
+
+    static void setDistFunc(DISTFUNC<dist_t> &target, DISTFUNC<dist_t> func, SpaceInterface<dist_t> *) {
+        target = func;
+    }
+
+    template<typename Functor>
+    static void setDistFunc(Functor &target, DISTFUNC<dist_t>, SpaceInterface<dist_t> *s) {
+        if (s->get_query_size() != 0)
+            throw std::runtime_error("Distance functors cannot be used with spaces which prepare queries");
+        target = Functor(s);
+    }
+
+
+    void setSpace(SpaceInterface<dist_t> *s) {
+        space_ = s;
+        data_size_ = s->get_data_size();
+        setDistFunc(fstdistfunc_, s->get_dist_func(), s);
+        dist_func_param_ = s->get_dist_func_param();
+        setDistFunc(query_distfunc_, s->get_query_dist_func(), s);
+        query_size_ = s->get_query_size();
+        batch_distfunc_ = s->get_batch_dist_func();
+    }
+
+
+    // Distances from one stored vector to n others, with the batch kernel of the space if it has one
+    inline void batchDistances(const void *data_point, const void *const *vectors, size_t n, dist_t *distances) const {
+        if (batch_distfunc_) {
+            batch_distfunc_(data_point, vectors, n, dist_func_param_, distances);
+            return;
+        }
+        for (size_t i = 0; i < n; i++)
+            distances[i] = fstdistfunc_(data_point, vectors[i], dist_func_param_);
+    }
+
+
+    // Returns the query in the form expected by query_distfunc_, buffer is used when the space prepares queries
+    const void *prepareQuery(const void *query_data, std::vector<char> &buffer) const {
+        if (query_size_ == 0)
+            return query_data;
+        buffer.resize(query_size_);
+        space_->prepare_query(query_data, buffer.data());
+        return buffer.data();
     }
 
 
@@ -169,12 +539,97 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         }
     };
 
+    typedef ReusableHeap<std::pair<dist_t, tableint>, CompareByFirst> SearchHeap;
+
+    /*
+    * Per-thread state which can be reused across searches: the heaps keep their capacity and the
+    * visited list is owned by the context, so after the first few queries searchKnn with a context
+    * does not allocate memory. A context must not be used by several threads at the same time.
+    */
+    class SearchContext {
+     public:
+        SearchHeap top_candidates;
+        SearchHeap candidate_set;
+        std::unique_ptr<VisitedList> visited_list{nullptr};
+        std::unique_ptr<VisitedHashSet> visited_set{nullptr};
+        std::vector<char> query_buffer;  // prepared query of spaces with get_query_size() != 0
+
+        explicit SearchContext(size_t ef = 0) {
+            top_candidates.reserve(ef + 1);
+            candidate_set.reserve(ef + 1);
+        }
+    };
+
 
     void setEf(size_t ef) {
         ef_ = ef;
     }
 
 
+    /*
+    * Limits the number of visited sets (dense lists of max_elements * sizeof(vl_type) bytes and hash sets
+    * together) used by concurrent searches and insertions; when all of them are in use, further searches
+    * wait and insertions take a hash set beyond the limit, whose memory follows the number of elements
+    * they visit. 0 removes the limit. Must not be called concurrently with searches or insertions.
+    */
+    void setMaxVisitedLists(size_t max_visited_lists) {
+        max_visited_lists_ = max_visited_lists;
+        if (visited_list_pool_)
+            initVisitedSetPools(max_elements_);
+    }
+
+
+    void initVisitedSetPools(size_t max_elements) {
+        visited_list_pool_.reset(nullptr);
+        visited_set_pool_.reset(nullptr);
+        visited_set_limit_ = std::make_shared<VisitedSetLimit>(max_visited_lists_);
+        visited_list_pool_.reset(new VisitedListPool(1, max_elements, visited_set_limit_));
+        visited_set_pool_.reset(new VisitedHashSetPool(0, max_elements, visited_set_limit_));
+    }
+
+
+    /*
+    * Selects the visited set used by searches. The dense list needs max_elements * sizeof(vl_type) bytes
+    * per concurrent search, the hash set grows with the number of elements visited by a search.
+    * Must not be called concurrently with searches.
+    */
+    void setVisitedSetType(VisitedSetType type) {
+        visited_set_type_ = type;
+    }
+
+
+    // Auto picks the hash set when the dense list is larger than the caches and a search is expected
+    // to touch only a tiny part of it (roughly ef * maxM0_ elements)
+    bool useVisitedHashSet(size_t ef) const {
+        size_t max_elements = max_elements_.load(std::memory_order_acquire);
+        switch (visited_set_type_) {
+        case VisitedSetType::Dense:
+            return false;
+        case VisitedSetType::Hash:
+            return true;
+        default:
+            return max_elements * sizeof(vl_type) > (4 << 20) &&
+                   std::max(ef, ef_) * maxM0_ * 64 < max_elements;
+        }
+    }
+
+
+    /*
+    * The entry point and the top level are packed in one atomic word, so a search always gets an entry point
+    * together with its own level, and insertions read them without a lock. The release store publishes
+    * the links of a new entry point to the threads which load it.
+    */
+    EntryPoint getEntryPoint() const {
+        uint64_t packed = entry_point_.load(std::memory_order_acquire);
+        return EntryPoint{(tableint) packed, (int) (uint32_t) (packed >> 32)};
+    }
+
+
+    void setEntryPoint(tableint node, int level) {
+        entry_point_.store(((uint64_t) (uint32_t) level << 32) | node, std::memory_order_release);
+    }
+
+
     inline std::mutex& getLabelOpMutex(labeltype label) const {
         // calculate hash
         size_t lock_id = label & (MAX_LABEL_OPERATION_LOCKS - 1);
@@ -184,23 +639,23 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     inline labeltype getExternalLabel(tableint internal_id) const {
         labeltype return_label;
-        memcpy(&return_label, (data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_), sizeof(labeltype));
+        memcpy(&return_label, getExternalLabeLp(internal_id), sizeof(labeltype));
         return return_label;
     }
 
 
     inline void setExternalLabel(tableint internal_id, labeltype label) const {
-        memcpy((data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_), &label, sizeof(labeltype));
+        memcpy(getExternalLabeLp(internal_id), &label, sizeof(labeltype));
     }
 
 
     inline labeltype *getExternalLabeLp(tableint internal_id) const {
-        return (labeltype *) (data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_);
+        return (labeltype *) (label_chunks_[internal_id >> chunk_shift_] + (internal_id & chunk_mask_) * label_stride_);
     }
 
 
     inline char *getDataByInternalId(tableint internal_id) const {
-        return (data_level0_memory_ + internal_id * size_data_per_element_ + offsetData_);
+        return vector_chunks_[internal_id >> chunk_shift_] + (internal_id & chunk_mask_) * vector_stride_;
     }
 
 
@@ -224,10 +679,25 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
     searchBaseLayer(tableint ep_id, const void *data_point, int layer) {
-        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
-        vl_type *visited_array = vl->mass;
-        vl_type visited_array_tag = vl->curV;
+        // the inserting thread holds the lock of its element, waiting here for a list held by a thread
+        // which waits for that lock would deadlock, so a hash set beyond the limit is used when it is reached
+        VisitedList *vl = visited_list_pool_->tryGetFreeVisitedList();
+        if (vl != nullptr) {
+            auto top_candidates = searchBaseLayer(ep_id, data_point, layer, vl);
+            visited_list_pool_->releaseVisitedList(vl);
+            return top_candidates;
+        }
+        VisitedHashSet *vs = visited_set_pool_->tryGetFreeVisitedList(true);
+        auto top_candidates = searchBaseLayer(ep_id, data_point, layer, vs);
+        visited_set_pool_->releaseVisitedList(vs);
+        return top_candidates;
+    }
+
 
+    // Same as above, with the given visited set (VisitedList or VisitedHashSet, already reset)
+    template <typename VisitedSet>
+    std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
+    searchBaseLayer(tableint ep_id, const void *data_point, int layer, VisitedSet *visited) {
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidateSet;
 
@@ -241,7 +711,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             lowerBound = std::numeric_limits<dist_t>::max();
             candidateSet.emplace(-lowerBound, ep_id);
         }
-        visited_array[ep_id] = visited_array_tag;
+        visited->visit(ep_id);
 
         while (!candidateSet.empty()) {
             std::pair<dist_t, tableint> curr_el_pair = candidateSet.top();
@@ -264,21 +734,26 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             size_t size = getListCount((linklistsizeint*)data);
             tableint *datal = (tableint *) (data + 1);
 #ifdef USE_SSE
-            _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
-            _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
-            _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
-            _mm_prefetch(getDataByInternalId(*(datal + 1)), _MM_HINT_T0);
+            // only ids within the list are prefetched, the chunk of any other value may not exist
+            if (size > 0) {
+                visited->prefetch(*datal);
+                _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
+            }
+            if (size > 1)
+                _mm_prefetch(getDataByInternalId(*(datal + 1)), _MM_HINT_T0);
 #endif
 
             for (size_t j = 0; j < size; j++) {
                 tableint candidate_id = *(datal + j);
 //                    if (candidate_id == 0) continue;
 #ifdef USE_SSE
-                _mm_prefetch((char *) (visited_array + *(datal + j + 1)), _MM_HINT_T0);
-                _mm_prefetch(getDataByInternalId(*(datal + j + 1)), _MM_HINT_T0);
+                if (j + 1 < size) {
+                    visited->prefetch(*(datal + j + 1));
+                    _mm_prefetch(getDataByInternalId(*(datal + j + 1)), _MM_HINT_T0);
+                }
 #endif
-                if (visited_array[candidate_id] == visited_array_tag) continue;
-                visited_array[candidate_id] = visited_array_tag;
+                // the dense list also skips the elements added after it was allocated
+                if (!visited->visit(candidate_id)) continue;
                 char *currObj1 = (getDataByInternalId(candidate_id));
 
                 dist_t dist1 = fstdistfunc_(data_point, currObj1, dist_func_param_);
@@ -299,13 +774,13 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 }
             }
         }
-        visited_list_pool_->releaseVisitedList(vl);
 
         return top_candidates;
     }
 
 
     // bare_bone_search means there is no check for deletions and stop condition is ignored in return of extra performance
+    // collect_metrics fills the per-query stats, which must not be null then
     template <bool bare_bone_search = true, bool collect_metrics = false>
     std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
     searchBaseLayerST(
@@ -313,31 +788,66 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         const void *data_point,
         size_t ef,
         BaseFilterFunctor* isIdAllowed = nullptr,
-        BaseSearchStopCondition<dist_t>* stop_condition = nullptr) const {
-        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
-        vl_type *visited_array = vl->mass;
-        vl_type visited_array_tag = vl->curV;
+        BaseSearchStopCondition<dist_t>* stop_condition = nullptr,
+        SearchStats* stats = nullptr) const {
+        SearchHeap top_candidates;
+        SearchHeap candidate_set;
+        if (useVisitedHashSet(ef)) {
+            VisitedHashSet *vs = visited_set_pool_->getFreeVisitedList();
+            searchBaseLayerST<bare_bone_search, collect_metrics>(
+                ep_id, data_point, ef, vs, top_candidates, candidate_set, isIdAllowed, stop_condition, stats);
+            visited_set_pool_->releaseVisitedList(vs);
+        } else {
+            VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+            searchBaseLayerST<bare_bone_search, collect_metrics>(
+                ep_id, data_point, ef, vl, top_candidates, candidate_set, isIdAllowed, stop_condition, stats);
+            visited_list_pool_->releaseVisitedList(vl);
+        }
+        return std::move(top_candidates);
+    }
 
-        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
-        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidate_set;
 
+    // Same as above, but uses the given visited set (VisitedList or VisitedHashSet, already reset)
+    // and fills the given empty heaps
+    template <bool bare_bone_search = true, bool collect_metrics = false, typename VisitedSet>
+    void searchBaseLayerST(
+        tableint ep_id,
+        const void *data_point,
+        size_t ef,
+        VisitedSet *visited,
+        SearchHeap &top_candidates,
+        SearchHeap &candidate_set,
+        BaseFilterFunctor* isIdAllowed = nullptr,
+        BaseSearchStopCondition<dist_t>* stop_condition = nullptr,
+        SearchStats* stats = nullptr) const {
         dist_t lowerBound;
         if (bare_bone_search || 
             (!isMarkedDeleted(ep_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(ep_id))))) {
             char* ep_data = getDataByInternalId(ep_id);
-            dist_t dist = fstdistfunc_(data_point, ep_data, dist_func_param_);
+            dist_t dist = query_distfunc_(data_point, ep_data, dist_func_param_);
             lowerBound = dist;
             top_candidates.emplace(dist, ep_id);
             if (!bare_bone_search && stop_condition) {
                 stop_condition->add_point_to_result(getExternalLabel(ep_id), ep_data, dist);
             }
             candidate_set.emplace(-dist, ep_id);
+            if (collect_metrics) {
+                stats->distance_computations++;
+                stats->heap_pushes += 2;
+            }
         } else {
             lowerBound = std::numeric_limits<dist_t>::max();
             candidate_set.emplace(-lowerBound, ep_id);
+            if (collect_metrics) {
+                stats->heap_pushes++;
+                stats->filtered_out++;
+            }
         }
 
-        visited_array[ep_id] = visited_array_tag;
+        visited->visit(ep_id);
+        if (collect_metrics) {
+            stats->visited++;
+        }
 
         while (!candidate_set.empty()) {
             std::pair<dist_t, tableint> current_node_pair = candidate_set.top();
@@ -363,14 +873,15 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             size_t size = getListCount((linklistsizeint*)data);
 //                bool cur_node_deleted = isMarkedDeleted(current_node_id);
             if (collect_metrics) {
-                metric_hops++;
-                metric_distance_computations+=size;
+                stats->addHop(0);
             }
 
 #ifdef USE_SSE
-            _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
-            _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
-            _mm_prefetch(data_level0_memory_ + (*(data + 1)) * size_data_per_element_ + offsetData_, _MM_HINT_T0);
+            // only ids within the list are prefetched, the chunk of any other value may not exist
+            if (size > 0) {
+                visited->prefetch(*(data + 1));
+                _mm_prefetch(getDataByInternalId(*(data + 1)), _MM_HINT_T0);
+            }
             _mm_prefetch((char *) (data + 2), _MM_HINT_T0);
 #endif
 
@@ -378,15 +889,19 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 int candidate_id = *(data + j);
 //                    if (candidate_id == 0) continue;
 #ifdef USE_SSE
-                _mm_prefetch((char *) (visited_array + *(data + j + 1)), _MM_HINT_T0);
-                _mm_prefetch(data_level0_memory_ + (*(data + j + 1)) * size_data_per_element_ + offsetData_,
-                                _MM_HINT_T0);  ////////////
+                if (j < size) {
+                    visited->prefetch(*(data + j + 1));
+                    _mm_prefetch(getDataByInternalId(*(data + j + 1)), _MM_HINT_T0);  ////////////
+                }
 #endif
-                if (!(visited_array[candidate_id] == visited_array_tag)) {
-                    visited_array[candidate_id] = visited_array_tag;
+                if (visited->visit(candidate_id)) {
 
                     char *currObj1 = (getDataByInternalId(candidate_id));
-                    dist_t dist = fstdistfunc_(data_point, currObj1, dist_func_param_);
+                    dist_t dist = query_distfunc_(data_point, currObj1, dist_func_param_);
+                    if (collect_metrics) {
+                        stats->visited++;
+                        stats->distance_computations++;
+                    }
 
                     bool flag_consider_candidate;
                     if (!bare_bone_search && stop_condition) {
@@ -398,9 +913,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     if (flag_consider_candidate) {
                         candidate_set.emplace(-dist, candidate_id);
 #ifdef USE_SSE
-                        _mm_prefetch(data_level0_memory_ + candidate_set.top().second * size_data_per_element_ +
-                                        offsetLevel0_,  ///////////
-                                        _MM_HINT_T0);  ////////////////////////
+                        _mm_prefetch((char *) get_linklist0(candidate_set.top().second), _MM_HINT_T0);
 #endif
 
                         if (bare_bone_search || 
@@ -409,6 +922,14 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                             if (!bare_bone_search && stop_condition) {
                                 stop_condition->add_point_to_result(getExternalLabel(candidate_id), currObj1, dist);
                             }
+                            if (collect_metrics) {
+                                stats->heap_pushes++;
+                            }
+                        } else if (collect_metrics) {
+                            stats->filtered_out++;
+                        }
+                        if (collect_metrics) {
+                            stats->heap_pushes++;
                         }
 
                         bool flag_remove_extra = false;
@@ -434,12 +955,33 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 }
             }
         }
+    }
 
-        visited_list_pool_->releaseVisitedList(vl);
-        return top_candidates;
+
+    // Per-thread buffers of the neighbor selection, so that insertions do not allocate for it
+    struct HeuristicScratch {
+        std::vector<std::pair<dist_t, tableint>> candidates;  // by increasing distance
+        std::vector<std::pair<dist_t, tableint>> selected;
+        std::vector<const void *> selected_data;
+        std::vector<const void *> link_data;  // links of an overflowing list
+        std::vector<dist_t> link_distances;
+        SearchHeap link_candidates;
+    };
+
+    static HeuristicScratch &heuristicScratch() {
+        static thread_local HeuristicScratch scratch;
+        return scratch;
     }
 
+    // number of selected neighbors a candidate is compared with per batch kernel call
+    static const size_t HEURISTIC_BLOCK_SIZE = 4;
 
+    /*
+    * Keeps at most M of the candidates: in increasing distance, a candidate is selected unless it is closer
+    * to an already selected one than to the element. The distances of a candidate to the selected ones are
+    * computed in blocks with the batch kernel, so a rejected candidate costs at most one block more than
+    * the distances up to the first closer selected one.
+    */
     void getNeighborsByHeuristic2(
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> &top_candidates,
         const size_t M) {
@@ -447,49 +989,50 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             return;
         }
 
-        std::priority_queue<std::pair<dist_t, tableint>> queue_closest;
-        std::vector<std::pair<dist_t, tableint>> return_list;
-        while (top_candidates.size() > 0) {
-            queue_closest.emplace(-top_candidates.top().first, top_candidates.top().second);
+        HeuristicScratch &scratch = heuristicScratch();
+        std::vector<std::pair<dist_t, tableint>> &candidates = scratch.candidates;
+        std::vector<std::pair<dist_t, tableint>> &selected = scratch.selected;
+        std::vector<const void *> &selected_data = scratch.selected_data;
+        // the heap returns the farthest candidate first
+        candidates.resize(top_candidates.size());
+        for (size_t i = candidates.size(); i > 0; i--) {
+            candidates[i - 1] = top_candidates.top();
             top_candidates.pop();
         }
+        selected.clear();
+        selected_data.clear();
 
-        while (queue_closest.size()) {
-            if (return_list.size() >= M)
+        dist_t distances[HEURISTIC_BLOCK_SIZE];
+        for (const std::pair<dist_t, tableint> &candidate : candidates) {
+            if (selected.size() >= M)
                 break;
-            std::pair<dist_t, tableint> curent_pair = queue_closest.top();
-            dist_t dist_to_query = -curent_pair.first;
-            queue_closest.pop();
+            const void *candidate_data = getDataByInternalId(candidate.second);
             bool good = true;
-
-            for (std::pair<dist_t, tableint> second_pair : return_list) {
-                dist_t curdist =
-                        fstdistfunc_(getDataByInternalId(second_pair.second),
-                                        getDataByInternalId(curent_pair.second),
-                                        dist_func_param_);
-                if (curdist < dist_to_query) {
-                    good = false;
-                    break;
+            for (size_t begin = 0; good && begin < selected.size(); begin += HEURISTIC_BLOCK_SIZE) {
+                size_t block_size = std::min((size_t) HEURISTIC_BLOCK_SIZE, selected.size() - begin);
+                batchDistances(candidate_data, selected_data.data() + begin, block_size, distances);
+                for (size_t j = 0; j < block_size; j++) {
+                    if (distances[j] < candidate.first) {
+                        good = false;
+                        break;
+                    }
                 }
             }
             if (good) {
-                return_list.push_back(curent_pair);
+                selected.push_back(candidate);
+                selected_data.push_back(candidate_data);
             }
         }
 
-        for (std::pair<dist_t, tableint> curent_pair : return_list) {
-            top_candidates.emplace(-curent_pair.first, curent_pair.second);
+        for (const std::pair<dist_t, tableint> &curent_pair : selected) {
+            top_candidates.push(curent_pair);
         }
     }
 
 
     linklistsizeint *get_linklist0(tableint internal_id) const {
-        return (linklistsizeint *) (data_level0_memory_ + internal_id * size_data_per_element_ + offsetLevel0_);
-    }
-
-
-    linklistsizeint *get_linklist0(tableint internal_id, char *data_level0_memory_) const {
-        return (linklistsizeint *) (data_level0_memory_ + internal_id * size_data_per_element_ + offsetLevel0_);
+        return (linklistsizeint *) (level0_chunks_[internal_id >> chunk_shift_] +
+                                    (internal_id & chunk_mask_) * size_data_per_element_ + offsetLevel0_);
     }
 
 
@@ -503,6 +1046,56 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    // Stored distances of the links of a list at the level, they follow the room for the ids of the list
+    uint16_t *getLinkDistances(linklistsizeint *ll, int level) const {
+        return (uint16_t *) ((tableint *) (ll + 1) + (level == 0 ? maxM0_ : maxM_));
+    }
+
+
+    static uint16_t encodeLinkDistance(dist_t distance) {
+        return FloatToBF16((float) distance);
+    }
+
+
+    static dist_t decodeLinkDistance(uint16_t distance) {
+        return (dist_t) BF16ToFloat(distance);
+    }
+
+
+    // Replaces the links of a list by the candidates, the lock of the list must be held
+    void setLinks(
+        linklistsizeint *ll,
+        int level,
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> &candidates) {
+        size_t candSize = candidates.size();
+        setListCount(ll, candSize);
+        tableint *data = (tableint *) (ll + 1);
+        uint16_t *distances = store_link_distances_ ? getLinkDistances(ll, level) : nullptr;
+        for (size_t idx = 0; idx < candSize; idx++) {
+            data[idx] = candidates.top().second;
+            if (distances)
+                distances[idx] = encodeLinkDistance(candidates.top().first);
+            candidates.pop();
+        }
+    }
+
+
+    // Recomputes the stored distance of the link from internalId to target at the level, if there is one
+    void refreshLinkDistance(tableint internalId, tableint target, int level) {
+        std::unique_lock <std::mutex> lock(link_list_locks_[internalId]);
+        linklistsizeint *ll = get_linklist_at_level(internalId, level);
+        size_t size = getListCount(ll);
+        tableint *data = (tableint *) (ll + 1);
+        for (size_t j = 0; j < size; j++) {
+            if (data[j] == target) {
+                getLinkDistances(ll, level)[j] = encodeLinkDistance(
+                    fstdistfunc_(getDataByInternalId(internalId), getDataByInternalId(target), dist_func_param_));
+                return;
+            }
+        }
+    }
+
+
     tableint mutuallyConnectNewElement(
         const void *data_point,
         tableint cur_c,
@@ -515,9 +1108,12 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             throw std::runtime_error("Should be not be more than M_ candidates returned by the heuristic");
 
         std::vector<tableint> selectedNeighbors;
+        std::vector<dist_t> selectedDistances;
         selectedNeighbors.reserve(M_);
+        selectedDistances.reserve(M_);
         while (top_candidates.size() > 0) {
             selectedNeighbors.push_back(top_candidates.top().second);
+            selectedDistances.push_back(top_candidates.top().first);
             top_candidates.pop();
         }
 
@@ -549,6 +1145,11 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
                 data[idx] = selectedNeighbors[idx];
             }
+            if (store_link_distances_) {
+                uint16_t *distances = getLinkDistances(ll_cur, level);
+                for (size_t idx = 0; idx < selectedNeighbors.size(); idx++)
+                    distances[idx] = encodeLinkDistance(selectedDistances[idx]);
+            }
         }
 
         for (size_t idx = 0; idx < selectedNeighbors.size(); idx++) {
@@ -576,6 +1177,9 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 for (size_t j = 0; j < sz_link_list_other; j++) {
                     if (data[j] == cur_c) {
                         is_cur_c_present = true;
+                        // the vector of cur_c has changed
+                        if (store_link_distances_)
+                            getLinkDistances(ll_other, level)[j] = encodeLinkDistance(selectedDistances[idx]);
                         break;
                     }
                 }
@@ -585,31 +1189,36 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             if (!is_cur_c_present) {
                 if (sz_link_list_other < Mcurmax) {
                     data[sz_link_list_other] = cur_c;
+                    if (store_link_distances_)
+                        getLinkDistances(ll_other, level)[sz_link_list_other] = encodeLinkDistance(selectedDistances[idx]);
                     setListCount(ll_other, sz_link_list_other + 1);
                 } else {
                     // finding the "weakest" element to replace it with the new one
-                    dist_t d_max = fstdistfunc_(getDataByInternalId(cur_c), getDataByInternalId(selectedNeighbors[idx]),
-                                                dist_func_param_);
-                    // Heuristic:
-                    std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
-                    candidates.emplace(d_max, cur_c);
-
-                    for (size_t j = 0; j < sz_link_list_other; j++) {
-                        candidates.emplace(
-                                fstdistfunc_(getDataByInternalId(data[j]), getDataByInternalId(selectedNeighbors[idx]),
-                                                dist_func_param_), data[j]);
+                    HeuristicScratch &scratch = heuristicScratch();
+                    scratch.link_distances.resize(sz_link_list_other);
+                    if (store_link_distances_) {
+                        uint16_t *distances = getLinkDistances(ll_other, level);
+                        for (size_t j = 0; j < sz_link_list_other; j++)
+                            scratch.link_distances[j] = decodeLinkDistance(distances[j]);
+                    } else {
+                        scratch.link_data.resize(sz_link_list_other);
+                        for (size_t j = 0; j < sz_link_list_other; j++)
+                            scratch.link_data[j] = getDataByInternalId(data[j]);
+                        batchDistances(getDataByInternalId(selectedNeighbors[idx]), scratch.link_data.data(),
+                                       sz_link_list_other, scratch.link_distances.data());
                     }
 
-                    getNeighborsByHeuristic2(candidates, Mcurmax);
+                    // Heuristic:
+                    SearchHeap &candidates = scratch.link_candidates;
+                    candidates.clear();
+                    // the distance between cur_c and the neighbor was computed by the search
+                    candidates.emplace(selectedDistances[idx], cur_c);
+                    for (size_t j = 0; j < sz_link_list_other; j++)
+                        candidates.emplace(scratch.link_distances[j], data[j]);
 
-                    int indx = 0;
-                    while (candidates.size() > 0) {
-                        data[indx] = candidates.top().second;
-                        candidates.pop();
-                        indx++;
-                    }
+                    getNeighborsByHeuristic2(candidates, Mcurmax);
 
-                    setListCount(ll_other, indx);
+                    setLinks(ll_other, level, candidates);
                     // Nearest K:
                     /*int indx = -1;
                     for (int j = 0; j < sz_link_list_other; j++) {
@@ -630,195 +1239,1136 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    /*
+    * Changes the capacity of the index. Growing appends chunks and does not copy the stored elements,
+    * so it may be called while other threads search and insert, inserts beyond the old capacity succeed
+    * once it returns. Shrinking frees the chunks beyond the new capacity and must not be called
+    * concurrently with other operations.
+    */
     void resizeIndex(size_t new_max_elements) {
+        if (mapped_file_)
+            throw std::runtime_error("Cannot resize a memory-mapped index");
+        std::unique_lock <std::mutex> lock_resize(resize_lock_);
         if (new_max_elements < cur_element_count)
             throw std::runtime_error("Cannot resize, max element is less than the current number of elements");
 
-        visited_list_pool_.reset(new VisitedListPool(1, new_max_elements));
-
-        element_levels_.resize(new_max_elements);
-
-        std::vector<std::mutex>(new_max_elements).swap(link_list_locks_);
+        if (new_max_elements >= max_elements_) {
+            resizeElements(new_max_elements);
+            visited_list_pool_->setNumElements(new_max_elements);
+            // published last, addPoint checks the capacity under this lock
+            std::unique_lock <std::mutex> lock_table(label_lookup_lock);
+            label_lookup_.reserve(new_max_elements);
+            max_elements_.store(new_max_elements, std::memory_order_release);
+        } else {
+            max_elements_.store(new_max_elements, std::memory_order_release);
+            visited_list_pool_.reset(new VisitedListPool(1, new_max_elements, visited_set_limit_));
+            resizeElements(new_max_elements);
+        }
+    }
 
-        // Reallocate base layer
-        char * data_level0_memory_new = (char *) realloc(data_level0_memory_, new_max_elements * size_data_per_element_);
-        if (data_level0_memory_new == nullptr)
-            throw std::runtime_error("Not enough memory: resizeIndex failed to allocate base layer");
-        data_level0_memory_ = data_level0_memory_new;
+    /*
+    * Offline pass which renumbers the internal ids so that elements traversed together are stored close
+    * to each other in the base layer. The order is built greedily, Gorder-style: the next element is
+    * the one with the most base layer links from the last `window` placed elements, starting from the
+    * entry point. Labels and search results are not changed, saveIndex keeps the new order.
+    * Temporarily needs a copy of the base layer. Must not be called concurrently with other operations.
+    */
+    void reorderGraph(size_t window = 16) {
+        checkWritable();
+        if (mapped_file_)
+            throw std::runtime_error("Cannot reorder a memory-mapped index");
+        size_t num_elements = cur_element_count;
+        if (num_elements == 0)
+            return;
 
-        // Reallocate all other layers
-        char ** linkLists_new = (char **) realloc(linkLists_, sizeof(void *) * new_max_elements);
-        if (linkLists_new == nullptr)
-            throw std::runtime_error("Not enough memory: resizeIndex failed to allocate other layers");
-        linkLists_ = linkLists_new;
+        std::vector<tableint> new_to_old = localityOrder(std::max<size_t>(window, 1));
+        std::vector<tableint> old_to_new(num_elements);
+        for (size_t i = 0; i < num_elements; i++)
+            old_to_new[new_to_old[i]] = i;
+
+        size_t element_size = fileElementSize();
+        std::vector<char> elements(num_elements * element_size);
+        std::vector<char *> link_lists(num_elements);
+        std::vector<int> levels(num_elements);
+        for (size_t i = 0; i < num_elements; i++) {
+            copyElementTo(i, elements.data() + i * element_size);
+            link_lists[i] = linkLists_[i];
+            levels[i] = element_levels_[i];
+        }
 
-        max_elements_ = new_max_elements;
+        for (size_t i = 0; i < num_elements; i++) {
+            tableint old_id = new_to_old[i];
+            copyElementFrom(i, elements.data() + old_id * element_size);
+            remapLinks(get_linklist0(i), old_to_new);
+            linkLists_[i] = link_lists[old_id];
+            element_levels_[i] = levels[old_id];
+            for (int level = 1; level <= element_levels_[i]; level++)
+                remapLinks(get_linklist(i, level), old_to_new);
+        }
+        packLinkLists();
+
+        for (auto &entry : label_lookup_)
+            entry.second = old_to_new[entry.second];
+        std::unordered_set<tableint> deleted_elements_new;
+        for (tableint id : deleted_elements)
+            deleted_elements_new.insert(old_to_new[id]);
+        deleted_elements.swap(deleted_elements_new);
+        EntryPoint entry_point = getEntryPoint();
+        setEntryPoint(old_to_new[entry_point.node], entry_point.level);
     }
 
-    size_t indexFileSize() const {
-        size_t size = 0;
-        size += sizeof(offsetLevel0_);
-        size += sizeof(max_elements_);
-        size += sizeof(cur_element_count);
-        size += sizeof(size_data_per_element_);
-        size += sizeof(label_offset_);
-        size += sizeof(offsetData_);
-        size += sizeof(maxlevel_);
-        size += sizeof(enterpoint_node_);
-        size += sizeof(maxM_);
-
-        size += sizeof(maxM0_);
-        size += sizeof(M_);
-        size += sizeof(mult_);
-        size += sizeof(ef_construction_);
-
-        size += cur_element_count * size_data_per_element_;
 
-        for (size_t i = 0; i < cur_element_count; i++) {
-            unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
-            size += sizeof(linkListSize);
-            size += linkListSize;
+    /*
+    * Removes the elements marked deleted from the index: the links to them are repaired as in removePoint
+    * (on num_threads threads, 0 means one per core), then the remaining elements are renumbered to the first
+    * internal ids and the labels of the deleted ones are released. Searches no longer traverse deleted elements
+    * and take the bare-bone path again, the freed slots take the next insertions, and resizeIndex can release
+    * their memory. Must not be called concurrently with other operations.
+    */
+    void compactDeleted(int num_threads = 0) {
+        checkWritable();
+        if (mapped_file_)
+            throw std::runtime_error("Cannot compact a memory-mapped index");
+        size_t num_elements = cur_element_count;
+        if (num_deleted_ == 0)
+            return;
+
+        // each remaining element only rewrites its own links, the links of deleted elements are not changed
+        ParallelFor(0, num_elements, num_threads > 0 ? num_threads : 0, [&](size_t id, size_t) {
+            if (isMarkedDeleted(id))
+                return;
+            for (int level = 0; level <= element_levels_[id]; level++)
+                repairLinksToDeleted(id, level);
+        });
+
+        const tableint NONE = std::numeric_limits<tableint>::max();
+        std::vector<tableint> old_to_new(num_elements, NONE);
+        size_t num_remaining = 0;
+        EntryPoint entry_point{NONE, -1};
+        for (size_t i = 0; i < num_elements; i++) {
+            if (isMarkedDeleted(i)) {
+                labeltype label = getExternalLabel(i);
+                auto search = label_lookup_.find(label);
+                if (search != label_lookup_.end() && search->second == i)
+                    label_lookup_.erase(label);
+                continue;
+            }
+            old_to_new[i] = num_remaining++;
+            // the highest remaining element replaces a deleted entry point
+            if (element_levels_[i] > entry_point.level)
+                entry_point = EntryPoint{old_to_new[i], element_levels_[i]};
         }
-        return size;
+        EntryPoint old_entry_point = getEntryPoint();
+        if (!isMarkedDeleted(old_entry_point.node))
+            entry_point = EntryPoint{old_to_new[old_entry_point.node], old_entry_point.level};
+
+        // the new id of an element is at most its old id, so the elements are moved in increasing order
+        std::vector<char> element(fileElementSize());
+        for (size_t i = 0; i < num_elements; i++) {
+            tableint new_id = old_to_new[i];
+            if (new_id == NONE)
+                continue;
+            if (new_id != i) {
+                copyElementTo(i, element.data());
+                copyElementFrom(new_id, element.data());
+                linkLists_[new_id] = linkLists_[i];
+                element_levels_[new_id] = element_levels_[i];
+            }
+            remapLinks(get_linklist0(new_id), old_to_new);
+            for (int level = 1; level <= element_levels_[new_id]; level++)
+                remapLinks(get_linklist(new_id, level), old_to_new);
+        }
+        for (size_t i = num_remaining; i < num_elements; i++) {
+            linkLists_[i] = nullptr;
+            element_levels_[i] = 0;
+        }
+        cur_element_count = num_remaining;
+        packLinkLists();
+
+        for (auto &entry : label_lookup_)
+            entry.second = old_to_new[entry.second];
+        deleted_elements.clear();
+        num_deleted_ = 0;
+        if (num_remaining == 0)
+            setEntryPoint(-1, -1);
+        else
+            setEntryPoint(entry_point.node, entry_point.level);
     }
 
-    void saveIndex(const std::string &location) {
-        std::ofstream output(location, std::ios::binary);
-        std::streampos position;
 
+    /*
+    * Allocates the upper-level link lists of all elements in one block of arena, sorted by decreasing level:
+    * the lists of the few elements of the top levels, which every search descends through, are packed
+    * together at the start of the block. Returns the list of every element, element_levels_ must be set.
+    */
+    std::vector<char *> allocateLinkListsByLevel(LinkListArena &arena) const {
+        size_t num_elements = cur_element_count;
+        int max_level = 0;
+        for (size_t i = 0; i < num_elements; i++)
+            max_level = std::max(max_level, element_levels_[i]);
+        std::vector<size_t> level_begin(max_level + 1, 0);
+        for (size_t i = 0; i < num_elements; i++)
+            level_begin[element_levels_[i]] += element_levels_[i] * size_links_per_element_;
+        size_t total_size = 0;
+        for (int level = max_level; level > 0; level--) {
+            size_t level_size = level_begin[level];
+            level_begin[level] = total_size;
+            total_size += level_size;
+        }
+
+        std::vector<char *> link_lists(num_elements, nullptr);
+        if (total_size == 0)
+            return link_lists;
+        char *block = arena.allocate(total_size);
+        for (size_t i = 0; i < num_elements; i++) {
+            int level = element_levels_[i];
+            if (level > 0) {
+                link_lists[i] = block + level_begin[level];
+                level_begin[level] += level * size_links_per_element_;
+            }
+        }
+        return link_lists;
+    }
+
+
+    /*
+    * Moves the upper-level link lists into one block sorted by decreasing level (see allocateLinkListsByLevel),
+    * which also releases the space left at the ends of the arena blocks by the insertions.
+    * Must not be called concurrently with other operations.
+    */
+    void packLinkLists() {
+        checkWritable();
+        LinkListArena arena;
+        std::vector<char *> link_lists = allocateLinkListsByLevel(arena);
+        for (size_t i = 0; i < cur_element_count; i++) {
+            if (element_levels_[i] > 0)
+                memcpy(link_lists[i], linkLists_[i], element_levels_[i] * size_links_per_element_);
+            linkLists_[i] = link_lists[i];
+        }
+        link_list_arena_.swap(arena);
+    }
+
+
+    // Placement order of reorderGraph, scores are kept in buckets of doubly linked lists
+    std::vector<tableint> localityOrder(size_t window) const {
+        const tableint NONE = std::numeric_limits<tableint>::max();
+        size_t num_elements = cur_element_count;
+        std::vector<tableint> order;
+        order.reserve(num_elements);
+        std::vector<bool> placed(num_elements, false);
+        std::vector<unsigned int> score(num_elements, 0);
+        std::vector<tableint> prev(num_elements), next(num_elements);
+        std::vector<tableint> buckets(window + 1, NONE);
+        size_t max_score = 0;
+
+        auto unlink = [&](tableint id) {
+            if (prev[id] != NONE)
+                next[prev[id]] = next[id];
+            else
+                buckets[score[id]] = next[id];
+            if (next[id] != NONE)
+                prev[next[id]] = prev[id];
+        };
+        auto link = [&](tableint id) {
+            if (score[id] >= buckets.size())
+                buckets.resize(score[id] + 1, NONE);
+            prev[id] = NONE;
+            next[id] = buckets[score[id]];
+            if (next[id] != NONE)
+                prev[next[id]] = id;
+            buckets[score[id]] = id;
+            max_score = std::max<size_t>(max_score, score[id]);
+        };
+        // adds delta to the scores of the unplaced neighbors of id
+        auto update = [&](tableint id, int delta) {
+            linklistsizeint *ll = get_linklist0(id);
+            size_t size = getListCount(ll);
+            tableint *links = (tableint *) (ll + 1);
+            for (size_t j = 0; j < size; j++) {
+                tableint neighbor = links[j];
+                if (placed[neighbor])
+                    continue;
+                if (score[neighbor] > 0)
+                    unlink(neighbor);
+                score[neighbor] += delta;
+                if (score[neighbor] > 0)
+                    link(neighbor);
+            }
+        };
+
+        tableint next_unplaced = 0;
+        for (size_t k = 0; k < num_elements; k++) {
+            while (max_score > 0 && buckets[max_score] == NONE)
+                max_score--;
+            tableint id;
+            if (max_score > 0) {
+                id = buckets[max_score];
+                unlink(id);
+            } else if (k == 0) {
+                id = getEntryPoint().node;
+            } else {
+                // no links from the window, continue with the first unplaced element
+                while (placed[next_unplaced])
+                    next_unplaced++;
+                id = next_unplaced;
+            }
+            placed[id] = true;
+            order.push_back(id);
+            update(id, 1);
+            if (order.size() > window)
+                update(order[order.size() - 1 - window], -1);
+        }
+        return order;
+    }
+
+
+    void remapLinks(linklistsizeint *ll, const std::vector<tableint> &old_to_new) {
+        size_t size = getListCount(ll);
+        tableint *links = (tableint *) (ll + 1);
+        for (size_t j = 0; j < size; j++)
+            links[j] = old_to_new[links[j]];
+    }
+
+
+    // Fields of the header of the older file versions, the parameters section of index files
+    std::string indexParameters(size_t element_count, EntryPoint entry_point) const {
+        std::ostringstream output;
         writeBinaryPOD(output, offsetLevel0_);
-        writeBinaryPOD(output, max_elements_);
-        writeBinaryPOD(output, cur_element_count);
-        writeBinaryPOD(output, size_data_per_element_);
+        writeBinaryPOD(output, max_elements_.load());
+        writeBinaryPOD(output, element_count);
+        writeBinaryPOD(output, fileElementSize());
         writeBinaryPOD(output, label_offset_);
         writeBinaryPOD(output, offsetData_);
-        writeBinaryPOD(output, maxlevel_);
-        writeBinaryPOD(output, enterpoint_node_);
+        writeBinaryPOD(output, entry_point.level);
+        writeBinaryPOD(output, entry_point.node);
         writeBinaryPOD(output, maxM_);
 
         writeBinaryPOD(output, maxM0_);
         writeBinaryPOD(output, M_);
         writeBinaryPOD(output, mult_);
         writeBinaryPOD(output, ef_construction_);
+        return output.str();
+    }
 
-        output.write(data_level0_memory_, cur_element_count * size_data_per_element_);
 
+    size_t linkListsFileSize() const {
+        size_t size = 0;
+        for (size_t i = 0; i < cur_element_count; i++)
+            size += element_levels_[i] * size_links_per_element_;
+        return size;
+    }
+
+
+    size_t indexFileSize() const {
+        size_t size = INDEX_FILE_ALIGNMENT;  // header and section table
+        size += alignIndexFileOffset(indexParameters(cur_element_count, getEntryPoint()).size());
+        size += alignIndexFileOffset(cur_element_count * sizeof(int));
+        size += alignIndexFileOffset(cur_element_count * fileElementSize());
+        size += alignIndexFileOffset(linkListsFileSize());
+        size += alignIndexFileOffset(label_lookup_.memoryUsage());
+        size += alignIndexFileOffset(num_deleted_ * sizeof(tableint));
+        return size;
+    }
+
+
+    void saveIndex(const std::string &location) {
+        saveIndex(location, false);
+    }
+
+
+    /*
+    * Writes the index file (see index_file.h) by large blocks, the writes overlap with the copies of the next
+    * block. With direct_io the page cache is bypassed where the file system allows it.
+    */
+    void saveIndex(const std::string &location, bool direct_io) {
+        IndexFileWriter writer(location, direct_io);
+
+        std::string parameters = indexParameters(cur_element_count, getEntryPoint());
+        writer.beginSection(IndexSection::Parameters);
+        writer.write(parameters.data(), parameters.size());
+        writer.endSection();
+
+        writer.beginSection(IndexSection::Levels);
+        for (size_t i = 0; i < cur_element_count; i++)
+            writer.write(&element_levels_[i], sizeof(int));
+        writer.endSection();
+
+        writer.beginSection(IndexSection::Level0);
+        if (layout_ == IndexLayout::Separate) {
+            std::vector<char> buffer(fileElementSize());
+            for (size_t i = 0; i < cur_element_count; i++) {
+                copyElementTo(i, buffer.data());
+                writer.write(buffer.data(), buffer.size());
+            }
+        } else {
+            for (size_t begin = 0; begin < cur_element_count; begin += chunkSize()) {
+                size_t count = std::min(chunkSize(), cur_element_count - begin);
+                writer.write(level0_chunks_[begin >> chunk_shift_], count * size_data_per_element_);
+            }
+        }
+        writer.endSection();
+
+        writer.beginSection(IndexSection::LinkLists);
         for (size_t i = 0; i < cur_element_count; i++) {
-            unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
-            writeBinaryPOD(output, linkListSize);
-            if (linkListSize)
-                output.write(linkLists_[i], linkListSize);
+            if (element_levels_[i] > 0)
+                writer.write(linkLists_[i], element_levels_[i] * size_links_per_element_);
+        }
+        writer.endSection();
+
+        writer.beginSection(IndexSection::Labels);
+        writer.write(label_lookup_.slots(), label_lookup_.memoryUsage());
+        writer.endSection();
+
+        writer.beginSection(IndexSection::Deleted);
+        for (tableint i = 0; i < cur_element_count; i++) {
+            if (isMarkedDeleted(i))
+                writer.write(&i, sizeof(tableint));
         }
-        output.close();
+        writer.endSection();
+        writer.finish();
     }
 
 
-    void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0) {
-        std::ifstream input(location, std::ios::binary);
+    // Removes the links to the ids from count on from a copy of a link list at the level
+    void dropLinksFrom(linklistsizeint *ll, int level, size_t count) const {
+        size_t size = getListCount(ll);
+        tableint *links = (tableint *) (ll + 1);
+        uint16_t *distances = store_link_distances_ ? getLinkDistances(ll, level) : nullptr;
+        size_t kept = 0;
+        for (size_t j = 0; j < size; j++) {
+            if (links[j] >= count)
+                continue;
+            links[kept] = links[j];
+            if (distances)
+                distances[kept] = distances[j];
+            kept++;
+        }
+        setListCount(ll, kept);
+    }
 
-        if (!input.is_open())
+
+    /*
+    * Matches a copy of the label lookup to the elements of a snapshot, which may have changed between the copies:
+    * the entries of later elements and of the labels given to replaced elements are dropped. The label a replaced
+    * element had in the snapshot is not added back, it was deleted. Without concurrent operations the copy is
+    * left as it is.
+    */
+    static void matchLabelLookup(FlatHashMap<labeltype, tableint> &label_lookup, const std::vector<labeltype> &labels) {
+        std::vector<labeltype> stale;
+        for (auto it = label_lookup.begin(); it != label_lookup.end(); ++it) {
+            if (it->second >= labels.size() || labels[it->second] != it->first)
+                stale.push_back(it->first);
+        }
+        for (labeltype label : stale)
+            label_lookup.erase(label);
+    }
+
+
+    /*
+    * Saves the index while insertions, deletions and searches continue, in the format of saveIndex.
+    * The snapshot holds the elements inserted before it started, their links to later elements are dropped.
+    * The label lookup is copied after the elements and then matched to the labels of the copied elements.
+    * Every element is copied under its link list lock, so it is never caught in the middle of an insertion.
+    * As the lists are copied one after the other, a list pruned for a later element may miss the link it replaced.
+    * An element updated or replaced meanwhile is saved with its old or its new vector.
+    * The file is written next to location and synced, then renamed over it, so location always holds a whole
+    * index. Must not be called concurrently with resizeIndex, compactDeleted, packLinkLists or reorderGraph.
+    */
+    void saveSnapshot(const std::string &location, bool direct_io = false) {
+        // the entry point is published after its insertion, so it is one of the counted elements
+        EntryPoint entry_point = getEntryPoint();
+        size_t count;
+        {
+            // the inserting thread takes the lock of its element before it releases label_lookup_lock
+            std::unique_lock <std::mutex> lock_table(label_lookup_lock);
+            count = cur_element_count;
+        }
+
+        std::vector<int> levels(count);
+        for (size_t i = 0; i < count; i++) {
+            std::unique_lock <std::mutex> lock(link_list_locks_[i]);
+            levels[i] = element_levels_[i];
+            // an insertion which raised the top level and did not publish the new entry point yet
+            if (levels[i] > entry_point.level) {
+                entry_point.node = i;
+                entry_point.level = levels[i];
+            }
+        }
+
+        std::string temp_location = location + ".tmp";
+        try {
+            IndexFileWriter writer(temp_location, direct_io);
+
+            std::string parameters = indexParameters(count, entry_point);
+            writer.beginSection(IndexSection::Parameters);
+            writer.write(parameters.data(), parameters.size());
+            writer.endSection();
+
+            writer.beginSection(IndexSection::Levels);
+            writer.write(levels.data(), count * sizeof(int));
+            writer.endSection();
+
+            writer.beginSection(IndexSection::Level0);
+            std::vector<char> buffer(fileElementSize());
+            std::vector<labeltype> labels(count);
+            std::vector<tableint> deleted;
+            for (tableint i = 0; i < count; i++) {
+                {
+                    std::unique_lock <std::mutex> lock(link_list_locks_[i]);
+                    copyElementTo(i, buffer.data());
+                }
+                memcpy(&labels[i], buffer.data() + label_offset_, sizeof(labeltype));
+                // the mark of isMarkedDeleted, in the header of the copied link list
+                if (((unsigned char *) buffer.data())[2] & DELETE_MARK)
+                    deleted.push_back(i);
+                dropLinksFrom((linklistsizeint *) buffer.data(), 0, count);
+                writer.write(buffer.data(), buffer.size());
+            }
+            writer.endSection();
+
+            writer.beginSection(IndexSection::LinkLists);
+            for (size_t i = 0; i < count; i++) {
+                if (levels[i] == 0)
+                    continue;
+                buffer.resize(levels[i] * size_links_per_element_);
+                {
+                    std::unique_lock <std::mutex> lock(link_list_locks_[i]);
+                    memcpy(buffer.data(), linkLists_[i], buffer.size());
+                }
+                for (int level = 1; level <= levels[i]; level++)
+                    dropLinksFrom((linklistsizeint *) (buffer.data() + (level - 1) * size_links_per_element_), level, count);
+                writer.write(buffer.data(), buffer.size());
+            }
+            writer.endSection();
+
+            FlatHashMap<labeltype, tableint> label_lookup;
+            {
+                std::unique_lock <std::mutex> lock_table(label_lookup_lock);
+                label_lookup.assignSlots(label_lookup_.slots(), label_lookup_.memoryUsage() / sizeof(*label_lookup_.slots()));
+            }
+            matchLabelLookup(label_lookup, labels);
+            writer.beginSection(IndexSection::Labels);
+            writer.write(label_lookup.slots(), label_lookup.memoryUsage());
+            writer.endSection();
+
+            writer.beginSection(IndexSection::Deleted);
+            writer.write(deleted.data(), deleted.size() * sizeof(tableint));
+            writer.endSection();
+            writer.finish();
+            writer.sync();
+        } catch (...) {
+            remove(temp_location.c_str());
+            throw;
+        }
+#ifdef _WIN32
+        // rename does not replace an existing file
+        remove(location.c_str());
+#endif
+        if (rename(temp_location.c_str(), location.c_str()) != 0) {
+            remove(temp_location.c_str());
+            throw std::runtime_error("Cannot rename the snapshot file");
+        }
+    }
+
+
+    /*
+    * Starts appending every insertion and deletion to the operation log at location, continuing an existing log.
+    * An operation is logged once it was applied, before the call returns; with sync the record is also flushed to
+    * the device, otherwise it survives a crash of the process but not of the system until syncOperationLog.
+    * Must not be called concurrently with insertions and deletions, neither must closeOperationLog.
+    */
+    void openOperationLog(const std::string &location, bool sync = false) {
+        checkWritable();
+        if (operation_log_)
+            throw std::runtime_error("An operation log is already open");
+        operation_log_.reset(new OperationLog(location, data_size_, sync));
+    }
+
+
+    void closeOperationLog() {
+        if (operation_log_)
+            operation_log_->sync();
+        operation_log_.reset(nullptr);
+    }
+
+
+    // Flushes the logged operations to the device
+    void syncOperationLog() {
+        if (!operation_log_)
+            throw std::runtime_error("No operation log is open");
+        operation_log_->sync();
+    }
+
+
+    /*
+    * Saves a snapshot to location and starts the operation log over. The log is first set aside next to itself
+    * with OPERATION_LOG_ROTATED_SUFFIX and removed once the snapshot is written. Every operation logged before
+    * the rotation is in the snapshot, the ones logged during it may be and are replayed again, see
+    * replayOperationLog. Can run concurrently with insertions, deletions and searches, like saveSnapshot.
+    *
+    * After a crash, load the last snapshot, call replayOperationLog with the location of the log, then
+    * openOperationLog to continue it.
+    */
+    void checkpoint(const std::string &location, bool direct_io = false) {
+        if (!operation_log_)
+            throw std::runtime_error("No operation log is open");
+        std::string rotated_location = operation_log_->location() + OPERATION_LOG_ROTATED_SUFFIX;
+        if (operationLogExists(rotated_location)) {
+            // a checkpoint which did not finish, its operations were replayed but may be missing from the snapshot
+            saveSnapshot(location, direct_io);
+            remove(rotated_location.c_str());
+        }
+        operation_log_->rotate(rotated_location);
+        saveSnapshot(location, direct_io);
+        remove(rotated_location.c_str());
+    }
+
+
+    /*
+    * Applies the operations of the log at location, after those of the log set aside by an unfinished checkpoint.
+    * Operations which the index already reflects are skipped, so a log may be replayed over a snapshot which holds
+    * part of it: the elements which are not deleted end up the same, a deleted label may be inserted and deleted
+    * again although its slot was replaced. Reading stops at the first record which does not pass its check, the end
+    * of a log cut off by a crash. Returns the number of applied operations.
+    */
+    size_t replayOperationLog(const std::string &location) {
+        checkWritable();
+        if (operation_log_)
+            throw std::runtime_error("Cannot replay an operation log while operations are logged");
+        std::string rotated_location = location + OPERATION_LOG_ROTATED_SUFFIX;
+        bool has_rotated = operationLogExists(rotated_location);
+        // a checkpoint may stop between setting the log aside and creating the new one
+        if (!has_rotated && !operationLogExists(location))
             throw std::runtime_error("Cannot open file");
 
-        clear();
-        // get file size:
-        input.seekg(0, input.end);
-        std::streampos total_filesize = input.tellg();
-        input.seekg(0, input.beg);
+        size_t num_applied = 0;
+        for (const std::string &log_location : {rotated_location, location}) {
+            if (!operationLogExists(log_location))
+                continue;
+            OperationLogReader reader(log_location, data_size_);
+            OperationLogEntry entry;
+            while (reader.next(entry)) {
+                if (applyLoggedOperation(entry))
+                    num_applied++;
+            }
+        }
+        return num_applied;
+    }
+
+
+    // Applies an operation of a log unless the index already reflects it
+    bool applyLoggedOperation(const OperationLogEntry &entry) {
+        std::unique_lock <std::mutex> lock_table(label_lookup_lock);
+        auto search = label_lookup_.find(entry.label);
+        bool found = search != label_lookup_.end();
+        tableint internalId = found ? search->second : 0;
+        lock_table.unlock();
+        bool deleted = found && isMarkedDeleted(internalId);
+
+        switch (entry.type) {
+        case LoggedOperation::Add:
+            if (found && !deleted && memcmp(getDataByInternalId(internalId), entry.data.data(), data_size_) == 0)
+                return false;
+            // an addPoint which found the label deleted in the index it was applied to
+            if (deleted)
+                unmarkDelete(entry.label);
+            // an existing label is updated in place, with replace_deleted it would be given another slot
+            addPoint(entry.data.data(), entry.label, !found && entry.replace_deleted && allow_replace_deleted_);
+            return true;
+        case LoggedOperation::MarkDelete:
+            if (!found || deleted)
+                return false;
+            markDelete(entry.label);
+            return true;
+        case LoggedOperation::Remove:
+            if (!found)
+                return false;
+            if (!deleted) {
+                removePoint(entry.label);
+            } else {
+                // deleted by an earlier markDelete, the links to it are still to be replaced
+                std::unique_lock <std::mutex> lock_label(getLabelOpMutex(entry.label));
+                repairNeighborsOfDeleted(internalId);
+            }
+            return true;
+        case LoggedOperation::UnmarkDelete:
+            if (!found || !deleted)
+                return false;
+            unmarkDelete(entry.label);
+            return true;
+        }
+        return false;
+    }
 
+
+    void readIndexHeader(std::istream &input) {
         readBinaryPOD(input, offsetLevel0_);
         readBinaryPOD(input, max_elements_);
         readBinaryPOD(input, cur_element_count);
-
-        size_t max_elements = max_elements_i;
-        if (max_elements < cur_element_count)
-            max_elements = max_elements_;
-        max_elements_ = max_elements;
         readBinaryPOD(input, size_data_per_element_);
         readBinaryPOD(input, label_offset_);
         readBinaryPOD(input, offsetData_);
-        readBinaryPOD(input, maxlevel_);
-        readBinaryPOD(input, enterpoint_node_);
+        EntryPoint entry_point;
+        readBinaryPOD(input, entry_point.level);
+        readBinaryPOD(input, entry_point.node);
+        setEntryPoint(entry_point.node, entry_point.level);
 
         readBinaryPOD(input, maxM_);
         readBinaryPOD(input, maxM0_);
         readBinaryPOD(input, M_);
         readBinaryPOD(input, mult_);
         readBinaryPOD(input, ef_construction_);
+        if (!input)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+    }
 
-        data_size_ = s->get_data_size();
-        fstdistfunc_ = s->get_dist_func();
-        dist_func_param_ = s->get_dist_func_param();
+
+    /*
+    * Reads the parameters and the levels of an index file and checks the sizes of the level 0 and link list
+    * sections against them, the sizes of the link lists must be set. Returns the levels.
+    */
+    std::vector<int> readIndexStructure(IndexFileReader &reader) {
+        std::vector<char> parameters = reader.readSection(IndexSection::Parameters);
+        std::istringstream input(std::string(parameters.begin(), parameters.end()));
+        readIndexHeader(input);
+        setLinkListSizesFromFile();
+
+        std::vector<int> levels(cur_element_count);
+        std::vector<char> levels_data = reader.readSection(IndexSection::Levels);
+        if (levels_data.size() != levels.size() * sizeof(int))
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        memcpy(levels.data(), levels_data.data(), levels_data.size());
+        EntryPoint entry_point = getEntryPoint();
+        if (cur_element_count > 0 && entry_point.node >= cur_element_count)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        size_t link_lists_size = 0;
+        for (int level : levels) {
+            if (level < 0 || level > entry_point.level)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            link_lists_size += level * size_links_per_element_;
+        }
+        if (reader.section(IndexSection::Level0).size != cur_element_count * size_data_per_element_ ||
+            reader.section(IndexSection::LinkLists).size != link_lists_size)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        return levels;
+    }
+
+
+    /*
+    * Loads an index saved by saveIndex, the file can be loaded into either layout.
+    * The sections are read by blocks on num_threads threads (0 means one per core), which copy them into
+    * the index and check their CRC, a corrupted file throws. With direct_io the page cache is bypassed where
+    * the file system allows it. Files of older versions are read as before, without the checks.
+    */
+    void loadIndex(
+        const std::string &location,
+        SpaceInterface<dist_t> *s,
+        size_t max_elements_i = 0,
+        IndexLayout layout = IndexLayout::Interleaved,
+        size_t num_threads = 0,
+        bool direct_io = false) {
+        if (!IndexFileReader::isIndexFile(location)) {
+            loadLegacyIndex(location, s, max_elements_i, layout);
+            return;
+        }
+        IndexFileReader reader(location, direct_io);
+
+        clear();
+        std::vector<int> levels = readIndexStructure(reader);
+
+        size_t max_elements = max_elements_i;
+        if (max_elements < cur_element_count)
+            max_elements = max_elements_;
+        max_elements_ = max_elements;
+
+        setSpace(s);
+
+        size_t file_element_size = size_data_per_element_;
+        setLayout(layout);
+        if (layout_ == IndexLayout::Separate &&
+            (offsetData_ != size_links_level0_ || label_offset_ != offsetData_ + data_size_ ||
+             file_element_size != fileElementSize()))
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        if (layout_ == IndexLayout::Interleaved && label_offset_ + sizeof(labeltype) > file_element_size)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        initChunks(max_elements);
+        resizeElements(max_elements);
+        reader.readSection(IndexSection::Level0, num_threads, [&](size_t offset, const char *data, size_t size) {
+            copyLevel0Range(offset, data, size, file_element_size);
+        });
+
+        for (size_t i = 0; i < cur_element_count; i++)
+            element_levels_[i] = levels[i];
+        std::vector<char *> link_lists = allocateLinkListsByLevel(link_list_arena_);
+        // offsets of the link lists in the section
+        std::vector<size_t> starts(cur_element_count + 1, 0);
+        for (size_t i = 0; i < cur_element_count; i++) {
+            linkLists_[i] = link_lists[i];
+            starts[i + 1] = starts[i] + levels[i] * size_links_per_element_;
+        }
+        reader.readSection(IndexSection::LinkLists, num_threads, [&](size_t offset, const char *data, size_t size) {
+            size_t end = offset + size;
+            size_t i = std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin() - 1;
+            for (; i < cur_element_count && starts[i] < end; i++) {
+                size_t begin = std::max(offset, starts[i]);
+                size_t count = std::min(end, starts[i + 1]) - begin;
+                memcpy(linkLists_[i] + (begin - starts[i]), data + (begin - offset), count);
+            }
+        });
+
+        bool labels_loaded = reader.hasSection(IndexSection::Labels);
+        if (labels_loaded) {
+            std::vector<char> labels(reader.section(IndexSection::Labels).size);
+            reader.readSection(IndexSection::Labels, num_threads, [&](size_t offset, const char *data, size_t size) {
+                memcpy(labels.data() + offset, data, size);
+            });
+            restoreLabelLookup(labels.data(), labels.size());
+        }
+        bool deleted_loaded = reader.hasSection(IndexSection::Deleted);
+        if (deleted_loaded) {
+            std::vector<char> deleted = reader.readSection(IndexSection::Deleted);
+            restoreDeleted(deleted.data(), deleted.size());
+        }
+        initLoadedIndex(labels_loaded, deleted_loaded);
+    }
+
+
+    // Takes the label lookup from the slot array of a Labels section, checking that it points to stored elements
+    void restoreLabelLookup(const char *data, size_t size) {
+        typedef typename FlatHashMap<labeltype, tableint>::value_type LabelSlot;
+        if (size % sizeof(LabelSlot) != 0 || !label_lookup_.assignSlots((const LabelSlot *) data, size / sizeof(LabelSlot)))
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        if (label_lookup_.size() > cur_element_count || (cur_element_count > 0 && label_lookup_.empty()))
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        for (auto it = label_lookup_.begin(); it != label_lookup_.end(); ++it) {
+            if (it->second >= cur_element_count)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+        }
+    }
+
+
+    // Counts the deleted elements of a Deleted section
+    void restoreDeleted(const char *data, size_t size) {
+        if (size % sizeof(tableint) != 0)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        for (size_t offset = 0; offset < size; offset += sizeof(tableint)) {
+            tableint id;
+            memcpy(&id, data + offset, sizeof(tableint));
+            if (id >= cur_element_count)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            if (allow_replace_deleted_) deleted_elements.insert(id);
+        }
+        num_deleted_ += size / sizeof(tableint);
+    }
+
+
+    /*
+    * Shared end of the loads: locks, visited lists, the label lookup and the deleted elements, which are found
+    * in the base layer unless they were loaded from the file.
+    */
+    void initLoadedIndex(bool labels_loaded = false, bool deleted_loaded = false) {
+        std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
+
+        initVisitedSetPools(max_elements_);
+
+        revSize_ = 1.0 / mult_;
+        ef_ = 10;
+        label_lookup_.reserve(max_elements_);
+        if (labels_loaded && deleted_loaded)
+            return;
+        for (size_t i = 0; i < cur_element_count; i++) {
+            if (!labels_loaded)
+                label_lookup_[getExternalLabel(i)] = i;
+            if (!deleted_loaded && isMarkedDeleted(i)) {
+                num_deleted_ += 1;
+                if (allow_replace_deleted_) deleted_elements.insert(i);
+            }
+        }
+    }
+
+
+    // Copies the bytes [offset, offset + size) of a base layer in the layout of index files
+    void copyLevel0Range(size_t offset, const char *src, size_t size, size_t file_element_size) {
+        while (size > 0) {
+            tableint id = offset / file_element_size;
+            size_t begin = offset % file_element_size;
+            size_t count;
+            if (layout_ == IndexLayout::Interleaved) {
+                // the elements up to the end of the chunk are contiguous
+                count = std::min(size, (chunkSize() - (id & chunk_mask_)) * file_element_size - begin);
+                memcpy((char *) get_linklist0(id) + begin, src, count);
+            } else {
+                count = std::min(size, file_element_size - begin);
+                std::pair<char *, size_t> fields[3] = {
+                    {(char *) get_linklist0(id), 0}, {getDataByInternalId(id), offsetData_},
+                    {(char *) getExternalLabeLp(id), label_offset_}};
+                size_t ends[3] = {offsetData_, label_offset_, file_element_size};
+                for (int f = 0; f < 3; f++) {
+                    size_t field_begin = std::max(begin, fields[f].second);
+                    size_t field_end = std::min(begin + count, ends[f]);
+                    if (field_begin < field_end)
+                        memcpy(fields[f].first + (field_begin - fields[f].second), src + (field_begin - begin),
+                               field_end - field_begin);
+                }
+            }
+            offset += count;
+            src += count;
+            size -= count;
+        }
+    }
+
+
+    // Loads a file of the versions without header, which consist of the parameters, level 0 and the link lists
+    void loadLegacyIndex(
+        const std::string &location,
+        SpaceInterface<dist_t> *s,
+        size_t max_elements_i,
+        IndexLayout layout) {
+        std::ifstream input(location, std::ios::binary);
+
+        if (!input.is_open())
+            throw std::runtime_error("Cannot open file");
+
+        clear();
+        // get file size:
+        input.seekg(0, input.end);
+        std::streampos total_filesize = input.tellg();
+        input.seekg(0, input.beg);
+
+        readIndexHeader(input);
+
+        size_t max_elements = max_elements_i;
+        if (max_elements < cur_element_count)
+            max_elements = max_elements_;
+        max_elements_ = max_elements;
+
+        setSpace(s);
 
         auto pos = input.tellg();
 
+        setLinkListSizesFromFile();
+
         /// Optional - check if index is ok:
+        // also collects the levels, so that the link lists can be laid out before they are read
+        std::vector<int> levels(cur_element_count);
         input.seekg(cur_element_count * size_data_per_element_, input.cur);
         for (size_t i = 0; i < cur_element_count; i++) {
-            if (input.tellg() < 0 || input.tellg() >= total_filesize) {
-                throw std::runtime_error("Index seems to be corrupted or unsupported");
-            }
+            if (input.tellg() < 0 || input.tellg() >= total_filesize) {
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            }
+
+            unsigned int linkListSize;
+            readBinaryPOD(input, linkListSize);
+            if (linkListSize % size_links_per_element_ != 0)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            levels[i] = linkListSize / size_links_per_element_;
+            if (linkListSize != 0) {
+                input.seekg(linkListSize, input.cur);
+            }
+        }
+
+        // throw exception if it either corrupted or old index
+        if (input.tellg() != total_filesize)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        input.clear();
+        /// Optional check end
+
+        input.seekg(pos, input.beg);
+
+        size_t file_element_size = size_data_per_element_;
+        setLayout(layout);
+        if (layout_ == IndexLayout::Separate &&
+            (offsetData_ != size_links_level0_ || label_offset_ != offsetData_ + data_size_ ||
+             file_element_size != fileElementSize()))
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        initChunks(max_elements);
+        resizeElements(max_elements);
+        readLevel0(input, file_element_size);
+
+        for (size_t i = 0; i < cur_element_count; i++)
+            element_levels_[i] = levels[i];
+        std::vector<char *> link_lists = allocateLinkListsByLevel(link_list_arena_);
+        for (size_t i = 0; i < cur_element_count; i++) {
+            unsigned int linkListSize;
+            readBinaryPOD(input, linkListSize);
+            linkLists_[i] = link_lists[i];
+            if (linkListSize != 0)
+                input.read(linkLists_[i], linkListSize);
+        }
+        input.close();
+
+        initLoadedIndex();
+    }
+
+
+    // Reads the base layer of cur_element_count elements stored in the Interleaved layout
+    void readLevel0(std::istream &input, size_t file_element_size) {
+        std::vector<char> buffer;
+        if (layout_ == IndexLayout::Separate)
+            buffer.resize(std::min(cur_element_count.load(), chunkSize()) * file_element_size);
+        for (size_t begin = 0; begin < cur_element_count; begin += chunkSize()) {
+            size_t count = std::min(chunkSize(), cur_element_count - begin);
+            if (layout_ == IndexLayout::Interleaved) {
+                input.read(level0_chunks_[begin >> chunk_shift_], count * size_data_per_element_);
+                continue;
+            }
+            input.read(buffer.data(), count * file_element_size);
+            for (size_t j = 0; j < count; j++)
+                copyElementFrom(begin + j, buffer.data() + j * file_element_size);
+        }
+    }
+
+
+    /*
+    * Loads the index by memory-mapping the file instead of reading it.
+    * The level 0 data and the upper-level link lists are used in place, so the vectors and the links are not read
+    * by the load but on demand by the searches, and several processes mapping the same file share one physical
+    * copy of them. The load reads the levels, the label lookup and the ids of the deleted elements from their
+    * sections, a few bytes per element read sequentially. Files without the Labels and Deleted sections and files
+    * of older versions find them in the base layer, which reads the header and the label of every element.
+    * By default the mapping is read-only and any modification of the index throws.
+    * With copy_on_write the index can be updated, but the changes are private to the process.
+    * The capacity of a mapped index is the number of stored elements, it cannot be resized.
+    * A mapped index always has the Interleaved layout of the file.
+    * The parameters, levels, labels and deleted elements of the file are always checked against their CRC.
+    * verify_checksums also checks the CRC of level 0 and of the link lists. That reads the whole file on all
+    * cores, from the device if it is not cached, which takes the time of loadIndex and defeats loading on demand,
+    * so it is off by default: a corruption of these sections then shows up as wrong search results.
+    */
+    void loadIndexMapped(
+        const std::string &location,
+        SpaceInterface<dist_t> *s,
+        bool copy_on_write = false,
+        bool verify_checksums = false) {
+        if (!IndexFileReader::isIndexFile(location)) {
+            loadLegacyIndexMapped(location, s, copy_on_write);
+            return;
+        }
+        IndexFileReader reader(location, false);
+
+        clear();
+        std::vector<int> levels = readIndexStructure(reader);
+        if (label_offset_ + sizeof(labeltype) > size_data_per_element_)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        std::unique_ptr<MappedFile> mapped_file(new MappedFile(location, copy_on_write));
+        char *base = mapped_file->data();
+        const IndexFileSection &level0 = reader.section(IndexSection::Level0);
+        const IndexFileSection &link_lists = reader.section(IndexSection::LinkLists);
+        if (level0.offset + level0.size > mapped_file->size() || link_lists.offset + link_lists.size > mapped_file->size())
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        if (verify_checksums) {
+            for (const IndexFileSection *section : {&level0, &link_lists}) {
+                if (Crc32cParallel(base + section->offset, section->size, 0) != section->crc)
+                    throw std::runtime_error("Index file checksum mismatch");
+            }
+        }
+        // the label lookup and the deleted elements are copied, so their sections are always checked
+        bool labels_loaded = reader.hasSection(IndexSection::Labels);
+        bool deleted_loaded = reader.hasSection(IndexSection::Deleted);
+        for (IndexSection type : {IndexSection::Labels, IndexSection::Deleted}) {
+            if (!reader.hasSection(type))
+                continue;
+            const IndexFileSection &section = reader.section(type);
+            if (Crc32cParallel(base + section.offset, section.size, 0) != section.crc)
+                throw std::runtime_error("Index file checksum mismatch");
+        }
+
+        max_elements_ = cur_element_count.load();
+        setSpace(s);
+
+        setLayout(IndexLayout::Interleaved);
+        initChunks(max_elements_);
+        element_levels_.resize(max_elements_);
+        link_list_locks_.resize(max_elements_);
+        linkLists_.resize(max_elements_);
+        size_t offset = link_lists.offset;
+        for (size_t i = 0; i < cur_element_count; i++) {
+            element_levels_[i] = levels[i];
+            linkLists_[i] = levels[i] > 0 ? base + offset : nullptr;
+            offset += levels[i] * size_links_per_element_;
+        }
+        if (labels_loaded) {
+            const IndexFileSection &labels = reader.section(IndexSection::Labels);
+            restoreLabelLookup(base + labels.offset, labels.size);
+        }
+        if (deleted_loaded) {
+            const IndexFileSection &deleted = reader.section(IndexSection::Deleted);
+            restoreDeleted(base + deleted.offset, deleted.size);
+        }
+        mapLevel0(std::move(mapped_file), level0.offset, copy_on_write);
+        initLoadedIndex(labels_loaded, deleted_loaded);
+    }
 
-            unsigned int linkListSize;
-            readBinaryPOD(input, linkListSize);
-            if (linkListSize != 0) {
-                input.seekg(linkListSize, input.cur);
-            }
+
+    // Points the chunks of the base layer into the mapping, which the index then owns
+    void mapLevel0(std::unique_ptr<MappedFile> mapped_file, size_t level0_offset, bool copy_on_write) {
+        char *base = mapped_file->data();
+        mapped_file->adviseRandom(level0_offset, cur_element_count * size_data_per_element_);
+        for (size_t begin = 0; begin < cur_element_count; begin += chunkSize()) {
+            char *links = base + level0_offset + begin * size_data_per_element_;
+            pushLevel0Chunk(Level0Chunk{links, links + offsetData_, links + label_offset_});
         }
+        mapped_file_ = std::move(mapped_file);
+        read_only_ = !copy_on_write;
+    }
 
-        // throw exception if it either corrupted or old index
-        if (input.tellg() != total_filesize)
-            throw std::runtime_error("Index seems to be corrupted or unsupported");
 
-        input.clear();
-        /// Optional check end
+    // Maps a file of the versions without header
+    void loadLegacyIndexMapped(const std::string &location, SpaceInterface<dist_t> *s, bool copy_on_write) {
+        std::ifstream input(location, std::ios::binary);
 
-        input.seekg(pos, input.beg);
+        if (!input.is_open())
+            throw std::runtime_error("Cannot open file");
 
-        data_level0_memory_ = (char *) malloc(max_elements * size_data_per_element_);
-        if (data_level0_memory_ == nullptr)
-            throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
-        input.read(data_level0_memory_, cur_element_count * size_data_per_element_);
+        clear();
+        readIndexHeader(input);
+        size_t level0_offset = input.tellg();
+        input.close();
 
-        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+        std::unique_ptr<MappedFile> mapped_file(new MappedFile(location, copy_on_write));
+        size_t total_filesize = mapped_file->size();
+        char *base = mapped_file->data();
 
-        size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
-        std::vector<std::mutex>(max_elements).swap(link_list_locks_);
-        std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
+        max_elements_ = cur_element_count.load();
+        setSpace(s);
 
-        visited_list_pool_.reset(new VisitedListPool(1, max_elements));
+        setLinkListSizesFromFile();
 
-        linkLists_ = (char **) malloc(sizeof(void *) * max_elements);
-        if (linkLists_ == nullptr)
-            throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
-        element_levels_ = std::vector<int>(max_elements);
-        revSize_ = 1.0 / mult_;
-        ef_ = 10;
+        size_t level0_size = cur_element_count * size_data_per_element_;
+        if (level0_offset + level0_size > total_filesize)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        setLayout(IndexLayout::Interleaved);
+        initChunks(max_elements_);
+        element_levels_.resize(max_elements_);
+        link_list_locks_.resize(max_elements_);
+        // offset table of the upper-level link lists, they follow level 0 in the file
+        linkLists_.resize(max_elements_);
+        size_t offset = level0_offset + level0_size;
         for (size_t i = 0; i < cur_element_count; i++) {
-            label_lookup_[getExternalLabel(i)] = i;
             unsigned int linkListSize;
-            readBinaryPOD(input, linkListSize);
+            if (offset + sizeof(linkListSize) > total_filesize)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            memcpy(&linkListSize, base + offset, sizeof(linkListSize));
+            offset += sizeof(linkListSize);
             if (linkListSize == 0) {
                 element_levels_[i] = 0;
                 linkLists_[i] = nullptr;
             } else {
+                if (offset + linkListSize > total_filesize)
+                    throw std::runtime_error("Index seems to be corrupted or unsupported");
                 element_levels_[i] = linkListSize / size_links_per_element_;
-                linkLists_[i] = (char *) malloc(linkListSize);
-                if (linkLists_[i] == nullptr)
-                    throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
-                input.read(linkLists_[i], linkListSize);
-            }
-        }
-
-        for (size_t i = 0; i < cur_element_count; i++) {
-            if (isMarkedDeleted(i)) {
-                num_deleted_ += 1;
-                if (allow_replace_deleted_) deleted_elements.insert(i);
+                linkLists_[i] = base + offset;
+                offset += linkListSize;
             }
         }
+        if (offset != total_filesize)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
 
-        input.close();
-
-        return;
+        mapLevel0(std::move(mapped_file), level0_offset, copy_on_write);
+        initLoadedIndex();
     }
 
 
@@ -863,6 +2413,86 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         lock_table.unlock();
 
         markDeletedInternal(internalId);
+        if (operation_log_)
+            operation_log_->append(LoggedOperation::MarkDelete, label);
+    }
+
+
+    /*
+    * Marks an element with the given label deleted and replaces the links to it by links to its neighbors.
+    * The links of the element are mostly bidirectional, so the elements it links to are repaired right away,
+    * which keeps searches from traversing it. The remaining links and the slot are released by compactDeleted.
+    */
+    void removePoint(labeltype label) {
+        // lock all operations with element by label
+        std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
+
+        std::unique_lock <std::mutex> lock_table(label_lookup_lock);
+        auto search = label_lookup_.find(label);
+        if (search == label_lookup_.end()) {
+            throw std::runtime_error("Label not found");
+        }
+        tableint internalId = search->second;
+        lock_table.unlock();
+
+        markDeletedInternal(internalId);
+        repairNeighborsOfDeleted(internalId);
+        if (operation_log_)
+            operation_log_->append(LoggedOperation::Remove, label);
+    }
+
+
+    // Repairs the links of the elements a deleted element links to, which mostly link back to it
+    void repairNeighborsOfDeleted(tableint internalId) {
+        for (int level = 0; level <= element_levels_[internalId]; level++) {
+            for (tableint neighbor : getConnectionsWithLock(internalId, level)) {
+                if (!isMarkedDeleted(neighbor))
+                    repairLinksToDeleted(neighbor, level);
+            }
+        }
+    }
+
+
+    /*
+    * Replaces the deleted elements among the links of an element at the level by their own links, the new links
+    * are selected with the heuristic from the remaining and the replacing ones as in updatePoint.
+    * Only reads the links of the element itself and of deleted elements.
+    */
+    void repairLinksToDeleted(tableint internalId, int level) {
+        std::vector<dist_t> link_distances;
+        std::vector<tableint> links = getConnectionsWithLock(internalId, level, store_link_distances_ ? &link_distances : nullptr);
+        bool has_deleted = false;
+        for (tableint link : links)
+            has_deleted = has_deleted || isMarkedDeleted(link);
+        if (!has_deleted)
+            return;
+
+        const void *data_point = getDataByInternalId(internalId);
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
+        auto addCandidate = [&](tableint cand, dist_t distance) {
+            if (candidates.size() < ef_construction_) {
+                candidates.emplace(distance, cand);
+            } else if (distance < candidates.top().first) {
+                candidates.pop();
+                candidates.emplace(distance, cand);
+            }
+        };
+        std::unordered_set<tableint> sCand(links.begin(), links.end());
+        for (size_t i = 0; i < links.size(); i++) {
+            if (!isMarkedDeleted(links[i])) {
+                addCandidate(links[i], store_link_distances_ ? link_distances[i] :
+                             fstdistfunc_(data_point, getDataByInternalId(links[i]), dist_func_param_));
+                continue;
+            }
+            for (tableint two_hop : getConnectionsWithLock(links[i], level)) {
+                if (two_hop != internalId && !isMarkedDeleted(two_hop) && sCand.insert(two_hop).second)
+                    addCandidate(two_hop, fstdistfunc_(data_point, getDataByInternalId(two_hop), dist_func_param_));
+            }
+        }
+        getNeighborsByHeuristic2(candidates, level == 0 ? maxM0_ : maxM_);
+
+        std::unique_lock <std::mutex> lock(link_list_locks_[internalId]);
+        setLinks(get_linklist_at_level(internalId, level), level, candidates);
     }
 
 
@@ -872,6 +2502,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     */
     void markDeletedInternal(tableint internalId) {
         assert(internalId < cur_element_count);
+        checkWritable();
         if (!isMarkedDeleted(internalId)) {
             unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId))+2;
             *ll_cur |= DELETE_MARK;
@@ -905,6 +2536,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         lock_table.unlock();
 
         unmarkDeletedInternal(internalId);
+        if (operation_log_)
+            operation_log_->append(LoggedOperation::UnmarkDelete, label);
     }
 
 
@@ -914,6 +2547,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     */
     void unmarkDeletedInternal(tableint internalId) {
         assert(internalId < cur_element_count);
+        checkWritable();
         if (isMarkedDeleted(internalId)) {
             unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId)) + 2;
             *ll_cur &= ~DELETE_MARK;
@@ -952,14 +2586,18 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     * If replacement of deleted elements is enabled: replaces previously deleted point if any, updating it with new point
     */
     void addPoint(const void *data_point, labeltype label, bool replace_deleted = false) {
+        checkWritable();
         if ((allow_replace_deleted_ == false) && (replace_deleted == true)) {
             throw std::runtime_error("Replacement of deleted elements is disabled in constructor");
         }
 
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
+        // operations are logged once applied and under the label lock, so those of a label are logged in order
         if (!replace_deleted) {
             addPoint(data_point, label, -1);
+            if (operation_log_)
+                operation_log_->append(LoggedOperation::Add, label, data_point);
             return;
         }
         // check if there is vacant place
@@ -989,6 +2627,51 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             unmarkDeletedInternal(internal_id_replaced);
             updatePoint(data_point, internal_id_replaced, 1.0);
         }
+        if (operation_log_)
+            operation_log_->append(LoggedOperation::Add, label, data_point, true);
+    }
+
+
+    // Number of points addPoints inserts one by one before it starts the threads
+    static const size_t ADD_POINTS_SEED_SIZE = 1000;
+
+    /*
+    * Adds n points stored one after another (data_size_ bytes each) on num_threads threads, 0 means one per core.
+    * While the index has fewer than ADD_POINTS_SEED_SIZE elements the points are inserted serially, so that
+    * the threads start from a connected graph instead of racing on a handful of elements.
+    * progress, if set, is called with the number of inserted points and n about every percent and at the end,
+    * from the worker threads but never concurrently.
+    * The first exception of an insertion stops the build and is rethrown, the points inserted until then stay.
+    */
+    void addPoints(
+        const void *data,
+        const labeltype *labels,
+        size_t n,
+        int num_threads = 0,
+        std::function<void(size_t, size_t)> progress = nullptr,
+        bool replace_deleted = false) {
+        checkWritable();
+        const char *points = (const char *) data;
+        std::atomic<size_t> num_added(0);
+        size_t progress_step = std::max<size_t>(n / 100, 1);
+        std::mutex progress_lock;
+        size_t reported = 0;
+        auto add = [&](size_t i, size_t) {
+            addPoint(points + i * data_size_, labels[i], replace_deleted);
+            size_t added = ++num_added;
+            if (progress && (added % progress_step == 0 || added == n)) {
+                std::unique_lock <std::mutex> lock(progress_lock);
+                if (added > reported) {
+                    reported = added;
+                    progress(added, n);
+                }
+            }
+        };
+
+        size_t seed_size = 0;
+        while (seed_size < n && cur_element_count < ADD_POINTS_SEED_SIZE)
+            add(seed_size++, 0);
+        ParallelFor(seed_size, n, num_threads > 0 ? num_threads : 0, add);
     }
 
 
@@ -996,8 +2679,9 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         // update the feature vector associated with existing point with new vector
         memcpy(getDataByInternalId(internalId), dataPoint, data_size_);
 
-        int maxLevelCopy = maxlevel_;
-        tableint entryPointCopy = enterpoint_node_;
+        EntryPoint entry_point = getEntryPoint();
+        int maxLevelCopy = entry_point.level;
+        tableint entryPointCopy = entry_point.node;
         // If point to be updated is entry point and graph just contains single element then just return.
         if (entryPointCopy == internalId && cur_element_count == 1)
             return;
@@ -1016,8 +2700,12 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             for (auto&& elOneHop : listOneHop) {
                 sCand.insert(elOneHop);
 
-                if (distribution(update_probability_generator_) > updateNeighborProbability)
+                if (distribution(update_probability_generator_) > updateNeighborProbability) {
+                    // the links of the neighbor are kept, its distance to the updated element has changed
+                    if (store_link_distances_)
+                        refreshLinkDistance(elOneHop, internalId, layer);
                     continue;
+                }
 
                 sNeigh.insert(elOneHop);
 
@@ -1031,6 +2719,17 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 // if (neigh == internalId)
                 //     continue;
 
+                // the stored distances of the links of neigh are reused, except the one to the updated element
+                std::unordered_map<tableint, dist_t> knownDistances;
+                if (store_link_distances_) {
+                    std::vector<dist_t> distances;
+                    std::vector<tableint> links = getConnectionsWithLock(neigh, layer, &distances);
+                    for (size_t j = 0; j < links.size(); j++) {
+                        if (links[j] != internalId)
+                            knownDistances[links[j]] = distances[j];
+                    }
+                }
+
                 std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
                 size_t size = sCand.find(neigh) == sCand.end() ? sCand.size() : sCand.size() - 1;  // sCand guaranteed to have size >= 1
                 size_t elementsToKeep = std::min(ef_construction_, size);
@@ -1038,7 +2737,9 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     if (cand == neigh)
                         continue;
 
-                    dist_t distance = fstdistfunc_(getDataByInternalId(neigh), getDataByInternalId(cand), dist_func_param_);
+                    auto known = knownDistances.find(cand);
+                    dist_t distance = known != knownDistances.end() ? known->second :
+                        fstdistfunc_(getDataByInternalId(neigh), getDataByInternalId(cand), dist_func_param_);
                     if (candidates.size() < elementsToKeep) {
                         candidates.emplace(distance, cand);
                     } else {
@@ -1054,15 +2755,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
                 {
                     std::unique_lock <std::mutex> lock(link_list_locks_[neigh]);
-                    linklistsizeint *ll_cur;
-                    ll_cur = get_linklist_at_level(neigh, layer);
-                    size_t candSize = candidates.size();
-                    setListCount(ll_cur, candSize);
-                    tableint *data = (tableint *) (ll_cur + 1);
-                    for (size_t idx = 0; idx < candSize; idx++) {
-                        data[idx] = candidates.top().second;
-                        candidates.pop();
-                    }
+                    setLinks(get_linklist_at_level(neigh, layer), layer, candidates);
                 }
             }
         }
@@ -1090,11 +2783,14 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     int size = getListCount(data);
                     tableint *datal = (tableint *) (data + 1);
 #ifdef USE_SSE
-                    _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
+                    // only ids within the list are prefetched, the chunk of any other value may not exist
+                    if (size > 0)
+                        _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
 #endif
                     for (int i = 0; i < size; i++) {
 #ifdef USE_SSE
-                        _mm_prefetch(getDataByInternalId(*(datal + i + 1)), _MM_HINT_T0);
+                        if (i + 1 < size)
+                            _mm_prefetch(getDataByInternalId(*(datal + i + 1)), _MM_HINT_T0);
 #endif
                         tableint cand = datal[i];
                         dist_t d = fstdistfunc_(dataPoint, getDataByInternalId(cand), dist_func_param_);
@@ -1139,19 +2835,28 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
-    std::vector<tableint> getConnectionsWithLock(tableint internalId, int level) {
+    // Links of the element at the level, and their stored distances if distances is not null
+    std::vector<tableint> getConnectionsWithLock(tableint internalId, int level, std::vector<dist_t> *distances = nullptr) {
         std::unique_lock <std::mutex> lock(link_list_locks_[internalId]);
         unsigned int *data = get_linklist_at_level(internalId, level);
         int size = getListCount(data);
         std::vector<tableint> result(size);
         tableint *ll = (tableint *) (data + 1);
         memcpy(result.data(), ll, size * sizeof(tableint));
+        if (distances) {
+            uint16_t *stored = getLinkDistances(data, level);
+            distances->resize(size);
+            for (int j = 0; j < size; j++)
+                (*distances)[j] = decodeLinkDistance(stored[j]);
+        }
         return result;
     }
 
 
     tableint addPoint(const void *data_point, labeltype label, int level) {
+        checkWritable();
         tableint cur_c = 0;
+        std::unique_lock <std::mutex> lock_el;
         {
             // Checking if the element with the same label already exists
             // if so, updating it *instead* of creating a new element.
@@ -1179,40 +2884,47 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             }
 
             cur_c = cur_element_count;
+            // taken before the element is counted by other threads, so that saveSnapshot waits for its insertion
+            lock_el = std::unique_lock <std::mutex>(link_list_locks_[cur_c]);
             cur_element_count++;
             label_lookup_[label] = cur_c;
         }
 
-        std::unique_lock <std::mutex> lock_el(link_list_locks_[cur_c]);
         int curlevel = getRandomLevel(mult_);
         if (level > 0)
             curlevel = level;
 
         element_levels_[cur_c] = curlevel;
 
-        std::unique_lock <std::mutex> templock(global);
-        int maxlevelcopy = maxlevel_;
-        if (curlevel <= maxlevelcopy)
-            templock.unlock();
-        tableint currObj = enterpoint_node_;
-        tableint enterpoint_copy = enterpoint_node_;
+        // only the rare insertion which raises the top level takes the global lock, it holds it until
+        // the new entry point is published, so that concurrent raising insertions do not overwrite each other
+        EntryPoint entry_point = getEntryPoint();
+        std::unique_lock <std::mutex> templock(global, std::defer_lock);
+        if (curlevel > entry_point.level) {
+            templock.lock();
+            entry_point = getEntryPoint();
+            if (curlevel <= entry_point.level)
+                templock.unlock();
+        }
+        int maxlevelcopy = entry_point.level;
+        tableint currObj = entry_point.node;
+        tableint enterpoint_copy = entry_point.node;
 
-        memset(data_level0_memory_ + cur_c * size_data_per_element_ + offsetLevel0_, 0, size_data_per_element_);
+        memset(get_linklist0(cur_c), 0, size_data_per_element_);
 
         // Initialisation of the data and label
         memcpy(getExternalLabeLp(cur_c), &label, sizeof(labeltype));
         memcpy(getDataByInternalId(cur_c), data_point, data_size_);
 
         if (curlevel) {
-            linkLists_[cur_c] = (char *) malloc(size_links_per_element_ * curlevel + 1);
-            if (linkLists_[cur_c] == nullptr)
-                throw std::runtime_error("Not enough memory: addPoint failed to allocate linklist");
-            memset(linkLists_[cur_c], 0, size_links_per_element_ * curlevel + 1);
+            linkLists_[cur_c] = link_list_arena_.allocate(size_links_per_element_ * curlevel);
+            memset(linkLists_[cur_c], 0, size_links_per_element_ * curlevel);
         }
 
         if ((signed)currObj != -1) {
             if (curlevel < maxlevelcopy) {
                 dist_t curdist = fstdistfunc_(data_point, getDataByInternalId(currObj), dist_func_param_);
+                size_t max_elements = max_elements_.load(std::memory_order_acquire);
                 for (int level = maxlevelcopy; level > curlevel; level--) {
                     bool changed = true;
                     while (changed) {
@@ -1225,7 +2937,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                         tableint *datal = (tableint *) (data + 1);
                         for (int i = 0; i < size; i++) {
                             tableint cand = datal[i];
-                            if (cand < 0 || cand > max_elements_)
+                            if (cand < 0 || cand > max_elements)
                                 throw std::runtime_error("cand error");
                             dist_t d = fstdistfunc_(data_point, getDataByInternalId(cand), dist_func_param_);
                             if (d < curdist) {
@@ -1252,30 +2964,29 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 }
                 currObj = mutuallyConnectNewElement(data_point, cur_c, top_candidates, level, false);
             }
-        } else {
-            // Do nothing for the first element
-            enterpoint_node_ = 0;
-            maxlevel_ = curlevel;
         }
 
-        // Releasing lock for the maximum level
-        if (curlevel > maxlevelcopy) {
-            enterpoint_node_ = cur_c;
-            maxlevel_ = curlevel;
-        }
+        // the first element, or the new top level
+        if (curlevel > maxlevelcopy)
+            setEntryPoint(cur_c, curlevel);
         return cur_c;
     }
 
 
-    std::priority_queue<std::pair<dist_t, labeltype >>
-    searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
-        std::priority_queue<std::pair<dist_t, labeltype >> result;
-        if (cur_element_count == 0) return result;
-
-        tableint currObj = enterpoint_node_;
-        dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
+    /*
+    * Greedy search through the upper levels, returns the closest element found on level 1.
+    * Per-hop statistics are added to stats if it is not null.
+    */
+    tableint searchUpperLevels(const void *query_data, SearchStats* stats = nullptr) const {
+        EntryPoint entry_point = getEntryPoint();
+        tableint currObj = entry_point.node;
+        dist_t curdist = query_distfunc_(query_data, getDataByInternalId(currObj), dist_func_param_);
+        size_t max_elements = max_elements_.load(std::memory_order_acquire);
+        if (stats) {
+            stats->distance_computations++;
+        }
 
-        for (int level = maxlevel_; level > 0; level--) {
+        for (int level = entry_point.level; level > 0; level--) {
             bool changed = true;
             while (changed) {
                 changed = false;
@@ -1283,15 +2994,17 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
                 data = (unsigned int *) get_linklist(currObj, level);
                 int size = getListCount(data);
-                metric_hops++;
-                metric_distance_computations+=size;
+                if (stats) {
+                    stats->addHop(level);
+                    stats->distance_computations += size;
+                }
 
                 tableint *datal = (tableint *) (data + 1);
                 for (int i = 0; i < size; i++) {
                     tableint cand = datal[i];
-                    if (cand < 0 || cand > max_elements_)
+                    if (cand < 0 || cand > max_elements)
                         throw std::runtime_error("cand error");
-                    dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
+                    dist_t d = query_distfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
 
                     if (d < curdist) {
                         curdist = d;
@@ -1301,10 +3014,40 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 }
             }
         }
+        return currObj;
+    }
+
+
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        return searchKnn(query_data, k, isIdAllowed, nullptr);
+    }
+
+
+    /*
+    * Same as searchKnn, additionally adds the statistics of the search to stats if it is not null.
+    * The statistics are collected by the calling thread only, without touching shared counters.
+    */
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed, SearchStats* stats) const {
+        std::priority_queue<std::pair<dist_t, labeltype >> result;
+        if (cur_element_count == 0) return result;
+
+        std::vector<char> query_buffer;
+        query_data = prepareQuery(query_data, query_buffer);
+        tableint currObj = searchUpperLevels(query_data, stats);
 
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
         bool bare_bone_search = !num_deleted_ && !isIdAllowed;
-        if (bare_bone_search) {
+        if (stats) {
+            if (bare_bone_search) {
+                top_candidates = searchBaseLayerST<true, true>(
+                        currObj, query_data, std::max(ef_, k), isIdAllowed, nullptr, stats);
+            } else {
+                top_candidates = searchBaseLayerST<false, true>(
+                        currObj, query_data, std::max(ef_, k), isIdAllowed, nullptr, stats);
+            }
+        } else if (bare_bone_search) {
             top_candidates = searchBaseLayerST<true>(
                     currObj, query_data, std::max(ef_, k), isIdAllowed);
         } else {
@@ -1324,46 +3067,361 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
-    std::vector<std::pair<dist_t, labeltype >>
-    searchStopConditionClosest(
+    /*
+    * Searches num_candidates candidates with the distances of the index space (e.g. approximate PQ distances)
+    * and returns the k closest of them by the exact distance of exact_space between query_data and the
+    * vectors read from store. query_data must be accepted by both spaces, e.g. a raw fp32 vector.
+    */
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnnReranked(
         const void *query_data,
-        BaseSearchStopCondition<dist_t>& stop_condition,
+        size_t k,
+        size_t num_candidates,
+        const VectorStore &store,
+        SpaceInterface<dist_t> *exact_space,
         BaseFilterFunctor* isIdAllowed = nullptr) const {
-        std::vector<std::pair<dist_t, labeltype >> result;
-        if (cur_element_count == 0) return result;
+        if (store.get_data_size() != exact_space->get_data_size())
+            throw std::runtime_error("Vector store does not match the exact space");
 
-        tableint currObj = enterpoint_node_;
-        dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
+        std::priority_queue<std::pair<dist_t, labeltype >> candidates =
+                searchKnn(query_data, std::max(k, num_candidates), isIdAllowed);
 
-        for (int level = maxlevel_; level > 0; level--) {
-            bool changed = true;
-            while (changed) {
-                changed = false;
-                unsigned int *data;
+        DISTFUNC<dist_t> exact_distfunc = exact_space->get_dist_func();
+        void *exact_param = exact_space->get_dist_func_param();
+        std::vector<char> vector(store.get_data_size());
+        std::priority_queue<std::pair<dist_t, labeltype >> result;
+        while (!candidates.empty()) {
+            labeltype label = candidates.top().second;
+            candidates.pop();
+            store.read(label, vector.data());
+            dist_t dist = exact_distfunc(query_data, vector.data(), exact_param);
+            if (result.size() < k || dist < result.top().first) {
+                result.emplace(dist, label);
+                if (result.size() > k)
+                    result.pop();
+            }
+        }
+        return result;
+    }
 
-                data = (unsigned int *) get_linklist(currObj, level);
-                int size = getListCount(data);
-                metric_hops++;
-                metric_distance_computations+=size;
 
-                tableint *datal = (tableint *) (data + 1);
-                for (int i = 0; i < size; i++) {
-                    tableint cand = datal[i];
-                    if (cand < 0 || cand > max_elements_)
-                        throw std::runtime_error("cand error");
-                    dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
+    template <typename VisitedSet>
+    void searchBaseLayerContext(
+        tableint ep_id,
+        const void *query_data,
+        size_t ef,
+        VisitedSet *visited,
+        SearchContext &context,
+        BaseFilterFunctor* isIdAllowed,
+        SearchStats* stats) const {
+        bool bare_bone_search = !num_deleted_ && !isIdAllowed;
+        if (stats) {
+            if (bare_bone_search) {
+                searchBaseLayerST<true, true>(ep_id, query_data, ef, visited, context.top_candidates,
+                                              context.candidate_set, isIdAllowed, nullptr, stats);
+            } else {
+                searchBaseLayerST<false, true>(ep_id, query_data, ef, visited, context.top_candidates,
+                                               context.candidate_set, isIdAllowed, nullptr, stats);
+            }
+        } else if (bare_bone_search) {
+            searchBaseLayerST<true>(ep_id, query_data, ef, visited, context.top_candidates, context.candidate_set, isIdAllowed);
+        } else {
+            searchBaseLayerST<false>(ep_id, query_data, ef, visited, context.top_candidates, context.candidate_set, isIdAllowed);
+        }
+    }
 
-                    if (d < curdist) {
-                        curdist = d;
-                        currObj = cand;
-                        changed = true;
-                    }
+
+    /*
+    * Allocation-free variant of searchKnn: uses the heaps and the visited list of the reusable context
+    * and writes up to k results, closest first, into the caller-provided array.
+    * Returns the number of results written.
+    */
+    size_t searchKnn(
+        const void *query_data,
+        size_t k,
+        SearchContext &context,
+        std::pair<dist_t, labeltype> *result,
+        BaseFilterFunctor* isIdAllowed = nullptr,
+        SearchStats* stats = nullptr) const {
+        if (cur_element_count == 0 || k == 0) return 0;
+
+        context.top_candidates.clear();
+        context.candidate_set.clear();
+
+        query_data = prepareQuery(query_data, context.query_buffer);
+        tableint currObj = searchUpperLevels(query_data, stats);
+
+        size_t ef = std::max(ef_, k);
+        size_t max_elements = max_elements_.load(std::memory_order_acquire);
+        if (useVisitedHashSet(ef)) {
+            if (!context.visited_set)
+                context.visited_set.reset(new VisitedHashSet());
+            context.visited_set->reset();
+            searchBaseLayerContext(currObj, query_data, ef, context.visited_set.get(), context, isIdAllowed, stats);
+        } else {
+            if (!context.visited_list || context.visited_list->numelements < max_elements)
+                context.visited_list.reset(new VisitedList(max_elements));
+            context.visited_list->reset();
+            searchBaseLayerContext(currObj, query_data, ef, context.visited_list.get(), context, isIdAllowed, stats);
+        }
+
+        SearchHeap &top_candidates = context.top_candidates;
+        while (top_candidates.size() > k) {
+            top_candidates.pop();
+        }
+        size_t num_results = top_candidates.size();
+        for (size_t i = num_results; i > 0; i--) {
+            result[i - 1] = std::pair<dist_t, labeltype>(top_candidates.top().first, getExternalLabel(top_candidates.top().second));
+            top_candidates.pop();
+        }
+        return num_results;
+    }
+
+
+    // State of a single query in searchKnnBatch, VisitedSet is VisitedList or VisitedHashSet
+    template <typename VisitedSet>
+    struct BatchSearchState {
+        const void *query_data;
+        std::vector<char> query_buffer;  // prepared query of spaces with get_query_size() != 0
+        VisitedSet *visited;
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidate_set;
+        dist_t lowerBound;
+        std::vector<tableint> pending;  // unvisited neighbors whose vectors are being prefetched
+        bool done;
+    };
+
+
+    /*
+    * Pops the closest candidate of the query and collects its unvisited neighbors into pending,
+    * issuing prefetches for their vectors. Returns false when the search of the query is finished.
+    */
+    template <bool bare_bone_search, typename VisitedSet>
+    bool expandBatchCandidate(BatchSearchState<VisitedSet> &state, size_t ef) const {
+        if (state.candidate_set.empty())
+            return false;
+
+        std::pair<dist_t, tableint> current_node_pair = state.candidate_set.top();
+        dist_t candidate_dist = -current_node_pair.first;
+        bool flag_stop_search;
+        if (bare_bone_search) {
+            flag_stop_search = candidate_dist > state.lowerBound;
+        } else {
+            flag_stop_search = candidate_dist > state.lowerBound && state.top_candidates.size() == ef;
+        }
+        if (flag_stop_search)
+            return false;
+        state.candidate_set.pop();
+
+        int *data = (int *) get_linklist0(current_node_pair.second);
+        size_t size = getListCount((linklistsizeint*)data);
+        for (size_t j = 1; j <= size; j++) {
+            tableint candidate_id = *(data + j);
+            if (!state.visited->visit(candidate_id))
+                continue;
+            state.pending.push_back(candidate_id);
+#ifdef USE_SSE
+            char *candidate_data = getDataByInternalId(candidate_id);
+            for (size_t offset = 0; offset < data_size_; offset += 64)
+                _mm_prefetch(candidate_data + offset, _MM_HINT_T0);
+#endif
+        }
+        return true;
+    }
+
+
+    // Computes distances to the pending neighbors of the query, same as the inner loop of searchBaseLayerST
+    template <bool bare_bone_search, typename VisitedSet>
+    void evaluateBatchCandidates(BatchSearchState<VisitedSet> &state, size_t ef, BaseFilterFunctor* isIdAllowed) const {
+        for (tableint candidate_id : state.pending) {
+            dist_t dist = query_distfunc_(state.query_data, getDataByInternalId(candidate_id), dist_func_param_);
+            if (state.top_candidates.size() < ef || state.lowerBound > dist) {
+                state.candidate_set.emplace(-dist, candidate_id);
+
+                if (bare_bone_search ||
+                    (!isMarkedDeleted(candidate_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(candidate_id))))) {
+                    state.top_candidates.emplace(dist, candidate_id);
+                }
+
+                while (state.top_candidates.size() > ef)
+                    state.top_candidates.pop();
+
+                if (!state.top_candidates.empty())
+                    state.lowerBound = state.top_candidates.top().first;
+            }
+        }
+        state.pending.clear();
+#ifdef USE_SSE
+        // the link list of the next candidate is read in the next round
+        if (!state.candidate_set.empty())
+            _mm_prefetch((char *) get_linklist0(state.candidate_set.top().second), _MM_HINT_T0);
+#endif
+    }
+
+
+    /*
+    * Runs the base layer searches of all states in lockstep.
+    * Every round first expands one candidate of each query, prefetching the vectors of its neighbors,
+    * and then computes the distances of all queries. The vectors of a query are thus loaded while the other
+    * queries of the batch are processed, which hides the memory latency of the hops.
+    */
+    template <bool bare_bone_search, typename VisitedSet>
+    void searchBaseLayerBatch(
+        std::vector<BatchSearchState<VisitedSet>> &states,
+        size_t ef,
+        BaseFilterFunctor* isIdAllowed) const {
+        for (BatchSearchState<VisitedSet> &state : states) {
+            tableint ep_id = state.candidate_set.top().second;
+            state.candidate_set.pop();
+            state.visited->visit(ep_id);
+            if (bare_bone_search ||
+                (!isMarkedDeleted(ep_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(ep_id))))) {
+                dist_t dist = query_distfunc_(state.query_data, getDataByInternalId(ep_id), dist_func_param_);
+                state.lowerBound = dist;
+                state.top_candidates.emplace(dist, ep_id);
+                state.candidate_set.emplace(-dist, ep_id);
+            } else {
+                state.lowerBound = std::numeric_limits<dist_t>::max();
+                state.candidate_set.emplace(-state.lowerBound, ep_id);
+            }
+            state.pending.reserve(maxM0_);
+            state.done = false;
+        }
+
+        size_t active = states.size();
+        while (active > 0) {
+            for (BatchSearchState<VisitedSet> &state : states) {
+                if (state.done)
+                    continue;
+                if (!expandBatchCandidate<bare_bone_search>(state, ef)) {
+                    state.done = true;
+                    active--;
+                }
+            }
+            for (BatchSearchState<VisitedSet> &state : states) {
+                if (!state.pending.empty())
+                    evaluateBatchCandidates<bare_bone_search>(state, ef, isIdAllowed);
+            }
+        }
+    }
+
+
+    /*
+    * Searches nq queries stored one after another, query_stride bytes apart (0 means data_size_, spaces which
+    * prepare queries need the size of a raw query, e.g. dim * sizeof(float) for PQ), and returns their results
+    * in the same order, each result is the same as searchKnn would return.
+    * Up to batch_size queries are traversed in lockstep so that the memory accesses of one query
+    * overlap with the distance computations of the others.
+    * Every query takes a visited set of the type useVisitedHashSet selects, as searchKnn does. Batches of
+    * dense lists are shrunk so that they take at most MAX_BATCH_VISITED_LIST_BYTES, and to a single query
+    * when the number of visited sets is limited (see setMaxVisitedLists).
+    */
+    std::vector<std::priority_queue<std::pair<dist_t, labeltype >>>
+    searchKnnBatch(
+        const void *queries,
+        size_t nq,
+        size_t k,
+        BaseFilterFunctor* isIdAllowed = nullptr,
+        size_t batch_size = 8,
+        size_t query_stride = 0) const {
+        if (query_stride == 0) {
+            if (query_size_ != 0)
+                throw std::runtime_error("Batch search of a space which prepares queries needs the query stride");
+            query_stride = data_size_;
+        }
+        std::vector<std::priority_queue<std::pair<dist_t, labeltype >>> results(nq);
+        if (cur_element_count == 0 || nq == 0) return results;
+        if (batch_size == 0)
+            batch_size = 1;
+
+        size_t ef = std::max(ef_, k);
+        if (useVisitedHashSet(ef)) {
+            searchKnnBatch(queries, nq, k, ef, isIdAllowed, batch_size, query_stride, *visited_set_pool_, results);
+        } else {
+            size_t list_bytes = max_elements_.load(std::memory_order_acquire) * sizeof(vl_type);
+            batch_size = std::min(batch_size, std::max<size_t>(MAX_BATCH_VISITED_LIST_BYTES / list_bytes, 1));
+            if (max_visited_lists_)
+                batch_size = 1;
+            searchKnnBatch(queries, nq, k, ef, isIdAllowed, batch_size, query_stride, *visited_list_pool_, results);
+        }
+        return results;
+    }
+
+
+    // Same as above, with the visited sets of the given pool
+    template <typename VisitedSet>
+    void searchKnnBatch(
+        const void *queries,
+        size_t nq,
+        size_t k,
+        size_t ef,
+        BaseFilterFunctor* isIdAllowed,
+        size_t batch_size,
+        size_t query_stride,
+        BasicVisitedListPool<VisitedSet> &pool,
+        std::vector<std::priority_queue<std::pair<dist_t, labeltype >>> &results) const {
+        bool bare_bone_search = !num_deleted_ && !isIdAllowed;
+        std::vector<BatchSearchState<VisitedSet>> states;
+        states.reserve(std::min(batch_size, nq));
+        for (size_t batch_start = 0, batch_end = 0; batch_start < nq; batch_start = batch_end) {
+            batch_end = std::min(nq, batch_start + batch_size);
+            states.clear();
+            states.resize(batch_end - batch_start);
+            for (size_t i = batch_start; i < batch_end; i++) {
+                BatchSearchState<VisitedSet> &state = states[i - batch_start];
+                // only the first set may wait, otherwise threads holding parts of their batches could
+                // block each other when the number of visited sets is limited; the batch is shrunk instead
+                state.visited = i == batch_start ? pool.getFreeVisitedList() : pool.tryGetFreeVisitedList();
+                if (state.visited == nullptr) {
+                    batch_end = i;
+                    states.resize(batch_end - batch_start);
+                    break;
+                }
+                state.query_data = prepareQuery((const char *) queries + i * query_stride, state.query_buffer);
+                state.candidate_set.emplace(0, searchUpperLevels(state.query_data));
+            }
+
+            if (bare_bone_search) {
+                searchBaseLayerBatch<true>(states, ef, isIdAllowed);
+            } else {
+                searchBaseLayerBatch<false>(states, ef, isIdAllowed);
+            }
+
+            for (size_t i = batch_start; i < batch_end; i++) {
+                BatchSearchState<VisitedSet> &state = states[i - batch_start];
+                pool.releaseVisitedList(state.visited);
+                while (state.top_candidates.size() > k) {
+                    state.top_candidates.pop();
+                }
+                while (state.top_candidates.size() > 0) {
+                    std::pair<dist_t, tableint> rez = state.top_candidates.top();
+                    results[i].push(std::pair<dist_t, labeltype>(rez.first, getExternalLabel(rez.second)));
+                    state.top_candidates.pop();
                 }
             }
         }
+    }
+
+
+    std::vector<std::pair<dist_t, labeltype >>
+    searchStopConditionClosest(
+        const void *query_data,
+        BaseSearchStopCondition<dist_t>& stop_condition,
+        BaseFilterFunctor* isIdAllowed = nullptr,
+        SearchStats* stats = nullptr) const {
+        std::vector<std::pair<dist_t, labeltype >> result;
+        if (cur_element_count == 0) return result;
+
+        std::vector<char> query_buffer;
+        query_data = prepareQuery(query_data, query_buffer);
+        tableint currObj = searchUpperLevels(query_data, stats);
 
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
-        top_candidates = searchBaseLayerST<false>(currObj, query_data, 0, isIdAllowed, &stop_condition);
+        if (stats) {
+            top_candidates = searchBaseLayerST<false, true>(currObj, query_data, 0, isIdAllowed, &stop_condition, stats);
+        } else {
+            top_candidates = searchBaseLayerST<false>(currObj, query_data, 0, isIdAllowed, &stop_condition);
+        }
 
         size_t sz = top_candidates.size();
         result.resize(sz);
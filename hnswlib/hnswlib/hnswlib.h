@@ -8,18 +8,66 @@
   #define HNSWERR HNSWLIB_ERR_OVERRIDE
 #endif
 
+// With GCC and Clang on x86 every kernel is compiled with a target attribute and selected when a space
+// is constructed using the *Capable() probes, so a binary built for the baseline ISA still gets the
+// AVX/AVX-512 kernels on machines which support them.
+// Define HNSWLIB_NO_RUNTIME_DISPATCH to only compile the kernels enabled by the compiler flags.
+#if !defined(NO_MANUAL_VECTORIZATION) && !defined(HNSWLIB_NO_RUNTIME_DISPATCH) && \
+    defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HNSWLIB_RUNTIME_DISPATCH
+#define HNSWLIB_TARGET(isa) __attribute__((target(isa)))
+// AVX512-VNNI and AVX512-BF16 intrinsics are only declared by newer compilers
+#if (defined(__clang__) && __clang_major__ >= 9) || (!defined(__clang__) && __GNUC__ >= 10)
+#define HNSWLIB_RUNTIME_DISPATCH_AVX512_EXT
+#endif
+#else
+#define HNSWLIB_TARGET(isa)
+#endif
+
 #ifndef NO_MANUAL_VECTORIZATION
 #if (defined(__SSE__) || _M_IX86_FP > 0 || defined(_M_AMD64) || defined(_M_X64))
 #define USE_SSE
-#ifdef __AVX__
+#if defined(__AVX__) || defined(HNSWLIB_RUNTIME_DISPATCH)
 #define USE_AVX
-#ifdef __AVX512F__
+#if defined(__AVX512F__) || defined(HNSWLIB_RUNTIME_DISPATCH)
 #define USE_AVX512
 #endif
 #endif
 #endif
 #endif
 
+// Kernels for extensions beyond AVX and AVX512F
+#if defined(USE_SSE) && (defined(__SSE4_2__) || defined(HNSWLIB_RUNTIME_DISPATCH))
+#define USE_SSE42
+#endif
+#if defined(USE_AVX) && (defined(__AVX2__) || defined(HNSWLIB_RUNTIME_DISPATCH))
+#define USE_AVX2
+#endif
+#if defined(USE_AVX) && (defined(__F16C__) || defined(HNSWLIB_RUNTIME_DISPATCH))
+#define USE_F16C
+#endif
+#if defined(USE_AVX512) && (defined(__AVX512BW__) || defined(HNSWLIB_RUNTIME_DISPATCH))
+#define USE_AVX512BW
+#endif
+#if defined(USE_AVX512BW) && (defined(__AVX512VNNI__) || defined(HNSWLIB_RUNTIME_DISPATCH_AVX512_EXT))
+#define USE_AVX512VNNI
+#endif
+#if defined(USE_AVX512BW) && (defined(__AVX512BF16__) || defined(HNSWLIB_RUNTIME_DISPATCH_AVX512_EXT))
+#define USE_AVX512BF16
+#endif
+
+// Dimensions of L2Space and InnerProductSpace with kernels specialized at compile time, all multiples of 32
+#ifndef HNSWLIB_FOR_EACH_FIXED_DIM
+#define HNSWLIB_FOR_EACH_FIXED_DIM(X) X(96) X(128) X(256) X(384) X(512) X(768) X(1024) X(1536)
+#endif
+
+// The widest compiled kernel is not enabled by the compiler flags, so the distance functors of the fixed
+// dimensions (L2SqrFixedDim) call the kernel selected for the CPU through a pointer and are not inlined.
+// This is the case in the default runtime dispatch build unless e.g. -mavx512f is given.
+#if (defined(USE_AVX512) && !defined(__AVX512F__)) || (defined(USE_AVX) && !defined(__AVX__))
+#define HNSWLIB_FIXED_DIM_DISPATCH
+#endif
+
 #if defined(USE_AVX) || defined(USE_SSE)
 #ifdef _MSC_VER
 #include <intrin.h>
@@ -44,7 +92,7 @@ static uint64_t xgetbv(unsigned int index) {
 }
 #endif
 
-#if defined(USE_AVX512)
+#if defined(USE_AVX)
 #include <immintrin.h>
 #endif
 
@@ -114,6 +162,50 @@ static bool AVX512Capable() {
     }
     return HW_AVX512F && avx512Supported;
 }
+
+// Returns the bit of the extended features (cpuid leaf 7) in ebx (reg = 1) or ecx (reg = 2)
+static bool CPUExtendedFeature(int reg, int bit) {
+    int cpuInfo[4];
+    cpuid(cpuInfo, 0, 0);
+    if (cpuInfo[0] < 0x00000007)
+        return false;
+    cpuid(cpuInfo, 0x00000007, 0);
+    return (cpuInfo[reg] & ((int)1 << bit)) != 0;
+}
+
+static bool SSE42Capable() {
+    int cpuInfo[4];
+    cpuid(cpuInfo, 0x00000001, 0);
+    return (cpuInfo[2] & ((int)1 << 20)) != 0;
+}
+
+static bool AVX2Capable() {
+    return AVXCapable() && CPUExtendedFeature(1, 5);
+}
+
+static bool AVX512BWCapable() {
+    return AVX512Capable() && CPUExtendedFeature(1, 30);
+}
+
+static bool AVX512VNNICapable() {
+    return AVX512BWCapable() && CPUExtendedFeature(2, 11);
+}
+
+static bool F16CCapable() {
+    int cpuInfo[4];
+    cpuid(cpuInfo, 0x00000001, 0);
+    return AVXCapable() && (cpuInfo[2] & ((int)1 << 29)) != 0;
+}
+
+static bool AVX512BF16Capable() {
+    if (!AVX512Capable()) return false;
+    int cpuInfo[4];
+    cpuid(cpuInfo, 0x00000007, 0);
+    if (cpuInfo[0] < 1)
+        return false;
+    cpuid(cpuInfo, 0x00000007, 1);
+    return (cpuInfo[0] & ((int)1 << 5)) != 0;
+}
 #endif
 
 #include <queue>
@@ -170,6 +262,10 @@ static void readBinaryPOD(std::istream &in, T &podRef) {
 template<typename MTYPE>
 using DISTFUNC = MTYPE(*)(const void *, const void *, const void *);
 
+// Computes the distances from one vector to n others: (vector, vectors, n, dist_func_param, distances)
+template<typename MTYPE>
+using BATCHDISTFUNC = void(*)(const void *, const void *const *, size_t, const void *, MTYPE *);
+
 template<typename MTYPE>
 class SpaceInterface {
  public:
@@ -180,6 +276,19 @@ class SpaceInterface {
 
     virtual void *get_dist_func_param() = 0;
 
+    // Spaces which compare queries in another representation than the stored vectors (e.g. lookup tables
+    // built once per query) return the size of the prepared query, 0 means queries are used as they are.
+    // The query distance function takes the prepared query, a stored vector and get_dist_func_param().
+    virtual size_t get_query_size() { return 0; }
+
+    virtual void prepare_query(const void * /*query*/, void * /*prepared*/) {}
+
+    virtual DISTFUNC<MTYPE> get_query_dist_func() { return get_dist_func(); }
+
+    // Optional kernel computing the distance of get_dist_func() from one stored vector to several others at once,
+    // nullptr means that the distances are computed one at a time.
+    virtual BATCHDISTFUNC<MTYPE> get_batch_dist_func() { return nullptr; }
+
     virtual ~SpaceInterface() {}
 };
 
@@ -223,6 +332,10 @@ AlgorithmInterface<dist_t>::searchKnnCloserFirst(const void* query_data, size_t
 
 #include "space_l2.h"
 #include "space_ip.h"
+#include "space_sq8.h"
+#include "space_f16.h"
+#include "space_pq.h"
+#include "vector_store.h"
 #include "stop_condition.h"
 #include "bruteforce.h"
 #include "hnswalg.h"
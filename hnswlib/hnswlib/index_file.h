@@ -0,0 +1,604 @@
+#pragma once
+
+#include "hnswlib.h"
+#include "parallel_for.h"
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HNSWLIB_HAS_POSIX_IO
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <mutex>
+#endif
+
+namespace hnswlib {
+
+/*
+* CRC32C (Castagnoli polynomial), with the SSE4.2 crc32 instruction when the CPU has it.
+* The kernels work on the CRC register, Crc32c() applies the usual inversions.
+*/
+static const uint32_t CRC32C_POLY = 0x82F63B78;  // reflected
+
+struct Crc32cTables {
+    uint32_t table[8][256];
+
+    Crc32cTables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+                crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int k = 1; k < 8; k++)
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+        }
+    }
+};
+
+
+// Slicing-by-8 on little-endian machines, one byte at a time otherwise
+static uint32_t Crc32cSoftware(uint32_t crc, const char *data, size_t size) {
+    static const Crc32cTables tables;
+    const uint32_t (*t)[256] = tables.table;
+    const unsigned char *p = (const unsigned char *) data;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ || defined(_M_X64) || defined(_M_IX86)
+    for (; size >= 8; size -= 8, p += 8) {
+        uint32_t low, high;
+        memcpy(&low, p, 4);
+        memcpy(&high, p + 4, 4);
+        low ^= crc;
+        crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+              t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+    }
+#endif
+    for (; size > 0; size--, p++)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+    return crc;
+}
+
+
+#if defined(USE_SSE42)
+HNSWLIB_TARGET("sse4.2")
+static uint32_t Crc32cSSE42(uint32_t crc, const char *data, size_t size) {
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t crc64 = crc;
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+#endif
+    for (; size >= 4; size -= 4, data += 4) {
+        uint32_t word;
+        memcpy(&word, data, 4);
+        crc = _mm_crc32_u32(crc, word);
+    }
+    for (; size > 0; size--, data++)
+        crc = _mm_crc32_u8(crc, (unsigned char) *data);
+    return crc;
+}
+#endif
+
+
+typedef uint32_t (*CRC32CFUNC)(uint32_t, const char *, size_t);
+
+static CRC32CFUNC Crc32cKernel() {
+#if defined(USE_SSE42)
+    if (SSE42Capable())
+        return Crc32cSSE42;
+#endif
+    return Crc32cSoftware;
+}
+
+
+// CRC32C of the data, continuing the CRC of the preceding data
+static uint32_t Crc32c(const void *data, size_t size, uint32_t crc = 0) {
+    static const CRC32CFUNC kernel = Crc32cKernel();
+    return ~kernel(~crc, (const char *) data, size);
+}
+
+
+// a * b modulo the polynomial, bit 31 is the coefficient of x^0
+static uint32_t Crc32cMultiply(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t m = 1u << 31; m != 0; m >>= 1) {
+        if (a & m)
+            product ^= b;
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return product;
+}
+
+
+/*
+* CRC32C of the concatenation of two blocks from their CRCs and the size of the second one,
+* so that the blocks of a large buffer can be checked in parallel.
+*/
+static uint32_t Crc32cCombine(uint32_t crc_first, uint32_t crc_second, size_t size_second) {
+    uint32_t shift = 1u << 31;   // x^0
+    uint32_t square = 1u << 23;  // x^8, one byte
+    for (; size_second != 0; size_second >>= 1) {
+        if (size_second & 1)
+            shift = Crc32cMultiply(shift, square);
+        square = Crc32cMultiply(square, square);
+    }
+    return Crc32cMultiply(shift, crc_first) ^ crc_second;
+}
+
+
+static const size_t CRC32C_PARALLEL_BLOCK = (size_t) 1 << 22;
+
+// CRC32C of a large buffer computed by blocks on num_threads threads, 0 means one per core
+static uint32_t Crc32cParallel(const char *data, size_t size, size_t num_threads) {
+    size_t num_blocks = (size + CRC32C_PARALLEL_BLOCK - 1) / CRC32C_PARALLEL_BLOCK;
+    if (num_blocks <= 1)
+        return Crc32c(data, size);
+    std::vector<uint32_t> crcs(num_blocks);
+    ParallelFor(0, num_blocks, num_threads, [&](size_t i, size_t) {
+        size_t begin = i * CRC32C_PARALLEL_BLOCK;
+        crcs[i] = Crc32c(data + begin, std::min(CRC32C_PARALLEL_BLOCK, size - begin));
+    });
+    uint32_t crc = crcs[0];
+    for (size_t i = 1; i < num_blocks; i++)
+        crc = Crc32cCombine(crc, crcs[i], std::min(CRC32C_PARALLEL_BLOCK, size - i * CRC32C_PARALLEL_BLOCK));
+    return crc;
+}
+
+
+/*
+* Index files start with a block holding the header and the section table, the sections follow at multiples of
+* INDEX_FILE_ALIGNMENT so that they can be read with O_DIRECT and mapped in place. Every section has its own
+* CRC32C, the header has a CRC of itself and the table. The header is written last, so a file whose writer
+* did not finish has no magic and is rejected.
+* Files of older versions, which start with the parameters without a header, are still loaded.
+*/
+static const char INDEX_FILE_MAGIC[8] = {'H', 'N', 'S', 'W', 'L', 'I', 'B', 'X'};
+static const uint32_t INDEX_FILE_VERSION = 1;
+static const size_t INDEX_FILE_ALIGNMENT = 4096;
+
+enum class IndexSection : uint32_t {
+    Parameters = 1,  // the fields of the header of older versions
+    Levels = 2,      // level of every element, int
+    Level0 = 3,      // the base layer in the Interleaved layout
+    LinkLists = 4,   // upper-level link lists of the elements with levels, in the order of the elements
+    Labels = 5,      // optional: slot array of the label lookup, rebuilt from the base layer when missing
+    Deleted = 6      // optional: internal ids of the deleted elements, tableint, found in the base layer when missing
+};
+
+struct IndexFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_sections;
+    uint64_t file_size;
+    uint32_t reserved;
+    uint32_t crc;  // of the header with crc = 0 and of the section table
+};
+
+struct IndexFileSection {
+    uint32_t type;
+    uint32_t crc;
+    uint64_t offset;
+    uint64_t size;
+};
+
+static const size_t INDEX_FILE_MAX_SECTIONS = (INDEX_FILE_ALIGNMENT - sizeof(IndexFileHeader)) / sizeof(IndexFileSection);
+
+
+static size_t alignIndexFileOffset(size_t offset) {
+    return (offset + INDEX_FILE_ALIGNMENT - 1) / INDEX_FILE_ALIGNMENT * INDEX_FILE_ALIGNMENT;
+}
+
+
+// Memory aligned for O_DIRECT transfers
+class AlignedBuffer {
+    char *data_{nullptr};
+
+ public:
+    explicit AlignedBuffer(size_t size) {
+        void *ptr = nullptr;
+        size = std::max(size, INDEX_FILE_ALIGNMENT);
+#ifdef _WIN32
+        ptr = _aligned_malloc(size, INDEX_FILE_ALIGNMENT);
+#else
+        if (posix_memalign(&ptr, INDEX_FILE_ALIGNMENT, size) != 0)
+            ptr = nullptr;
+#endif
+        if (ptr == nullptr)
+            throw std::runtime_error("Not enough memory: failed to allocate the I/O buffer");
+        data_ = (char *) ptr;
+    }
+
+    AlignedBuffer(const AlignedBuffer &) = delete;
+    AlignedBuffer &operator=(const AlignedBuffer &) = delete;
+
+    ~AlignedBuffer() {
+#ifdef _WIN32
+        _aligned_free(data_);
+#else
+        free(data_);
+#endif
+    }
+
+    char *data() const {
+        return data_;
+    }
+};
+
+
+/*
+* File read and written at explicit offsets, so that several threads can read it at once.
+* With direct_io the page cache is bypassed where the platform and the file system allow it (O_DIRECT, F_NOCACHE),
+* then the offsets, sizes and buffers of the transfers must be multiples of INDEX_FILE_ALIGNMENT.
+* A file opened for writing is emptied, unless truncate is false.
+*/
+class IndexFile {
+#ifdef HNSWLIB_HAS_POSIX_IO
+    int fd_{-1};
+#else
+    std::fstream stream_;
+    std::mutex lock_;
+#endif
+
+ public:
+    IndexFile(const std::string &location, bool write, bool direct_io, bool truncate = true) {
+#ifdef HNSWLIB_HAS_POSIX_IO
+        int flags = write ? O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0) : O_RDONLY;
+#ifdef O_DIRECT
+        if (direct_io) {
+            fd_ = open(location.c_str(), flags | O_DIRECT, 0644);
+            // some file systems (tmpfs) do not support O_DIRECT
+            if (fd_ < 0 && errno != EINVAL)
+                throw std::runtime_error("Cannot open file");
+        }
+#endif
+        if (fd_ < 0)
+            fd_ = open(location.c_str(), flags, 0644);
+        if (fd_ < 0)
+            throw std::runtime_error("Cannot open file");
+#ifdef F_NOCACHE
+        if (direct_io)
+            fcntl(fd_, F_NOCACHE, 1);
+#endif
+#else
+        std::ios::openmode mode = std::ios::binary | std::ios::in;
+        if (write) {
+            mode = std::ios::binary | std::ios::out | (truncate ? std::ios::trunc : std::ios::in);
+            // in | out does not create the file
+            if (!truncate)
+                std::ofstream(location, std::ios::binary | std::ios::app);
+        }
+        stream_.open(location, mode);
+        if (!stream_.is_open())
+            throw std::runtime_error("Cannot open file");
+#endif
+    }
+
+    IndexFile(const IndexFile &) = delete;
+    IndexFile &operator=(const IndexFile &) = delete;
+
+    ~IndexFile() {
+#ifdef HNSWLIB_HAS_POSIX_IO
+        if (fd_ >= 0)
+            ::close(fd_);
+#endif
+    }
+
+    size_t size() {
+#ifdef HNSWLIB_HAS_POSIX_IO
+        struct stat st;
+        if (fstat(fd_, &st) != 0)
+            throw std::runtime_error("Cannot stat file");
+        return st.st_size;
+#else
+        std::unique_lock <std::mutex> lock(lock_);
+        stream_.seekg(0, stream_.end);
+        return (size_t) stream_.tellg();
+#endif
+    }
+
+    // Reads size bytes at the offset, throws if the file ends before
+    void read(char *data, size_t size, size_t offset) {
+#ifdef HNSWLIB_HAS_POSIX_IO
+        while (size > 0) {
+            ssize_t count = pread(fd_, data, size, offset);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            data += count;
+            size -= count;
+            offset += count;
+        }
+#else
+        std::unique_lock <std::mutex> lock(lock_);
+        stream_.seekg(offset);
+        stream_.read(data, size);
+        if (!stream_)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+#endif
+    }
+
+    // Flushes the written data to the device
+    void sync() {
+#ifdef HNSWLIB_HAS_POSIX_IO
+        if (fsync(fd_) != 0)
+            throw std::runtime_error("Cannot write file");
+#else
+        std::unique_lock <std::mutex> lock(lock_);
+        stream_.flush();
+        if (!stream_)
+            throw std::runtime_error("Cannot write file");
+#endif
+    }
+
+    // Cuts the file to size bytes, where the platform allows it, otherwise the bytes after it are left
+    void resize(size_t size) {
+#ifdef HNSWLIB_HAS_POSIX_IO
+        if (ftruncate(fd_, size) != 0)
+            throw std::runtime_error("Cannot write file");
+#else
+        (void) size;
+#endif
+    }
+
+    void write(const char *data, size_t size, size_t offset) {
+#ifdef HNSWLIB_HAS_POSIX_IO
+        while (size > 0) {
+            ssize_t count = pwrite(fd_, data, size, offset);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                throw std::runtime_error("Cannot write file");
+            data += count;
+            size -= count;
+            offset += count;
+        }
+#else
+        std::unique_lock <std::mutex> lock(lock_);
+        stream_.seekp(offset);
+        stream_.write(data, size);
+        if (!stream_)
+            throw std::runtime_error("Cannot write file");
+#endif
+    }
+};
+
+
+/*
+* Writes the sections of an index file through two large buffers: while one is filled, the other one is
+* checksummed and written by a background task. Sections are written one at a time with beginSection,
+* write and endSection, finish writes the header.
+*/
+class IndexFileWriter {
+    static const size_t BUFFER_SIZE = (size_t) 1 << 22;
+
+    IndexFile file_;
+    std::vector<IndexFileSection> sections_;
+    std::unique_ptr<AlignedBuffer> buffers_[2];
+    int current_{0};         // buffer being filled
+    size_t buffered_{0};     // bytes in the current buffer
+    size_t offset_;          // file offset of the current buffer
+    uint32_t crc_{0};        // CRC of the open section, updated by the background task
+    std::future<void> pending_;
+
+    // Waits for the background write, rethrowing its error
+    void wait() {
+        if (pending_.valid())
+            pending_.get();
+    }
+
+    // Hands the current buffer to the background task, padded to the alignment
+    void flush() {
+        if (buffered_ == 0)
+            return;
+        wait();
+        size_t size = alignIndexFileOffset(buffered_);
+        char *data = buffers_[current_]->data();
+        memset(data + buffered_, 0, size - buffered_);
+        size_t data_size = buffered_;
+        size_t offset = offset_;
+        pending_ = std::async(std::launch::async, [this, data, data_size, size, offset]() {
+            crc_ = Crc32c(data, data_size, crc_);
+            file_.write(data, size, offset);
+        });
+        offset_ += size;
+        buffered_ = 0;
+        current_ = 1 - current_;
+    }
+
+ public:
+    IndexFileWriter(const std::string &location, bool direct_io)
+        : file_(location, true, direct_io), offset_(INDEX_FILE_ALIGNMENT) {
+        buffers_[0].reset(new AlignedBuffer(BUFFER_SIZE));
+        buffers_[1].reset(new AlignedBuffer(BUFFER_SIZE));
+    }
+
+    ~IndexFileWriter() {
+        // an unfinished file has no header, the error of the background task is not rethrown
+        if (pending_.valid())
+            pending_.wait();
+    }
+
+    void beginSection(IndexSection type) {
+        if (sections_.size() == INDEX_FILE_MAX_SECTIONS)
+            throw std::runtime_error("Too many sections in the index file");
+        wait();
+        crc_ = 0;
+        sections_.push_back(IndexFileSection{(uint32_t) type, 0, offset_, 0});
+    }
+
+    void write(const void *data, size_t size) {
+        const char *src = (const char *) data;
+        sections_.back().size += size;
+        while (size > 0) {
+            size_t count = std::min(size, BUFFER_SIZE - buffered_);
+            memcpy(buffers_[current_]->data() + buffered_, src, count);
+            buffered_ += count;
+            src += count;
+            size -= count;
+            if (buffered_ == BUFFER_SIZE)
+                flush();
+        }
+    }
+
+    // Pads the section to the alignment, the next one starts at a new block
+    void endSection() {
+        flush();
+        wait();
+        sections_.back().crc = crc_;
+    }
+
+    // Writes the header and the section table to the first block
+    void finish() {
+        wait();
+        AlignedBuffer block(INDEX_FILE_ALIGNMENT);
+        memset(block.data(), 0, INDEX_FILE_ALIGNMENT);
+        IndexFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+        header.version = INDEX_FILE_VERSION;
+        header.num_sections = sections_.size();
+        header.file_size = offset_;
+        memcpy(block.data(), &header, sizeof(header));
+        memcpy(block.data() + sizeof(header), sections_.data(), sections_.size() * sizeof(IndexFileSection));
+        header.crc = Crc32c(block.data(), sizeof(header) + sections_.size() * sizeof(IndexFileSection));
+        memcpy(block.data(), &header, sizeof(header));
+        file_.write(block.data(), INDEX_FILE_ALIGNMENT, 0);
+    }
+
+    // Makes the finished file durable
+    void sync() {
+        wait();
+        file_.sync();
+    }
+};
+
+
+/*
+* Reads the header and the section table of an index file and checks them against the file. Sections are read
+* by blocks on several threads and checked against their CRC.
+*/
+class IndexFileReader {
+    static const size_t BLOCK_SIZE = (size_t) 1 << 22;
+
+    IndexFile file_;
+    std::vector<IndexFileSection> sections_;
+
+ public:
+    // Whether the file starts with the magic of versioned index files, older files start with a zero offset
+    static bool isIndexFile(const std::string &location) {
+        IndexFile file(location, false, false);
+        if (file.size() < sizeof(INDEX_FILE_MAGIC))
+            return false;
+        char magic[sizeof(INDEX_FILE_MAGIC)];
+        file.read(magic, sizeof(magic), 0);
+        return memcmp(magic, INDEX_FILE_MAGIC, sizeof(magic)) == 0;
+    }
+
+    IndexFileReader(const std::string &location, bool direct_io) : file_(location, false, direct_io) {
+        size_t file_size = file_.size();
+        if (file_size < INDEX_FILE_ALIGNMENT)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        AlignedBuffer block(INDEX_FILE_ALIGNMENT);
+        file_.read(block.data(), INDEX_FILE_ALIGNMENT, 0);
+        IndexFileHeader header;
+        memcpy(&header, block.data(), sizeof(header));
+        if (memcmp(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic)) != 0)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        if (header.version != INDEX_FILE_VERSION)
+            throw std::runtime_error("Unsupported index file version");
+        if (header.num_sections > INDEX_FILE_MAX_SECTIONS)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        uint32_t crc = header.crc;
+        header.crc = 0;
+        memcpy(block.data(), &header, sizeof(header));
+        if (Crc32c(block.data(), sizeof(header) + header.num_sections * sizeof(IndexFileSection)) != crc)
+            throw std::runtime_error("Index file checksum mismatch");
+        // a truncated file
+        if (header.file_size != file_size)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        sections_.resize(header.num_sections);
+        memcpy(sections_.data(), block.data() + sizeof(header), sections_.size() * sizeof(IndexFileSection));
+        for (const IndexFileSection &section : sections_) {
+            if (section.offset % INDEX_FILE_ALIGNMENT != 0 || section.offset < INDEX_FILE_ALIGNMENT ||
+                section.offset > file_size || section.size > file_size - section.offset)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+        }
+    }
+
+    bool hasSection(IndexSection type) const {
+        for (const IndexFileSection &section : sections_) {
+            if (section.type == (uint32_t) type)
+                return true;
+        }
+        return false;
+    }
+
+    const IndexFileSection &section(IndexSection type) const {
+        for (const IndexFileSection &section : sections_) {
+            if (section.type == (uint32_t) type)
+                return section;
+        }
+        throw std::runtime_error("Index seems to be corrupted or unsupported");
+    }
+
+    /*
+    * Reads a section by blocks on num_threads threads (0 means one per core) and calls
+    * consume(offset, data, size) for every block, where offset is the position of the block in the section.
+    * Blocks are consumed in any order and concurrently. Throws after all blocks were consumed if the CRC
+    * of the section does not match, so the data is not used before the check.
+    */
+    template<class Consumer>
+    void readSection(IndexSection type, size_t num_threads, Consumer consume) {
+        const IndexFileSection &section = this->section(type);
+        size_t num_blocks = (section.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (num_threads == 0)
+            num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        num_threads = std::min(num_threads, std::max<size_t>(num_blocks, 1));
+
+        std::vector<std::unique_ptr<AlignedBuffer>> buffers(num_threads);
+        std::vector<uint32_t> crcs(num_blocks);
+        ParallelFor(0, num_blocks, num_threads, [&](size_t i, size_t threadId) {
+            if (!buffers[threadId])
+                buffers[threadId].reset(new AlignedBuffer(BLOCK_SIZE));
+            char *data = buffers[threadId]->data();
+            size_t begin = i * BLOCK_SIZE;
+            size_t size = std::min(BLOCK_SIZE, (size_t) section.size - begin);
+            // the file is padded to the alignment
+            file_.read(data, alignIndexFileOffset(size), section.offset + begin);
+            crcs[i] = Crc32c(data, size);
+            consume(begin, (const char *) data, size);
+        });
+
+        uint32_t crc = 0;
+        for (size_t i = 0; i < num_blocks; i++)
+            crc = Crc32cCombine(crc, crcs[i], std::min(BLOCK_SIZE, (size_t) section.size - i * BLOCK_SIZE));
+        if (crc != section.crc)
+            throw std::runtime_error("Index file checksum mismatch");
+    }
+
+    // Reads a small section whole
+    std::vector<char> readSection(IndexSection type) {
+        std::vector<char> data(section(type).size);
+        readSection(type, 1, [&](size_t offset, const char *block, size_t size) {
+            memcpy(data.data() + offset, block, size);
+        });
+        return data;
+    }
+};
+}  // namespace hnswlib
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdlib.h>
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace hnswlib {
+
+/*
+* Bump allocator for the upper-level link lists of HierarchicalNSW. Lists are carved out of a few large blocks
+* instead of one heap allocation each, so millions of small lists do not fragment the heap, clear() frees
+* a handful of blocks and lists allocated together are stored next to each other.
+* Blocks are never moved or freed before clear(), so pointers into them stay valid while the arena grows.
+* allocate() may be called from several threads, individual lists cannot be freed.
+*/
+class LinkListArena {
+    std::vector<std::pair<char *, size_t>> blocks_;  // the current block is the last one
+    size_t used_{0};      // bytes used in the current block
+    size_t size_{0};      // bytes handed out in all blocks
+    size_t capacity_{0};  // bytes of all blocks
+    std::mutex lock_;
+
+    static const size_t ALIGNMENT = 4;  // alignment of the lists, the size of a link
+
+    void addBlock(size_t size) {
+        char *block = (char *) malloc(size);
+        if (block == nullptr)
+            throw std::runtime_error("Not enough memory: failed to allocate the link lists");
+        blocks_.emplace_back(block, size);
+        used_ = 0;
+        capacity_ += size;
+    }
+
+ public:
+    static const size_t MIN_BLOCK_SIZE = 1 << 16;
+
+    LinkListArena() {}
+    LinkListArena(const LinkListArena &) = delete;
+    LinkListArena &operator=(const LinkListArena &) = delete;
+
+    // Returns size uninitialized bytes, aligned to the size of a link
+    char *allocate(size_t size) {
+        size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        std::unique_lock <std::mutex> lock(lock_);
+        if (blocks_.empty() || used_ + size > blocks_.back().second) {
+            // blocks double with the arena, so their number stays logarithmic in its size
+            addBlock(std::max(std::max(size, (size_t) MIN_BLOCK_SIZE), capacity_));
+        }
+        char *ptr = blocks_.back().first + used_;
+        used_ += size;
+        size_ += size;
+        return ptr;
+    }
+
+    // Makes the next allocations of up to size bytes in total come from one block
+    void reserve(size_t size) {
+        std::unique_lock <std::mutex> lock(lock_);
+        if (blocks_.empty() || used_ + size > blocks_.back().second)
+            addBlock(std::max(size, (size_t) MIN_BLOCK_SIZE));
+    }
+
+    // Bytes handed out by allocate()
+    size_t size() const {
+        return size_;
+    }
+
+    // Bytes of all blocks
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    size_t numBlocks() const {
+        return blocks_.size();
+    }
+
+    // Exchanges the blocks of two arenas, not thread-safe
+    void swap(LinkListArena &other) {
+        blocks_.swap(other.blocks_);
+        std::swap(used_, other.used_);
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+    }
+
+    void clear() {
+        for (auto &block : blocks_)
+            free(block.first);
+        blocks_.clear();
+        used_ = 0;
+        size_ = 0;
+        capacity_ = 0;
+    }
+
+    ~LinkListArena() {
+        clear();
+    }
+};
+}  // namespace hnswlib
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HNSWLIB_HAS_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace hnswlib {
+
+/*
+* Read-only or copy-on-write memory mapping of a whole file.
+* With copy_on_write the pages are writable, but modifications stay private to the process
+* and are never written back to the file.
+*/
+class MappedFile {
+    char *data_{nullptr};
+    size_t size_{0};
+
+ public:
+    MappedFile(const std::string &location, bool copy_on_write = false) {
+#ifdef HNSWLIB_HAS_MMAP
+        int fd = open(location.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open file");
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot stat file");
+        }
+        size_ = st.st_size;
+        if (size_ == 0) {
+            close(fd);
+            throw std::runtime_error("Cannot map an empty file");
+        }
+
+        int prot = copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ;
+        int flags = copy_on_write ? MAP_PRIVATE : MAP_SHARED;
+        void *addr = mmap(nullptr, size_, prot, flags, fd, 0);
+        // the mapping keeps its own reference to the file
+        close(fd);
+        if (addr == MAP_FAILED)
+            throw std::runtime_error("Cannot map file");
+        data_ = (char *) addr;
+#else
+        throw std::runtime_error("Memory-mapped files are not supported on this platform");
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+#ifdef HNSWLIB_HAS_MMAP
+        if (data_ != nullptr)
+            munmap(data_, size_);
+#endif
+    }
+
+    char *data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    // Graph traversal touches pages in random order, so read-ahead only wastes page cache
+    void adviseRandom(size_t offset, size_t length) const {
+#ifdef HNSWLIB_HAS_MMAP
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t begin = offset / page * page;
+        if (begin < size_)
+            madvise(data_ + begin, std::min(size_ - begin, length + (offset - begin)), MADV_RANDOM);
+#endif
+    }
+};
+}  // namespace hnswlib
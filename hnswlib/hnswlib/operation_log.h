@@ -0,0 +1,235 @@
+#pragma once
+
+#include "hnswlib.h"
+#include "index_file.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace hnswlib {
+
+/*
+* Operation logs hold the insertions and deletions applied to an index since its last snapshot, so that they
+* survive a crash. The file starts with a header, then the records follow one after another, each with a CRC32C
+* of itself and of its vector. A record cut off by a crash fails its check, reading stops there.
+*/
+static const char OPERATION_LOG_MAGIC[8] = {'H', 'N', 'S', 'W', 'O', 'P', 'L', 'G'};
+static const uint32_t OPERATION_LOG_VERSION = 1;
+// suffix of the log set aside by a checkpoint until its snapshot is written
+static const char OPERATION_LOG_ROTATED_SUFFIX[] = ".old";
+
+enum class LoggedOperation : uint32_t {
+    Add = 1,           // addPoint, the record holds the vector
+    MarkDelete = 2,
+    UnmarkDelete = 3,
+    Remove = 4         // removePoint
+};
+
+struct OperationLogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t data_size;  // bytes of the vectors, checked against the index
+};
+
+struct OperationRecord {
+    uint32_t crc;        // of the record with crc = 0 and of the vector
+    uint32_t type;
+    uint64_t label;
+    uint32_t replace_deleted;
+    uint32_t data_size;  // 0 or the data size of the header
+};
+
+struct OperationLogEntry {
+    LoggedOperation type;
+    labeltype label;
+    bool replace_deleted;
+    std::vector<char> data;
+};
+
+
+static bool operationLogExists(const std::string &location) {
+    return std::ifstream(location).good();
+}
+
+
+/*
+* Reads the records of an operation log in order, up to the end of the file or to the first record which
+* does not pass its check.
+*/
+class OperationLogReader {
+    std::ifstream input_;
+    size_t data_size_;
+    size_t offset_;  // end of the last valid record
+
+ public:
+    OperationLogReader(const std::string &location, size_t data_size)
+        : input_(location, std::ios::binary), data_size_(data_size), offset_(sizeof(OperationLogHeader)) {
+        if (!input_.is_open())
+            throw std::runtime_error("Cannot open file");
+        OperationLogHeader header;
+        input_.read((char *) &header, sizeof(header));
+        if (!input_ || memcmp(header.magic, OPERATION_LOG_MAGIC, sizeof(header.magic)) != 0)
+            throw std::runtime_error("Operation log seems to be corrupted or unsupported");
+        if (header.version != OPERATION_LOG_VERSION)
+            throw std::runtime_error("Unsupported operation log version");
+        if (header.data_size != data_size)
+            throw std::runtime_error("The operation log does not match the index");
+    }
+
+    // Reads the next record into entry, false at the end of the valid records
+    bool next(OperationLogEntry &entry) {
+        OperationRecord record;
+        if (!input_.read((char *) &record, sizeof(record)))
+            return false;
+        bool is_add = record.type == (uint32_t) LoggedOperation::Add;
+        if (record.type < (uint32_t) LoggedOperation::Add || record.type > (uint32_t) LoggedOperation::Remove ||
+            record.data_size != (is_add ? data_size_ : 0))
+            return false;
+        entry.data.resize(record.data_size);
+        if (!input_.read(entry.data.data(), entry.data.size()))
+            return false;
+        uint32_t crc = record.crc;
+        record.crc = 0;
+        if (Crc32c(entry.data.data(), entry.data.size(), Crc32c(&record, sizeof(record))) != crc)
+            return false;
+
+        entry.type = (LoggedOperation) record.type;
+        entry.label = record.label;
+        entry.replace_deleted = record.replace_deleted != 0;
+        offset_ += sizeof(record) + record.data_size;
+        return true;
+    }
+
+    size_t offset() const {
+        return offset_;
+    }
+};
+
+
+/*
+* Appends records to an operation log from several threads. A record is written with one call to the
+* operating system, so it survives a crash of the process; with sync it is also flushed to the device before
+* append returns, and appenders which wait at the same time share one flush.
+* An existing log is continued after its last valid record.
+*/
+class OperationLog {
+    std::string location_;
+    size_t data_size_;
+    bool sync_;
+    std::unique_ptr<IndexFile> file_;
+    size_t offset_{0};            // end of the file
+    size_t position_{0};          // bytes appended since the log was opened, across rotations
+    size_t synced_position_{0};
+    std::mutex lock_;             // appends and rotations
+    std::mutex sync_lock_;        // taken before lock_
+
+    void create() {
+        file_.reset(new IndexFile(location_, true, false));
+        OperationLogHeader header;
+        memcpy(header.magic, OPERATION_LOG_MAGIC, sizeof(header.magic));
+        header.version = OPERATION_LOG_VERSION;
+        header.data_size = (uint32_t) data_size_;
+        file_->write((const char *) &header, sizeof(header), 0);
+        offset_ = sizeof(header);
+    }
+
+    // Flushes the records up to position, unless a concurrent flush already did
+    void syncTo(size_t position) {
+        std::unique_lock <std::mutex> lock_sync(sync_lock_);
+        if (synced_position_ >= position)
+            return;
+        std::unique_lock <std::mutex> lock(lock_);
+        size_t end = position_;
+        lock.unlock();
+        file_->sync();
+        synced_position_ = end;
+    }
+
+ public:
+    OperationLog(const std::string &location, size_t data_size, bool sync)
+        : location_(location), data_size_(data_size), sync_(sync) {
+        // a log whose creation was cut off before the header is created again
+        bool exists = operationLogExists(location) && IndexFile(location, false, false).size() >= sizeof(OperationLogHeader);
+        if (!exists) {
+            create();
+            return;
+        }
+        OperationLogReader reader(location, data_size);
+        OperationLogEntry entry;
+        while (reader.next(entry)) {
+        }
+        file_.reset(new IndexFile(location, true, false, false));
+        // the end of a record cut off by a crash
+        file_->resize(reader.offset());
+        offset_ = reader.offset();
+    }
+
+    OperationLog(const OperationLog &) = delete;
+    OperationLog &operator=(const OperationLog &) = delete;
+
+    const std::string &location() const {
+        return location_;
+    }
+
+    void append(LoggedOperation type, labeltype label, const void *data = nullptr, bool replace_deleted = false) {
+        OperationRecord record;
+        record.crc = 0;
+        record.type = (uint32_t) type;
+        record.label = label;
+        record.replace_deleted = replace_deleted;
+        record.data_size = type == LoggedOperation::Add ? (uint32_t) data_size_ : 0;
+        std::vector<char> buffer(sizeof(record) + record.data_size);
+        if (record.data_size)
+            memcpy(buffer.data() + sizeof(record), data, record.data_size);
+        record.crc = Crc32c(buffer.data() + sizeof(record), record.data_size, Crc32c(&record, sizeof(record)));
+        memcpy(buffer.data(), &record, sizeof(record));
+
+        size_t position;
+        {
+            std::unique_lock <std::mutex> lock(lock_);
+            file_->write(buffer.data(), buffer.size(), offset_);
+            offset_ += buffer.size();
+            position_ += buffer.size();
+            position = position_;
+        }
+        if (sync_)
+            syncTo(position);
+    }
+
+    // Flushes the appended records to the device
+    void sync() {
+        std::unique_lock <std::mutex> lock(lock_);
+        size_t position = position_;
+        lock.unlock();
+        syncTo(position);
+    }
+
+    /*
+    * Moves the records written so far to rotated_location, flushed, and continues in a new empty log.
+    * The records appended after it returns go to the new log.
+    */
+    void rotate(const std::string &rotated_location) {
+        std::unique_lock <std::mutex> lock_sync(sync_lock_);
+        std::unique_lock <std::mutex> lock(lock_);
+        file_->sync();
+        synced_position_ = position_;
+#ifdef _WIN32
+        // an open file cannot be renamed, rename does not replace an existing file
+        file_.reset();
+        remove(rotated_location.c_str());
+#endif
+        if (rename(location_.c_str(), rotated_location.c_str()) != 0) {
+            if (!file_)
+                file_.reset(new IndexFile(location_, true, false, false));
+            throw std::runtime_error("Cannot rename the operation log");
+        }
+        create();
+    }
+};
+}  // namespace hnswlib
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hnswlib {
+
+/*
+* Calls fn(id, thread_id) for every id in [start, end) on num_threads threads, 0 means one per core.
+* Threads take the ids in batches from a shared counter, so the work stays balanced when the cost per id varies,
+* and the batches get smaller towards the end so that all threads finish at about the same time.
+* The first exception thrown by fn stops the remaining work and is rethrown by ParallelFor.
+*/
+template<class Function>
+inline void ParallelFor(size_t start, size_t end, size_t num_threads, Function fn) {
+    if (num_threads == 0)
+        num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    num_threads = std::min(num_threads, std::max<size_t>(end - start, 1));
+
+    if (num_threads == 1) {
+        for (size_t id = start; id < end; id++)
+            fn(id, 0);
+        return;
+    }
+
+    const size_t max_batch = 64;
+    std::atomic<size_t> current(start);
+    std::exception_ptr last_exception = nullptr;
+    std::mutex last_exception_lock;
+
+    auto worker = [&](size_t thread_id) {
+        while (true) {
+            size_t begin = current.load(std::memory_order_relaxed);
+            size_t batch;
+            do {
+                if (begin >= end)
+                    return;
+                batch = std::min(max_batch, std::max<size_t>((end - begin) / (4 * num_threads), 1));
+            } while (!current.compare_exchange_weak(begin, begin + batch, std::memory_order_relaxed));
+
+            try {
+                for (size_t id = begin; id < begin + batch; id++)
+                    fn(id, thread_id);
+            } catch (...) {
+                std::unique_lock <std::mutex> lock(last_exception_lock);
+                if (!last_exception)
+                    last_exception = std::current_exception();
+                current = end;
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    try {
+        for (size_t thread_id = 1; thread_id < num_threads; thread_id++)
+            threads.emplace_back(worker, thread_id);
+    } catch (...) {
+        current = end;
+        for (auto &thread : threads)
+            thread.join();
+        throw;
+    }
+    // the calling thread is one of the workers
+    worker(0);
+    for (auto &thread : threads)
+        thread.join();
+    if (last_exception)
+        std::rethrow_exception(last_exception);
+}
+}  // namespace hnswlib
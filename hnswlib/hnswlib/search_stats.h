@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <memory>
+#include <string.h>
+
+namespace hnswlib {
+
+/*
+* Counters of a single search. The structure is filled by the searching thread only,
+* so collecting it does not touch any shared memory.
+*/
+struct SearchStats {
+    static const int MAX_LEVELS = 16;  // hops on levels >= MAX_LEVELS - 1 are counted in the last bucket
+
+    size_t hops_per_level[MAX_LEVELS];  // number of expanded nodes on each level
+    size_t distance_computations;
+    size_t visited;                     // number of elements marked as visited in the base layer
+    size_t heap_pushes;                 // insertions into the candidate and the result heaps
+    size_t filtered_out;                // candidates rejected by the filter or because they are deleted
+
+    SearchStats() {
+        reset();
+    }
+
+    void reset() {
+        memset(hops_per_level, 0, sizeof(hops_per_level));
+        distance_computations = 0;
+        visited = 0;
+        heap_pushes = 0;
+        filtered_out = 0;
+    }
+
+    inline void addHop(int level) {
+        hops_per_level[level < MAX_LEVELS ? level : MAX_LEVELS - 1]++;
+    }
+
+    size_t hops() const {
+        size_t total = 0;
+        for (int i = 0; i < MAX_LEVELS; i++)
+            total += hops_per_level[i];
+        return total;
+    }
+
+    SearchStats &operator+=(const SearchStats &other) {
+        for (int i = 0; i < MAX_LEVELS; i++)
+            hops_per_level[i] += other.hops_per_level[i];
+        distance_computations += other.distance_computations;
+        visited += other.visited;
+        heap_pushes += other.heap_pushes;
+        filtered_out += other.filtered_out;
+        return *this;
+    }
+};
+
+
+/*
+* Aggregates SearchStats of many threads.
+* Every thread accumulates into its own cache-line padded slot, so add() never writes memory
+* shared with other threads. collect() can be called at any time (e.g. by a metrics scraper)
+* and sums the slots of all threads.
+*/
+class SearchStatsAggregator {
+    static const int NUM_COUNTERS = SearchStats::MAX_LEVELS + 5;
+
+    struct Slot {
+        char padding_front_[64];
+        std::atomic<size_t> counters[NUM_COUNTERS];
+        char padding_back_[64];
+
+        Slot() {
+            for (int i = 0; i < NUM_COUNTERS; i++)
+                counters[i] = 0;
+        }
+
+        // only the owning thread writes the slot, so a plain load/store pair is enough
+        inline void add(int i, size_t value) {
+            counters[i].store(counters[i].load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+    };
+
+    // Ids of the live aggregators, the generation changes whenever one is destroyed
+    struct Registry {
+        std::mutex lock;
+        std::unordered_set<size_t> live;
+        size_t next_id{0};
+        std::atomic<size_t> generation{0};
+    };
+
+    // Slots of the aggregators a thread added to, with the generation of the registry they were last pruned at
+    struct LocalSlots {
+        size_t generation{0};
+        std::vector<std::pair<size_t, Slot *>> slots;
+    };
+
+    size_t id_;
+    mutable std::mutex slots_lock_;
+    std::vector<std::unique_ptr<Slot>> slots_;
+
+    static Registry &registry() {
+        static Registry registry;
+        return registry;
+    }
+
+    static LocalSlots &localSlots() {
+        static thread_local LocalSlots local_slots;
+        return local_slots;
+    }
+
+    Slot *localSlot() {
+        LocalSlots &local_slots = localSlots();
+        Registry &registry = SearchStatsAggregator::registry();
+        size_t generation = registry.generation.load(std::memory_order_acquire);
+        if (local_slots.generation != generation) {
+            // drop the entries of destroyed aggregators, their slots were freed with them
+            std::unique_lock <std::mutex> lock(registry.lock);
+            auto &slots = local_slots.slots;
+            slots.erase(std::remove_if(slots.begin(), slots.end(), [&](const std::pair<size_t, Slot *> &entry) {
+                return registry.live.count(entry.first) == 0;
+            }), slots.end());
+            local_slots.generation = generation;
+        }
+        for (auto &entry : local_slots.slots) {
+            if (entry.first == id_)
+                return entry.second;
+        }
+        Slot *slot = new Slot();
+        {
+            std::unique_lock <std::mutex> lock(slots_lock_);
+            slots_.emplace_back(slot);
+        }
+        local_slots.slots.emplace_back(id_, slot);
+        return slot;
+    }
+
+ public:
+    SearchStatsAggregator() {
+        // the registry is constructed before the first aggregator, so it outlives all of them
+        Registry &registry = SearchStatsAggregator::registry();
+        std::unique_lock <std::mutex> lock(registry.lock);
+        id_ = registry.next_id++;
+        registry.live.insert(id_);
+    }
+
+    ~SearchStatsAggregator() {
+        Registry &registry = SearchStatsAggregator::registry();
+        std::unique_lock <std::mutex> lock(registry.lock);
+        registry.live.erase(id_);
+        registry.generation.fetch_add(1, std::memory_order_release);
+    }
+
+    SearchStatsAggregator(const SearchStatsAggregator &) = delete;
+    SearchStatsAggregator &operator=(const SearchStatsAggregator &) = delete;
+
+    // Number of aggregators the calling thread holds a slot of, live ones and destroyed ones not pruned yet
+    static size_t localSlotCount() {
+        return localSlots().slots.size();
+    }
+
+    void add(const SearchStats &stats) {
+        Slot *slot = localSlot();
+        for (int i = 0; i < SearchStats::MAX_LEVELS; i++) {
+            if (stats.hops_per_level[i])
+                slot->add(i, stats.hops_per_level[i]);
+        }
+        slot->add(SearchStats::MAX_LEVELS, stats.distance_computations);
+        slot->add(SearchStats::MAX_LEVELS + 1, stats.visited);
+        slot->add(SearchStats::MAX_LEVELS + 2, stats.heap_pushes);
+        slot->add(SearchStats::MAX_LEVELS + 3, stats.filtered_out);
+        slot->add(SearchStats::MAX_LEVELS + 4, 1);
+    }
+
+    // Returns the sum of the statistics of all threads and optionally the number of aggregated searches
+    SearchStats collect(size_t *num_searches = nullptr) const {
+        SearchStats total;
+        size_t searches = 0;
+        std::unique_lock <std::mutex> lock(slots_lock_);
+        for (auto &slot : slots_) {
+            for (int i = 0; i < SearchStats::MAX_LEVELS; i++)
+                total.hops_per_level[i] += slot->counters[i].load(std::memory_order_relaxed);
+            total.distance_computations += slot->counters[SearchStats::MAX_LEVELS].load(std::memory_order_relaxed);
+            total.visited += slot->counters[SearchStats::MAX_LEVELS + 1].load(std::memory_order_relaxed);
+            total.heap_pushes += slot->counters[SearchStats::MAX_LEVELS + 2].load(std::memory_order_relaxed);
+            total.filtered_out += slot->counters[SearchStats::MAX_LEVELS + 3].load(std::memory_order_relaxed);
+            searches += slot->counters[SearchStats::MAX_LEVELS + 4].load(std::memory_order_relaxed);
+        }
+        if (num_searches)
+            *num_searches = searches;
+        return total;
+    }
+};
+}  // namespace hnswlib
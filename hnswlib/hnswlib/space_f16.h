@@ -0,0 +1,521 @@
+#pragma once
+#include "hnswlib.h"
+
+namespace hnswlib {
+
+/*
+* Spaces storing vectors as IEEE half precision (fp16) or bfloat16 (bf16), 2 bytes per dimension.
+* Vectors (data and queries) must be converted with ConvertFloatToF16 / ConvertFloatToBF16 before being
+* passed to the index. Components are widened to fp32 inside the distance loops, so the accumulation
+* has the same precision as in the fp32 spaces.
+*/
+
+// Round to nearest even, values beyond the fp16 range become infinity
+static uint16_t FloatToF16(float value) {
+    const uint32_t f32infty = 255u << 23;
+    const uint32_t f16max = (127u + 16) << 23;
+    const uint32_t denorm_magic_bits = ((127u - 15) + (23 - 10) + 1) << 23;
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    uint32_t sign = f & 0x80000000u;
+    f ^= sign;
+
+    uint16_t o;
+    if (f >= f16max) {
+        o = f > f32infty ? 0x7e00 : 0x7c00;  // NaN or infinity
+    } else if (f < (113u << 23)) {
+        // the result is a subnormal fp16, let the fp32 addition do the rounding
+        float fv, denorm_magic;
+        memcpy(&fv, &f, sizeof(f));
+        memcpy(&denorm_magic, &denorm_magic_bits, sizeof(f));
+        fv += denorm_magic;
+        memcpy(&f, &fv, sizeof(f));
+        o = (uint16_t) (f - denorm_magic_bits);
+    } else {
+        uint32_t mant_odd = (f >> 13) & 1;
+        f += ((uint32_t) (15 - 127) << 23) + 0xfff;
+        f += mant_odd;
+        o = (uint16_t) (f >> 13);
+    }
+    return o | (uint16_t) (sign >> 16);
+}
+
+static float F16ToFloat(uint16_t h) {
+    const uint32_t shifted_exp = 0x7c00u << 13;
+    uint32_t o = ((uint32_t) (h & 0x7fff)) << 13;
+    uint32_t exp = shifted_exp & o;
+    o += (127u - 15) << 23;
+    if (exp == shifted_exp) {
+        o += (128u - 16) << 23;  // infinity or NaN
+    } else if (exp == 0) {
+        // zero or subnormal, renormalize through an fp32 subtraction
+        const uint32_t magic_bits = 113u << 23;
+        float f, magic;
+        o += 1u << 23;
+        memcpy(&f, &o, sizeof(o));
+        memcpy(&magic, &magic_bits, sizeof(o));
+        f -= magic;
+        memcpy(&o, &f, sizeof(o));
+    }
+    o |= ((uint32_t) (h & 0x8000)) << 16;
+    float result;
+    memcpy(&result, &o, sizeof(o));
+    return result;
+}
+
+// Round to nearest even
+static uint16_t FloatToBF16(float value) {
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    if ((f & 0x7fffffffu) > 0x7f800000u)
+        return (uint16_t) ((f >> 16) | 0x0040);  // keep NaN quiet
+    f += 0x7fff + ((f >> 16) & 1);
+    return (uint16_t) (f >> 16);
+}
+
+static float BF16ToFloat(uint16_t h) {
+    uint32_t o = ((uint32_t) h) << 16;
+    float result;
+    memcpy(&result, &o, sizeof(o));
+    return result;
+}
+
+#if defined(USE_F16C)
+// Converts the multiple of 8 prefix, returns its length
+HNSWLIB_TARGET("avx,f16c")
+static size_t ConvertFloatToF16F16C(const float *src, uint16_t *dst, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *) (dst + i), h);
+    }
+    return i;
+}
+#endif
+
+static inline void ConvertFloatToF16(const float *src, uint16_t *dst, size_t n) {
+    size_t i = 0;
+#if defined(USE_F16C)
+    if (F16CCapable())
+        i = ConvertFloatToF16F16C(src, dst, n);
+#endif
+    for (; i < n; i++)
+        dst[i] = FloatToF16(src[i]);
+}
+
+static inline void ConvertF16ToFloat(const uint16_t *src, float *dst, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        dst[i] = F16ToFloat(src[i]);
+}
+
+static inline void ConvertFloatToBF16(const float *src, uint16_t *dst, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        dst[i] = FloatToBF16(src[i]);
+}
+
+static inline void ConvertBF16ToFloat(const uint16_t *src, float *dst, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        dst[i] = BF16ToFloat(src[i]);
+}
+
+
+static float
+L2SqrF16(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    float res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        float t = F16ToFloat(pVect1[i]) - F16ToFloat(pVect2[i]);
+        res += t * t;
+    }
+    return res;
+}
+
+static float
+InnerProductF16(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    float res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        res += F16ToFloat(pVect1[i]) * F16ToFloat(pVect2[i]);
+    }
+    return res;
+}
+
+static float
+L2SqrBF16(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    float res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        float t = BF16ToFloat(pVect1[i]) - BF16ToFloat(pVect2[i]);
+        res += t * t;
+    }
+    return res;
+}
+
+static float
+InnerProductBF16(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    float res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        res += BF16ToFloat(pVect1[i]) * BF16ToFloat(pVect2[i]);
+    }
+    return res;
+}
+
+#if defined(USE_F16C)
+
+HNSWLIB_TARGET("avx,f16c")
+static float
+F16HorizontalSumAVX(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+HNSWLIB_TARGET("avx,f16c")
+static float
+L2SqrF16AVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    __m256 sum = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= qty; i += 8) {
+        __m256 v1 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (pVect1 + i)));
+        __m256 v2 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (pVect2 + i)));
+        __m256 diff = _mm256_sub_ps(v1, v2);
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+    }
+    size_t qty_left = qty - i;
+    return F16HorizontalSumAVX(sum) + L2SqrF16(pVect1 + i, pVect2 + i, &qty_left);
+}
+
+HNSWLIB_TARGET("avx,f16c")
+static float
+InnerProductF16AVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    __m256 sum = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= qty; i += 8) {
+        __m256 v1 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (pVect1 + i)));
+        __m256 v2 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (pVect2 + i)));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(v1, v2));
+    }
+    size_t qty_left = qty - i;
+    return F16HorizontalSumAVX(sum) + InnerProductF16(pVect1 + i, pVect2 + i, &qty_left);
+}
+
+#endif
+
+#if defined(USE_AVX2)
+
+// bf16 is the upper half of an fp32, widening is a shift
+HNSWLIB_TARGET("avx2")
+static inline __m256
+BF16LoadAVX2(const uint16_t *p) {
+    __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) p));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(v, 16));
+}
+
+HNSWLIB_TARGET("avx2")
+static float
+L2SqrBF16AVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    __m256 sum = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= qty; i += 8) {
+        __m256 diff = _mm256_sub_ps(BF16LoadAVX2(pVect1 + i), BF16LoadAVX2(pVect2 + i));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+    }
+    __m128 sum128 = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    sum128 = _mm_add_ps(sum128, _mm_movehl_ps(sum128, sum128));
+    sum128 = _mm_add_ss(sum128, _mm_shuffle_ps(sum128, sum128, 1));
+    size_t qty_left = qty - i;
+    return _mm_cvtss_f32(sum128) + L2SqrBF16(pVect1 + i, pVect2 + i, &qty_left);
+}
+
+HNSWLIB_TARGET("avx2")
+static float
+InnerProductBF16AVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    __m256 sum = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= qty; i += 8) {
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(BF16LoadAVX2(pVect1 + i), BF16LoadAVX2(pVect2 + i)));
+    }
+    __m128 sum128 = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    sum128 = _mm_add_ps(sum128, _mm_movehl_ps(sum128, sum128));
+    sum128 = _mm_add_ss(sum128, _mm_shuffle_ps(sum128, sum128, 1));
+    size_t qty_left = qty - i;
+    return _mm_cvtss_f32(sum128) + InnerProductBF16(pVect1 + i, pVect2 + i, &qty_left);
+}
+
+#endif
+
+#if defined(USE_AVX512)
+
+HNSWLIB_TARGET("avx512f")
+static float
+L2SqrF16AVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    __m512 sum = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= qty; i += 16) {
+        __m512 v1 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *) (pVect1 + i)));
+        __m512 v2 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *) (pVect2 + i)));
+        __m512 diff = _mm512_sub_ps(v1, v2);
+        sum = _mm512_fmadd_ps(diff, diff, sum);
+    }
+    size_t qty_left = qty - i;
+    return _mm512_reduce_add_ps(sum) + L2SqrF16(pVect1 + i, pVect2 + i, &qty_left);
+}
+
+HNSWLIB_TARGET("avx512f")
+static float
+InnerProductF16AVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    __m512 sum = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= qty; i += 16) {
+        __m512 v1 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *) (pVect1 + i)));
+        __m512 v2 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *) (pVect2 + i)));
+        sum = _mm512_fmadd_ps(v1, v2, sum);
+    }
+    size_t qty_left = qty - i;
+    return _mm512_reduce_add_ps(sum) + InnerProductF16(pVect1 + i, pVect2 + i, &qty_left);
+}
+
+HNSWLIB_TARGET("avx512f")
+static inline __m512
+BF16LoadAVX512(const uint16_t *p) {
+    __m512i v = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *) p));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(v, 16));
+}
+
+HNSWLIB_TARGET("avx512f")
+static float
+L2SqrBF16AVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    __m512 sum = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= qty; i += 16) {
+        __m512 diff = _mm512_sub_ps(BF16LoadAVX512(pVect1 + i), BF16LoadAVX512(pVect2 + i));
+        sum = _mm512_fmadd_ps(diff, diff, sum);
+    }
+    size_t qty_left = qty - i;
+    return _mm512_reduce_add_ps(sum) + L2SqrBF16(pVect1 + i, pVect2 + i, &qty_left);
+}
+
+HNSWLIB_TARGET("avx512f")
+static float
+InnerProductBF16AVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    __m512 sum = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= qty; i += 16) {
+        sum = _mm512_fmadd_ps(BF16LoadAVX512(pVect1 + i), BF16LoadAVX512(pVect2 + i), sum);
+    }
+    size_t qty_left = qty - i;
+    return _mm512_reduce_add_ps(sum) + InnerProductBF16(pVect1 + i, pVect2 + i, &qty_left);
+}
+
+#if defined(USE_AVX512BF16)
+
+// vdpbf16ps multiplies pairs of bf16 and accumulates them in fp32 without widening first
+HNSWLIB_TARGET("avx512f,avx512bf16")
+static float
+InnerProductBF16AVX512BF16(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    __m512 sum = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= qty; i += 32) {
+        __m512i v1 = _mm512_loadu_si512((const void *) (pVect1 + i));
+        __m512i v2 = _mm512_loadu_si512((const void *) (pVect2 + i));
+        sum = _mm512_dpbf16_ps(sum, (__m512bh) v1, (__m512bh) v2);
+    }
+    size_t qty_left = qty - i;
+    return _mm512_reduce_add_ps(sum) + InnerProductBF16(pVect1 + i, pVect2 + i, &qty_left);
+}
+
+#endif
+#endif
+
+template<DISTFUNC<float> inner_product>
+static float
+InnerProductDistanceHalf(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - inner_product(pVect1v, pVect2v, qty_ptr);
+}
+
+
+class L2SpaceF16 : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    size_t data_size_;
+    size_t dim_;
+
+ public:
+    L2SpaceF16(size_t dim) {
+        fstdistfunc_ = L2SqrF16;
+#if defined(USE_F16C)
+        if (F16CCapable())
+            fstdistfunc_ = L2SqrF16AVX;
+#endif
+#if defined(USE_AVX512)
+        if (AVX512Capable())
+            fstdistfunc_ = L2SqrF16AVX512;
+#endif
+        dim_ = dim;
+        data_size_ = dim * sizeof(uint16_t);
+    }
+
+    size_t get_data_size() {
+        return data_size_;
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &dim_;
+    }
+
+    ~L2SpaceF16() {}
+};
+
+
+class InnerProductSpaceF16 : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    size_t data_size_;
+    size_t dim_;
+
+ public:
+    InnerProductSpaceF16(size_t dim) {
+        fstdistfunc_ = InnerProductDistanceHalf<InnerProductF16>;
+#if defined(USE_F16C)
+        if (F16CCapable())
+            fstdistfunc_ = InnerProductDistanceHalf<InnerProductF16AVX>;
+#endif
+#if defined(USE_AVX512)
+        if (AVX512Capable())
+            fstdistfunc_ = InnerProductDistanceHalf<InnerProductF16AVX512>;
+#endif
+        dim_ = dim;
+        data_size_ = dim * sizeof(uint16_t);
+    }
+
+    size_t get_data_size() {
+        return data_size_;
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &dim_;
+    }
+
+    ~InnerProductSpaceF16() {}
+};
+
+
+class L2SpaceBF16 : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    size_t data_size_;
+    size_t dim_;
+
+ public:
+    L2SpaceBF16(size_t dim) {
+        fstdistfunc_ = L2SqrBF16;
+#if defined(USE_AVX2)
+        if (AVX2Capable())
+            fstdistfunc_ = L2SqrBF16AVX2;
+#endif
+#if defined(USE_AVX512)
+        if (AVX512Capable())
+            fstdistfunc_ = L2SqrBF16AVX512;
+#endif
+        dim_ = dim;
+        data_size_ = dim * sizeof(uint16_t);
+    }
+
+    size_t get_data_size() {
+        return data_size_;
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &dim_;
+    }
+
+    ~L2SpaceBF16() {}
+};
+
+
+class InnerProductSpaceBF16 : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    size_t data_size_;
+    size_t dim_;
+
+ public:
+    InnerProductSpaceBF16(size_t dim) {
+        fstdistfunc_ = InnerProductDistanceHalf<InnerProductBF16>;
+#if defined(USE_AVX2)
+        if (AVX2Capable())
+            fstdistfunc_ = InnerProductDistanceHalf<InnerProductBF16AVX2>;
+#endif
+#if defined(USE_AVX512)
+        if (AVX512Capable())
+            fstdistfunc_ = InnerProductDistanceHalf<InnerProductBF16AVX512>;
+    #if defined(USE_AVX512BF16)
+        if (AVX512BF16Capable())
+            fstdistfunc_ = InnerProductDistanceHalf<InnerProductBF16AVX512BF16>;
+    #endif
+#endif
+        dim_ = dim;
+        data_size_ = dim * sizeof(uint16_t);
+    }
+
+    size_t get_data_size() {
+        return data_size_;
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &dim_;
+    }
+
+    ~InnerProductSpaceBF16() {}
+};
+
+}  // namespace hnswlib
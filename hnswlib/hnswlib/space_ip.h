@@ -21,6 +21,7 @@ InnerProductDistance(const void *pVect1, const void *pVect2, const void *qty_ptr
 #if defined(USE_AVX)
 
 // Favor using AVX if available.
+HNSWLIB_TARGET("avx")
 static float
 InnerProductSIMD4ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float PORTABLE_ALIGN32 TmpRes[8];
@@ -68,6 +69,7 @@ InnerProductSIMD4ExtAVX(const void *pVect1v, const void *pVect2v, const void *qt
     return sum;
 }
 
+HNSWLIB_TARGET("avx")
 static float
 InnerProductDistanceSIMD4ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     return 1.0f - InnerProductSIMD4ExtAVX(pVect1v, pVect2v, qty_ptr);
@@ -143,6 +145,7 @@ InnerProductDistanceSIMD4ExtSSE(const void *pVect1v, const void *pVect2v, const
 
 #if defined(USE_AVX512)
 
+HNSWLIB_TARGET("avx512f")
 static float
 InnerProductSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float PORTABLE_ALIGN64 TmpRes[16];
@@ -198,6 +201,7 @@ InnerProductSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void
     return sum;
 }
 
+HNSWLIB_TARGET("avx512f")
 static float
 InnerProductDistanceSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     return 1.0f - InnerProductSIMD16ExtAVX512(pVect1v, pVect2v, qty_ptr);
@@ -207,6 +211,7 @@ InnerProductDistanceSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, co
 
 #if defined(USE_AVX)
 
+HNSWLIB_TARGET("avx")
 static float
 InnerProductSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float PORTABLE_ALIGN32 TmpRes[8];
@@ -243,6 +248,7 @@ InnerProductSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *q
     return sum;
 }
 
+HNSWLIB_TARGET("avx")
 static float
 InnerProductDistanceSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     return 1.0f - InnerProductSIMD16ExtAVX(pVect1v, pVect2v, qty_ptr);
@@ -339,8 +345,236 @@ InnerProductDistanceSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v,
 }
 #endif
 
+/*
+* Kernels specialized on the dimension, see L2SqrFixed. They return the distance 1 - <x, y>.
+*/
+template<size_t DIM>
+static float
+InnerProductDistanceFixed(const void *pVect1v, const void *pVect2v, const void *) {
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    float res = 0;
+    for (size_t i = 0; i < DIM; i++)
+        res += pVect1[i] * pVect2[i];
+    return 1.0f - res;
+}
+
+#if defined(USE_AVX512)
+template<size_t DIM>
+HNSWLIB_TARGET("avx512f")
+static float
+InnerProductDistanceFixedAVX512(const void *pVect1v, const void *pVect2v, const void *) {
+    static_assert(DIM % 32 == 0, "Dimension must be a multiple of 32");
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    for (size_t i = 0; i < DIM; i += 32) {
+        sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(pVect1 + i), _mm512_loadu_ps(pVect2 + i), sum0);
+        sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(pVect1 + i + 16), _mm512_loadu_ps(pVect2 + i + 16), sum1);
+    }
+    return 1.0f - _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+}
+#endif
+
+#if defined(USE_AVX)
+template<size_t DIM>
+HNSWLIB_TARGET("avx")
+static float
+InnerProductDistanceFixedAVX(const void *pVect1v, const void *pVect2v, const void *) {
+    static_assert(DIM % 32 == 0, "Dimension must be a multiple of 32");
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    float PORTABLE_ALIGN32 TmpRes[8];
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    for (size_t i = 0; i < DIM; i += 16) {
+        sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(pVect1 + i), _mm256_loadu_ps(pVect2 + i)));
+        sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(pVect1 + i + 8), _mm256_loadu_ps(pVect2 + i + 8)));
+    }
+    _mm256_store_ps(TmpRes, _mm256_add_ps(sum0, sum1));
+    return 1.0f - (TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7]);
+}
+#endif
+
+#if defined(USE_SSE)
+template<size_t DIM>
+static float
+InnerProductDistanceFixedSSE(const void *pVect1v, const void *pVect2v, const void *) {
+    static_assert(DIM % 32 == 0, "Dimension must be a multiple of 32");
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    float PORTABLE_ALIGN32 TmpRes[4];
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    for (size_t i = 0; i < DIM; i += 8) {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(pVect1 + i), _mm_loadu_ps(pVect2 + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(pVect1 + i + 4), _mm_loadu_ps(pVect2 + i + 4)));
+    }
+    _mm_store_ps(TmpRes, _mm_add_ps(sum0, sum1));
+    return 1.0f - (TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3]);
+}
+#endif
+
+template<size_t DIM>
+static DISTFUNC<float> InnerProductDistanceFixedKernel() {
+#if defined(USE_AVX512)
+    if (AVX512Capable())
+        return InnerProductDistanceFixedAVX512<DIM>;
+#endif
+#if defined(USE_AVX)
+    if (AVXCapable())
+        return InnerProductDistanceFixedAVX<DIM>;
+#endif
+#if defined(USE_SSE)
+    return InnerProductDistanceFixedSSE<DIM>;
+#else
+    return InnerProductDistanceFixed<DIM>;
+#endif
+}
+
+// Returns the specialized kernel for dim or nullptr if there is none
+static DISTFUNC<float> InnerProductDistanceFixedKernel(size_t dim) {
+    switch (dim) {
+#define HNSWLIB_FIXED_DIM_CASE(DIM) case DIM: return InnerProductDistanceFixedKernel<DIM>();
+    HNSWLIB_FOR_EACH_FIXED_DIM(HNSWLIB_FIXED_DIM_CASE)
+#undef HNSWLIB_FIXED_DIM_CASE
+    default:
+        return nullptr;
+    }
+}
+
+/*
+* Batch kernels computing the distances from one vector to n others, four at a time as the L2 batch kernels.
+*/
+#if !defined(USE_SSE)
+static void
+InnerProductDistanceBatch(const void *pVect1v, const void *const *pVects, size_t n, const void *qty_ptr, float *res) {
+    for (size_t i = 0; i < n; i++)
+        res[i] = InnerProductDistance(pVect1v, pVects[i], qty_ptr);
+}
+#endif
+
+#if defined(USE_AVX512)
+template<size_t N>
+HNSWLIB_TARGET("avx512f")
+static inline void
+InnerProductDistanceBlockAVX512(const float *pVect1, const void *const *pVects, size_t qty, float *res) {
+    size_t qty16 = qty >> 4 << 4;
+    __m512 sum[N];
+    for (size_t k = 0; k < N; k++)
+        sum[k] = _mm512_setzero_ps();
+    for (size_t i = 0; i < qty16; i += 16) {
+        __m512 v1 = _mm512_loadu_ps(pVect1 + i);
+        for (size_t k = 0; k < N; k++)
+            sum[k] = _mm512_fmadd_ps(v1, _mm512_loadu_ps((const float *) pVects[k] + i), sum[k]);
+    }
+    size_t qty_left = qty - qty16;
+    for (size_t k = 0; k < N; k++)
+        res[k] = 1.0f - (_mm512_reduce_add_ps(sum[k]) +
+                         InnerProduct(pVect1 + qty16, (const float *) pVects[k] + qty16, &qty_left));
+}
+
+HNSWLIB_TARGET("avx512f")
+static void
+InnerProductDistanceBatchAVX512(const void *pVect1v, const void *const *pVects, size_t n, const void *qty_ptr, float *res) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        InnerProductDistanceBlockAVX512<4>((const float *) pVect1v, pVects + i, qty, res + i);
+    for (; i < n; i++)
+        InnerProductDistanceBlockAVX512<1>((const float *) pVect1v, pVects + i, qty, res + i);
+}
+#endif
+
+#if defined(USE_AVX)
+template<size_t N>
+HNSWLIB_TARGET("avx")
+static inline void
+InnerProductDistanceBlockAVX(const float *pVect1, const void *const *pVects, size_t qty, float *res) {
+    float PORTABLE_ALIGN32 TmpRes[8];
+    size_t qty8 = qty >> 3 << 3;
+    __m256 sum[N];
+    for (size_t k = 0; k < N; k++)
+        sum[k] = _mm256_setzero_ps();
+    for (size_t i = 0; i < qty8; i += 8) {
+        __m256 v1 = _mm256_loadu_ps(pVect1 + i);
+        for (size_t k = 0; k < N; k++)
+            sum[k] = _mm256_add_ps(sum[k], _mm256_mul_ps(v1, _mm256_loadu_ps((const float *) pVects[k] + i)));
+    }
+    size_t qty_left = qty - qty8;
+    for (size_t k = 0; k < N; k++) {
+        _mm256_store_ps(TmpRes, sum[k]);
+        res[k] = 1.0f - (TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7] +
+                         InnerProduct(pVect1 + qty8, (const float *) pVects[k] + qty8, &qty_left));
+    }
+}
+
+HNSWLIB_TARGET("avx")
+static void
+InnerProductDistanceBatchAVX(const void *pVect1v, const void *const *pVects, size_t n, const void *qty_ptr, float *res) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        InnerProductDistanceBlockAVX<4>((const float *) pVect1v, pVects + i, qty, res + i);
+    for (; i < n; i++)
+        InnerProductDistanceBlockAVX<1>((const float *) pVect1v, pVects + i, qty, res + i);
+}
+#endif
+
+#if defined(USE_SSE)
+template<size_t N>
+static inline void
+InnerProductDistanceBlockSSE(const float *pVect1, const void *const *pVects, size_t qty, float *res) {
+    float PORTABLE_ALIGN32 TmpRes[4];
+    size_t qty4 = qty >> 2 << 2;
+    __m128 sum[N];
+    for (size_t k = 0; k < N; k++)
+        sum[k] = _mm_setzero_ps();
+    for (size_t i = 0; i < qty4; i += 4) {
+        __m128 v1 = _mm_loadu_ps(pVect1 + i);
+        for (size_t k = 0; k < N; k++)
+            sum[k] = _mm_add_ps(sum[k], _mm_mul_ps(v1, _mm_loadu_ps((const float *) pVects[k] + i)));
+    }
+    size_t qty_left = qty - qty4;
+    for (size_t k = 0; k < N; k++) {
+        _mm_store_ps(TmpRes, sum[k]);
+        res[k] = 1.0f - (TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] +
+                         InnerProduct(pVect1 + qty4, (const float *) pVects[k] + qty4, &qty_left));
+    }
+}
+
+static void
+InnerProductDistanceBatchSSE(const void *pVect1v, const void *const *pVects, size_t n, const void *qty_ptr, float *res) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        InnerProductDistanceBlockSSE<4>((const float *) pVect1v, pVects + i, qty, res + i);
+    for (; i < n; i++)
+        InnerProductDistanceBlockSSE<1>((const float *) pVect1v, pVects + i, qty, res + i);
+}
+#endif
+
+// Best batch kernel supported by the CPU
+static BATCHDISTFUNC<float> InnerProductDistanceBatchKernel() {
+#if defined(USE_AVX512)
+    if (AVX512Capable())
+        return InnerProductDistanceBatchAVX512;
+#endif
+#if defined(USE_AVX)
+    if (AVXCapable())
+        return InnerProductDistanceBatchAVX;
+#endif
+#if defined(USE_SSE)
+    return InnerProductDistanceBatchSSE;
+#else
+    return InnerProductDistanceBatch;
+#endif
+}
+
 class InnerProductSpace : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
+    BATCHDISTFUNC<float> batchdistfunc_;
     size_t data_size_;
     size_t dim_;
 
@@ -378,6 +612,9 @@ class InnerProductSpace : public SpaceInterface<float> {
         else if (dim > 4)
             fstdistfunc_ = InnerProductDistanceSIMD4ExtResiduals;
 #endif
+        if (DISTFUNC<float> fixed = InnerProductDistanceFixedKernel(dim))
+            fstdistfunc_ = fixed;
+        batchdistfunc_ = InnerProductDistanceBatchKernel();
         dim_ = dim;
         data_size_ = dim * sizeof(float);
     }
@@ -390,6 +627,10 @@ class InnerProductSpace : public SpaceInterface<float> {
         return fstdistfunc_;
     }
 
+    BATCHDISTFUNC<float> get_batch_dist_func() {
+        return batchdistfunc_;
+    }
+
     void *get_dist_func_param() {
         return &dim_;
     }
@@ -397,4 +638,36 @@ class InnerProductSpace : public SpaceInterface<float> {
 ~InnerProductSpace() {}
 };
 
+// Distance functor for HierarchicalNSW<float, InnerProductDistanceFixedDim<DIM>> with an InnerProductSpace,
+// see L2SqrFixedDim
+template<size_t DIM>
+struct InnerProductDistanceFixedDim {
+#ifdef HNSWLIB_FIXED_DIM_DISPATCH
+    DISTFUNC<float> kernel_{InnerProductDistanceFixedKernel<DIM>()};
+#endif
+
+    InnerProductDistanceFixedDim() {}
+
+    explicit InnerProductDistanceFixedDim(SpaceInterface<float> *s) {
+        if (dynamic_cast<InnerProductSpace *>(s) == nullptr)
+            throw std::runtime_error("Space of the index does not match the distance functor");
+        if (s->get_data_size() != DIM * sizeof(float))
+            throw std::runtime_error("Dimension of the space does not match the distance functor");
+    }
+
+    inline float operator()(const void *pVect1, const void *pVect2, const void *qty_ptr) const {
+#if defined(HNSWLIB_FIXED_DIM_DISPATCH)
+        return kernel_(pVect1, pVect2, qty_ptr);
+#elif defined(USE_AVX512)
+        return InnerProductDistanceFixedAVX512<DIM>(pVect1, pVect2, qty_ptr);
+#elif defined(USE_AVX)
+        return InnerProductDistanceFixedAVX<DIM>(pVect1, pVect2, qty_ptr);
+#elif defined(USE_SSE)
+        return InnerProductDistanceFixedSSE<DIM>(pVect1, pVect2, qty_ptr);
+#else
+        return InnerProductDistanceFixed<DIM>(pVect1, pVect2, qty_ptr);
+#endif
+    }
+};
+
 }  // namespace hnswlib
@@ -22,6 +22,7 @@ L2Sqr(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
 #if defined(USE_AVX512)
 
 // Favor using AVX512 if available.
+HNSWLIB_TARGET("avx512f")
 static float
 L2SqrSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float *pVect1 = (float *) pVect1v;
@@ -57,6 +58,7 @@ L2SqrSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_p
 #if defined(USE_AVX)
 
 // Favor using AVX if available.
+HNSWLIB_TARGET("avx")
 static float
 L2SqrSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float *pVect1 = (float *) pVect1v;
@@ -205,8 +207,254 @@ L2SqrSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty
 }
 #endif
 
+/*
+* Kernels specialized on the dimension, DIM must be a multiple of 32. The trip count is a compile-time
+* constant, so the loops are unrolled by the compiler, the dimension is not read from the parameter
+* and there is no residual handling.
+*/
+template<size_t DIM>
+static float
+L2SqrFixed(const void *pVect1v, const void *pVect2v, const void *) {
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    float res = 0;
+    for (size_t i = 0; i < DIM; i++) {
+        float t = pVect1[i] - pVect2[i];
+        res += t * t;
+    }
+    return res;
+}
+
+#if defined(USE_AVX512)
+template<size_t DIM>
+HNSWLIB_TARGET("avx512f")
+static float
+L2SqrFixedAVX512(const void *pVect1v, const void *pVect2v, const void *) {
+    static_assert(DIM % 32 == 0, "Dimension must be a multiple of 32");
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    for (size_t i = 0; i < DIM; i += 32) {
+        __m512 diff0 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i), _mm512_loadu_ps(pVect2 + i));
+        __m512 diff1 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i + 16), _mm512_loadu_ps(pVect2 + i + 16));
+        sum0 = _mm512_fmadd_ps(diff0, diff0, sum0);
+        sum1 = _mm512_fmadd_ps(diff1, diff1, sum1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+}
+#endif
+
+#if defined(USE_AVX)
+template<size_t DIM>
+HNSWLIB_TARGET("avx")
+static float
+L2SqrFixedAVX(const void *pVect1v, const void *pVect2v, const void *) {
+    static_assert(DIM % 32 == 0, "Dimension must be a multiple of 32");
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    float PORTABLE_ALIGN32 TmpRes[8];
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    for (size_t i = 0; i < DIM; i += 16) {
+        __m256 diff0 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i), _mm256_loadu_ps(pVect2 + i));
+        __m256 diff1 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i + 8), _mm256_loadu_ps(pVect2 + i + 8));
+        sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(diff0, diff0));
+        sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(diff1, diff1));
+    }
+    _mm256_store_ps(TmpRes, _mm256_add_ps(sum0, sum1));
+    return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+}
+#endif
+
+#if defined(USE_SSE)
+template<size_t DIM>
+static float
+L2SqrFixedSSE(const void *pVect1v, const void *pVect2v, const void *) {
+    static_assert(DIM % 32 == 0, "Dimension must be a multiple of 32");
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    float PORTABLE_ALIGN32 TmpRes[4];
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    for (size_t i = 0; i < DIM; i += 8) {
+        __m128 diff0 = _mm_sub_ps(_mm_loadu_ps(pVect1 + i), _mm_loadu_ps(pVect2 + i));
+        __m128 diff1 = _mm_sub_ps(_mm_loadu_ps(pVect1 + i + 4), _mm_loadu_ps(pVect2 + i + 4));
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(diff0, diff0));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(diff1, diff1));
+    }
+    _mm_store_ps(TmpRes, _mm_add_ps(sum0, sum1));
+    return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+}
+#endif
+
+// Best kernel for DIM supported by the CPU
+template<size_t DIM>
+static DISTFUNC<float> L2SqrFixedKernel() {
+#if defined(USE_AVX512)
+    if (AVX512Capable())
+        return L2SqrFixedAVX512<DIM>;
+#endif
+#if defined(USE_AVX)
+    if (AVXCapable())
+        return L2SqrFixedAVX<DIM>;
+#endif
+#if defined(USE_SSE)
+    return L2SqrFixedSSE<DIM>;
+#else
+    return L2SqrFixed<DIM>;
+#endif
+}
+
+// Returns the specialized kernel for dim or nullptr if there is none
+static DISTFUNC<float> L2SqrFixedKernel(size_t dim) {
+    switch (dim) {
+#define HNSWLIB_FIXED_DIM_CASE(DIM) case DIM: return L2SqrFixedKernel<DIM>();
+    HNSWLIB_FOR_EACH_FIXED_DIM(HNSWLIB_FIXED_DIM_CASE)
+#undef HNSWLIB_FIXED_DIM_CASE
+    default:
+        return nullptr;
+    }
+}
+
+/*
+* Batch kernels computing the distances from one vector to n others. The vectors are processed four at a time,
+* which shares the loads of the first vector and gives four independent sums to the SIMD units.
+* Any dimension, the residual of the SIMD width is added by the scalar kernel.
+*/
+#if !defined(USE_SSE)
+static void
+L2SqrBatch(const void *pVect1v, const void *const *pVects, size_t n, const void *qty_ptr, float *res) {
+    for (size_t i = 0; i < n; i++)
+        res[i] = L2Sqr(pVect1v, pVects[i], qty_ptr);
+}
+#endif
+
+#if defined(USE_AVX512)
+template<size_t N>
+HNSWLIB_TARGET("avx512f")
+static inline void
+L2SqrBlockAVX512(const float *pVect1, const void *const *pVects, size_t qty, float *res) {
+    size_t qty16 = qty >> 4 << 4;
+    __m512 sum[N];
+    for (size_t k = 0; k < N; k++)
+        sum[k] = _mm512_setzero_ps();
+    for (size_t i = 0; i < qty16; i += 16) {
+        __m512 v1 = _mm512_loadu_ps(pVect1 + i);
+        for (size_t k = 0; k < N; k++) {
+            __m512 diff = _mm512_sub_ps(v1, _mm512_loadu_ps((const float *) pVects[k] + i));
+            sum[k] = _mm512_fmadd_ps(diff, diff, sum[k]);
+        }
+    }
+    size_t qty_left = qty - qty16;
+    for (size_t k = 0; k < N; k++)
+        res[k] = _mm512_reduce_add_ps(sum[k]) + L2Sqr(pVect1 + qty16, (const float *) pVects[k] + qty16, &qty_left);
+}
+
+HNSWLIB_TARGET("avx512f")
+static void
+L2SqrBatchAVX512(const void *pVect1v, const void *const *pVects, size_t n, const void *qty_ptr, float *res) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        L2SqrBlockAVX512<4>((const float *) pVect1v, pVects + i, qty, res + i);
+    for (; i < n; i++)
+        L2SqrBlockAVX512<1>((const float *) pVect1v, pVects + i, qty, res + i);
+}
+#endif
+
+#if defined(USE_AVX)
+template<size_t N>
+HNSWLIB_TARGET("avx")
+static inline void
+L2SqrBlockAVX(const float *pVect1, const void *const *pVects, size_t qty, float *res) {
+    float PORTABLE_ALIGN32 TmpRes[8];
+    size_t qty8 = qty >> 3 << 3;
+    __m256 sum[N];
+    for (size_t k = 0; k < N; k++)
+        sum[k] = _mm256_setzero_ps();
+    for (size_t i = 0; i < qty8; i += 8) {
+        __m256 v1 = _mm256_loadu_ps(pVect1 + i);
+        for (size_t k = 0; k < N; k++) {
+            __m256 diff = _mm256_sub_ps(v1, _mm256_loadu_ps((const float *) pVects[k] + i));
+            sum[k] = _mm256_add_ps(sum[k], _mm256_mul_ps(diff, diff));
+        }
+    }
+    size_t qty_left = qty - qty8;
+    for (size_t k = 0; k < N; k++) {
+        _mm256_store_ps(TmpRes, sum[k]);
+        res[k] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7] +
+                 L2Sqr(pVect1 + qty8, (const float *) pVects[k] + qty8, &qty_left);
+    }
+}
+
+HNSWLIB_TARGET("avx")
+static void
+L2SqrBatchAVX(const void *pVect1v, const void *const *pVects, size_t n, const void *qty_ptr, float *res) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        L2SqrBlockAVX<4>((const float *) pVect1v, pVects + i, qty, res + i);
+    for (; i < n; i++)
+        L2SqrBlockAVX<1>((const float *) pVect1v, pVects + i, qty, res + i);
+}
+#endif
+
+#if defined(USE_SSE)
+template<size_t N>
+static inline void
+L2SqrBlockSSE(const float *pVect1, const void *const *pVects, size_t qty, float *res) {
+    float PORTABLE_ALIGN32 TmpRes[4];
+    size_t qty4 = qty >> 2 << 2;
+    __m128 sum[N];
+    for (size_t k = 0; k < N; k++)
+        sum[k] = _mm_setzero_ps();
+    for (size_t i = 0; i < qty4; i += 4) {
+        __m128 v1 = _mm_loadu_ps(pVect1 + i);
+        for (size_t k = 0; k < N; k++) {
+            __m128 diff = _mm_sub_ps(v1, _mm_loadu_ps((const float *) pVects[k] + i));
+            sum[k] = _mm_add_ps(sum[k], _mm_mul_ps(diff, diff));
+        }
+    }
+    size_t qty_left = qty - qty4;
+    for (size_t k = 0; k < N; k++) {
+        _mm_store_ps(TmpRes, sum[k]);
+        res[k] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] +
+                 L2Sqr(pVect1 + qty4, (const float *) pVects[k] + qty4, &qty_left);
+    }
+}
+
+static void
+L2SqrBatchSSE(const void *pVect1v, const void *const *pVects, size_t n, const void *qty_ptr, float *res) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        L2SqrBlockSSE<4>((const float *) pVect1v, pVects + i, qty, res + i);
+    for (; i < n; i++)
+        L2SqrBlockSSE<1>((const float *) pVect1v, pVects + i, qty, res + i);
+}
+#endif
+
+// Best batch kernel supported by the CPU
+static BATCHDISTFUNC<float> L2SqrBatchKernel() {
+#if defined(USE_AVX512)
+    if (AVX512Capable())
+        return L2SqrBatchAVX512;
+#endif
+#if defined(USE_AVX)
+    if (AVXCapable())
+        return L2SqrBatchAVX;
+#endif
+#if defined(USE_SSE)
+    return L2SqrBatchSSE;
+#else
+    return L2SqrBatch;
+#endif
+}
+
 class L2Space : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
+    BATCHDISTFUNC<float> batchdistfunc_;
     size_t data_size_;
     size_t dim_;
 
@@ -233,6 +481,9 @@ class L2Space : public SpaceInterface<float> {
         else if (dim > 4)
             fstdistfunc_ = L2SqrSIMD4ExtResiduals;
 #endif
+        if (DISTFUNC<float> fixed = L2SqrFixedKernel(dim))
+            fstdistfunc_ = fixed;
+        batchdistfunc_ = L2SqrBatchKernel();
         dim_ = dim;
         data_size_ = dim * sizeof(float);
     }
@@ -245,6 +496,10 @@ class L2Space : public SpaceInterface<float> {
         return fstdistfunc_;
     }
 
+    BATCHDISTFUNC<float> get_batch_dist_func() {
+        return batchdistfunc_;
+    }
+
     void *get_dist_func_param() {
         return &dim_;
     }
@@ -252,6 +507,45 @@ class L2Space : public SpaceInterface<float> {
     ~L2Space() {}
 };
 
+/*
+* Distance functor for HierarchicalNSW<float, L2SqrFixedDim<DIM>>. Any DIM which is a multiple of 32 can be used,
+* the index checks that its space is an L2Space of DIM floats.
+* The kernel is only called directly, and can be inlined into the search loops, when the compiler flags enable
+* the widest kernel which is compiled (e.g. -mavx512f with USE_AVX512, or HNSWLIB_NO_RUNTIME_DISPATCH).
+* Otherwise (HNSWLIB_FIXED_DIM_DISPATCH, which includes the default runtime dispatch build) it calls the kernel
+* selected for the CPU through a pointer, the same indirect call as the DISTFUNC of L2Space, so generic builds
+* gain nothing over HierarchicalNSW<float> and should use that.
+*/
+template<size_t DIM>
+struct L2SqrFixedDim {
+#ifdef HNSWLIB_FIXED_DIM_DISPATCH
+    DISTFUNC<float> kernel_{L2SqrFixedKernel<DIM>()};
+#endif
+
+    L2SqrFixedDim() {}
+
+    explicit L2SqrFixedDim(SpaceInterface<float> *s) {
+        if (dynamic_cast<L2Space *>(s) == nullptr)
+            throw std::runtime_error("Space of the index does not match the distance functor");
+        if (s->get_data_size() != DIM * sizeof(float))
+            throw std::runtime_error("Dimension of the space does not match the distance functor");
+    }
+
+    inline float operator()(const void *pVect1, const void *pVect2, const void *qty_ptr) const {
+#if defined(HNSWLIB_FIXED_DIM_DISPATCH)
+        return kernel_(pVect1, pVect2, qty_ptr);
+#elif defined(USE_AVX512)
+        return L2SqrFixedAVX512<DIM>(pVect1, pVect2, qty_ptr);
+#elif defined(USE_AVX)
+        return L2SqrFixedAVX<DIM>(pVect1, pVect2, qty_ptr);
+#elif defined(USE_SSE)
+        return L2SqrFixedSSE<DIM>(pVect1, pVect2, qty_ptr);
+#else
+        return L2SqrFixed<DIM>(pVect1, pVect2, qty_ptr);
+#endif
+    }
+};
+
 static int
 L2SqrI4x(const void *__restrict pVect1, const void *__restrict pVect2, const void *__restrict qty_ptr) {
     size_t qty = *((size_t *) qty_ptr);
@@ -0,0 +1,291 @@
+#pragma once
+#include "hnswlib.h"
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+namespace hnswlib {
+
+/*
+* Product quantization (PQ).
+* The vector is split into m subvectors of dim / m components, every subvector is replaced by the
+* index of the closest of 256 centroids trained by k-means on that subspace, so an encoded vector takes m bytes.
+*
+* The index stores the codes (pass encode()d vectors to addPoint) and compares them in two ways:
+*  - during construction code to code, with a table of the distances between the centroids of each subspace (SDC)
+*  - during search the raw fp32 query to codes, with a table of the distances between the query subvectors
+*    and the centroids built once per query by prepare_query (ADC)
+* The distances are approximate, exact ones can be computed for the final candidates with
+* HierarchicalNSW::searchKnnReranked and a full-precision VectorStore.
+*/
+struct PQDistParams {
+    size_t m;               // first member, so the parameter can be read like the one of other spaces
+    const float *sdc;       // m tables of 256 x 256 distances between centroids
+};
+
+static const size_t PQ_NUM_CENTROIDS = 256;
+
+// Sums m table entries selected by the codes, table j starts at tables + j * stride
+static float
+PQLookupSum(const float *tables, size_t stride, const uint8_t *codes, size_t m) {
+    float res0 = 0, res1 = 0, res2 = 0, res3 = 0;
+    size_t j = 0;
+    for (; j + 4 <= m; j += 4) {
+        res0 += tables[j * stride + codes[j]];
+        res1 += tables[(j + 1) * stride + codes[j + 1]];
+        res2 += tables[(j + 2) * stride + codes[j + 2]];
+        res3 += tables[(j + 3) * stride + codes[j + 3]];
+    }
+    for (; j < m; j++)
+        res0 += tables[j * stride + codes[j]];
+    return (res0 + res1) + (res2 + res3);
+}
+
+// Code to code: the table of subspace j is indexed by both codes
+static float
+PQSymmetricSum(const void *pVect1, const void *pVect2, const void *qty_ptr) {
+    const PQDistParams *param = (const PQDistParams *) qty_ptr;
+    const uint8_t *a = (const uint8_t *) pVect1;
+    const uint8_t *b = (const uint8_t *) pVect2;
+    const size_t table_size = PQ_NUM_CENTROIDS * PQ_NUM_CENTROIDS;
+    float res = 0;
+    for (size_t j = 0; j < param->m; j++)
+        res += param->sdc[j * table_size + a[j] * PQ_NUM_CENTROIDS + b[j]];
+    return res;
+}
+
+// Prepared query to code: the query is the table of m x 256 distances to the centroids
+static float
+PQAsymmetricSum(const void *pVect1, const void *pVect2, const void *qty_ptr) {
+    const PQDistParams *param = (const PQDistParams *) qty_ptr;
+    return PQLookupSum((const float *) pVect1, PQ_NUM_CENTROIDS, (const uint8_t *) pVect2, param->m);
+}
+
+static float
+PQL2Sqr(const void *pVect1, const void *pVect2, const void *qty_ptr) {
+    return PQSymmetricSum(pVect1, pVect2, qty_ptr);
+}
+
+static float
+PQL2SqrQuery(const void *pVect1, const void *pVect2, const void *qty_ptr) {
+    return PQAsymmetricSum(pVect1, pVect2, qty_ptr);
+}
+
+static float
+PQInnerProductDistance(const void *pVect1, const void *pVect2, const void *qty_ptr) {
+    return 1.0f - PQSymmetricSum(pVect1, pVect2, qty_ptr);
+}
+
+static float
+PQInnerProductDistanceQuery(const void *pVect1, const void *pVect2, const void *qty_ptr) {
+    return 1.0f - PQAsymmetricSum(pVect1, pVect2, qty_ptr);
+}
+
+
+class PQSpaceBase : public SpaceInterface<float> {
+ protected:
+    size_t dim_;
+    size_t m_;
+    size_t dsub_;
+    bool inner_product_;
+    std::vector<float> centroids_;  // m x 256 x dsub
+    std::vector<float> sdc_;
+    PQDistParams param_;
+
+    const float *centroid(size_t j, size_t c) const {
+        return centroids_.data() + (j * PQ_NUM_CENTROIDS + c) * dsub_;
+    }
+
+    float subDistance(const float *x, const float *y) const {
+        float res = 0;
+        if (inner_product_) {
+            for (size_t i = 0; i < dsub_; i++)
+                res += x[i] * y[i];
+        } else {
+            for (size_t i = 0; i < dsub_; i++) {
+                float t = x[i] - y[i];
+                res += t * t;
+            }
+        }
+        return res;
+    }
+
+    static float l2Sqr(const float *x, const float *y, size_t d) {
+        float res = 0;
+        for (size_t i = 0; i < d; i++) {
+            float t = x[i] - y[i];
+            res += t * t;
+        }
+        return res;
+    }
+
+    size_t closestCentroid(size_t j, const float *x) const {
+        size_t best = 0;
+        float best_dist = std::numeric_limits<float>::max();
+        for (size_t c = 0; c < PQ_NUM_CENTROIDS; c++) {
+            float dist = l2Sqr(x, centroid(j, c), dsub_);
+            if (dist < best_dist) {
+                best_dist = dist;
+                best = c;
+            }
+        }
+        return best;
+    }
+
+    void updateTables() {
+        const size_t table_size = PQ_NUM_CENTROIDS * PQ_NUM_CENTROIDS;
+        sdc_.resize(m_ * table_size);
+        for (size_t j = 0; j < m_; j++) {
+            for (size_t a = 0; a < PQ_NUM_CENTROIDS; a++) {
+                for (size_t b = 0; b < PQ_NUM_CENTROIDS; b++)
+                    sdc_[j * table_size + a * PQ_NUM_CENTROIDS + b] = subDistance(centroid(j, a), centroid(j, b));
+            }
+        }
+        param_.m = m_;
+        param_.sdc = sdc_.data();
+    }
+
+ public:
+    PQSpaceBase(size_t dim, size_t m, bool inner_product)
+        : dim_(dim), m_(m), inner_product_(inner_product) {
+        if (m == 0 || dim % m != 0)
+            throw std::runtime_error("PQ dimension must be a multiple of the number of subquantizers");
+        dsub_ = dim / m;
+        centroids_.assign(m_ * PQ_NUM_CENTROIDS * dsub_, 0.0f);
+        updateTables();
+    }
+
+    /*
+    * Trains the centroids with k-means on n vectors stored one after another, n must be at least 256.
+    * Must be called before the space is used by an index.
+    */
+    void train(const float *data, size_t n, size_t iterations = 20, unsigned int seed = 100) {
+        if (n < PQ_NUM_CENTROIDS)
+            throw std::runtime_error("Cannot train PQ quantizer with less than 256 vectors");
+        std::mt19937 rng(seed);
+        std::vector<float> sub(n * dsub_);
+        std::vector<size_t> assignment(n);
+        std::vector<size_t> counts(PQ_NUM_CENTROIDS);
+        std::vector<size_t> order(n);
+        for (size_t j = 0; j < m_; j++) {
+            for (size_t i = 0; i < n; i++)
+                memcpy(&sub[i * dsub_], data + i * dim_ + j * dsub_, dsub_ * sizeof(float));
+
+            // initialization with distinct random samples
+            for (size_t i = 0; i < n; i++)
+                order[i] = i;
+            std::shuffle(order.begin(), order.end(), rng);
+            float *cent = centroids_.data() + j * PQ_NUM_CENTROIDS * dsub_;
+            for (size_t c = 0; c < PQ_NUM_CENTROIDS; c++)
+                memcpy(cent + c * dsub_, &sub[order[c] * dsub_], dsub_ * sizeof(float));
+
+            for (size_t it = 0; it < iterations; it++) {
+                for (size_t i = 0; i < n; i++)
+                    assignment[i] = closestCentroid(j, &sub[i * dsub_]);
+
+                std::fill(cent, cent + PQ_NUM_CENTROIDS * dsub_, 0.0f);
+                std::fill(counts.begin(), counts.end(), 0);
+                for (size_t i = 0; i < n; i++) {
+                    float *c = cent + assignment[i] * dsub_;
+                    for (size_t d = 0; d < dsub_; d++)
+                        c[d] += sub[i * dsub_ + d];
+                    counts[assignment[i]]++;
+                }
+                for (size_t c = 0; c < PQ_NUM_CENTROIDS; c++) {
+                    if (counts[c] == 0) {
+                        // empty cluster, restart it from a random sample
+                        size_t i = rng() % n;
+                        memcpy(cent + c * dsub_, &sub[i * dsub_], dsub_ * sizeof(float));
+                        continue;
+                    }
+                    for (size_t d = 0; d < dsub_; d++)
+                        cent[c * dsub_ + d] /= counts[c];
+                }
+            }
+        }
+        updateTables();
+    }
+
+    // Writes get_data_size() bytes
+    void encode(const float *x, void *code) const {
+        uint8_t *codes = (uint8_t *) code;
+        for (size_t j = 0; j < m_; j++)
+            codes[j] = (uint8_t) closestCentroid(j, x + j * dsub_);
+    }
+
+    // Writes the dim reconstructed components
+    void decode(const void *code, float *x) const {
+        const uint8_t *codes = (const uint8_t *) code;
+        for (size_t j = 0; j < m_; j++)
+            memcpy(x + j * dsub_, centroid(j, codes[j]), dsub_ * sizeof(float));
+    }
+
+    // The dim * 256 centroid components, the 256 centroids of each subquantizer one after another
+    const float *getCentroids() const {
+        return centroids_.data();
+    }
+
+    /*
+    * Restores centroids read from getCentroids, e.g. saved next to the index, so that its codes are decoded
+    * and searched again without training. Must be called before the space is used by an index.
+    */
+    void setCentroids(const float *centroids) {
+        memcpy(centroids_.data(), centroids, centroids_.size() * sizeof(float));
+        updateTables();
+    }
+
+    size_t get_data_size() {
+        return m_;
+    }
+
+    void *get_dist_func_param() {
+        return &param_;
+    }
+
+    size_t get_query_size() {
+        return m_ * PQ_NUM_CENTROIDS * sizeof(float);
+    }
+
+    void prepare_query(const void *query, void *prepared) {
+        const float *x = (const float *) query;
+        float *table = (float *) prepared;
+        for (size_t j = 0; j < m_; j++) {
+            for (size_t c = 0; c < PQ_NUM_CENTROIDS; c++)
+                table[j * PQ_NUM_CENTROIDS + c] = subDistance(x + j * dsub_, centroid(j, c));
+        }
+    }
+
+    ~PQSpaceBase() {}
+};
+
+
+class L2SpacePQ : public PQSpaceBase {
+ public:
+    L2SpacePQ(size_t dim, size_t m) : PQSpaceBase(dim, m, false) {}
+
+    DISTFUNC<float> get_dist_func() {
+        return PQL2Sqr;
+    }
+
+    DISTFUNC<float> get_query_dist_func() {
+        return PQL2SqrQuery;
+    }
+};
+
+
+class InnerProductSpacePQ : public PQSpaceBase {
+ public:
+    InnerProductSpacePQ(size_t dim, size_t m) : PQSpaceBase(dim, m, true) {}
+
+    DISTFUNC<float> get_dist_func() {
+        return PQInnerProductDistance;
+    }
+
+    DISTFUNC<float> get_query_dist_func() {
+        return PQInnerProductDistanceQuery;
+    }
+};
+
+}  // namespace hnswlib
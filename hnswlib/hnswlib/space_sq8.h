@@ -0,0 +1,476 @@
+#pragma once
+#include "hnswlib.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace hnswlib {
+
+/*
+* Scalar quantization to 8 bits (SQ8).
+* Every component x_i is stored as the code c_i = round((x_i - min_i) / step_i), where step_i = (max_i - min_i) / 255.
+* min/max are either shared by all dimensions or trained per dimension.
+*
+* An encoded vector takes dim bytes of codes followed by a float with sum(min_i * step_i * c_i),
+* which lets the inner product be computed on the codes:
+*     <x, y> = sum(min_i^2) + t_x + t_y + sum(step_i^2 * c_i * d_i)
+* Both the data and the queries must be encoded with the same space before being passed to the index.
+*/
+struct SQ8DistParams {
+    size_t dim;              // first member, so the parameter can be read like the one of other spaces
+    float step2;             // squared step of the global quantizer
+    const float *weights;    // squared steps of the per-dimension quantizer, nullptr for the global one
+    float ip_constant;       // sum(min_i^2)
+};
+
+static float SQ8Correction(const void *pVect, size_t dim) {
+    float correction;
+    memcpy(&correction, (const uint8_t *) pVect + dim, sizeof(float));
+    return correction;
+}
+
+static int
+SQ8L2SqrInt(const uint8_t *a, const uint8_t *b, size_t qty) {
+    int res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        int diff = (int) a[i] - (int) b[i];
+        res += diff * diff;
+    }
+    return res;
+}
+
+static int
+SQ8DotInt(const uint8_t *a, const uint8_t *b, size_t qty) {
+    int res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        res += (int) a[i] * (int) b[i];
+    }
+    return res;
+}
+
+static float
+SQ8L2SqrWeighted(const uint8_t *a, const uint8_t *b, const float *w, size_t qty) {
+    float res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        float diff = (float) a[i] - (float) b[i];
+        res += w[i] * diff * diff;
+    }
+    return res;
+}
+
+static float
+SQ8DotWeighted(const uint8_t *a, const uint8_t *b, const float *w, size_t qty) {
+    float res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        res += w[i] * (float) a[i] * (float) b[i];
+    }
+    return res;
+}
+
+#if defined(USE_AVX2)
+
+HNSWLIB_TARGET("avx2")
+static int SQ8HorizontalSumAVX2(__m256i v) {
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+
+HNSWLIB_TARGET("avx2")
+static float SQ8HorizontalSumAVX2(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+// codes are widened to 16 bits, madd sums pairs of products into 32-bit lanes
+HNSWLIB_TARGET("avx2")
+static int
+SQ8L2SqrIntAVX2(const uint8_t *a, const uint8_t *b, size_t qty) {
+    __m256i sum = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= qty; i += 16) {
+        __m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (a + i)));
+        __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (b + i)));
+        __m256i diff = _mm256_sub_epi16(va, vb);
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(diff, diff));
+    }
+    return SQ8HorizontalSumAVX2(sum) + SQ8L2SqrInt(a + i, b + i, qty - i);
+}
+
+HNSWLIB_TARGET("avx2")
+static int
+SQ8DotIntAVX2(const uint8_t *a, const uint8_t *b, size_t qty) {
+    __m256i sum = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= qty; i += 16) {
+        __m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (a + i)));
+        __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (b + i)));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(va, vb));
+    }
+    return SQ8HorizontalSumAVX2(sum) + SQ8DotInt(a + i, b + i, qty - i);
+}
+
+HNSWLIB_TARGET("avx2")
+static float
+SQ8L2SqrWeightedAVX2(const uint8_t *a, const uint8_t *b, const float *w, size_t qty) {
+    __m256 sum = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= qty; i += 8) {
+        __m256i va = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (a + i)));
+        __m256i vb = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (b + i)));
+        __m256 diff = _mm256_cvtepi32_ps(_mm256_sub_epi32(va, vb));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(w + i), _mm256_mul_ps(diff, diff)));
+    }
+    return SQ8HorizontalSumAVX2(sum) + SQ8L2SqrWeighted(a + i, b + i, w + i, qty - i);
+}
+
+HNSWLIB_TARGET("avx2")
+static float
+SQ8DotWeightedAVX2(const uint8_t *a, const uint8_t *b, const float *w, size_t qty) {
+    __m256 sum = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= qty; i += 8) {
+        __m256i va = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (a + i)));
+        __m256i vb = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (b + i)));
+        __m256 prod = _mm256_cvtepi32_ps(_mm256_mullo_epi32(va, vb));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(w + i), prod));
+    }
+    return SQ8HorizontalSumAVX2(sum) + SQ8DotWeighted(a + i, b + i, w + i, qty - i);
+}
+
+#endif
+
+#if defined(USE_AVX512)
+
+// the weighted kernels widen the codes to 32 bits, which only needs AVX-512F
+HNSWLIB_TARGET("avx512f")
+static float
+SQ8L2SqrWeightedAVX512(const uint8_t *a, const uint8_t *b, const float *w, size_t qty) {
+    __m512 sum = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= qty; i += 16) {
+        __m512i va = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) (a + i)));
+        __m512i vb = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) (b + i)));
+        __m512 diff = _mm512_cvtepi32_ps(_mm512_sub_epi32(va, vb));
+        sum = _mm512_fmadd_ps(_mm512_loadu_ps(w + i), _mm512_mul_ps(diff, diff), sum);
+    }
+    return _mm512_reduce_add_ps(sum) + SQ8L2SqrWeighted(a + i, b + i, w + i, qty - i);
+}
+
+HNSWLIB_TARGET("avx512f")
+static float
+SQ8DotWeightedAVX512(const uint8_t *a, const uint8_t *b, const float *w, size_t qty) {
+    __m512 sum = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= qty; i += 16) {
+        __m512i va = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) (a + i)));
+        __m512i vb = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) (b + i)));
+        __m512 prod = _mm512_cvtepi32_ps(_mm512_mullo_epi32(va, vb));
+        sum = _mm512_fmadd_ps(_mm512_loadu_ps(w + i), prod, sum);
+    }
+    return _mm512_reduce_add_ps(sum) + SQ8DotWeighted(a + i, b + i, w + i, qty - i);
+}
+
+#endif
+
+#if defined(USE_AVX512BW)
+
+HNSWLIB_TARGET("avx512f,avx512bw")
+static int
+SQ8L2SqrIntAVX512(const uint8_t *a, const uint8_t *b, size_t qty) {
+    __m512i sum = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 32 <= qty; i += 32) {
+        __m512i va = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *) (a + i)));
+        __m512i vb = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *) (b + i)));
+        __m512i diff = _mm512_sub_epi16(va, vb);
+        sum = _mm512_add_epi32(sum, _mm512_madd_epi16(diff, diff));
+    }
+    return _mm512_reduce_add_epi32(sum) + SQ8L2SqrInt(a + i, b + i, qty - i);
+}
+
+HNSWLIB_TARGET("avx512f,avx512bw")
+static int
+SQ8DotIntAVX512(const uint8_t *a, const uint8_t *b, size_t qty) {
+    __m512i sum = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 32 <= qty; i += 32) {
+        __m512i va = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *) (a + i)));
+        __m512i vb = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *) (b + i)));
+        sum = _mm512_add_epi32(sum, _mm512_madd_epi16(va, vb));
+    }
+    return _mm512_reduce_add_epi32(sum) + SQ8DotInt(a + i, b + i, qty - i);
+}
+
+#if defined(USE_AVX512VNNI)
+
+// vpdpwssd fuses the 16-bit multiply with the 32-bit accumulation
+HNSWLIB_TARGET("avx512f,avx512bw,avx512vnni")
+static int
+SQ8L2SqrIntAVX512VNNI(const uint8_t *a, const uint8_t *b, size_t qty) {
+    __m512i sum = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 32 <= qty; i += 32) {
+        __m512i va = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *) (a + i)));
+        __m512i vb = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *) (b + i)));
+        __m512i diff = _mm512_sub_epi16(va, vb);
+        sum = _mm512_dpwssd_epi32(sum, diff, diff);
+    }
+    return _mm512_reduce_add_epi32(sum) + SQ8L2SqrInt(a + i, b + i, qty - i);
+}
+
+HNSWLIB_TARGET("avx512f,avx512bw,avx512vnni")
+static int
+SQ8DotIntAVX512VNNI(const uint8_t *a, const uint8_t *b, size_t qty) {
+    __m512i sum = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 32 <= qty; i += 32) {
+        __m512i va = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *) (a + i)));
+        __m512i vb = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *) (b + i)));
+        sum = _mm512_dpwssd_epi32(sum, va, vb);
+    }
+    return _mm512_reduce_add_epi32(sum) + SQ8DotInt(a + i, b + i, qty - i);
+}
+
+#endif
+#endif
+
+typedef int (*SQ8IntKernel)(const uint8_t *, const uint8_t *, size_t);
+typedef float (*SQ8WeightedKernel)(const uint8_t *, const uint8_t *, const float *, size_t);
+
+// Distance functions, instantiated for every kernel so that the kernel is inlined
+template<SQ8IntKernel kernel>
+static float
+SQ8L2SqrGlobal(const void *pVect1, const void *pVect2, const void *param_ptr) {
+    const SQ8DistParams *param = (const SQ8DistParams *) param_ptr;
+    return param->step2 * (float) kernel((const uint8_t *) pVect1, (const uint8_t *) pVect2, param->dim);
+}
+
+template<SQ8WeightedKernel kernel>
+static float
+SQ8L2SqrPerDimension(const void *pVect1, const void *pVect2, const void *param_ptr) {
+    const SQ8DistParams *param = (const SQ8DistParams *) param_ptr;
+    return kernel((const uint8_t *) pVect1, (const uint8_t *) pVect2, param->weights, param->dim);
+}
+
+template<SQ8IntKernel kernel>
+static float
+SQ8InnerProductDistanceGlobal(const void *pVect1, const void *pVect2, const void *param_ptr) {
+    const SQ8DistParams *param = (const SQ8DistParams *) param_ptr;
+    float dot = param->step2 * (float) kernel((const uint8_t *) pVect1, (const uint8_t *) pVect2, param->dim);
+    return 1.0f - (param->ip_constant + SQ8Correction(pVect1, param->dim) + SQ8Correction(pVect2, param->dim) + dot);
+}
+
+template<SQ8WeightedKernel kernel>
+static float
+SQ8InnerProductDistancePerDimension(const void *pVect1, const void *pVect2, const void *param_ptr) {
+    const SQ8DistParams *param = (const SQ8DistParams *) param_ptr;
+    float dot = kernel((const uint8_t *) pVect1, (const uint8_t *) pVect2, param->weights, param->dim);
+    return 1.0f - (param->ip_constant + SQ8Correction(pVect1, param->dim) + SQ8Correction(pVect2, param->dim) + dot);
+}
+
+
+/*
+* Base of the SQ8 spaces: holds the quantizer and encodes/decodes vectors.
+* The quantizer has to be trained (or given its range) before encoding.
+*/
+class SQ8SpaceBase : public SpaceInterface<float> {
+ protected:
+    size_t dim_;
+    bool per_dimension_;
+    std::vector<float> min_;   // one value for the global quantizer, dim_ values otherwise
+    std::vector<float> step_;
+    std::vector<float> weights_;
+    SQ8DistParams param_;
+    DISTFUNC<float> fstdistfunc_;
+
+    size_t rangeIndex(size_t i) const {
+        return per_dimension_ ? i : 0;
+    }
+
+    void updateParams() {
+        param_.dim = dim_;
+        param_.step2 = step_[0] * step_[0];
+        param_.ip_constant = 0;
+        for (size_t i = 0; i < dim_; i++) {
+            float m = min_[rangeIndex(i)];
+            param_.ip_constant += m * m;
+        }
+        if (per_dimension_) {
+            weights_.resize(dim_);
+            for (size_t i = 0; i < dim_; i++)
+                weights_[i] = step_[i] * step_[i];
+            param_.weights = weights_.data();
+        } else {
+            param_.weights = nullptr;
+        }
+    }
+
+ public:
+    SQ8SpaceBase(size_t dim, bool per_dimension) : dim_(dim), per_dimension_(per_dimension) {
+        // the integer kernels accumulate up to 255^2 per dimension in 32 bits
+        if (dim > (size_t) std::numeric_limits<int>::max() / (2 * 255 * 255))
+            throw std::runtime_error("Dimension is too large for SQ8 quantization");
+        size_t num_ranges = per_dimension ? dim : 1;
+        min_.assign(num_ranges, 0.0f);
+        step_.assign(num_ranges, 1.0f / 255);
+        updateParams();
+    }
+
+    // Sets the quantization range, min and max point to one value or to dim values for the per-dimension quantizer
+    void setRange(const float *min, const float *max) {
+        for (size_t r = 0; r < min_.size(); r++) {
+            if (max[r] < min[r])
+                throw std::runtime_error("Invalid SQ8 range");
+            min_[r] = min[r];
+            step_[r] = (max[r] - min[r]) / 255;
+        }
+        updateParams();
+    }
+
+    // Computes the range from n vectors stored one after another
+    void train(const float *data, size_t n) {
+        if (n == 0)
+            throw std::runtime_error("Cannot train SQ8 quantizer without data");
+        std::vector<float> min(min_.size(), std::numeric_limits<float>::max());
+        std::vector<float> max(min_.size(), std::numeric_limits<float>::lowest());
+        for (size_t j = 0; j < n; j++) {
+            for (size_t i = 0; i < dim_; i++) {
+                float x = data[j * dim_ + i];
+                size_t r = rangeIndex(i);
+                min[r] = std::min(min[r], x);
+                max[r] = std::max(max[r], x);
+            }
+        }
+        setRange(min.data(), max.data());
+    }
+
+    // Writes get_data_size() bytes
+    void encode(const float *x, void *code) const {
+        uint8_t *codes = (uint8_t *) code;
+        float correction = 0;
+        for (size_t i = 0; i < dim_; i++) {
+            size_t r = rangeIndex(i);
+            float c = step_[r] > 0 ? std::round((x[i] - min_[r]) / step_[r]) : 0.0f;
+            c = std::min(std::max(c, 0.0f), 255.0f);
+            codes[i] = (uint8_t) c;
+            correction += min_[r] * step_[r] * c;
+        }
+        memcpy(codes + dim_, &correction, sizeof(float));
+    }
+
+    void decode(const void *code, float *x) const {
+        const uint8_t *codes = (const uint8_t *) code;
+        for (size_t i = 0; i < dim_; i++) {
+            size_t r = rangeIndex(i);
+            x[i] = min_[r] + step_[r] * codes[i];
+        }
+    }
+
+    const std::vector<float> &getMin() const {
+        return min_;
+    }
+
+    const std::vector<float> &getStep() const {
+        return step_;
+    }
+
+    size_t get_data_size() {
+        return dim_ + sizeof(float);
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &param_;
+    }
+};
+
+
+class L2SpaceSQ8 : public SQ8SpaceBase {
+ public:
+    L2SpaceSQ8(size_t dim, bool per_dimension = false) : SQ8SpaceBase(dim, per_dimension) {
+        if (per_dimension) {
+            fstdistfunc_ = SQ8L2SqrPerDimension<SQ8L2SqrWeighted>;
+#if defined(USE_AVX512)
+            if (AVX512Capable()) {
+                fstdistfunc_ = SQ8L2SqrPerDimension<SQ8L2SqrWeightedAVX512>;
+                return;
+            }
+#endif
+#if defined(USE_AVX2)
+            if (AVX2Capable())
+                fstdistfunc_ = SQ8L2SqrPerDimension<SQ8L2SqrWeightedAVX2>;
+#endif
+        } else {
+            fstdistfunc_ = SQ8L2SqrGlobal<SQ8L2SqrInt>;
+#if defined(USE_AVX512BW)
+    #if defined(USE_AVX512VNNI)
+            if (AVX512VNNICapable()) {
+                fstdistfunc_ = SQ8L2SqrGlobal<SQ8L2SqrIntAVX512VNNI>;
+                return;
+            }
+    #endif
+            if (AVX512BWCapable()) {
+                fstdistfunc_ = SQ8L2SqrGlobal<SQ8L2SqrIntAVX512>;
+                return;
+            }
+#endif
+#if defined(USE_AVX2)
+            if (AVX2Capable())
+                fstdistfunc_ = SQ8L2SqrGlobal<SQ8L2SqrIntAVX2>;
+#endif
+        }
+    }
+
+    ~L2SpaceSQ8() {}
+};
+
+
+class InnerProductSpaceSQ8 : public SQ8SpaceBase {
+ public:
+    InnerProductSpaceSQ8(size_t dim, bool per_dimension = false) : SQ8SpaceBase(dim, per_dimension) {
+        if (per_dimension) {
+            fstdistfunc_ = SQ8InnerProductDistancePerDimension<SQ8DotWeighted>;
+#if defined(USE_AVX512)
+            if (AVX512Capable()) {
+                fstdistfunc_ = SQ8InnerProductDistancePerDimension<SQ8DotWeightedAVX512>;
+                return;
+            }
+#endif
+#if defined(USE_AVX2)
+            if (AVX2Capable())
+                fstdistfunc_ = SQ8InnerProductDistancePerDimension<SQ8DotWeightedAVX2>;
+#endif
+        } else {
+            fstdistfunc_ = SQ8InnerProductDistanceGlobal<SQ8DotInt>;
+#if defined(USE_AVX512BW)
+    #if defined(USE_AVX512VNNI)
+            if (AVX512VNNICapable()) {
+                fstdistfunc_ = SQ8InnerProductDistanceGlobal<SQ8DotIntAVX512VNNI>;
+                return;
+            }
+    #endif
+            if (AVX512BWCapable()) {
+                fstdistfunc_ = SQ8InnerProductDistanceGlobal<SQ8DotIntAVX512>;
+                return;
+            }
+#endif
+#if defined(USE_AVX2)
+            if (AVX2Capable())
+                fstdistfunc_ = SQ8InnerProductDistanceGlobal<SQ8DotIntAVX2>;
+#endif
+        }
+    }
+
+    ~InnerProductSpaceSQ8() {}
+};
+
+}  // namespace hnswlib
@@ -0,0 +1,146 @@
+#pragma once
+#include "hnswlib.h"
+#include "mapped_file.h"
+
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+namespace hnswlib {
+
+/*
+* Full-precision vectors kept outside of the index, e.g. for exact re-ranking of the results of a
+* quantized index. Vectors are addressed by label, row i holds the vector of label i.
+* read() may be called by several threads at the same time.
+*/
+class VectorStore {
+ public:
+    virtual size_t get_data_size() const = 0;
+
+    // Copies get_data_size() bytes of the vector of label into out
+    virtual void read(labeltype label, void *out) const = 0;
+
+    virtual ~VectorStore() {}
+};
+
+
+class MemoryVectorStore : public VectorStore {
+    size_t data_size_;
+    size_t num_rows_{0};
+    std::vector<char> data_;
+
+ public:
+    explicit MemoryVectorStore(size_t data_size, size_t max_elements = 0) : data_size_(data_size) {
+        data_.reserve(data_size_ * max_elements);
+    }
+
+    size_t get_data_size() const {
+        return data_size_;
+    }
+
+    size_t size() const {
+        return num_rows_;
+    }
+
+    // Not thread-safe, rows between the previous last one and label are zero-filled
+    void add(labeltype label, const void *data) {
+        if (label >= num_rows_) {
+            num_rows_ = label + 1;
+            data_.resize(num_rows_ * data_size_);
+        }
+        memcpy(data_.data() + label * data_size_, data, data_size_);
+    }
+
+    void read(labeltype label, void *out) const {
+        if (label >= num_rows_)
+            throw std::runtime_error("Label not found in the vector store");
+        memcpy(out, data_.data() + label * data_size_, data_size_);
+    }
+
+    // Writes the rows one after another, the file can be opened with FileVectorStore
+    void save(const std::string &location) const {
+        std::ofstream output(location, std::ios::binary);
+        output.write(data_.data(), num_rows_ * data_size_);
+        if (!output)
+            throw std::runtime_error("Cannot write vector store file");
+    }
+};
+
+
+/*
+* Vectors read from a local file of rows stored one after another (see MemoryVectorStore::save).
+* Every read() is a positioned read of one row, so only the re-ranked candidates are loaded.
+*/
+class FileVectorStore : public VectorStore {
+    size_t data_size_;
+    size_t num_rows_;
+#ifdef HNSWLIB_HAS_MMAP
+    int fd_;
+#else
+    mutable std::ifstream input_;
+    mutable std::mutex input_lock_;
+#endif
+
+ public:
+    FileVectorStore(const std::string &location, size_t data_size) : data_size_(data_size) {
+        if (data_size == 0)
+            throw std::runtime_error("Invalid vector size");
+#ifdef HNSWLIB_HAS_MMAP
+        fd_ = open(location.c_str(), O_RDONLY);
+        if (fd_ < 0)
+            throw std::runtime_error("Cannot open file");
+        struct stat st;
+        if (fstat(fd_, &st) != 0) {
+            close(fd_);
+            throw std::runtime_error("Cannot stat file");
+        }
+        num_rows_ = st.st_size / data_size_;
+#else
+        input_.open(location, std::ios::binary);
+        if (!input_.is_open())
+            throw std::runtime_error("Cannot open file");
+        input_.seekg(0, input_.end);
+        num_rows_ = input_.tellg() / data_size_;
+#endif
+    }
+
+    FileVectorStore(const FileVectorStore &) = delete;
+    FileVectorStore &operator=(const FileVectorStore &) = delete;
+
+    ~FileVectorStore() {
+#ifdef HNSWLIB_HAS_MMAP
+        close(fd_);
+#endif
+    }
+
+    size_t get_data_size() const {
+        return data_size_;
+    }
+
+    size_t size() const {
+        return num_rows_;
+    }
+
+    void read(labeltype label, void *out) const {
+        if (label >= num_rows_)
+            throw std::runtime_error("Label not found in the vector store");
+#ifdef HNSWLIB_HAS_MMAP
+        char *dst = (char *) out;
+        size_t done = 0;
+        while (done < data_size_) {
+            ssize_t res = pread(fd_, dst + done, data_size_ - done, (off_t) (label * data_size_ + done));
+            if (res <= 0)
+                throw std::runtime_error("Cannot read vector store file");
+            done += res;
+        }
+#else
+        std::unique_lock<std::mutex> lock(input_lock_);
+        input_.seekg(label * data_size_, input_.beg);
+        input_.read((char *) out, data_size_);
+        if (!input_)
+            throw std::runtime_error("Cannot read vector store file");
+#endif
+    }
+};
+}  // namespace hnswlib
@@ -1,12 +1,25 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <stdint.h>
 #include <string.h>
-#include <deque>
 
 namespace hnswlib {
 typedef unsigned short int vl_type;
 
+// Implementation of the visited set used by searches
+enum class VisitedSetType {
+    Auto,   // chosen per search from ef and the index size
+    Dense,  // VisitedList: one tag per element of the index
+    Hash    // VisitedHashSet: memory proportional to the number of visited elements
+};
+
 class VisitedList {
  public:
     vl_type curV;
@@ -27,52 +40,372 @@ class VisitedList {
         }
     }
 
+    // Marks the element as visited, returns false if it was already visited or if it was added to the index
+    // after the list was allocated (id >= numelements), so the search skips it
+    inline bool visit(unsigned int id) {
+        if (id >= numelements || mass[id] == curV)
+            return false;
+        mass[id] = curV;
+        return true;
+    }
+
+    inline void prefetch(unsigned int id) const {
+#ifdef USE_SSE
+        _mm_prefetch((char *) (mass + id), _MM_HINT_T0);
+#endif
+    }
+
     ~VisitedList() { delete[] mass; }
 };
+
+
+/*
+* Visited set for searches which touch a small part of a large index: an open-addressing hash table
+* with linear probing. Every entry stores the id together with the epoch in which it was inserted,
+* so reset() only increments the epoch. The table doubles when it gets half full and keeps its size
+* when reused, so its memory follows the number of elements visited by a search instead of the
+* index size, and the entries of a search stay in a few cache lines and pages.
+*/
+class VisitedHashSet {
+    uint64_t *table_{nullptr};
+    size_t capacity_{0};  // power of two
+    size_t size_{0};
+    int shift_{0};
+    uint32_t epoch_{0};
+
+    void allocate(size_t capacity) {
+        table_ = new uint64_t[capacity];
+        memset(table_, 0, sizeof(uint64_t) * capacity);
+        capacity_ = capacity;
+        shift_ = 64;
+        while (capacity > 1) {
+            capacity >>= 1;
+            shift_--;
+        }
+    }
+
+    // Fibonacci hashing, takes the high bits of the product
+    inline size_t bucket(unsigned int id) const {
+        return (size_t) ((id * 0x9E3779B97F4A7C15ull) >> shift_);
+    }
+
+    void grow() {
+        uint64_t *old_table = table_;
+        size_t old_capacity = capacity_;
+        allocate(2 * old_capacity);
+        for (size_t i = 0; i < old_capacity; i++) {
+            uint64_t entry = old_table[i];
+            if ((uint32_t) (entry >> 32) != epoch_)
+                continue;
+            size_t j = bucket((unsigned int) entry);
+            while (table_[j] != 0)
+                j = (j + 1) & (capacity_ - 1);
+            table_[j] = entry;
+        }
+        delete[] old_table;
+    }
+
+ public:
+    static const size_t MIN_CAPACITY = 1024;
+
+    // The table starts small and grows on demand, independently of the size of the index
+    explicit VisitedHashSet(size_t initial_capacity = MIN_CAPACITY) {
+        size_t capacity = MIN_CAPACITY;
+        while (capacity < initial_capacity)
+            capacity <<= 1;
+        allocate(capacity);
+    }
+
+    VisitedHashSet(const VisitedHashSet &) = delete;
+    VisitedHashSet &operator=(const VisitedHashSet &) = delete;
+
+    void reset() {
+        size_ = 0;
+        epoch_++;
+        if (epoch_ == 0) {
+            memset(table_, 0, sizeof(uint64_t) * capacity_);
+            epoch_++;
+        }
+    }
+
+    // Marks the element as visited, returns false if it was already visited
+    inline bool visit(unsigned int id) {
+        uint64_t key = ((uint64_t) epoch_ << 32) | id;
+        for (size_t i = bucket(id);; i = (i + 1) & (capacity_ - 1)) {
+            uint64_t entry = table_[i];
+            if (entry == key)
+                return false;
+            if ((uint32_t) (entry >> 32) != epoch_) {
+                table_[i] = key;
+                if (++size_ * 2 > capacity_)
+                    grow();
+                return true;
+            }
+        }
+    }
+
+    inline void prefetch(unsigned int id) const {
+#ifdef USE_SSE
+        _mm_prefetch((char *) (table_ + bucket(id)), _MM_HINT_T0);
+#endif
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    ~VisitedHashSet() { delete[] table_; }
+};
+
+
+// Whether a pooled set can be used for an index of numelements elements
+inline bool visitedSetFits(const VisitedList *vl, unsigned int numelements) {
+    return vl->numelements >= numelements;
+}
+
+inline bool visitedSetFits(const VisitedHashSet *, unsigned int) {
+    return true;
+}
+
+// Allocates a set for an index of numelements elements
+template<typename List>
+List *newVisitedSet(unsigned int numelements);
+
+template<>
+inline VisitedList *newVisitedSet<VisitedList>(unsigned int numelements) {
+    return new VisitedList(numelements);
+}
+
+template<>
+inline VisitedHashSet *newVisitedSet<VisitedHashSet>(unsigned int) {
+    return new VisitedHashSet();
+}
+
+class VisitedSetPoolInterface {
+ public:
+    // Frees one of the free sets of the pool, returns false if there is none
+    virtual bool freeIdleVisitedSet() = 0;
+
+    virtual ~VisitedSetPoolInterface() {}
+};
+
+
+/*
+* Limit of the visited sets alive at the same time, shared by the pools of an index so that dense lists
+* and hash sets count against the same limit. A pool which reaches the limit first frees the free sets
+* of the pools sharing it, so sets idle in one pool do not block the other one.
+*/
+class VisitedSetLimit {
+    std::atomic<size_t> num_sets_{0};
+    size_t max_sets_;
+    std::mutex pools_lock_;
+    std::vector<VisitedSetPoolInterface *> pools_;
+
+ public:
+    // max_sets of 0 means unlimited
+    explicit VisitedSetLimit(size_t max_sets = 0) : max_sets_(max_sets) {}
+
+    VisitedSetLimit(const VisitedSetLimit &) = delete;
+    VisitedSetLimit &operator=(const VisitedSetLimit &) = delete;
+
+    // Counts a new set, returns false if max_sets sets are already alive and no free set could be freed
+    bool tryAddSet(bool ignore_limit = false) {
+        size_t num_sets = num_sets_.fetch_add(1);
+        if (ignore_limit || !max_sets_ || num_sets < max_sets_)
+            return true;
+        num_sets_--;
+        if (!freeIdleVisitedSet())
+            return false;
+        return tryAddSet();
+    }
+
+    void removeSet() {
+        num_sets_--;
+    }
+
+    size_t getMaxSets() const {
+        return max_sets_;
+    }
+
+    size_t getNumSets() const {
+        return num_sets_;
+    }
+
+    void addPool(VisitedSetPoolInterface *pool) {
+        std::unique_lock <std::mutex> lock(pools_lock_);
+        pools_.push_back(pool);
+    }
+
+    void removePool(VisitedSetPoolInterface *pool) {
+        std::unique_lock <std::mutex> lock(pools_lock_);
+        pools_.erase(std::remove(pools_.begin(), pools_.end(), pool), pools_.end());
+    }
+
+ private:
+    bool freeIdleVisitedSet() {
+        std::unique_lock <std::mutex> lock(pools_lock_);
+        for (VisitedSetPoolInterface *pool : pools_) {
+            if (pool->freeIdleVisitedSet())
+                return true;
+        }
+        return false;
+    }
+};
+
 ///////////////////////////////////////////////////////////
 //
 // Class for multi-threaded pool-management of VisitedLists
 //
 /////////////////////////////////////////////////////////
 
-class VisitedListPool {
-    std::deque<VisitedList *> pool;
-    std::mutex poolguard;
-    int numelements;
+/*
+* Lock-free pool: free lists are kept in a fixed array of slots which are taken with an atomic exchange
+* and refilled with a compare-and-swap, so the query path never takes a lock or allocates once warmed up.
+* Every thread starts scanning at its own slot, so a thread usually gets back the list it released
+* (still hot in its cache) and threads rarely touch the same slot.
+*
+* Every list takes numelements * sizeof(vl_type) bytes. The limit (see VisitedSetLimit) bounds the number
+* of lists alive at the same time in all the pools sharing it; when it is reached getFreeVisitedList waits
+* until a list is released. Lists released while all slots are occupied are freed, so idle memory is
+* bounded by the number of slots.
+*/
+template<typename List>
+class BasicVisitedListPool : public VisitedSetPoolInterface {
+    struct Slot {
+        std::atomic<List *> list;
+        char padding_[64 - sizeof(std::atomic<List *>)];
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t num_slots_;
+    std::atomic<size_t> num_lists_{0};
+    std::shared_ptr<VisitedSetLimit> limit_;
+    std::atomic<int> numelements;
+
+    size_t threadSlot() const {
+        static thread_local size_t thread_hash = std::hash<std::thread::id>()(std::this_thread::get_id());
+        return thread_hash % num_slots_;
+    }
+
+    List *takeFreeList() {
+        size_t start = threadSlot();
+        for (size_t i = 0; i < num_slots_; i++) {
+            std::atomic<List *> &slot = slots_[(start + i) % num_slots_].list;
+            if (slot.load(std::memory_order_relaxed) != nullptr) {
+                List *rez = slot.exchange(nullptr, std::memory_order_acquire);
+                if (rez != nullptr)
+                    return rez;
+            }
+        }
+        return nullptr;
+    }
+
+    void deleteList(List *vl) {
+        delete vl;
+        num_lists_--;
+        limit_->removeSet();
+    }
 
  public:
-    VisitedListPool(int initmaxpools, int numelements1) {
+    // max_lists (0 means unlimited) bounds the number of lists alive in this pool
+    BasicVisitedListPool(int initmaxpools, int numelements1, size_t max_lists = 0)
+        : BasicVisitedListPool(initmaxpools, numelements1, std::make_shared<VisitedSetLimit>(max_lists)) {}
+
+    // The limit may be shared with other pools
+    BasicVisitedListPool(int initmaxpools, int numelements1, std::shared_ptr<VisitedSetLimit> limit) {
         numelements = numelements1;
-        for (int i = 0; i < initmaxpools; i++)
-            pool.push_front(new VisitedList(numelements));
-    }
-
-    VisitedList *getFreeVisitedList() {
-        VisitedList *rez;
-        {
-            std::unique_lock <std::mutex> lock(poolguard);
-            if (pool.size() > 0) {
-                rez = pool.front();
-                pool.pop_front();
-            } else {
-                rez = new VisitedList(numelements);
+        limit_ = std::move(limit);
+        size_t max_lists = limit_->getMaxSets();
+        size_t num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        // room for a few lists per thread, e.g. the ones held by a batched search
+        num_slots_ = std::max<size_t>(std::max<size_t>(initmaxpools, max_lists), 8 * num_threads);
+        slots_.reset(new Slot[num_slots_]);
+        for (size_t i = 0; i < num_slots_; i++)
+            slots_[i].list.store(nullptr, std::memory_order_relaxed);
+        for (int i = 0; i < initmaxpools && limit_->tryAddSet(); i++) {
+            slots_[i].list.store(newVisitedSet<List>(numelements), std::memory_order_relaxed);
+            num_lists_++;
+        }
+        limit_->addPool(this);
+    }
+
+    // Returns a reset list, waits if the limit of lists is reached
+    List *getFreeVisitedList() {
+        List *rez = tryGetFreeVisitedList();
+        while (rez == nullptr) {
+            std::this_thread::yield();
+            rez = tryGetFreeVisitedList();
+        }
+        return rez;
+    }
+
+    // Returns a reset list or nullptr if the limit of lists is reached, ignore_limit allocates a list anyway
+    List *tryGetFreeVisitedList(bool ignore_limit = false) {
+        List *rez = takeFreeList();
+        if (rez != nullptr && !visitedSetFits(rez, numelements)) {
+            // allocated before the index grew
+            deleteList(rez);
+            rez = nullptr;
+        }
+        if (rez == nullptr) {
+            if (!limit_->tryAddSet(ignore_limit))
+                return nullptr;
+            try {
+                rez = newVisitedSet<List>(numelements);
+            } catch (...) {
+                limit_->removeSet();
+                throw;
             }
+            num_lists_++;
         }
         rez->reset();
         return rez;
     }
 
-    void releaseVisitedList(VisitedList *vl) {
-        std::unique_lock <std::mutex> lock(poolguard);
-        pool.push_front(vl);
+    void releaseVisitedList(List *vl) {
+        size_t start = threadSlot();
+        for (size_t i = 0; i < num_slots_; i++) {
+            std::atomic<List *> &slot = slots_[(start + i) % num_slots_].list;
+            List *expected = nullptr;
+            if (slot.load(std::memory_order_relaxed) == nullptr &&
+                slot.compare_exchange_strong(expected, vl, std::memory_order_release, std::memory_order_relaxed))
+                return;
+        }
+        deleteList(vl);
+    }
+
+    bool freeIdleVisitedSet() override {
+        List *vl = takeFreeList();
+        if (vl == nullptr)
+            return false;
+        deleteList(vl);
+        return true;
     }
 
-    ~VisitedListPool() {
-        while (pool.size()) {
-            VisitedList *rez = pool.front();
-            pool.pop_front();
-            delete rez;
+    // Lists handed out from now on hold numelements1 elements, smaller pooled lists are replaced when taken
+    void setNumElements(int numelements1) {
+        numelements = numelements1;
+    }
+
+    // Number of lists currently allocated, both free and in use
+    size_t getNumLists() const {
+        return num_lists_;
+    }
+
+    ~BasicVisitedListPool() {
+        limit_->removePool(this);
+        for (size_t i = 0; i < num_slots_; i++) {
+            List *vl = slots_[i].list.load();
+            if (vl != nullptr)
+                deleteList(vl);
         }
     }
 };
+
+typedef BasicVisitedListPool<VisitedList> VisitedListPool;
+typedef BasicVisitedListPool<VisitedHashSet> VisitedHashSetPool;
 }  // namespace hnswlib
@@ -4,6 +4,7 @@
 #include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 #include "hnswlib.h"
+#include "parallel_for.h"
 #include <thread>
 #include <atomic>
 #include <stdlib.h>
@@ -12,67 +13,6 @@
 namespace py = pybind11;
 using namespace pybind11::literals;  // needed to bring in _a literal
 
-/*
- * replacement for the openmp '#pragma omp parallel for' directive
- * only handles a subset of functionality (no reductions etc)
- * Process ids from start (inclusive) to end (EXCLUSIVE)
- *
- * The method is borrowed from nmslib
- */
-template<class Function>
-inline void ParallelFor(size_t start, size_t end, size_t numThreads, Function fn) {
-    if (numThreads <= 0) {
-        numThreads = std::thread::hardware_concurrency();
-    }
-
-    if (numThreads == 1) {
-        for (size_t id = start; id < end; id++) {
-            fn(id, 0);
-        }
-    } else {
-        std::vector<std::thread> threads;
-        std::atomic<size_t> current(start);
-
-        // keep track of exceptions in threads
-        // https://stackoverflow.com/a/32428427/1713196
-        std::exception_ptr lastException = nullptr;
-        std::mutex lastExceptMutex;
-
-        for (size_t threadId = 0; threadId < numThreads; ++threadId) {
-            threads.push_back(std::thread([&, threadId] {
-                while (true) {
-                    size_t id = current.fetch_add(1);
-
-                    if (id >= end) {
-                        break;
-                    }
-
-                    try {
-                        fn(id, threadId);
-                    } catch (...) {
-                        std::unique_lock<std::mutex> lastExcepLock(lastExceptMutex);
-                        lastException = std::current_exception();
-                        /*
-                         * This will work even when current is the largest value that
-                         * size_t can fit, because fetch_add returns the previous value
-                         * before the increment (what will result in overflow
-                         * and produce 0 instead of current + 1).
-                         */
-                        current = end;
-                        break;
-                    }
-                }
-            }));
-        }
-        for (auto &thread : threads) {
-            thread.join();
-        }
-        if (lastException) {
-            std::rethrow_exception(lastException);
-        }
-    }
-}
-
 
 inline void assert_true(bool expr, const std::string & msg) {
     if (expr == false) throw std::runtime_error("Unpickle Error: " + msg);
@@ -112,6 +52,62 @@ inline void get_input_array_shapes(const py::buffer_info& buffer, size_t* rows,
 }
 
 
+// Type of the stored vectors, selected by the "_f16" / "_bf16" suffix of the space name
+enum class VectorStorage { Float32, Float16, BFloat16 };
+
+
+inline hnswlib::SpaceInterface<float>* create_space(
+    const std::string& space_name, int dim, bool* normalize, VectorStorage* storage) {
+    std::string metric = space_name;
+    *storage = VectorStorage::Float32;
+    if (metric.size() > 4 && metric.compare(metric.size() - 4, 4, "_f16") == 0) {
+        metric.resize(metric.size() - 4);
+        *storage = VectorStorage::Float16;
+    } else if (metric.size() > 5 && metric.compare(metric.size() - 5, 5, "_bf16") == 0) {
+        metric.resize(metric.size() - 5);
+        *storage = VectorStorage::BFloat16;
+    }
+
+    *normalize = metric == "cosine";
+    if (metric == "l2") {
+        if (*storage == VectorStorage::Float16)
+            return new hnswlib::L2SpaceF16(dim);
+        if (*storage == VectorStorage::BFloat16)
+            return new hnswlib::L2SpaceBF16(dim);
+        return new hnswlib::L2Space(dim);
+    } else if (metric == "ip" || metric == "cosine") {
+        if (*storage == VectorStorage::Float16)
+            return new hnswlib::InnerProductSpaceF16(dim);
+        if (*storage == VectorStorage::BFloat16)
+            return new hnswlib::InnerProductSpaceBF16(dim);
+        return new hnswlib::InnerProductSpace(dim);
+    }
+    throw std::runtime_error("Space name must be one of l2, ip, or cosine, optionally with the _f16 or _bf16 suffix.");
+}
+
+
+// Converts an fp32 vector to the half precision storage type
+inline void convert_vector(const float* data, void* out, int dim, VectorStorage storage) {
+    if (storage == VectorStorage::Float16) {
+        hnswlib::ConvertFloatToF16(data, (uint16_t*)out, dim);
+    } else {
+        hnswlib::ConvertFloatToBF16(data, (uint16_t*)out, dim);
+    }
+}
+
+
+// Converts a vector stored in half precision back to fp32
+inline std::vector<float> convert_stored_vector(const std::vector<uint16_t>& stored, VectorStorage storage) {
+    std::vector<float> data(stored.size());
+    if (storage == VectorStorage::Float16) {
+        hnswlib::ConvertF16ToFloat(stored.data(), data.data(), stored.size());
+    } else {
+        hnswlib::ConvertBF16ToFloat(stored.data(), data.data(), stored.size());
+    }
+    return data;
+}
+
+
 inline std::vector<size_t> get_input_ids_and_check_shapes(const py::object& ids_, size_t feature_rows) {
     std::vector<size_t> ids;
     if (!ids_.is_none()) {
@@ -146,6 +142,7 @@ template<typename dist_t, typename data_t = float>
 class Index {
  public:
     static const int ser_version = 1;  // serialization version
+    static const size_t search_batch_size = 8;  // number of queries traversed together by knn_query
 
     std::string space_name;
     int dim;
@@ -155,6 +152,7 @@ class Index {
     bool index_inited;
     bool ep_added;
     bool normalize;
+    VectorStorage storage;
     int num_threads_default;
     hnswlib::labeltype cur_l;
     hnswlib::HierarchicalNSW<dist_t>* appr_alg;
@@ -162,17 +160,7 @@ class Index {
 
 
     Index(const std::string &space_name, const int dim) : space_name(space_name), dim(dim) {
-        normalize = false;
-        if (space_name == "l2") {
-            l2space = new hnswlib::L2Space(dim);
-        } else if (space_name == "ip") {
-            l2space = new hnswlib::InnerProductSpace(dim);
-        } else if (space_name == "cosine") {
-            l2space = new hnswlib::InnerProductSpace(dim);
-            normalize = true;
-        } else {
-            throw std::runtime_error("Space name must be one of l2, ip, or cosine.");
-        }
+        l2space = create_space(space_name, dim, &normalize, &storage);
         appr_alg = NULL;
         ep_added = true;
         index_inited = false;
@@ -194,12 +182,14 @@ class Index {
         size_t M,
         size_t efConstruction,
         size_t random_seed,
-        bool allow_replace_deleted) {
+        bool allow_replace_deleted,
+        bool store_link_distances) {
         if (appr_alg) {
             throw std::runtime_error("The index is already initiated.");
         }
         cur_l = 0;
-        appr_alg = new hnswlib::HierarchicalNSW<dist_t>(l2space, maxElements, M, efConstruction, random_seed, allow_replace_deleted);
+        appr_alg = new hnswlib::HierarchicalNSW<dist_t>(l2space, maxElements, M, efConstruction, random_seed, allow_replace_deleted,
+                                                        hnswlib::IndexLayout::Interleaved, nullptr, store_link_distances);
         index_inited = true;
         ep_added = false;
         appr_alg->ef_ = default_ef;
@@ -227,6 +217,46 @@ class Index {
     }
 
 
+    void saveSnapshot(const std::string &path_to_index) {
+        // other python threads keep adding and querying during the snapshot
+        py::gil_scoped_release l;
+        appr_alg->saveSnapshot(path_to_index);
+    }
+
+
+    void openOperationLog(const std::string &path_to_log, bool sync) {
+        appr_alg->openOperationLog(path_to_log, sync);
+    }
+
+
+    void closeOperationLog() {
+        appr_alg->closeOperationLog();
+    }
+
+
+    void syncOperationLog() {
+        py::gil_scoped_release l;
+        appr_alg->syncOperationLog();
+    }
+
+
+    void checkpoint(const std::string &path_to_index) {
+        py::gil_scoped_release l;
+        appr_alg->checkpoint(path_to_index);
+    }
+
+
+    size_t replayOperationLog(const std::string &path_to_log) {
+        size_t num_applied;
+        {
+            py::gil_scoped_release l;
+            num_applied = appr_alg->replayOperationLog(path_to_log);
+        }
+        cur_l = appr_alg->cur_element_count;
+        return num_applied;
+    }
+
+
     void loadIndex(const std::string &path_to_index, size_t max_elements, bool allow_replace_deleted) {
       if (appr_alg) {
           std::cerr << "Warning: Calling load_index for an already inited index. Old index is being deallocated." << std::endl;
@@ -248,6 +278,26 @@ class Index {
     }
 
 
+    bool needs_prepare() const {
+        return normalize || storage != VectorStorage::Float32;
+    }
+
+
+    // Writes the vector as it is stored by the index (normalized and/or converted) into out,
+    // norm_buffer holds dim floats
+    void prepare_vector(float* data, void* out, float* norm_buffer) {
+        if (storage == VectorStorage::Float32) {
+            normalize_vector(data, (float*)out);
+            return;
+        }
+        if (normalize) {
+            normalize_vector(data, norm_buffer);
+            data = norm_buffer;
+        }
+        convert_vector(data, out, dim, storage);
+    }
+
+
     void addItems(py::object input, py::object ids_ = py::none(), int num_threads = -1, bool replace_deleted = false) {
         py::array_t < dist_t, py::array::c_style | py::array::forcecast > items(input);
         auto buffer = items.request();
@@ -269,34 +319,37 @@ class Index {
 
         {
             int start = 0;
+            size_t row_size = l2space->get_data_size();
             if (!ep_added) {
                 size_t id = ids.size() ? ids.at(0) : (cur_l);
-                float* vector_data = (float*)items.data(0);
+                void* vector_data = (void*)items.data(0);
+                std::vector<char> row_array(row_size);
                 std::vector<float> norm_array(dim);
-                if (normalize) {
-                    normalize_vector(vector_data, norm_array.data());
-                    vector_data = norm_array.data();
+                if (needs_prepare()) {
+                    prepare_vector((float*)vector_data, row_array.data(), norm_array.data());
+                    vector_data = row_array.data();
                 }
-                appr_alg->addPoint((void*)vector_data, (size_t)id, replace_deleted);
+                appr_alg->addPoint(vector_data, (size_t)id, replace_deleted);
                 start = 1;
                 ep_added = true;
             }
 
             py::gil_scoped_release l;
-            if (normalize == false) {
-                ParallelFor(start, rows, num_threads, [&](size_t row, size_t threadId) {
+            if (needs_prepare() == false) {
+                hnswlib::ParallelFor(start, rows, num_threads, [&](size_t row, size_t threadId) {
                     size_t id = ids.size() ? ids.at(row) : (cur_l + row);
                     appr_alg->addPoint((void*)items.data(row), (size_t)id, replace_deleted);
                     });
             } else {
+                std::vector<char> row_array(num_threads * row_size);
                 std::vector<float> norm_array(num_threads * dim);
-                ParallelFor(start, rows, num_threads, [&](size_t row, size_t threadId) {
-                    // normalize vector:
-                    size_t start_idx = threadId * dim;
-                    normalize_vector((float*)items.data(row), (norm_array.data() + start_idx));
+                hnswlib::ParallelFor(start, rows, num_threads, [&](size_t row, size_t threadId) {
+                    // normalize and/or convert the vector:
+                    char* row_data = row_array.data() + threadId * row_size;
+                    prepare_vector((float*)items.data(row), row_data, norm_array.data() + threadId * dim);
 
                     size_t id = ids.size() ? ids.at(row) : (cur_l + row);
-                    appr_alg->addPoint((void*)(norm_array.data() + start_idx), (size_t)id, replace_deleted);
+                    appr_alg->addPoint((void*)row_data, (size_t)id, replace_deleted);
                     });
             }
             cur_l += rows;
@@ -327,7 +380,12 @@ class Index {
 
         std::vector<std::vector<data_t>> data;
         for (auto id : ids) {
-            data.push_back(appr_alg->template getDataByLabel<data_t>(id));
+            if (storage == VectorStorage::Float32) {
+                data.push_back(appr_alg->template getDataByLabel<data_t>(id));
+            } else {
+                std::vector<float> row = convert_stored_vector(appr_alg->template getDataByLabel<uint16_t>(id), storage);
+                data.push_back(std::vector<data_t>(row.begin(), row.end()));
+            }
         }
         if (return_type == "list") {
             return py::cast(data);
@@ -381,8 +439,10 @@ class Index {
 
         memset(link_list_npy, 0, link_npy_size);
 
-        memcpy(data_level0_npy, appr_alg->data_level0_memory_, level0_npy_size);
-        memcpy(element_levels_npy, appr_alg->element_levels_.data(), appr_alg->element_levels_.size() * sizeof(int));
+        for (size_t i = 0; i < appr_alg->cur_element_count; i++)
+            appr_alg->copyElementTo(i, data_level0_npy + i * appr_alg->size_data_per_element_);
+        for (size_t i = 0; i < appr_alg->element_levels_.size(); i++)
+            element_levels_npy[i] = appr_alg->element_levels_[i];
 
         for (size_t i = 0; i < appr_alg->cur_element_count; i++) {
             size_t linkListSize = appr_alg->element_levels_[i] > 0 ? appr_alg->size_links_per_element_ * appr_alg->element_levels_[i] : 0;
@@ -412,13 +472,13 @@ class Index {
 
         return py::dict(
             "offset_level0"_a = appr_alg->offsetLevel0_,
-            "max_elements"_a = appr_alg->max_elements_,
+            "max_elements"_a = (size_t)appr_alg->max_elements_,
             "cur_element_count"_a = (size_t)appr_alg->cur_element_count,
             "size_data_per_element"_a = appr_alg->size_data_per_element_,
             "label_offset"_a = appr_alg->label_offset_,
             "offset_data"_a = appr_alg->offsetData_,
-            "max_level"_a = appr_alg->maxlevel_,
-            "enterpoint_node"_a = appr_alg->enterpoint_node_,
+            "max_level"_a = appr_alg->getEntryPoint().level,
+            "enterpoint_node"_a = appr_alg->getEntryPoint().node,
             "max_M"_a = appr_alg->maxM_,
             "max_M0"_a = appr_alg->maxM0_,
             "M"_a = appr_alg->M_,
@@ -428,6 +488,7 @@ class Index {
             "has_deletions"_a = (bool)appr_alg->num_deleted_,
             "size_links_per_element"_a = appr_alg->size_links_per_element_,
             "allow_replace_deleted"_a = appr_alg->allow_replace_deleted_,
+            "store_link_distances"_a = appr_alg->store_link_distances_,
 
             "label_lookup_external"_a = py::array_t<hnswlib::labeltype>(
                 { appr_alg->label_lookup_.size() },  // shape
@@ -502,7 +563,11 @@ class Index {
                 d["max_elements"].cast<size_t>(),
                 d["M"].cast<size_t>(),
                 d["ef_construction"].cast<size_t>(),
-                new_index->seed);
+                new_index->seed,
+                false,
+                hnswlib::IndexLayout::Interleaved,
+                nullptr,
+                d.contains("store_link_distances") && d["store_link_distances"].cast<bool>());
             new_index->cur_l = d["cur_element_count"].cast<size_t>();
         }
 
@@ -535,8 +600,7 @@ class Index {
         assert_true(appr_alg->label_offset_ == d["label_offset"].cast<size_t>(), "Invalid value of label_offset_ ");
         assert_true(appr_alg->offsetData_ == d["offset_data"].cast<size_t>(), "Invalid value of offsetData_ ");
 
-        appr_alg->maxlevel_ = d["max_level"].cast<int>();
-        appr_alg->enterpoint_node_ = d["enterpoint_node"].cast<hnswlib::tableint>();
+        appr_alg->setEntryPoint(d["enterpoint_node"].cast<hnswlib::tableint>(), d["max_level"].cast<int>());
 
         assert_true(appr_alg->maxM_ == d["max_M"].cast<size_t>(), "Invalid value of maxM_ ");
         assert_true(appr_alg->maxM0_ == d["max_M0"].cast<size_t>(), "Invalid value of maxM0_ ");
@@ -562,7 +626,8 @@ class Index {
             }
         }
 
-        memcpy(appr_alg->element_levels_.data(), element_levels_npy.data(), element_levels_npy.nbytes());
+        for (size_t i = 0; i < std::min<size_t>(element_levels_npy.size(), appr_alg->element_levels_.size()); i++)
+            appr_alg->element_levels_[i] = element_levels_npy.data()[i];
 
         size_t link_npy_size = 0;
         std::vector<size_t> link_npy_offsets(appr_alg->cur_element_count);
@@ -574,17 +639,15 @@ class Index {
                 link_npy_size += linkListSize;
         }
 
-        memcpy(appr_alg->data_level0_memory_, data_level0_npy.data(), data_level0_npy.nbytes());
+        for (size_t i = 0; i < appr_alg->cur_element_count; i++)
+            appr_alg->copyElementFrom(i, data_level0_npy.data() + i * appr_alg->size_data_per_element_);
 
         for (size_t i = 0; i < appr_alg->max_elements_; i++) {
             size_t linkListSize = appr_alg->element_levels_[i] > 0 ? appr_alg->size_links_per_element_ * appr_alg->element_levels_[i] : 0;
             if (linkListSize == 0) {
                 appr_alg->linkLists_[i] = nullptr;
             } else {
-                appr_alg->linkLists_[i] = (char*)malloc(linkListSize);
-                if (appr_alg->linkLists_[i] == nullptr)
-                    throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
-
+                appr_alg->linkLists_[i] = appr_alg->link_list_arena_.allocate(linkListSize);
                 memcpy(appr_alg->linkLists_[i], link_list_npy.data() + link_npy_offsets[i], linkListSize);
             }
         }
@@ -639,38 +702,48 @@ class Index {
             CustomFilterFunctor idFilter(filter);
             CustomFilterFunctor* p_idFilter = filter ? &idFilter : nullptr;
 
-            if (normalize == false) {
-                ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
-                    std::priority_queue<std::pair<dist_t, hnswlib::labeltype >> result = appr_alg->searchKnn(
-                        (void*)items.data(row), k, p_idFilter);
-                    if (result.size() != k)
-                        throw std::runtime_error(
-                            "Cannot return the results in a contiguous 2D array. Probably ef or M is too small");
-                    for (int i = k - 1; i >= 0; i--) {
-                        auto& result_tuple = result.top();
-                        data_numpy_d[row * k + i] = result_tuple.first;
-                        data_numpy_l[row * k + i] = result_tuple.second;
-                        result.pop();
+            // queries are searched in small batches, the graph traversals of a batch are interleaved
+            size_t num_batches = (rows + search_batch_size - 1) / search_batch_size;
+            auto store_results = [&](size_t row, std::priority_queue<std::pair<dist_t, hnswlib::labeltype >>& result) {
+                if (result.size() != k)
+                    throw std::runtime_error(
+                        "Cannot return the results in a contiguous 2D array. Probably ef or M is too small");
+                for (int i = k - 1; i >= 0; i--) {
+                    auto& result_tuple = result.top();
+                    data_numpy_d[row * k + i] = result_tuple.first;
+                    data_numpy_l[row * k + i] = result_tuple.second;
+                    result.pop();
+                }
+            };
+
+            if (needs_prepare() == false) {
+                hnswlib::ParallelFor(0, num_batches, num_threads, [&](size_t batch, size_t threadId) {
+                    size_t start_row = batch * search_batch_size;
+                    size_t end_row = std::min(rows, start_row + search_batch_size);
+                    auto results = appr_alg->searchKnnBatch(
+                        (void*)items.data(start_row), end_row - start_row, k, p_idFilter, search_batch_size);
+                    for (size_t row = start_row; row < end_row; row++) {
+                        store_results(row, results[row - start_row]);
                     }
                 });
             } else {
-                std::vector<float> norm_array(num_threads * features);
-                ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
-                    float* data = (float*)items.data(row);
-
-                    size_t start_idx = threadId * dim;
-                    normalize_vector((float*)items.data(row), (norm_array.data() + start_idx));
-
-                    std::priority_queue<std::pair<dist_t, hnswlib::labeltype >> result = appr_alg->searchKnn(
-                        (void*)(norm_array.data() + start_idx), k, p_idFilter);
-                    if (result.size() != k)
-                        throw std::runtime_error(
-                            "Cannot return the results in a contiguous 2D array. Probably ef or M is too small");
-                    for (int i = k - 1; i >= 0; i--) {
-                        auto& result_tuple = result.top();
-                        data_numpy_d[row * k + i] = result_tuple.first;
-                        data_numpy_l[row * k + i] = result_tuple.second;
-                        result.pop();
+                size_t row_size = l2space->get_data_size();
+                std::vector<char> query_array(num_threads * search_batch_size * row_size);
+                std::vector<float> norm_array(num_threads * dim);
+                hnswlib::ParallelFor(0, num_batches, num_threads, [&](size_t batch, size_t threadId) {
+                    size_t start_row = batch * search_batch_size;
+                    size_t end_row = std::min(rows, start_row + search_batch_size);
+
+                    char* batch_data = query_array.data() + threadId * search_batch_size * row_size;
+                    for (size_t row = start_row; row < end_row; row++) {
+                        prepare_vector((float*)items.data(row), batch_data + (row - start_row) * row_size,
+                                       norm_array.data() + threadId * dim);
+                    }
+
+                    auto results = appr_alg->searchKnnBatch(
+                        (void*)batch_data, end_row - start_row, k, p_idFilter, search_batch_size);
+                    for (size_t row = start_row; row < end_row; row++) {
+                        store_results(row, results[row - start_row]);
                     }
                 });
             }
@@ -707,6 +780,19 @@ class Index {
     }
 
 
+    void removePoint(size_t label) {
+        appr_alg->removePoint(label);
+    }
+
+
+    void compactDeleted(int num_threads = -1) {
+        if (num_threads <= 0)
+            num_threads = num_threads_default;
+        py::gil_scoped_release l;
+        appr_alg->compactDeleted(num_threads);
+    }
+
+
     void resizeIndex(size_t new_size) {
         appr_alg->resizeIndex(new_size);
     }
@@ -731,6 +817,7 @@ class BFIndex {
     int dim;
     bool index_inited;
     bool normalize;
+    VectorStorage storage;
     int num_threads_default;
 
     hnswlib::labeltype cur_l;
@@ -739,17 +826,7 @@ class BFIndex {
 
 
     BFIndex(const std::string &space_name, const int dim) : space_name(space_name), dim(dim) {
-        normalize = false;
-        if (space_name == "l2") {
-            space = new hnswlib::L2Space(dim);
-        } else if (space_name == "ip") {
-            space = new hnswlib::InnerProductSpace(dim);
-        } else if (space_name == "cosine") {
-            space = new hnswlib::InnerProductSpace(dim);
-            normalize = true;
-        } else {
-            throw std::runtime_error("Space name must be one of l2, ip, or cosine.");
-        }
+        space = create_space(space_name, dim, &normalize, &storage);
         alg = NULL;
         index_inited = false;
 
@@ -799,6 +876,26 @@ class BFIndex {
     }
 
 
+    bool needs_prepare() const {
+        return normalize || storage != VectorStorage::Float32;
+    }
+
+
+    // Writes the vector as it is stored by the index (normalized and/or converted) into out,
+    // norm_buffer holds dim floats
+    void prepare_vector(float* data, void* out, float* norm_buffer) {
+        if (storage == VectorStorage::Float32) {
+            normalize_vector(data, (float*)out);
+            return;
+        }
+        if (normalize) {
+            normalize_vector(data, norm_buffer);
+            data = norm_buffer;
+        }
+        convert_vector(data, out, dim, storage);
+    }
+
+
     void addItems(py::object input, py::object ids_ = py::none()) {
         py::array_t < dist_t, py::array::c_style | py::array::forcecast > items(input);
         auto buffer = items.request();
@@ -811,14 +908,15 @@ class BFIndex {
         std::vector<size_t> ids = get_input_ids_and_check_shapes(ids_, rows);
 
         {
+            std::vector<char> row_data(space->get_data_size());
+            std::vector<float> norm_array(dim);
             for (size_t row = 0; row < rows; row++) {
                 size_t id = ids.size() ? ids.at(row) : cur_l + row;
-                if (!normalize) {
+                if (!needs_prepare()) {
                     alg->addPoint((void *) items.data(row), (size_t) id);
                 } else {
-                    std::vector<float> normalized_vector(dim);
-                    normalize_vector((float *)items.data(row), normalized_vector.data());
-                    alg->addPoint((void *) normalized_vector.data(), (size_t) id);
+                    prepare_vector((float *)items.data(row), row_data.data(), norm_array.data());
+                    alg->addPoint((void *) row_data.data(), (size_t) id);
                 }
             }
             cur_l+=rows;
@@ -871,9 +969,16 @@ class BFIndex {
             CustomFilterFunctor idFilter(filter);
             CustomFilterFunctor* p_idFilter = filter ? &idFilter : nullptr;
 
-            ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
+            size_t row_size = space->get_data_size();
+            std::vector<char> query_array(num_threads * row_size);
+            hnswlib::ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
+                void* query_data = (void*)items.data(row);
+                if (storage != VectorStorage::Float32) {
+                    convert_vector((float*)query_data, query_array.data() + threadId * row_size, dim, storage);
+                    query_data = query_array.data() + threadId * row_size;
+                }
                 std::priority_queue<std::pair<dist_t, hnswlib::labeltype >> result = alg->searchKnn(
-                    (void*)items.data(row), k, p_idFilter);
+                    query_data, k, p_idFilter);
                 for (int i = k - 1; i >= 0; i--) {
                     auto& result_tuple = result.top();
                     data_numpy_d[row * k + i] = result_tuple.first;
@@ -921,7 +1026,8 @@ PYBIND11_PLUGIN(hnswlib) {
             py::arg("M") = 16,
             py::arg("ef_construction") = 200,
             py::arg("random_seed") = 100,
-            py::arg("allow_replace_deleted") = false)
+            py::arg("allow_replace_deleted") = false,
+            py::arg("store_link_distances") = false)
         .def("knn_query",
             &Index<float>::knnQuery_return_numpy,
             py::arg("data"),
@@ -940,6 +1046,12 @@ PYBIND11_PLUGIN(hnswlib) {
         .def("set_num_threads", &Index<float>::set_num_threads, py::arg("num_threads"))
         .def("index_file_size", &Index<float>::indexFileSize)
         .def("save_index", &Index<float>::saveIndex, py::arg("path_to_index"))
+        .def("save_snapshot", &Index<float>::saveSnapshot, py::arg("path_to_index"))
+        .def("open_operation_log", &Index<float>::openOperationLog, py::arg("path_to_log"), py::arg("sync") = false)
+        .def("close_operation_log", &Index<float>::closeOperationLog)
+        .def("sync_operation_log", &Index<float>::syncOperationLog)
+        .def("checkpoint", &Index<float>::checkpoint, py::arg("path_to_index"))
+        .def("replay_operation_log", &Index<float>::replayOperationLog, py::arg("path_to_log"))
         .def("load_index",
             &Index<float>::loadIndex,
             py::arg("path_to_index"),
@@ -947,6 +1059,8 @@ PYBIND11_PLUGIN(hnswlib) {
             py::arg("allow_replace_deleted") = false)
         .def("mark_deleted", &Index<float>::markDeleted, py::arg("label"))
         .def("unmark_deleted", &Index<float>::unmarkDeleted, py::arg("label"))
+        .def("remove_point", &Index<float>::removePoint, py::arg("label"))
+        .def("compact_deleted", &Index<float>::compactDeleted, py::arg("num_threads") = -1)
         .def("resize_index", &Index<float>::resizeIndex, py::arg("new_size"))
         .def("get_max_elements", &Index<float>::getMaxElements)
         .def("get_current_count", &Index<float>::getCurrentCount)
@@ -963,7 +1077,7 @@ PYBIND11_PLUGIN(hnswlib) {
               index.appr_alg->ef_ = ef_;
         })
         .def_property_readonly("max_elements", [](const Index<float> & index) {
-            return index.index_inited ? index.appr_alg->max_elements_ : 0;
+            return index.index_inited ? (size_t)index.appr_alg->max_elements_ : 0;
         })
         .def_property_readonly("element_count", [](const Index<float> & index) {
             return index.index_inited ? (size_t)index.appr_alg->cur_element_count : 0;
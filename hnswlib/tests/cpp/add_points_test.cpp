@@ -0,0 +1,108 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+// fraction of the exact k nearest neighbors found by the index
+double recall(
+    hnswlib::HierarchicalNSW<float> &alg_hnsw, hnswlib::BruteforceSearch<float> &alg_brute,
+    const std::vector<float> &query, size_t nq, size_t d, size_t k) {
+    size_t found = 0;
+    for (size_t j = 0; j < nq; ++j) {
+        auto gt = alg_brute.searchKnn(query.data() + j * d, k);
+        auto result = alg_hnsw.searchKnn(query.data() + j * d, k);
+        std::unordered_set<idx_t> expected;
+        while (!gt.empty()) {
+            expected.insert(gt.top().second);
+            gt.pop();
+        }
+        while (!result.empty()) {
+            found += expected.count(result.top().second);
+            result.pop();
+        }
+    }
+    return (double) found / (nq * k);
+}
+
+void test() {
+    int d = 16;
+    idx_t n = 20000;
+    idx_t nq = 100;
+    size_t k = 10;
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+    std::vector<idx_t> labels(n);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < n; ++i) {
+        labels[i] = 3 * i + 1;
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    for (idx_t i = 0; i < n; ++i) {
+        alg_brute.addPoint(data.data() + d * i, labels[i]);
+    }
+
+    for (int num_threads : {1, 4}) {
+        hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+        size_t last_done = 0;
+        size_t num_calls = 0;
+        alg_hnsw.addPoints(data.data(), labels.data(), n, num_threads, [&](size_t done, size_t total) {
+            assert(total == n);
+            assert(done > last_done);
+            last_done = done;
+            num_calls++;
+        });
+        assert(last_done == n);
+        assert(num_calls >= 50 && num_calls <= 100);
+        assert(alg_hnsw.getCurrentElementCount() == n);
+        for (idx_t i = 0; i < n; i += 13) {
+            assert(alg_hnsw.getDataByLabel<float>(labels[i]) ==
+                   std::vector<float>(data.begin() + d * i, data.begin() + d * (i + 1)));
+        }
+        alg_hnsw.checkIntegrity();
+        alg_hnsw.setEf(50);
+        double r = recall(alg_hnsw, alg_brute, query, nq, d, k);
+        std::cout << num_threads << " threads, recall: " << r << std::endl;
+        assert(r > 0.95);
+    }
+
+    // the first error stops the build and is rethrown
+    hnswlib::HierarchicalNSW<float> alg_small(&space, n / 2);
+    bool thrown = false;
+    try {
+        alg_small.addPoints(data.data(), labels.data(), n, 4);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(alg_small.getCurrentElementCount() == n / 2);
+    alg_small.checkIntegrity();
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <map>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+// Keeps track of the live allocations
+class CountingAllocator : public hnswlib::Level0Allocator {
+ public:
+    std::map<char *, size_t> live;
+    size_t num_allocations = 0;
+
+    char *allocate(size_t size) {
+        char *ptr = hnswlib::AlignedAllocator::instance()->allocate(size);
+        live[ptr] = size;
+        num_allocations++;
+        return ptr;
+    }
+
+    void deallocate(char *ptr, size_t size) {
+        assert(live.count(ptr) == 1);
+        assert(live[ptr] == size);
+        live.erase(ptr);
+        hnswlib::AlignedAllocator::instance()->deallocate(ptr, size);
+    }
+};
+
+// Rounds every allocation up to pages of 1 MB, like MmapAllocator does with huge pages
+class PagedCountingAllocator : public CountingAllocator {
+ public:
+    static const size_t PAGE_SIZE = 1 << 20;
+
+    char *allocate(size_t size) {
+        assert(size % PAGE_SIZE == 0);
+        return CountingAllocator::allocate(size);
+    }
+
+    size_t pageSize() const {
+        return PAGE_SIZE;
+    }
+};
+
+std::vector<std::vector<std::pair<float, idx_t>>> searchAll(
+    hnswlib::HierarchicalNSW<float> &alg_hnsw, const std::vector<float> &query, size_t nq, size_t d, size_t k) {
+    std::vector<std::vector<std::pair<float, idx_t>>> results(nq);
+    for (size_t j = 0; j < nq; ++j)
+        results[j] = alg_hnsw.searchKnnCloserFirst(query.data() + j * d, k);
+    return results;
+}
+
+void build(hnswlib::HierarchicalNSW<float> &alg_hnsw, const std::vector<float> &data, size_t n, size_t d) {
+    for (size_t i = 0; i < n; ++i)
+        alg_hnsw.addPoint(data.data() + d * i, i);
+}
+
+void test() {
+    int d = 16;
+    idx_t n = 2000;
+    idx_t nq = 50;
+    size_t k = 10;
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_default(&space, n);
+    build(alg_default, data, n, d);
+    auto expected = searchAll(alg_default, query, nq, d, k);
+
+    // every base layer array goes through the allocator, with the size it was allocated with
+    CountingAllocator counting;
+    {
+        hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n / 2, 16, 200, 100, false,
+                                                 hnswlib::IndexLayout::Separate, &counting);
+        assert(counting.live.size() == 3);
+        for (size_t i = 0; i < n / 2; ++i)
+            alg_hnsw.addPoint(data.data() + d * i, i);
+        alg_hnsw.resizeIndex(n);
+        for (size_t i = n / 2; i < n; ++i)
+            alg_hnsw.addPoint(data.data() + d * i, i);
+        alg_hnsw.reorderGraph();
+        // growing appended a chunk of links, vectors and labels, nothing was reallocated
+        assert(counting.live.size() == 6);
+        assert(counting.num_allocations == 6);
+        assert(searchAll(alg_hnsw, query, nq, d, k) == expected);
+
+        // moving the index back to the default allocator
+        alg_hnsw.setAllocator(nullptr);
+        assert(counting.live.empty());
+        assert(searchAll(alg_hnsw, query, nq, d, k) == expected);
+    }
+    {
+        std::string path = "allocator_test.bin";
+        alg_default.saveIndex(path);
+        hnswlib::HierarchicalNSW<float> alg_hnsw(&space, path, false, 0, false,
+                                                 hnswlib::IndexLayout::Interleaved, &counting);
+        assert(counting.live.size() == 1);
+        assert(searchAll(alg_hnsw, query, nq, d, k) == expected);
+        remove(path.c_str());
+    }
+    assert(counting.live.empty());
+
+    // the chunks share the pages of an allocator which rounds sizes up to its page size
+    PagedCountingAllocator paged;
+    {
+        hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n / 2, 16, 200, 100, false,
+                                                 hnswlib::IndexLayout::Separate, &paged);
+        build(alg_hnsw, data, n / 2, d);
+        alg_hnsw.resizeIndex(n);
+        for (size_t i = n / 2; i < n; ++i)
+            alg_hnsw.addPoint(data.data() + d * i, i);
+        // two chunks of links, vectors and labels in one page
+        assert(paged.num_allocations == 1);
+        assert(searchAll(alg_hnsw, query, nq, d, k) == expected);
+        // moving the chunks takes new slabs and frees the old ones
+        alg_hnsw.setAllocator(&paged);
+        assert(paged.num_allocations == 2);
+        assert(paged.live.size() == 1);
+        assert(searchAll(alg_hnsw, query, nq, d, k) == expected);
+    }
+    assert(paged.live.empty());
+
+#ifdef HNSWLIB_HAS_HUGE_PAGES
+    // explicit huge pages fall back to transparent ones when the hugetlbfs pool is empty
+    hnswlib::MmapAllocator huge_pages(hnswlib::PageSize::Huge2MB);
+    hnswlib::MmapAllocator interleaved(hnswlib::PageSize::Transparent, hnswlib::NumaPolicy::Interleave);
+    hnswlib::MmapAllocator local(hnswlib::PageSize::Default, hnswlib::NumaPolicy::Bind, hnswlib::currentNumaNode());
+    hnswlib::Level0Allocator *allocators[] = {&huge_pages, &interleaved, &local};
+    for (hnswlib::Level0Allocator *allocator : allocators) {
+        hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 200, 100, false,
+                                                 hnswlib::IndexLayout::Interleaved, allocator);
+        build(alg_hnsw, data, n, d);
+        assert((size_t) alg_hnsw.get_linklist0(0) % hnswlib::LEVEL0_ALIGNMENT == 0);
+        assert(searchAll(alg_hnsw, query, nq, d, k) == expected);
+        alg_hnsw.resizeIndex(2 * n);
+        assert(searchAll(alg_hnsw, query, nq, d, k) == expected);
+    }
+
+    // an existing index can be moved to huge pages
+    alg_default.setAllocator(&huge_pages);
+    assert(searchAll(alg_default, query, nq, d, k) == expected);
+    alg_default.setAllocator(nullptr);
+
+    // without the fallback the allocation fails if there are no free huge pages
+    hnswlib::MmapAllocator strict(hnswlib::PageSize::Huge1GB, hnswlib::NumaPolicy::Default, 0, false);
+    try {
+        hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 200, 100, false,
+                                                 hnswlib::IndexLayout::Interleaved, &strict);
+        build(alg_hnsw, data, n, d);
+        assert(searchAll(alg_hnsw, query, nq, d, k) == expected);
+    } catch (const std::runtime_error &e) {
+        std::cout << "No 1 GB huge pages: " << e.what() << std::endl;
+    }
+#endif
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+std::vector<std::vector<std::pair<float, idx_t>>> searchAll(
+    hnswlib::HierarchicalNSW<float> &alg_hnsw, const std::vector<float> &query, size_t nq, size_t d, size_t k) {
+    std::vector<std::vector<std::pair<float, idx_t>>> results(nq);
+    for (size_t j = 0; j < nq; ++j)
+        results[j] = alg_hnsw.searchKnnCloserFirst(query.data() + j * d, k);
+    return results;
+}
+
+void test() {
+    int d = 16;
+    idx_t n = 6000;
+    idx_t nq = 100;
+    size_t k = 10;
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    // the index starts with one chunk and grows while it is searched and inserted into
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, 300);
+    for (idx_t i = 0; i < 100; ++i)
+        alg_hnsw.addPoint(data.data() + d * i, i);
+
+    std::atomic<idx_t> next_label(100);
+    std::atomic<size_t> num_inserted(100);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2; t++) {
+        threads.emplace_back([&]() {
+            for (idx_t label = next_label++; label < n; label = next_label++) {
+                while (true) {
+                    try {
+                        alg_hnsw.addPoint(data.data() + d * label, label);
+                        break;
+                    } catch (const std::runtime_error &) {
+                        // full, waits for the resizing thread
+                        std::this_thread::yield();
+                    }
+                }
+                num_inserted++;
+            }
+        });
+    }
+    threads.emplace_back([&]() {
+        while (num_inserted < n) {
+            size_t max_elements = alg_hnsw.getMaxElements();
+            if (max_elements < n && max_elements - alg_hnsw.getCurrentElementCount() < 200)
+                alg_hnsw.resizeIndex(std::min<size_t>(max_elements + 700, n));
+            else
+                std::this_thread::yield();
+        }
+    });
+    threads.emplace_back([&]() {
+        for (size_t j = 0; num_inserted < n; j = (j + 1) % nq) {
+            auto result = alg_hnsw.searchKnnCloserFirst(query.data() + j * d, k);
+            for (size_t i = 0; i < result.size(); i++) {
+                if (result[i].second >= n || (i > 0 && result[i].first < result[i - 1].first))
+                    failed = true;
+            }
+        }
+    });
+    for (auto &thread : threads)
+        thread.join();
+    assert(!failed);
+    assert(alg_hnsw.getCurrentElementCount() == n);
+    assert(alg_hnsw.getMaxElements() == n);
+    alg_hnsw.checkIntegrity();
+
+    // every element is found by searching for its own vector
+    size_t found = 0;
+    for (idx_t label = 0; label < n; label++) {
+        assert(alg_hnsw.getDataByLabel<float>(label) ==
+               std::vector<float>(data.begin() + d * label, data.begin() + d * (label + 1)));
+        auto result = alg_hnsw.searchKnn(data.data() + d * label, 1);
+        found += result.top().second == label;
+    }
+    std::cout << "Self recall: " << (double) found / n << std::endl;
+    assert(found > 0.99 * n);
+
+    alg_hnsw.setEf(50);
+    auto expected = searchAll(alg_hnsw, query, nq, d, k);
+
+    // growing and shrinking do not change the stored elements
+    alg_hnsw.resizeIndex(3 * n);
+    assert(searchAll(alg_hnsw, query, nq, d, k) == expected);
+    alg_hnsw.resizeIndex(n);
+    assert(alg_hnsw.getMaxElements() == n);
+    assert(searchAll(alg_hnsw, query, nq, d, k) == expected);
+    bool thrown = false;
+    try {
+        alg_hnsw.resizeIndex(n - 1);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // the chunks are saved as one contiguous base layer
+    std::string path = "chunked_resize_test.bin";
+    alg_hnsw.saveIndex(path);
+    for (hnswlib::IndexLayout layout : {hnswlib::IndexLayout::Interleaved, hnswlib::IndexLayout::Separate}) {
+        hnswlib::HierarchicalNSW<float> alg_loaded(&space, path, false, 2 * n, false, layout);
+        alg_loaded.setEf(50);
+        assert(searchAll(alg_loaded, query, nq, d, k) == expected);
+    }
+    hnswlib::HierarchicalNSW<float> alg_mapped(&space);
+    alg_mapped.loadIndexMapped(path, &space);
+    alg_mapped.setEf(50);
+    assert(searchAll(alg_mapped, query, nq, d, k) == expected);
+    remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <unordered_set>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+// fraction of the exact k nearest neighbors found by the index
+double recall(
+    hnswlib::HierarchicalNSW<float> &alg_hnsw, hnswlib::BruteforceSearch<float> &alg_brute,
+    const std::vector<float> &query, size_t nq, size_t d, size_t k) {
+    size_t found = 0;
+    for (size_t j = 0; j < nq; ++j) {
+        auto gt = alg_brute.searchKnn(query.data() + j * d, k);
+        auto result = alg_hnsw.searchKnn(query.data() + j * d, k);
+        std::unordered_set<idx_t> expected;
+        while (!gt.empty()) {
+            expected.insert(gt.top().second);
+            gt.pop();
+        }
+        while (!result.empty()) {
+            found += expected.count(result.top().second);
+            result.pop();
+        }
+    }
+    return (double) found / (nq * k);
+}
+
+// no element links to a deleted one
+void checkNoLinksToDeleted(hnswlib::HierarchicalNSW<float> &alg_hnsw) {
+    for (hnswlib::tableint i = 0; i < alg_hnsw.getCurrentElementCount(); i++) {
+        if (alg_hnsw.isMarkedDeleted(i))
+            continue;
+        for (int level = 0; level <= alg_hnsw.element_levels_[i]; level++) {
+            for (hnswlib::tableint id : alg_hnsw.getConnectionsWithLock(i, level))
+                assert(!alg_hnsw.isMarkedDeleted(id));
+        }
+    }
+}
+
+void test() {
+    int d = 16;
+    idx_t n = 10000;
+    idx_t nq = 100;
+    size_t k = 10;
+
+    std::vector<float> data(2 * n * d);
+    std::vector<float> query(nq * d);
+    std::vector<idx_t> labels(n);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < 2 * n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < n; ++i) {
+        labels[i] = i;
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    alg_hnsw.addPoints(data.data(), labels.data(), n, 4);
+
+    // removes half of the elements, including the entry point, a few of them right away
+    hnswlib::tableint entry_point = alg_hnsw.getEntryPoint().node;
+    std::unordered_set<idx_t> removed;
+    removed.insert(alg_hnsw.getExternalLabel(entry_point));
+    for (idx_t i = 0; i < n; i += 2)
+        removed.insert(i);
+    size_t num_removed = 0;
+    for (idx_t label : removed) {
+        if (num_removed++ < 100) {
+            alg_hnsw.removePoint(label);
+        } else {
+            alg_hnsw.markDelete(label);
+        }
+    }
+    assert(alg_hnsw.getDeletedCount() == removed.size());
+
+    bool thrown = false;
+    try {
+        alg_hnsw.removePoint(0);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    alg_hnsw.compactDeleted(4);
+    size_t num_remaining = n - removed.size();
+    assert(alg_hnsw.getCurrentElementCount() == num_remaining);
+    assert(alg_hnsw.getDeletedCount() == 0);
+    assert(alg_hnsw.label_lookup_.size() == num_remaining);
+    checkNoLinksToDeleted(alg_hnsw);
+    alg_hnsw.checkIntegrity();
+    auto new_entry_point = alg_hnsw.getEntryPoint();
+    assert(alg_hnsw.element_levels_[new_entry_point.node] == new_entry_point.level);
+
+    hnswlib::BruteforceSearch<float> alg_brute(&space, 2 * n);
+    for (idx_t i = 0; i < n; ++i) {
+        if (removed.count(i)) {
+            thrown = false;
+            try {
+                alg_hnsw.getDataByLabel<float>(i);
+            } catch (const std::runtime_error &) {
+                thrown = true;
+            }
+            assert(thrown);
+        } else {
+            assert(alg_hnsw.getDataByLabel<float>(i) == std::vector<float>(data.begin() + d * i, data.begin() + d * (i + 1)));
+            alg_brute.addPoint(data.data() + d * i, i);
+        }
+    }
+    alg_hnsw.setEf(50);
+    double r = recall(alg_hnsw, alg_brute, query, nq, d, k);
+    std::cout << "Recall after compaction: " << r << std::endl;
+    assert(r > 0.95);
+
+    // the freed slots take new elements without growing the index
+    for (idx_t i = n; i < n + removed.size(); ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+        alg_brute.addPoint(data.data() + d * i, i);
+    }
+    assert(alg_hnsw.getCurrentElementCount() == n);
+    alg_hnsw.checkIntegrity();
+    r = recall(alg_hnsw, alg_brute, query, nq, d, k);
+    std::cout << "Recall after reinsertion: " << r << std::endl;
+    assert(r > 0.95);
+
+    // compacting an index without deleted elements changes nothing, removing everything empties it
+    alg_hnsw.compactDeleted();
+    assert(alg_hnsw.getCurrentElementCount() == n);
+    for (hnswlib::tableint i = 0; i < n; ++i)
+        alg_hnsw.markDeletedInternal(i);
+    alg_hnsw.compactDeleted();
+    assert(alg_hnsw.getCurrentElementCount() == 0);
+    assert(alg_hnsw.label_lookup_.empty());
+    assert(alg_hnsw.getEntryPoint().level == -1);
+    assert(alg_hnsw.searchKnn(query.data(), k).empty());
+    alg_hnsw.addPoint(data.data(), 0);
+    assert(alg_hnsw.searchKnn(data.data(), 1).top().second == 0);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cmath>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+// the kernels are chosen by the probes of the running CPU, not only by the compiler flags
+void testSelection() {
+#if defined(HNSWLIB_RUNTIME_DISPATCH)
+    assert(AVX512Capable() == (hnswlib::L2Space(32).get_dist_func() == hnswlib::L2SqrSIMD16ExtAVX512));
+    hnswlib::InnerProductSpace ip(32);
+    if (AVX512Capable())
+        assert(hnswlib::InnerProductSIMD16Ext == hnswlib::InnerProductSIMD16ExtAVX512);
+    else if (AVXCapable())
+        assert(hnswlib::InnerProductSIMD16Ext == hnswlib::InnerProductSIMD16ExtAVX);
+
+    hnswlib::L2SpaceSQ8 sq8(32);
+    if (AVX512VNNICapable())
+        assert(sq8.get_dist_func() == hnswlib::SQ8L2SqrGlobal<hnswlib::SQ8L2SqrIntAVX512VNNI>);
+    else if (!AVX512BWCapable() && AVX2Capable())
+        assert(sq8.get_dist_func() == hnswlib::SQ8L2SqrGlobal<hnswlib::SQ8L2SqrIntAVX2>);
+
+    hnswlib::L2SpaceF16 f16(32);
+    if (AVX512Capable())
+        assert(f16.get_dist_func() == hnswlib::L2SqrF16AVX512);
+    else if (F16CCapable())
+        assert(f16.get_dist_func() == hnswlib::L2SqrF16AVX);
+    std::cout << "Runtime dispatch: AVX " << AVXCapable() << ", AVX2 " << AVX2Capable()
+              << ", AVX512 " << AVX512Capable() << std::endl;
+#endif
+}
+
+// every selected kernel must agree with the scalar one
+void testDistances() {
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<float> distrib(-1, 1);
+    for (size_t dim : {3, 4, 16, 17, 32, 100, 128}) {
+        std::vector<float> a(dim), b(dim);
+        for (size_t i = 0; i < dim; i++) {
+            a[i] = distrib(rng);
+            b[i] = distrib(rng);
+        }
+        hnswlib::L2Space l2(dim);
+        hnswlib::InnerProductSpace ip(dim);
+        float l2_ref = hnswlib::L2Sqr(a.data(), b.data(), &dim);
+        float ip_ref = hnswlib::InnerProductDistance(a.data(), b.data(), &dim);
+        float l2_dist = l2.get_dist_func()(a.data(), b.data(), l2.get_dist_func_param());
+        float ip_dist = ip.get_dist_func()(a.data(), b.data(), ip.get_dist_func_param());
+        assert(std::abs(l2_dist - l2_ref) <= 1e-4f * (1 + l2_ref));
+        assert(std::abs(ip_dist - ip_ref) <= 1e-4f * (1 + std::abs(ip_ref)));
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testSelection();
+    testDistances();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
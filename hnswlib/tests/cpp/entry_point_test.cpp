@@ -0,0 +1,101 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void test() {
+    int d = 16;
+    idx_t n = 8000;
+    idx_t nq = 100;
+    size_t k = 10;
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+    std::vector<int> levels(n);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+    // many insertions raise the top level, which is what takes the global lock
+    for (idx_t i = 0; i < n; ++i) {
+        levels[i] = i % 40 == 0 ? 1 + i / 400 : 0;
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    assert(alg_hnsw.getEntryPoint().level == -1);
+
+    std::atomic<idx_t> next_label(0);
+    std::atomic<bool> done(false);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&]() {
+            for (idx_t label = next_label++; label < n; label = next_label++) {
+                // level 0 is passed as -1, the random level
+                alg_hnsw.addPoint(data.data() + d * label, label, levels[label] > 0 ? levels[label] : -1);
+            }
+        });
+    }
+    threads.emplace_back([&]() {
+        while (!done) {
+            // the entry point always has the published level
+            auto entry_point = alg_hnsw.getEntryPoint();
+            if (entry_point.level >= 0 && alg_hnsw.element_levels_[entry_point.node] != entry_point.level)
+                failed = true;
+            if (alg_hnsw.getCurrentElementCount() > 0 && entry_point.level >= 0) {
+                auto result = alg_hnsw.searchKnn(query.data(), k);
+                if (result.empty())
+                    failed = true;
+            }
+        }
+    });
+    for (int t = 0; t < 4; t++)
+        threads[t].join();
+    done = true;
+    threads.back().join();
+    assert(!failed);
+
+    int max_level = 0;
+    for (idx_t i = 0; i < n; ++i)
+        max_level = std::max(max_level, alg_hnsw.element_levels_[i]);
+    auto entry_point = alg_hnsw.getEntryPoint();
+    std::cout << "Top level: " << entry_point.level << std::endl;
+    assert(entry_point.level == max_level);
+    assert(alg_hnsw.element_levels_[entry_point.node] == max_level);
+    alg_hnsw.checkIntegrity();
+
+    // the pair survives saving and loading
+    std::string path = "entry_point_test.bin";
+    alg_hnsw.saveIndex(path);
+    hnswlib::HierarchicalNSW<float> alg_loaded(&space, path);
+    assert(alg_loaded.getEntryPoint().node == entry_point.node);
+    assert(alg_loaded.getEntryPoint().level == entry_point.level);
+    remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cmath>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void testConversions() {
+    assert(hnswlib::FloatToF16(0.0f) == 0x0000);
+    assert(hnswlib::FloatToF16(-0.0f) == 0x8000);
+    assert(hnswlib::FloatToF16(1.0f) == 0x3c00);
+    assert(hnswlib::FloatToF16(-2.0f) == 0xc000);
+    assert(hnswlib::FloatToF16(65504.0f) == 0x7bff);
+    assert(hnswlib::FloatToF16(1e6f) == 0x7c00);
+    assert(hnswlib::FloatToF16(std::pow(2.0f, -24.0f)) == 0x0001);
+    assert(hnswlib::F16ToFloat(0x0001) == std::pow(2.0f, -24.0f));
+    assert(hnswlib::F16ToFloat(0x3555) == 0.333251953125f);
+    // ties round to even
+    assert(hnswlib::FloatToF16(1.0f + std::pow(2.0f, -11.0f)) == 0x3c00);
+    assert(hnswlib::FloatToF16(1.0f + 3 * std::pow(2.0f, -11.0f)) == 0x3c02);
+
+    assert(hnswlib::FloatToBF16(1.0f) == 0x3f80);
+    assert(hnswlib::BF16ToFloat(0xc000) == -2.0f);
+    assert(hnswlib::FloatToBF16(1.0f + std::pow(2.0f, -8.0f)) == 0x3f80);
+    assert(hnswlib::FloatToBF16(1.0f + 3 * std::pow(2.0f, -8.0f)) == 0x3f82);
+
+    // every finite fp16 value survives a round trip
+    for (uint32_t h = 0; h < 0x10000; h++) {
+        if ((h & 0x7c00) == 0x7c00)
+            continue;
+        assert(hnswlib::FloatToF16(hnswlib::F16ToFloat((uint16_t) h)) == h);
+    }
+
+    // the vectorized conversion gives the same codes as the scalar one
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<float> distrib(-100, 100);
+    std::vector<float> x(1003);
+    for (auto &v : x)
+        v = distrib(rng);
+    std::vector<uint16_t> h(x.size());
+    hnswlib::ConvertFloatToF16(x.data(), h.data(), x.size());
+    for (size_t i = 0; i < x.size(); i++) {
+        assert(h[i] == hnswlib::FloatToF16(x[i]));
+        assert(std::abs(hnswlib::F16ToFloat(h[i]) - x[i]) <= std::abs(x[i]) * std::pow(2.0f, -11.0f));
+    }
+}
+
+void testKernels() {
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<float> distrib(-1, 1);
+
+    for (size_t dim : {1, 7, 16, 33, 64, 100}) {
+        std::vector<float> a(dim), b(dim);
+        for (size_t i = 0; i < dim; i++) {
+            a[i] = distrib(rng);
+            b[i] = distrib(rng);
+        }
+        std::vector<uint16_t> a16(dim), b16(dim), abf(dim), bbf(dim);
+        hnswlib::ConvertFloatToF16(a.data(), a16.data(), dim);
+        hnswlib::ConvertFloatToF16(b.data(), b16.data(), dim);
+        hnswlib::ConvertFloatToBF16(a.data(), abf.data(), dim);
+        hnswlib::ConvertFloatToBF16(b.data(), bbf.data(), dim);
+
+        float l2_f16 = hnswlib::L2SqrF16(a16.data(), b16.data(), &dim);
+        float ip_f16 = hnswlib::InnerProductF16(a16.data(), b16.data(), &dim);
+        float l2_bf16 = hnswlib::L2SqrBF16(abf.data(), bbf.data(), &dim);
+        float ip_bf16 = hnswlib::InnerProductBF16(abf.data(), bbf.data(), &dim);
+
+        std::vector<hnswlib::SpaceInterface<float> *> spaces = {
+            new hnswlib::L2SpaceF16(dim), new hnswlib::InnerProductSpaceF16(dim),
+            new hnswlib::L2SpaceBF16(dim), new hnswlib::InnerProductSpaceBF16(dim)};
+        std::vector<float> expected = {l2_f16, 1.0f - ip_f16, l2_bf16, 1.0f - ip_bf16};
+        for (size_t s = 0; s < spaces.size(); s++) {
+            bool bf16 = s >= 2;
+            float d = spaces[s]->get_dist_func()(bf16 ? abf.data() : a16.data(), bf16 ? bbf.data() : b16.data(),
+                                                 spaces[s]->get_dist_func_param());
+            assert(spaces[s]->get_data_size() == 2 * dim);
+            assert(std::abs(d - expected[s]) <= 1e-4f * std::max(1.0f, std::abs(expected[s])));
+            delete spaces[s];
+        }
+    }
+}
+
+template<typename L2SpaceHalf>
+void testSearch(void (*convert)(const float *, uint16_t *, size_t), const std::string &name) {
+    int d = 32;
+    idx_t n = 3000;
+    idx_t nq = 100;
+    size_t k = 10;
+    std::string path = "f16_space_test.bin";
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+    std::vector<uint16_t> data_half(n * d);
+    std::vector<uint16_t> query_half(nq * d);
+    convert(data.data(), data_half.data(), n * d);
+    convert(query.data(), query_half.data(), nq * d);
+
+    hnswlib::L2Space space(d);
+    L2SpaceHalf space_half(d);
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    hnswlib::BruteforceSearch<float> alg_brute_half(&space_half, n);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space_half, n);
+    for (size_t i = 0; i < n; ++i) {
+        alg_brute.addPoint(data.data() + d * i, i);
+        alg_brute_half.addPoint(data_half.data() + d * i, i);
+        alg_hnsw.addPoint(data_half.data() + d * i, i);
+    }
+    alg_hnsw.setEf(100);
+    alg_hnsw.saveIndex(path);
+    hnswlib::HierarchicalNSW<float> alg_loaded(&space_half, path);
+    alg_loaded.setEf(100);
+
+    size_t correct_brute = 0;
+    size_t correct_hnsw = 0;
+    for (size_t j = 0; j < nq; ++j) {
+        auto gt = alg_brute.searchKnnCloserFirst(query.data() + d * j, k);
+        auto res_brute = alg_brute_half.searchKnnCloserFirst(query_half.data() + d * j, k);
+        auto res_hnsw = alg_hnsw.searchKnnCloserFirst(query_half.data() + d * j, k);
+        assert(res_hnsw == alg_loaded.searchKnnCloserFirst(query_half.data() + d * j, k));
+        for (auto &g : gt) {
+            for (auto &r : res_brute) {
+                if (r.second == g.second)
+                    correct_brute++;
+            }
+            for (auto &r : res_hnsw) {
+                if (r.second == g.second)
+                    correct_hnsw++;
+            }
+        }
+    }
+    float recall_brute = (float) correct_brute / (nq * k);
+    float recall_hnsw = (float) correct_hnsw / (nq * k);
+    std::cout << name << " brute force recall: " << recall_brute << ", hnsw recall: " << recall_hnsw << "\n";
+    assert(recall_brute > 0.95f);
+    assert(recall_hnsw > 0.9f);
+
+    // stored vectors can be read back
+    std::vector<uint16_t> stored = alg_hnsw.getDataByLabel<uint16_t>(5);
+    assert(std::equal(stored.begin(), stored.end(), data_half.begin() + 5 * d));
+    remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testConversions();
+    testKernels();
+    testSearch<hnswlib::L2SpaceF16>(hnswlib::ConvertFloatToF16, "fp16");
+    testSearch<hnswlib::L2SpaceBF16>(hnswlib::ConvertFloatToBF16, "bf16");
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
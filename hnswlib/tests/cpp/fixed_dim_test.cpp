@@ -0,0 +1,144 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cmath>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+bool close(float a, float b) {
+    return std::abs(a - b) <= 1e-4f * (1 + std::abs(b));
+}
+
+// every specialized kernel must agree with the generic one
+template<size_t DIM>
+void testKernels(std::mt19937 &rng) {
+    std::uniform_real_distribution<float> distrib(-1, 1);
+    std::vector<float> a(DIM), b(DIM);
+    for (size_t i = 0; i < DIM; i++) {
+        a[i] = distrib(rng);
+        b[i] = distrib(rng);
+    }
+    size_t dim = DIM;
+    float l2 = hnswlib::L2Sqr(a.data(), b.data(), &dim);
+    float ip = hnswlib::InnerProductDistance(a.data(), b.data(), &dim);
+
+    assert(close(hnswlib::L2SqrFixed<DIM>(a.data(), b.data(), nullptr), l2));
+    assert(close(hnswlib::InnerProductDistanceFixed<DIM>(a.data(), b.data(), nullptr), ip));
+#if defined(USE_SSE)
+    assert(close(hnswlib::L2SqrFixedSSE<DIM>(a.data(), b.data(), nullptr), l2));
+    assert(close(hnswlib::InnerProductDistanceFixedSSE<DIM>(a.data(), b.data(), nullptr), ip));
+#endif
+#if defined(USE_AVX)
+    if (AVXCapable()) {
+        assert(close(hnswlib::L2SqrFixedAVX<DIM>(a.data(), b.data(), nullptr), l2));
+        assert(close(hnswlib::InnerProductDistanceFixedAVX<DIM>(a.data(), b.data(), nullptr), ip));
+    }
+#endif
+#if defined(USE_AVX512)
+    if (AVX512Capable()) {
+        assert(close(hnswlib::L2SqrFixedAVX512<DIM>(a.data(), b.data(), nullptr), l2));
+        assert(close(hnswlib::InnerProductDistanceFixedAVX512<DIM>(a.data(), b.data(), nullptr), ip));
+    }
+#endif
+    assert(close(hnswlib::L2SqrFixedDim<DIM>()(a.data(), b.data(), nullptr), l2));
+    assert(close(hnswlib::InnerProductDistanceFixedDim<DIM>()(a.data(), b.data(), nullptr), ip));
+
+    // the spaces select the specialized kernels
+    hnswlib::L2Space l2space(DIM);
+    hnswlib::InnerProductSpace ipspace(DIM);
+    assert(l2space.get_dist_func() == hnswlib::L2SqrFixedKernel<DIM>());
+    assert(ipspace.get_dist_func() == hnswlib::InnerProductDistanceFixedKernel<DIM>());
+}
+
+// an index with the distance functor must return the same results as the one with the function pointer
+void testFunctorIndex() {
+    const size_t d = 128;
+    idx_t n = 1000;
+    idx_t nq = 20;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+    for (idx_t i = 0; i < n * d; ++i)
+        data[i] = distrib(rng);
+    for (idx_t i = 0; i < nq * d; ++i)
+        query[i] = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    hnswlib::HierarchicalNSW<float, hnswlib::L2SqrFixedDim<d>> alg_fixed(&space, n);
+    for (size_t i = 0; i < n; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+        alg_fixed.addPoint(data.data() + d * i, i);
+    }
+
+    for (size_t j = 0; j < nq; ++j) {
+        auto res = alg_hnsw.searchKnnCloserFirst(query.data() + j * d, k);
+        auto res_fixed = alg_fixed.searchKnnCloserFirst(query.data() + j * d, k);
+        assert(res.size() == res_fixed.size());
+        for (size_t i = 0; i < res.size(); i++) {
+            assert(res[i].second == res_fixed[i].second);
+            assert(close(res_fixed[i].first, res[i].first));
+        }
+    }
+
+    // the functor must match the dimension of the space
+    bool thrown = false;
+    try {
+        hnswlib::HierarchicalNSW<float, hnswlib::L2SqrFixedDim<96>> alg_wrong(&space, n);
+    } catch (const std::exception &) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // and its type: vectors of the same size but another metric or component type are rejected
+    hnswlib::InnerProductSpace ip_space(d);
+    thrown = false;
+    try {
+        hnswlib::HierarchicalNSW<float, hnswlib::L2SqrFixedDim<d>> alg_wrong(&ip_space, n);
+    } catch (const std::exception &) {
+        thrown = true;
+    }
+    assert(thrown);
+    hnswlib::L2SpaceF16 f16_space(2 * d);
+    thrown = false;
+    try {
+        hnswlib::HierarchicalNSW<float, hnswlib::L2SqrFixedDim<d>> alg_wrong(&f16_space, n);
+    } catch (const std::exception &) {
+        thrown = true;
+    }
+    assert(thrown);
+    thrown = false;
+    try {
+        hnswlib::HierarchicalNSW<float, hnswlib::InnerProductDistanceFixedDim<d>> alg_wrong(&space, n);
+    } catch (const std::exception &) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    std::mt19937 rng;
+    rng.seed(47);
+    testKernels<96>(rng);
+    testKernels<128>(rng);
+    testKernels<384>(rng);
+    testKernels<768>(rng);
+    testKernels<1536>(rng);
+    assert(hnswlib::L2SqrFixedKernel(100) == nullptr);
+    testFunctorIndex();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
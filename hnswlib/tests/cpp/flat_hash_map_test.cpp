@@ -0,0 +1,146 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <unordered_map>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+typedef hnswlib::FlatHashMap<hnswlib::labeltype, hnswlib::tableint> LabelMap;
+
+void checkEqual(const LabelMap &map, const std::unordered_map<hnswlib::labeltype, hnswlib::tableint> &expected) {
+    assert(map.size() == expected.size());
+    size_t num_entries = 0;
+    for (auto &entry : map) {
+        auto it = expected.find(entry.first);
+        assert(it != expected.end() && it->second == entry.second);
+        num_entries++;
+    }
+    assert(num_entries == expected.size());
+    for (auto &entry : expected) {
+        auto it = map.find(entry.first);
+        assert(it != map.end() && it->second == entry.second);
+    }
+}
+
+void testRandomOperations() {
+    LabelMap map;
+    std::unordered_map<hnswlib::labeltype, hnswlib::tableint> expected;
+    assert(map.find(1) == map.end());
+    size_t num_erased = map.erase(1);
+    assert(num_erased == 0);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    // small key range, so that insertions, updates and erasures of present keys all happen often
+    std::uniform_int_distribution<hnswlib::labeltype> key_distrib(0, 5000);
+    for (int i = 0; i < 200000; i++) {
+        hnswlib::labeltype key = key_distrib(rng) * 1000003;
+        switch (rng() % 4) {
+        case 0:
+        case 1:
+            map[key] = i;
+            expected[key] = i;
+            break;
+        case 2: {
+            bool inserted = map.insert(std::make_pair(key, (hnswlib::tableint) i)).second;
+            bool expected_inserted = expected.insert(std::make_pair(key, (hnswlib::tableint) i)).second;
+            assert(inserted == expected_inserted);
+            break;
+        }
+        default: {
+            size_t erased = map.erase(key);
+            size_t expected_erased = expected.erase(key);
+            assert(erased == expected_erased);
+        }
+        }
+        if (i % 20000 == 0)
+            checkEqual(map, expected);
+    }
+    checkEqual(map, expected);
+
+    // a copy of the slot array holds the same entries
+    LabelMap restored;
+    bool assigned = restored.assignSlots(map.slots(), map.memoryUsage() / sizeof(LabelMap::value_type));
+    assert(assigned);
+    checkEqual(restored, expected);
+    assigned = restored.assignSlots(map.slots(), 3);
+    assert(!assigned && restored.empty());
+
+    // erasing everything leaves no stale entries
+    for (auto &entry : expected) {
+        num_erased = map.erase(entry.first);
+        assert(num_erased == 1);
+    }
+    assert(map.empty());
+    assert(map.begin() == map.end());
+}
+
+void testSequentialKeys() {
+    // the usual labels of an index, a reserved table takes 12 bytes per slot for 13 entries per 16 slots
+    const size_t n = 1000000;
+    LabelMap map;
+    map.reserve(n);
+    size_t memory = map.memoryUsage();
+    for (size_t i = 0; i < n; i++)
+        map[i] = n - i;
+    assert(map.memoryUsage() == memory);
+    std::cout << "Bytes per entry: " << (double) memory / n << std::endl;
+    assert(memory <= n * 15);
+    for (size_t i = 0; i < n; i++)
+        assert(map.find(i)->second == n - i);
+    assert(map.find(n) == map.end());
+    map.clear();
+    assert(map.size() == 0 && map.find(0) == map.end());
+}
+
+void testIndex() {
+    int d = 8;
+    hnswlib::labeltype n = 2000;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n / 2, 16, 200, 100, true);
+    for (size_t i = 0; i < n / 2; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, 7 * i);
+    }
+    alg_hnsw.resizeIndex(n);
+    for (size_t i = n / 2; i < n; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, 7 * i);
+    }
+    assert(alg_hnsw.label_lookup_.size() == n);
+    for (size_t i = 0; i < n; i += 10) {
+        alg_hnsw.markDelete(7 * i);
+    }
+    // replacing deleted elements moves their slots to the new labels
+    for (size_t i = 0; i < n; i += 10) {
+        alg_hnsw.addPoint(data.data() + d * i, 7 * i + 1, true);
+    }
+    assert(alg_hnsw.label_lookup_.size() == n);
+    for (size_t i = 0; i < n; i++) {
+        hnswlib::labeltype label = i % 10 == 0 ? 7 * i + 1 : 7 * i;
+        assert(alg_hnsw.getExternalLabel(alg_hnsw.label_lookup_.find(label)->second) == label);
+        assert(alg_hnsw.getDataByLabel<float>(label) == std::vector<float>(data.begin() + d * i, data.begin() + d * (i + 1)));
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testRandomOperations();
+    testSequentialKeys();
+    testIndex();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+typedef std::priority_queue<std::pair<float, hnswlib::tableint>, std::vector<std::pair<float, hnswlib::tableint>>,
+                            hnswlib::HierarchicalNSW<float>::CompareByFirst> CandidateQueue;
+
+// the batch kernel of the space gives the distances of its distance function, for any dimension
+void testBatchKernels() {
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    for (size_t dim : {1, 3, 4, 7, 16, 17, 33, 100, 128}) {
+        hnswlib::L2Space l2space(dim);
+        hnswlib::InnerProductSpace ipspace(dim);
+        for (hnswlib::SpaceInterface<float> *space : {(hnswlib::SpaceInterface<float> *) &l2space,
+                                                      (hnswlib::SpaceInterface<float> *) &ipspace}) {
+            size_t n = 11;
+            std::vector<float> data((n + 1) * dim);
+            for (float &x : data)
+                x = distrib(rng);
+            std::vector<const void *> vectors(n);
+            for (size_t i = 0; i < n; i++)
+                vectors[i] = data.data() + (i + 1) * dim;
+
+            hnswlib::BATCHDISTFUNC<float> batch = space->get_batch_dist_func();
+            hnswlib::DISTFUNC<float> dist = space->get_dist_func();
+            assert(batch != nullptr);
+            for (size_t count = 0; count <= n; count++) {
+                std::vector<float> distances(count);
+                batch(data.data(), vectors.data(), count, space->get_dist_func_param(), distances.data());
+                for (size_t i = 0; i < count; i++) {
+                    float expected = dist(data.data(), vectors[i], space->get_dist_func_param());
+                    assert(std::fabs(distances[i] - expected) <= 1e-4f * std::max(1.0f, std::fabs(expected)));
+                }
+            }
+        }
+    }
+}
+
+// selection of the original implementation, comparing every candidate to the selected ones one at a time
+std::vector<hnswlib::tableint> referenceHeuristic(
+    hnswlib::HierarchicalNSW<float> &alg_hnsw, std::vector<std::pair<float, hnswlib::tableint>> candidates, size_t M) {
+    std::vector<hnswlib::tableint> selected;
+    std::sort(candidates.begin(), candidates.end());
+    if (candidates.size() < M) {
+        for (auto &candidate : candidates)
+            selected.push_back(candidate.second);
+        return selected;
+    }
+    for (auto &candidate : candidates) {
+        if (selected.size() >= M)
+            break;
+        bool good = true;
+        for (hnswlib::tableint id : selected) {
+            float d = alg_hnsw.fstdistfunc_(alg_hnsw.getDataByInternalId(id),
+                                            alg_hnsw.getDataByInternalId(candidate.second), alg_hnsw.dist_func_param_);
+            if (d < candidate.first) {
+                good = false;
+                break;
+            }
+        }
+        if (good)
+            selected.push_back(candidate.second);
+    }
+    return selected;
+}
+
+void testHeuristic() {
+    int d = 32;
+    size_t n = 5000;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (float &x : data)
+        x = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100);
+    for (size_t i = 0; i < n; i++)
+        alg_hnsw.addPoint(data.data() + d * i, i);
+
+    std::uniform_int_distribution<hnswlib::tableint> id_distrib(0, n - 1);
+    double elapsed = 0;
+    for (int iter = 0; iter < 200; iter++) {
+        hnswlib::tableint element = id_distrib(rng);
+        size_t num_candidates = 1 + iter % 400;
+        size_t M = 1 + iter % 64;
+        std::vector<std::pair<float, hnswlib::tableint>> candidates;
+        CandidateQueue queue;
+        for (size_t i = 0; i < num_candidates; i++) {
+            hnswlib::tableint id = id_distrib(rng);
+            // as in the index, the element is not among its candidates
+            if (id == element)
+                continue;
+            float dist = alg_hnsw.fstdistfunc_(alg_hnsw.getDataByInternalId(element), alg_hnsw.getDataByInternalId(id),
+                                               alg_hnsw.dist_func_param_);
+            candidates.emplace_back(dist, id);
+            queue.emplace(dist, id);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        alg_hnsw.getNeighborsByHeuristic2(queue, M);
+        elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::vector<hnswlib::tableint> expected = referenceHeuristic(alg_hnsw, candidates, M);
+        assert(queue.size() == expected.size());
+        std::vector<std::pair<float, hnswlib::tableint>> result;
+        while (!queue.empty()) {
+            result.push_back(queue.top());
+            queue.pop();
+        }
+        // the candidates at equal distances may be selected in another order, the distances match
+        std::sort(result.begin(), result.end());
+        for (size_t i = 0; i < expected.size(); i++) {
+            float expected_dist = alg_hnsw.fstdistfunc_(alg_hnsw.getDataByInternalId(element),
+                                                        alg_hnsw.getDataByInternalId(expected[i]), alg_hnsw.dist_func_param_);
+            assert(result[i].first == expected_dist);
+        }
+    }
+    std::cout << "Heuristic time: " << elapsed * 1000 << " ms" << std::endl;
+    alg_hnsw.checkIntegrity();
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testBatchKernels();
+    testHeuristic();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+std::vector<char> readFile(const std::string &path) {
+    std::ifstream input(path, std::ios::binary);
+    return std::vector<char>((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+}
+
+void writeFile(const std::string &path, const std::vector<char> &data) {
+    std::ofstream output(path, std::ios::binary);
+    output.write(data.data(), data.size());
+}
+
+void testCrc32c() {
+    // check value of the CRC-32C catalogue
+    assert(hnswlib::Crc32c("123456789", 9) == 0xE3069283);
+    assert(hnswlib::Crc32c("", 0) == 0);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::vector<char> data(10 * hnswlib::CRC32C_PARALLEL_BLOCK + 12345);
+    for (char &c : data)
+        c = (char) rng();
+    for (size_t size : {1, 7, 8, 9, 63, 64, 1000, 4099}) {
+        uint32_t expected = ~hnswlib::Crc32cSoftware(~0u, data.data() + 3, size);
+        assert(hnswlib::Crc32c(data.data() + 3, size) == expected);
+        // continued and combined CRCs of the two parts
+        for (size_t split : {(size_t) 0, size / 3, size}) {
+            uint32_t first = hnswlib::Crc32c(data.data() + 3, split);
+            uint32_t second = hnswlib::Crc32c(data.data() + 3 + split, size - split);
+            assert(hnswlib::Crc32c(data.data() + 3 + split, size - split, first) == expected);
+            assert(hnswlib::Crc32cCombine(first, second, size - split) == expected);
+        }
+    }
+    assert(hnswlib::Crc32cParallel(data.data(), data.size(), 4) == hnswlib::Crc32c(data.data(), data.size()));
+}
+
+// the file of saveIndex before the versioned format: the header fields, level 0, the sizes and the link lists
+void saveLegacyIndex(hnswlib::HierarchicalNSW<float> &alg_hnsw, const std::string &path) {
+    std::ofstream output(path, std::ios::binary);
+    hnswlib::writeBinaryPOD(output, alg_hnsw.offsetLevel0_);
+    hnswlib::writeBinaryPOD(output, alg_hnsw.max_elements_.load());
+    hnswlib::writeBinaryPOD(output, alg_hnsw.cur_element_count);
+    hnswlib::writeBinaryPOD(output, alg_hnsw.size_data_per_element_);
+    hnswlib::writeBinaryPOD(output, alg_hnsw.label_offset_);
+    hnswlib::writeBinaryPOD(output, alg_hnsw.offsetData_);
+    hnswlib::writeBinaryPOD(output, alg_hnsw.getEntryPoint().level);
+    hnswlib::writeBinaryPOD(output, alg_hnsw.getEntryPoint().node);
+    hnswlib::writeBinaryPOD(output, alg_hnsw.maxM_);
+    hnswlib::writeBinaryPOD(output, alg_hnsw.maxM0_);
+    hnswlib::writeBinaryPOD(output, alg_hnsw.M_);
+    hnswlib::writeBinaryPOD(output, alg_hnsw.mult_);
+    hnswlib::writeBinaryPOD(output, alg_hnsw.ef_construction_);
+    for (size_t i = 0; i < alg_hnsw.cur_element_count; i++)
+        output.write((char *) alg_hnsw.get_linklist0(i), alg_hnsw.size_data_per_element_);
+    for (size_t i = 0; i < alg_hnsw.cur_element_count; i++) {
+        unsigned int linkListSize = alg_hnsw.element_levels_[i] * alg_hnsw.size_links_per_element_;
+        hnswlib::writeBinaryPOD(output, linkListSize);
+        if (linkListSize)
+            output.write(alg_hnsw.linkLists_[i], linkListSize);
+    }
+}
+
+std::vector<std::vector<std::pair<float, idx_t>>> searchAll(
+    hnswlib::HierarchicalNSW<float> &alg_hnsw, const std::vector<float> &query, size_t nq, size_t d, size_t k) {
+    std::vector<std::vector<std::pair<float, idx_t>>> results;
+    for (size_t j = 0; j < nq; ++j)
+        results.push_back(alg_hnsw.searchKnnCloserFirst(query.data() + j * d, k));
+    return results;
+}
+
+// loading the file throws, whether it is read or mapped
+void checkRejected(const std::string &path, hnswlib::SpaceInterface<float> *space) {
+    hnswlib::HierarchicalNSW<float> alg_hnsw(space);
+    bool thrown = false;
+    try {
+        alg_hnsw.loadIndex(path, space);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+    thrown = false;
+    try {
+        alg_hnsw.loadIndexMapped(path, space, false, true);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+void testIndexFile() {
+    int d = 16;
+    idx_t n = 20000;
+    idx_t nq = 100;
+    size_t k = 10;
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+    std::vector<idx_t> labels(n);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < n; ++i) {
+        labels[i] = 3 * i;
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100);
+    alg_hnsw.addPoints(data.data(), labels.data(), n, 4);
+    alg_hnsw.markDelete(3);
+    auto expected = searchAll(alg_hnsw, query, nq, d, k);
+
+    std::string path = "index_file_test.bin";
+    auto start = std::chrono::steady_clock::now();
+    alg_hnsw.saveIndex(path);
+    double save_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::vector<char> file = readFile(path);
+    assert(file.size() == alg_hnsw.indexFileSize());
+    assert(file.size() % hnswlib::INDEX_FILE_ALIGNMENT == 0);
+    assert(memcmp(file.data(), hnswlib::INDEX_FILE_MAGIC, sizeof(hnswlib::INDEX_FILE_MAGIC)) == 0);
+    // the file does not depend on direct I/O
+    alg_hnsw.saveIndex(path, true);
+    assert(readFile(path) == file);
+
+    for (size_t num_threads : {1, 4}) {
+        for (bool direct_io : {false, true}) {
+            for (hnswlib::IndexLayout layout : {hnswlib::IndexLayout::Interleaved, hnswlib::IndexLayout::Separate}) {
+                hnswlib::HierarchicalNSW<float> alg_loaded(&space);
+                start = std::chrono::steady_clock::now();
+                alg_loaded.loadIndex(path, &space, 0, layout, num_threads, direct_io);
+                double load_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if (layout == hnswlib::IndexLayout::Interleaved && !direct_io)
+                    std::cout << "Save: " << save_time << " s, load on " << num_threads << " threads: "
+                              << load_time << " s" << std::endl;
+                assert(alg_loaded.getDeletedCount() == 1);
+                for (size_t i = 0; i < n; ++i)
+                    assert(alg_loaded.element_levels_[i] == alg_hnsw.element_levels_[i]);
+                // the label lookup is loaded from its section as it was saved
+                assert(alg_loaded.label_lookup_.memoryUsage() == alg_hnsw.label_lookup_.memoryUsage());
+                assert(memcmp(alg_loaded.label_lookup_.slots(), alg_hnsw.label_lookup_.slots(),
+                              alg_hnsw.label_lookup_.memoryUsage()) == 0);
+                assert(searchAll(alg_loaded, query, nq, d, k) == expected);
+                alg_loaded.checkIntegrity();
+            }
+        }
+    }
+    hnswlib::HierarchicalNSW<float> alg_mapped(&space);
+    alg_mapped.loadIndexMapped(path, &space);
+    assert(searchAll(alg_mapped, query, nq, d, k) == expected);
+    alg_mapped.loadIndexMapped(path, &space, false, true);
+    assert(searchAll(alg_mapped, query, nq, d, k) == expected);
+
+    // files of the previous format are still loaded
+    std::string legacy_path = "index_file_test_legacy.bin";
+    saveLegacyIndex(alg_hnsw, legacy_path);
+    hnswlib::HierarchicalNSW<float> alg_legacy(&space, legacy_path);
+    assert(searchAll(alg_legacy, query, nq, d, k) == expected);
+    alg_mapped.loadIndexMapped(legacy_path, &space);
+    assert(searchAll(alg_mapped, query, nq, d, k) == expected);
+    remove(legacy_path.c_str());
+
+    // a flipped byte in any section, in the header or a truncated file is rejected
+    size_t labels_offset = hnswlib::IndexFileReader(path, false).section(hnswlib::IndexSection::Labels).offset;
+    std::vector<size_t> positions = {20, hnswlib::INDEX_FILE_ALIGNMENT + 5, file.size() / 2, file.size() - 10000,
+                                   labels_offset + 100};
+    for (size_t position : positions) {
+        std::vector<char> corrupted = file;
+        corrupted[position] ^= 0x10;
+        writeFile(path, corrupted);
+        checkRejected(path, &space);
+    }
+    writeFile(path, std::vector<char>(file.begin(), file.end() - hnswlib::INDEX_FILE_ALIGNMENT));
+    checkRejected(path, &space);
+    // a writer which did not finish left no header
+    std::vector<char> unfinished = file;
+    std::fill(unfinished.begin(), unfinished.begin() + hnswlib::INDEX_FILE_ALIGNMENT, 0);
+    writeFile(path, unfinished);
+    checkRejected(path, &space);
+
+    // by default the large sections are not checked, a mapped load only reads what it needs
+    std::vector<char> corrupted = file;
+    corrupted[file.size() / 2] ^= 0x10;
+    writeFile(path, corrupted);
+    alg_mapped.loadIndexMapped(path, &space);
+    assert(alg_mapped.cur_element_count == n);
+
+    // the label lookup and the deleted elements are taken from their sections, not from the base layer
+    corrupted = file;
+    size_t level0_offset = hnswlib::IndexFileReader(path, false).section(hnswlib::IndexSection::Level0).offset;
+    hnswlib::labeltype label = alg_hnsw.getExternalLabel(7);
+    corrupted[level0_offset + 7 * alg_hnsw.size_data_per_element_ + alg_hnsw.label_offset_] ^= 0x10;
+    writeFile(path, corrupted);
+    alg_mapped.loadIndexMapped(path, &space, false, false);
+    assert(alg_mapped.label_lookup_.find(label)->second == 7);
+    assert(alg_mapped.getDeletedCount() == 1);
+    remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testCrc32c();
+    testIndexFile();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
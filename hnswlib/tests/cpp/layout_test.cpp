@@ -0,0 +1,126 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+std::vector<std::vector<std::pair<float, idx_t>>> searchAll(
+    hnswlib::HierarchicalNSW<float> &alg_hnsw, const std::vector<float> &query, size_t nq, size_t d, size_t k) {
+    std::vector<std::vector<std::pair<float, idx_t>>> results(nq);
+    for (size_t j = 0; j < nq; ++j)
+        results[j] = alg_hnsw.searchKnnCloserFirst(query.data() + j * d, k);
+    return results;
+}
+
+std::vector<char> readFile(const std::string &path) {
+    std::ifstream input(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+}
+
+void checkAligned(hnswlib::HierarchicalNSW<float> &alg_hnsw) {
+    for (hnswlib::tableint i = 0; i < alg_hnsw.cur_element_count; i++)
+        assert((size_t) alg_hnsw.getDataByInternalId(i) % hnswlib::LEVEL0_ALIGNMENT == 0);
+}
+
+void test() {
+    int d = 17;  // the vector size is not a multiple of the alignment
+    idx_t n = 3000;
+    idx_t nq = 100;
+    size_t k = 10;
+
+    std::vector<float> data(2 * n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < 2 * n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+
+    // both layouts build the same graph
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_interleaved(&space, n, 16, 200, 100, true);
+    hnswlib::HierarchicalNSW<float> alg_separate(&space, n, 16, 200, 100, true, hnswlib::IndexLayout::Separate);
+    assert(alg_separate.layout_ == hnswlib::IndexLayout::Separate);
+    for (size_t i = 0; i < n; ++i) {
+        alg_interleaved.addPoint(data.data() + d * i, i);
+        alg_separate.addPoint(data.data() + d * i, i);
+    }
+    for (size_t i = 0; i < n; i += 10) {
+        alg_interleaved.markDelete(i);
+        alg_separate.markDelete(i);
+    }
+    checkAligned(alg_separate);
+    auto expected = searchAll(alg_interleaved, query, nq, d, k);
+    assert(searchAll(alg_separate, query, nq, d, k) == expected);
+    std::vector<float> vector = alg_separate.getDataByLabel<float>(7);
+    assert(std::vector<float>(data.begin() + 7 * d, data.begin() + 8 * d) == vector);
+
+    // growing and reusing deleted elements
+    alg_interleaved.resizeIndex(2 * n);
+    alg_separate.resizeIndex(2 * n);
+    for (size_t i = n; i < 2 * n; ++i) {
+        alg_interleaved.addPoint(data.data() + d * i, i, true);
+        alg_separate.addPoint(data.data() + d * i, i, true);
+    }
+    checkAligned(alg_separate);
+    expected = searchAll(alg_interleaved, query, nq, d, k);
+    assert(searchAll(alg_separate, query, nq, d, k) == expected);
+
+    alg_interleaved.reorderGraph();
+    alg_separate.reorderGraph();
+    checkAligned(alg_separate);
+    assert(searchAll(alg_interleaved, query, nq, d, k) == expected);
+    assert(searchAll(alg_separate, query, nq, d, k) == expected);
+
+    // the file format does not depend on the layout
+    std::string path_interleaved = "layout_test_interleaved.bin";
+    std::string path_separate = "layout_test_separate.bin";
+    alg_interleaved.saveIndex(path_interleaved);
+    alg_separate.saveIndex(path_separate);
+    std::vector<char> file_separate = readFile(path_separate);
+    assert(file_separate == readFile(path_interleaved));
+    assert(file_separate.size() == alg_separate.indexFileSize());
+
+    hnswlib::HierarchicalNSW<float> loaded_interleaved(&space, path_separate);
+    assert(loaded_interleaved.layout_ == hnswlib::IndexLayout::Interleaved);
+    assert(searchAll(loaded_interleaved, query, nq, d, k) == expected);
+
+    hnswlib::HierarchicalNSW<float> loaded_separate(&space, path_interleaved, false, 0, true,
+                                                    hnswlib::IndexLayout::Separate);
+    assert(loaded_separate.layout_ == hnswlib::IndexLayout::Separate);
+    assert(loaded_separate.getDeletedCount() == alg_separate.getDeletedCount());
+    checkAligned(loaded_separate);
+    assert(searchAll(loaded_separate, query, nq, d, k) == expected);
+
+    // a mapped index keeps the layout of the file
+    loaded_separate.loadIndexMapped(path_separate, &space);
+    assert(loaded_separate.layout_ == hnswlib::IndexLayout::Interleaved);
+    assert(searchAll(loaded_separate, query, nq, d, k) == expected);
+
+    remove(path_interleaved.c_str());
+    remove(path_separate.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <unordered_set>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+// every stored distance matches the distance of the link up to the bf16 rounding, except the links to skipped
+size_t checkLinkDistances(hnswlib::HierarchicalNSW<float> &alg_hnsw, const std::unordered_set<hnswlib::tableint> &skipped) {
+    size_t num_checked = 0;
+    for (hnswlib::tableint i = 0; i < alg_hnsw.getCurrentElementCount(); i++) {
+        for (int level = 0; level <= alg_hnsw.element_levels_[i]; level++) {
+            std::vector<float> distances;
+            std::vector<hnswlib::tableint> links = alg_hnsw.getConnectionsWithLock(i, level, &distances);
+            for (size_t j = 0; j < links.size(); j++) {
+                if (skipped.count(links[j]))
+                    continue;
+                float expected = alg_hnsw.fstdistfunc_(alg_hnsw.getDataByInternalId(i),
+                                                       alg_hnsw.getDataByInternalId(links[j]), alg_hnsw.dist_func_param_);
+                assert(std::fabs(distances[j] - expected) <= expected / 128);
+                num_checked++;
+            }
+        }
+    }
+    return num_checked;
+}
+
+// fraction of the exact k nearest neighbors found by the index
+double recall(
+    hnswlib::HierarchicalNSW<float> &alg_hnsw, hnswlib::BruteforceSearch<float> &alg_brute,
+    const std::vector<float> &query, size_t nq, size_t d, size_t k) {
+    size_t found = 0;
+    for (size_t j = 0; j < nq; ++j) {
+        auto gt = alg_brute.searchKnn(query.data() + j * d, k);
+        auto result = alg_hnsw.searchKnn(query.data() + j * d, k);
+        std::unordered_set<idx_t> expected;
+        while (!gt.empty()) {
+            expected.insert(gt.top().second);
+            gt.pop();
+        }
+        while (!result.empty()) {
+            found += expected.count(result.top().second);
+            result.pop();
+        }
+    }
+    return (double) found / (nq * k);
+}
+
+void test() {
+    int d = 32;
+    idx_t n = 10000;
+    idx_t nq = 100;
+    size_t k = 10;
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+    std::vector<idx_t> labels(n);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < n; ++i) {
+        labels[i] = i;
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    for (idx_t i = 0; i < n; ++i) {
+        alg_brute.addPoint(data.data() + d * i, i);
+    }
+
+    hnswlib::HierarchicalNSW<float> alg_plain(&space, n, 16, 200);
+    auto start = std::chrono::steady_clock::now();
+    alg_plain.addPoints(data.data(), labels.data(), n, 1);
+    double plain_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 200, 100, false, hnswlib::IndexLayout::Interleaved, nullptr, true);
+    start = std::chrono::steady_clock::now();
+    alg_hnsw.addPoints(data.data(), labels.data(), n, 1);
+    double stored_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Build time: " << plain_time << " s, with stored link distances: " << stored_time << " s" << std::endl;
+
+    // 2 more bytes per link
+    assert(alg_hnsw.size_links_level0_ == alg_plain.size_links_level0_ + alg_hnsw.maxM0_ * sizeof(uint16_t));
+    assert(alg_hnsw.size_links_per_element_ == alg_plain.size_links_per_element_ + alg_hnsw.maxM_ * sizeof(uint16_t));
+    std::cout << "Checked " << checkLinkDistances(alg_hnsw, {}) << " link distances" << std::endl;
+    alg_hnsw.checkIntegrity();
+    alg_plain.setEf(100);
+    alg_hnsw.setEf(100);
+    double plain_recall = recall(alg_plain, alg_brute, query, nq, d, k);
+    double stored_recall = recall(alg_hnsw, alg_brute, query, nq, d, k);
+    std::cout << "Recall: " << plain_recall << ", with stored link distances: " << stored_recall << std::endl;
+    assert(stored_recall > 0.9);
+    assert(stored_recall > plain_recall - 0.02);
+
+    // the distances are saved with the links, loading finds them from the size of the links
+    std::string path = "link_distances_test.bin";
+    alg_hnsw.saveIndex(path);
+    hnswlib::HierarchicalNSW<float> alg_loaded(&space, path);
+    assert(alg_loaded.store_link_distances_);
+    assert(alg_loaded.size_links_level0_ == alg_hnsw.size_links_level0_);
+    checkLinkDistances(alg_loaded, {});
+    alg_plain.saveIndex(path);
+    hnswlib::HierarchicalNSW<float> alg_plain_loaded(&space, path);
+    assert(!alg_plain_loaded.store_link_distances_);
+    remove(path.c_str());
+
+    // updated elements have new distances in their own lists and in the lists of the elements they link to,
+    // the other lists linking to them keep the old distances
+    std::unordered_set<hnswlib::tableint> updated;
+    for (idx_t i = 0; i < n; i += 100) {
+        alg_hnsw.addPoint(data.data() + d * ((i + 1) % n), i);
+        updated.insert(alg_hnsw.label_lookup_.find(i)->second);
+    }
+    for (hnswlib::tableint id : updated) {
+        for (int level = 0; level <= alg_hnsw.element_levels_[id]; level++) {
+            for (hnswlib::tableint link : alg_hnsw.getConnectionsWithLock(id, level)) {
+                std::vector<float> link_distances;
+                std::vector<hnswlib::tableint> links = alg_hnsw.getConnectionsWithLock(link, level, &link_distances);
+                for (size_t j = 0; j < links.size(); j++) {
+                    if (links[j] == id) {
+                        float expected = alg_hnsw.fstdistfunc_(alg_hnsw.getDataByInternalId(id),
+                                                               alg_hnsw.getDataByInternalId(link), alg_hnsw.dist_func_param_);
+                        assert(std::fabs(link_distances[j] - expected) <= expected / 128);
+                    }
+                }
+            }
+        }
+    }
+    checkLinkDistances(alg_hnsw, updated);
+
+    // the repair of the links to deleted elements keeps the distances exact
+    for (idx_t i = 1; i < n; i += 3) {
+        alg_loaded.markDelete(i);
+    }
+    alg_loaded.compactDeleted();
+    checkLinkDistances(alg_loaded, {});
+    alg_loaded.checkIntegrity();
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+std::vector<std::vector<std::pair<float, idx_t>>> searchAll(
+    hnswlib::HierarchicalNSW<float> &alg_hnsw, const std::vector<float> &query, size_t nq, size_t d, size_t k) {
+    std::vector<std::vector<std::pair<float, idx_t>>> results(nq);
+    for (size_t j = 0; j < nq; ++j)
+        results[j] = alg_hnsw.searchKnnCloserFirst(query.data() + j * d, k);
+    return results;
+}
+
+// the upper-level lists are ordered by decreasing level and do not overlap
+void checkSortedByLevel(hnswlib::HierarchicalNSW<float> &alg_hnsw) {
+    std::vector<std::pair<char *, int>> lists;
+    for (size_t i = 0; i < alg_hnsw.cur_element_count; i++) {
+        if (alg_hnsw.element_levels_[i] > 0)
+            lists.emplace_back(alg_hnsw.linkLists_[i], alg_hnsw.element_levels_[i]);
+    }
+    std::sort(lists.begin(), lists.end());
+    for (size_t i = 1; i < lists.size(); i++) {
+        assert(lists[i].second <= lists[i - 1].second);
+        assert(lists[i].first == lists[i - 1].first + lists[i - 1].second * alg_hnsw.size_links_per_element_);
+    }
+    assert(alg_hnsw.linkLists_[alg_hnsw.getEntryPoint().node] == lists[0].first);
+}
+
+void test() {
+    int d = 16;
+    idx_t n = 20000;
+    idx_t nq = 100;
+    size_t k = 10;
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    for (size_t i = 0; i < n; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+    }
+    alg_hnsw.setEf(50);
+    auto expected = searchAll(alg_hnsw, query, nq, d, k);
+
+    // the lists of the insertions come from a few blocks instead of one allocation each
+    size_t num_lists = 0;
+    size_t lists_size = 0;
+    for (size_t i = 0; i < n; i++) {
+        num_lists += alg_hnsw.element_levels_[i] > 0;
+        lists_size += alg_hnsw.element_levels_[i] * alg_hnsw.size_links_per_element_;
+    }
+    std::cout << "Upper-level lists: " << num_lists << " in " << alg_hnsw.link_list_arena_.numBlocks() << " blocks" << std::endl;
+    assert(alg_hnsw.link_list_arena_.size() == lists_size);
+    assert(alg_hnsw.link_list_arena_.numBlocks() < 8);
+
+    // packing lays the lists out in one block by level
+    alg_hnsw.packLinkLists();
+    assert(alg_hnsw.link_list_arena_.numBlocks() == 1);
+    assert(alg_hnsw.link_list_arena_.capacity() == lists_size);
+    checkSortedByLevel(alg_hnsw);
+    assert(searchAll(alg_hnsw, query, nq, d, k) == expected);
+    alg_hnsw.checkIntegrity();
+
+    // so does loading
+    std::string path = "link_list_arena_test.bin";
+    alg_hnsw.saveIndex(path);
+    hnswlib::HierarchicalNSW<float> alg_loaded(&space, path, false, 2 * n);
+    assert(alg_loaded.link_list_arena_.numBlocks() == 1);
+    checkSortedByLevel(alg_loaded);
+    alg_loaded.setEf(50);
+    assert(searchAll(alg_loaded, query, nq, d, k) == expected);
+
+    // insertions after loading add blocks
+    std::vector<float> more(n * d);
+    for (idx_t i = 0; i < n * d; ++i) {
+        more[i] = distrib(rng);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        alg_loaded.addPoint(more.data() + d * i, n + i);
+    }
+    alg_loaded.checkIntegrity();
+    size_t found = 0, total = 0;
+    for (idx_t label = 0; label < 2 * n; label += 7) {
+        const float *point = label < n ? data.data() + d * label : more.data() + d * (label - n);
+        found += alg_loaded.searchKnn(point, 1).top().second == label;
+        total++;
+    }
+    assert(found > 0.99 * total);
+
+    // reordering keeps the lists packed
+    alg_loaded.reorderGraph();
+    checkSortedByLevel(alg_loaded);
+    alg_loaded.checkIntegrity();
+
+    alg_loaded.clear();
+    assert(alg_loaded.link_list_arena_.numBlocks() == 0);
+    remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
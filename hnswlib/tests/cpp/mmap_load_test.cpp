@@ -0,0 +1,108 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+std::vector<char> readFile(const std::string &location) {
+    std::ifstream input(location, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+}
+
+void test() {
+    int d = 16;
+    idx_t n = 1000;
+    idx_t nq = 50;
+    size_t k = 10;
+    std::string path = "mmap_load_test.bin";
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float>* alg_hnsw = new hnswlib::HierarchicalNSW<float>(&space, n, 16, 100);
+    for (size_t i = 0; i < n; ++i) {
+        alg_hnsw->addPoint(data.data() + d * i, i);
+    }
+    alg_hnsw->markDelete(7);
+    alg_hnsw->saveIndex(path);
+    std::vector<char> file_before = readFile(path);
+
+    hnswlib::HierarchicalNSW<float>* alg_loaded = new hnswlib::HierarchicalNSW<float>(&space, path);
+    hnswlib::HierarchicalNSW<float>* alg_mapped = new hnswlib::HierarchicalNSW<float>(&space);
+    alg_mapped->loadIndexMapped(path, &space);
+
+    assert(alg_mapped->cur_element_count == n);
+    assert(alg_mapped->getDeletedCount() == 1);
+    assert(alg_mapped->getEntryPoint().level == alg_loaded->getEntryPoint().level);
+    for (size_t i = 0; i < n; ++i) {
+        assert(alg_mapped->element_levels_[i] == alg_loaded->element_levels_[i]);
+    }
+
+    // the mapped index must return exactly the same results as the loaded one
+    for (size_t j = 0; j < nq; ++j) {
+        const void* p = query.data() + j * d;
+        auto res_loaded = alg_loaded->searchKnnCloserFirst(p, k);
+        auto res_mapped = alg_mapped->searchKnnCloserFirst(p, k);
+        assert(res_loaded == res_mapped);
+    }
+
+    // read-only mapping rejects modifications
+    bool thrown = false;
+    try {
+        alg_mapped->addPoint(data.data(), n + 1);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    thrown = false;
+    try {
+        alg_mapped->markDelete(0);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // copy-on-write mapping can be modified without touching the file
+    hnswlib::HierarchicalNSW<float>* alg_cow = new hnswlib::HierarchicalNSW<float>(&space);
+    alg_cow->loadIndexMapped(path, &space, true);
+    alg_cow->markDelete(0);
+    alg_cow->unmarkDelete(7);
+    alg_cow->addPoint(data.data() + d * 1, 2);
+    assert(alg_cow->getDeletedCount() == 1);
+    delete alg_cow;
+    assert(readFile(path) == file_before);
+
+    delete alg_hnsw;
+    delete alg_loaded;
+    delete alg_mapped;
+    remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
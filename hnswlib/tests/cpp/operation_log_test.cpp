@@ -0,0 +1,253 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+std::vector<char> readFile(const std::string &path) {
+    std::ifstream input(path, std::ios::binary);
+    return std::vector<char>((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+}
+
+void writeFile(const std::string &path, const std::vector<char> &data) {
+    std::ofstream output(path, std::ios::binary);
+    output.write(data.data(), data.size());
+}
+
+bool fileExists(const std::string &path) {
+    return std::ifstream(path).good();
+}
+
+// both indexes hold the same elements which are not deleted, with the same vectors
+void checkSameElements(hnswlib::HierarchicalNSW<float> &alg_hnsw, hnswlib::HierarchicalNSW<float> &alg_recovered) {
+    assert(alg_recovered.label_lookup_.size() - alg_recovered.getDeletedCount() ==
+           alg_hnsw.label_lookup_.size() - alg_hnsw.getDeletedCount());
+    for (auto it = alg_hnsw.label_lookup_.begin(); it != alg_hnsw.label_lookup_.end(); ++it) {
+        auto search = alg_recovered.label_lookup_.find(it->first);
+        if (alg_hnsw.isMarkedDeleted(it->second)) {
+            // a label whose slot was replaced may be inserted and deleted again
+            assert(search == alg_recovered.label_lookup_.end() || alg_recovered.isMarkedDeleted(search->second));
+            continue;
+        }
+        assert(search != alg_recovered.label_lookup_.end() && !alg_recovered.isMarkedDeleted(search->second));
+        assert(memcmp(alg_recovered.getDataByInternalId(search->second), alg_hnsw.getDataByInternalId(it->second),
+                      alg_hnsw.data_size_) == 0);
+    }
+}
+
+void testReplay() {
+    int d = 16;
+    idx_t n = 2000;
+
+    std::vector<float> data(2 * n * d);
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    for (idx_t i = 0; i < 2 * n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    std::string path = "operation_log_test.log";
+    remove(path.c_str());
+    remove((path + hnswlib::OPERATION_LOG_ROTATED_SUFFIX).c_str());
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, 2 * n, 16, 100, 100, true);
+    alg_hnsw.openOperationLog(path);
+    for (idx_t i = 0; i < n; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+    }
+    for (idx_t i = 0; i < n; i += 10) {
+        alg_hnsw.markDelete(i);
+    }
+    for (idx_t i = 0; i < n; i += 30) {
+        alg_hnsw.unmarkDelete(i);
+    }
+    for (idx_t i = 5; i < n; i += 50) {
+        alg_hnsw.removePoint(i);
+    }
+    // updates, and insertions which take the slots of deleted elements
+    for (idx_t i = 1; i < n; i += 40) {
+        alg_hnsw.addPoint(data.data() + d * (n + i), i);
+    }
+    for (idx_t i = n; i < n + 100; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i, true);
+    }
+    // a failed operation is not logged
+    bool thrown = false;
+    try {
+        alg_hnsw.markDelete(10);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+    alg_hnsw.closeOperationLog();
+
+    hnswlib::HierarchicalNSW<float> alg_recovered(&space, 2 * n, 16, 100, 100, true);
+    size_t num_applied = alg_recovered.replayOperationLog(path);
+    std::cout << "Replayed " << num_applied << " operations" << std::endl;
+    checkSameElements(alg_hnsw, alg_recovered);
+    // replaying the log again leaves the same elements
+    alg_recovered.replayOperationLog(path);
+    checkSameElements(alg_hnsw, alg_recovered);
+
+    // the record cut off by a crash and the ones after a corrupted record are not replayed
+    std::vector<char> log = readFile(path);
+    writeFile(path, std::vector<char>(log.begin(), log.end() - 3));
+    hnswlib::HierarchicalNSW<float> alg_truncated(&space, 2 * n, 16, 100, 100, true);
+    size_t num_truncated = alg_truncated.replayOperationLog(path);
+    assert(num_truncated == num_applied - 1);
+    std::vector<char> corrupted = log;
+    corrupted[log.size() / 2] ^= 0x10;
+    writeFile(path, corrupted);
+    hnswlib::HierarchicalNSW<float> alg_corrupted(&space, 2 * n, 16, 100, 100, true);
+    size_t num_corrupted = alg_corrupted.replayOperationLog(path);
+    assert(num_corrupted < num_applied / 2 + 1);
+
+    // a log continued after a crash drops the cut off record
+    writeFile(path, std::vector<char>(log.begin(), log.end() - 3));
+    alg_truncated.openOperationLog(path);
+    alg_truncated.markDelete(n + 98);
+    alg_truncated.closeOperationLog();
+    hnswlib::HierarchicalNSW<float> alg_continued(&space, 2 * n, 16, 100, 100, true);
+    alg_continued.replayOperationLog(path);
+    checkSameElements(alg_truncated, alg_continued);
+
+    // a removal logged after the deletion of the label replaces the links to it
+    {
+        hnswlib::OperationLog log_removed(path, space.get_data_size(), false);
+        log_removed.append(hnswlib::LoggedOperation::MarkDelete, 1);
+        log_removed.append(hnswlib::LoggedOperation::Remove, 1);
+    }
+    hnswlib::HierarchicalNSW<float> alg_removed(&space, 2 * n, 16, 100, 100, true);
+    alg_removed.replayOperationLog(path);
+    hnswlib::tableint removed_id = alg_removed.label_lookup_.find(1)->second;
+    assert(alg_removed.isMarkedDeleted(removed_id));
+    for (hnswlib::tableint neighbor : alg_removed.getConnectionsWithLock(removed_id, 0)) {
+        std::vector<hnswlib::tableint> links = alg_removed.getConnectionsWithLock(neighbor, 0);
+        assert(alg_removed.isMarkedDeleted(neighbor) || std::find(links.begin(), links.end(), removed_id) == links.end());
+    }
+
+    // the log of another space is rejected
+    hnswlib::L2Space other_space(d + 1);
+    hnswlib::HierarchicalNSW<float> alg_other(&other_space, n);
+    thrown = false;
+    try {
+        alg_other.replayOperationLog(path);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+    remove(path.c_str());
+}
+
+void testCheckpoint() {
+    int d = 16;
+    idx_t n = 10000;
+    int num_inserters = 3;
+
+    std::vector<float> data(2 * n * d);
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    for (idx_t i = 0; i < 2 * n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    std::string path = "operation_log_test.bin";
+    std::string log_path = "operation_log_test.log";
+    remove(log_path.c_str());
+    remove((log_path + hnswlib::OPERATION_LOG_ROTATED_SUFFIX).c_str());
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, 2 * n, 16, 100);
+    alg_hnsw.openOperationLog(log_path, true);
+    for (idx_t i = 0; i < n / 2; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+    }
+    alg_hnsw.checkpoint(path);
+
+    // checkpoints are taken while other threads insert and delete
+    std::atomic<idx_t> next_label(n / 2);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_inserters; t++) {
+        threads.emplace_back([&]() {
+            idx_t label;
+            while ((label = next_label++) < n) {
+                alg_hnsw.addPoint(data.data() + d * label, label);
+                if (label % 20 == 0)
+                    alg_hnsw.markDelete(label - n / 2);
+            }
+        });
+    }
+    size_t num_checkpoints = 0;
+    while (next_label < n || num_checkpoints < 3) {
+        alg_hnsw.checkpoint(path);
+        num_checkpoints++;
+        assert(!fileExists(log_path + hnswlib::OPERATION_LOG_ROTATED_SUFFIX));
+    }
+    for (auto &thread : threads)
+        thread.join();
+    std::cout << num_checkpoints << " checkpoints" << std::endl;
+
+    // a crash after the last checkpoint: the snapshot and the log hold every operation
+    for (idx_t i = n; i < n + 100; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+    }
+    alg_hnsw.closeOperationLog();
+    {
+        hnswlib::HierarchicalNSW<float> alg_recovered(&space, path, false, 2 * n);
+        size_t num_applied = alg_recovered.replayOperationLog(log_path);
+        assert(num_applied >= 100);
+        checkSameElements(alg_hnsw, alg_recovered);
+    }
+
+    // a crash during a checkpoint, after the log was set aside and before the snapshot was written
+    alg_hnsw.openOperationLog(log_path);
+    for (idx_t i = n + 100; i < n + 200; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+    }
+    alg_hnsw.operation_log_->rotate(log_path + hnswlib::OPERATION_LOG_ROTATED_SUFFIX);
+    for (idx_t i = n + 200; i < n + 300; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+        alg_hnsw.markDelete(i - 150);
+    }
+    alg_hnsw.closeOperationLog();
+    hnswlib::HierarchicalNSW<float> alg_recovered(&space, path, false, 2 * n);
+    // the operations after the last checkpoint, in the log set aside and in the new one
+    size_t num_recovered = alg_recovered.replayOperationLog(log_path);
+    assert(num_recovered >= 400);
+    checkSameElements(alg_hnsw, alg_recovered);
+
+    // the next checkpoint of the recovered index removes the log set aside
+    alg_recovered.openOperationLog(log_path);
+    alg_recovered.checkpoint(path);
+    assert(!fileExists(log_path + hnswlib::OPERATION_LOG_ROTATED_SUFFIX));
+    alg_recovered.closeOperationLog();
+    hnswlib::HierarchicalNSW<float> alg_loaded(&space, path, false, 2 * n);
+    size_t num_loaded = alg_loaded.replayOperationLog(log_path);
+    assert(num_loaded == 0);
+    checkSameElements(alg_hnsw, alg_loaded);
+    alg_loaded.checkIntegrity();
+    remove(path.c_str());
+    remove(log_path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testReplay();
+    testCheckpoint();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,220 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+// distances of the prepared query and of the codes must match the fp32 distances to the decoded vectors
+void testDistances(hnswlib::PQSpaceBase &space, hnswlib::SpaceInterface<float> &reference_space,
+                   const std::vector<float> &data, size_t n, size_t dim) {
+    space.train(data.data(), n, 5);
+    size_t code_size = space.get_data_size();
+    std::vector<uint8_t> codes(n * code_size);
+    std::vector<float> decoded(n * dim);
+    for (size_t j = 0; j < n; j++) {
+        space.encode(data.data() + j * dim, codes.data() + j * code_size);
+        space.decode(codes.data() + j * code_size, decoded.data() + j * dim);
+    }
+
+    std::vector<char> query(space.get_query_size());
+    hnswlib::DISTFUNC<float> dist = space.get_dist_func();
+    hnswlib::DISTFUNC<float> query_dist = space.get_query_dist_func();
+    hnswlib::DISTFUNC<float> reference_dist = reference_space.get_dist_func();
+    void *param = space.get_dist_func_param();
+    void *reference_param = reference_space.get_dist_func_param();
+    for (size_t j = 0; j + 1 < 200; j++) {
+        const uint8_t *a = codes.data() + j * code_size;
+        const uint8_t *b = codes.data() + (j + 1) * code_size;
+        float d = dist(a, b, param);
+        float d_ref = reference_dist(decoded.data() + j * dim, decoded.data() + (j + 1) * dim, reference_param);
+        assert(std::abs(d - d_ref) <= 1e-4f * (1 + std::abs(d_ref)));
+
+        space.prepare_query(data.data() + j * dim, query.data());
+        float dq = query_dist(query.data(), b, param);
+        float dq_ref = reference_dist(data.data() + j * dim, decoded.data() + (j + 1) * dim, reference_param);
+        assert(std::abs(dq - dq_ref) <= 1e-4f * (1 + std::abs(dq_ref)));
+    }
+}
+
+float recall(hnswlib::HierarchicalNSW<float> &alg_hnsw, hnswlib::BruteforceSearch<float> &alg_brute,
+             const std::vector<float> &query, size_t nq, size_t dim, size_t k,
+             const hnswlib::VectorStore &store, hnswlib::SpaceInterface<float> &exact_space, size_t num_candidates) {
+    size_t correct = 0;
+    for (size_t j = 0; j < nq; j++) {
+        const float *q = query.data() + j * dim;
+        auto gt = alg_brute.searchKnn(q, k);
+        auto res = alg_hnsw.searchKnnReranked(q, k, num_candidates, store, &exact_space);
+        assert(res.size() == k);
+        std::vector<idx_t> expected;
+        while (!gt.empty()) {
+            expected.push_back(gt.top().second);
+            gt.pop();
+        }
+        while (!res.empty()) {
+            if (std::find(expected.begin(), expected.end(), res.top().second) != expected.end())
+                correct++;
+            res.pop();
+        }
+    }
+    return (float) correct / (nq * k);
+}
+
+void test() {
+    size_t dim = 32;
+    size_t n = 3000;
+    size_t nq = 50;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * dim);
+    std::vector<float> query(nq * dim);
+    for (size_t i = 0; i < n * dim; i++)
+        data[i] = distrib(rng);
+    for (size_t i = 0; i < nq * dim; i++)
+        query[i] = distrib(rng);
+
+    hnswlib::L2Space l2space(dim);
+    hnswlib::InnerProductSpace ipspace(dim);
+    {
+        hnswlib::L2SpacePQ space(dim, 8);
+        testDistances(space, l2space, data, n, dim);
+    }
+    {
+        hnswlib::InnerProductSpacePQ space(dim, 8);
+        testDistances(space, ipspace, data, n, dim);
+    }
+    bool thrown = false;
+    try {
+        hnswlib::L2SpacePQ space(dim, 5);
+    } catch (const std::exception &) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    hnswlib::L2SpacePQ space(dim, 8);
+    space.train(data.data(), n);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    hnswlib::BruteforceSearch<float> alg_brute(&l2space, n);
+    hnswlib::MemoryVectorStore store(dim * sizeof(float), n);
+    std::vector<uint8_t> code(space.get_data_size());
+    for (size_t i = 0; i < n; i++) {
+        space.encode(data.data() + i * dim, code.data());
+        alg_hnsw.addPoint(code.data(), i);
+        alg_brute.addPoint(data.data() + i * dim, i);
+        store.add(i, data.data() + i * dim);
+    }
+    alg_hnsw.setEf(100);
+
+    // the stored codes are the ones which were added
+    std::vector<uint8_t> stored = alg_hnsw.getDataByLabel<uint8_t>(7);
+    space.encode(data.data() + 7 * dim, code.data());
+    assert(stored == std::vector<uint8_t>(code.begin(), code.end()));
+
+    // the context search prepares the query too
+    hnswlib::HierarchicalNSW<float>::SearchContext context;
+    std::vector<std::pair<float, idx_t>> results(k);
+    for (size_t j = 0; j < nq; j++) {
+        const float *q = query.data() + j * dim;
+        auto res = alg_hnsw.searchKnn(q, k);
+        size_t num = alg_hnsw.searchKnn(q, k, context, results.data());
+        assert(num == res.size());
+        for (size_t i = num; i > 0; i--) {
+            assert(results[i - 1] == res.top());
+            res.pop();
+        }
+    }
+
+    float recall_approximate = recall(alg_hnsw, alg_brute, query, nq, dim, k, store, l2space, k);
+    float recall_reranked = recall(alg_hnsw, alg_brute, query, nq, dim, k, store, l2space, 100);
+    std::cout << "PQ recall: " << recall_approximate << ", re-ranked: " << recall_reranked << std::endl;
+    assert(recall_reranked > recall_approximate);
+    assert(recall_reranked >= 0.9f);
+
+    // the file store returns the same results
+    std::string path = "pq_search_test.vectors";
+    store.save(path);
+    {
+        hnswlib::FileVectorStore file_store(path, dim * sizeof(float));
+        assert(file_store.size() == n);
+        for (size_t j = 0; j < nq; j++) {
+            const float *q = query.data() + j * dim;
+            auto res = alg_hnsw.searchKnnReranked(q, k, 100, store, &l2space);
+            auto res_file = alg_hnsw.searchKnnReranked(q, k, 100, file_store, &l2space);
+            while (!res.empty()) {
+                assert(res.top() == res_file.top());
+                res.pop();
+                res_file.pop();
+            }
+        }
+    }
+    remove(path.c_str());
+
+    // the index and the centroids are saved, a new space with the restored centroids searches the same
+    std::string index_path = "pq_search_test.bin";
+    std::string centroids_path = "pq_search_test.centroids";
+    alg_hnsw.saveIndex(index_path);
+    {
+        std::ofstream output(centroids_path, std::ios::binary);
+        output.write((const char *) space.getCentroids(), dim * hnswlib::PQ_NUM_CENTROIDS * sizeof(float));
+    }
+    {
+        std::vector<float> centroids(dim * hnswlib::PQ_NUM_CENTROIDS);
+        std::ifstream input(centroids_path, std::ios::binary);
+        input.read((char *) centroids.data(), centroids.size() * sizeof(float));
+        hnswlib::L2SpacePQ restored_space(dim, 8);
+        restored_space.setCentroids(centroids.data());
+        hnswlib::HierarchicalNSW<float> alg_restored(&restored_space, index_path);
+        alg_restored.setEf(100);
+        std::vector<float> decoded(dim), restored_decoded(dim);
+        space.decode(stored.data(), decoded.data());
+        restored_space.decode(stored.data(), restored_decoded.data());
+        assert(decoded == restored_decoded);
+        for (size_t j = 0; j < nq; j++) {
+            const float *q = query.data() + j * dim;
+            assert(alg_restored.searchKnnCloserFirst(q, k) == alg_hnsw.searchKnnCloserFirst(q, k));
+        }
+    }
+    remove(index_path.c_str());
+    remove(centroids_path.c_str());
+
+    // the batch search prepares every query, the raw queries are dim floats apart
+    thrown = false;
+    try {
+        alg_hnsw.searchKnnBatch(query.data(), nq, k);
+    } catch (const std::exception &) {
+        thrown = true;
+    }
+    assert(thrown);
+    auto batch_results = alg_hnsw.searchKnnBatch(query.data(), nq, k, nullptr, 8, dim * sizeof(float));
+    for (size_t j = 0; j < nq; j++) {
+        auto res = alg_hnsw.searchKnn(query.data() + j * dim, k);
+        auto &res_batch = batch_results[j];
+        assert(res.size() == res_batch.size());
+        while (!res.empty()) {
+            assert(res.top() == res_batch.top());
+            res.pop();
+            res_batch.pop();
+        }
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
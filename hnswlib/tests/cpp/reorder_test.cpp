@@ -0,0 +1,116 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+// fraction of base layer links to elements with ids within 64 of the element
+double localLinks(hnswlib::HierarchicalNSW<float> &alg_hnsw) {
+    double total = 0;
+    size_t count = 0;
+    for (hnswlib::tableint i = 0; i < alg_hnsw.cur_element_count; i++) {
+        hnswlib::linklistsizeint *ll = alg_hnsw.get_linklist0(i);
+        size_t size = alg_hnsw.getListCount(ll);
+        hnswlib::tableint *links = (hnswlib::tableint *) (ll + 1);
+        for (size_t j = 0; j < size; j++) {
+            total += std::abs((double) links[j] - (double) i) <= 64;
+            count++;
+        }
+    }
+    return total / count;
+}
+
+std::vector<std::vector<std::pair<float, idx_t>>> searchAll(
+    hnswlib::HierarchicalNSW<float> &alg_hnsw, const std::vector<float> &query, size_t nq, size_t d, size_t k) {
+    std::vector<std::vector<std::pair<float, idx_t>>> results(nq);
+    for (size_t j = 0; j < nq; ++j)
+        results[j] = alg_hnsw.searchKnnCloserFirst(query.data() + j * d, k);
+    return results;
+}
+
+void test() {
+    int d = 16;
+    idx_t n = 5000;
+    idx_t nq = 100;
+    size_t k = 10;
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, 2 * n, 16, 200, 100, true);
+    for (size_t i = 0; i < n; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+    }
+    for (idx_t label = 0; label < n; label += 50) {
+        alg_hnsw.markDelete(label);
+    }
+    alg_hnsw.setEf(50);
+    auto expected = searchAll(alg_hnsw, query, nq, d, k);
+
+    double local_before = localLinks(alg_hnsw);
+    idx_t entry_label = alg_hnsw.getExternalLabel(alg_hnsw.getEntryPoint().node);
+    alg_hnsw.reorderGraph();
+    double local_after = localLinks(alg_hnsw);
+    std::cout << "Local links: " << local_before << " -> " << local_after << std::endl;
+    assert(local_after > 3 * local_before);
+    assert(alg_hnsw.getEntryPoint().node == 0);
+    assert(alg_hnsw.getExternalLabel(0) == entry_label);
+    alg_hnsw.checkIntegrity();
+
+    // the labels, the data and the deleted marks follow the elements
+    for (idx_t label = 0; label < n; label++) {
+        hnswlib::tableint id = alg_hnsw.label_lookup_[label];
+        assert(alg_hnsw.getExternalLabel(id) == label);
+        assert(alg_hnsw.isMarkedDeleted(id) == (label % 50 == 0));
+        assert(memcmp(alg_hnsw.getDataByInternalId(id), data.data() + label * d, d * sizeof(float)) == 0);
+    }
+    assert(searchAll(alg_hnsw, query, nq, d, k) == expected);
+
+    // the order is kept by saving and loading
+    std::string path = "reorder_test.bin";
+    alg_hnsw.saveIndex(path);
+    hnswlib::HierarchicalNSW<float> alg_loaded(&space, path, false, 2 * n, true);
+    alg_loaded.setEf(50);
+    assert(alg_loaded.getEntryPoint().node == 0);
+    assert(localLinks(alg_loaded) == local_after);
+    assert(searchAll(alg_loaded, query, nq, d, k) == expected);
+    remove(path.c_str());
+
+    // the index can still be updated
+    for (idx_t label = 0; label < n; label += 50) {
+        alg_hnsw.addPoint(data.data() + d * label, n + label, true);
+    }
+    for (size_t i = n; i < n + 100; ++i) {
+        alg_hnsw.addPoint(data.data() + d * (i - n), 2 * n - 1 - (i - n));
+    }
+    alg_hnsw.checkIntegrity();
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
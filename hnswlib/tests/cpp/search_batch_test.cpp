@@ -0,0 +1,99 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class PickDivisibleIds : public hnswlib::BaseFilterFunctor {
+    unsigned int divisor = 1;
+
+ public:
+    explicit PickDivisibleIds(unsigned int divisor) : divisor(divisor) {}
+
+    bool operator()(idx_t label) {
+        return label % divisor == 0;
+    }
+};
+
+void checkSameResults(
+    hnswlib::HierarchicalNSW<float> &alg_hnsw,
+    const std::vector<float> &query,
+    size_t nq,
+    size_t d,
+    size_t k,
+    size_t batch_size,
+    hnswlib::BaseFilterFunctor* filter) {
+    auto batch_results = alg_hnsw.searchKnnBatch(query.data(), nq, k, filter, batch_size);
+    assert(batch_results.size() == nq);
+    for (size_t j = 0; j < nq; ++j) {
+        auto res = alg_hnsw.searchKnn(query.data() + j * d, k, filter);
+        auto &res_batch = batch_results[j];
+        assert(res.size() == res_batch.size());
+        while (!res.empty()) {
+            assert(res.top() == res_batch.top());
+            res.pop();
+            res_batch.pop();
+        }
+    }
+}
+
+void test() {
+    int d = 16;
+    idx_t n = 3000;
+    idx_t nq = 101;
+    size_t k = 10;
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    for (size_t i = 0; i < n; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+    }
+    alg_hnsw.setEf(40);
+
+    PickDivisibleIds filter(3);
+    for (size_t batch_size : {1, 3, 8, 200}) {
+        checkSameResults(alg_hnsw, query, nq, d, k, batch_size, nullptr);
+        checkSameResults(alg_hnsw, query, nq, d, k, batch_size, &filter);
+    }
+
+    // deleted elements switch the batch search to the checked variant
+    for (idx_t label = 0; label < n; label += 7) {
+        alg_hnsw.markDelete(label);
+    }
+    checkSameResults(alg_hnsw, query, nq, d, k, 8, nullptr);
+    checkSameResults(alg_hnsw, query, nq, d, k, 8, &filter);
+
+    // the batch search takes the visited set selected for the index
+    alg_hnsw.setVisitedSetType(hnswlib::VisitedSetType::Hash);
+    checkSameResults(alg_hnsw, query, nq, d, k, 8, nullptr);
+    checkSameResults(alg_hnsw, query, nq, d, k, 8, &filter);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
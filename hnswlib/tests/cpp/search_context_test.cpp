@@ -0,0 +1,110 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <iostream>
+
+// counts all heap allocations of the process
+static std::atomic<size_t> num_allocations{0};
+
+void* operator new(size_t size) {
+    num_allocations++;
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class PickDivisibleIds : public hnswlib::BaseFilterFunctor {
+    unsigned int divisor = 1;
+
+ public:
+    explicit PickDivisibleIds(unsigned int divisor) : divisor(divisor) {}
+
+    bool operator()(idx_t label) {
+        return label % divisor == 0;
+    }
+};
+
+void test() {
+    int d = 16;
+    idx_t n = 2000;
+    idx_t nq = 100;
+    size_t k = 10;
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    for (size_t i = 0; i < n; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+    }
+    alg_hnsw.setEf(50);
+    for (idx_t label = 0; label < n; label += 11) {
+        alg_hnsw.markDelete(label);
+    }
+
+    PickDivisibleIds filter(3);
+    hnswlib::HierarchicalNSW<float>::SearchContext context(50);
+    std::vector<std::pair<float, idx_t>> result(k);
+
+    // the context gives the same results as the regular search
+    for (size_t j = 0; j < nq; ++j) {
+        const void* p = query.data() + j * d;
+        for (hnswlib::BaseFilterFunctor* f : {(hnswlib::BaseFilterFunctor*) nullptr, (hnswlib::BaseFilterFunctor*) &filter}) {
+            auto expected = alg_hnsw.searchKnnCloserFirst(p, k, f);
+            size_t num_results = alg_hnsw.searchKnn(p, k, context, result.data(), f);
+            assert(num_results == expected.size());
+            for (size_t i = 0; i < num_results; i++) {
+                assert(result[i] == expected[i]);
+            }
+        }
+    }
+
+    // once the context is warmed up, searching does not allocate
+    size_t allocations_before = num_allocations;
+    for (size_t j = 0; j < nq; ++j) {
+        const void* p = query.data() + j * d;
+        alg_hnsw.searchKnn(p, k, context, result.data());
+        alg_hnsw.searchKnn(p, k, context, result.data(), &filter);
+    }
+    assert(num_allocations == allocations_before);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
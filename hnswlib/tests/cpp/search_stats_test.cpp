@@ -0,0 +1,118 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class PickEvenIds : public hnswlib::BaseFilterFunctor {
+ public:
+    bool operator()(idx_t label) {
+        return label % 2 == 0;
+    }
+};
+
+void test() {
+    int d = 16;
+    idx_t n = 2000;
+    idx_t nq = 100;
+    size_t k = 10;
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    for (size_t i = 0; i < n; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+    }
+    alg_hnsw.setEf(50);
+
+    // collecting statistics must not change the results
+    hnswlib::SearchStats total;
+    for (size_t j = 0; j < nq; ++j) {
+        const void* p = query.data() + j * d;
+        hnswlib::SearchStats stats;
+        auto res = alg_hnsw.searchKnn(p, k);
+        auto res_stats = alg_hnsw.searchKnn(p, k, nullptr, &stats);
+        assert(res.size() == res_stats.size());
+        while (!res.empty()) {
+            assert(res.top() == res_stats.top());
+            res.pop();
+            res_stats.pop();
+        }
+        assert(stats.hops_per_level[0] > 0);
+        assert(stats.visited >= stats.hops_per_level[0]);
+        assert(stats.distance_computations >= stats.visited);
+        assert(stats.heap_pushes >= k);
+        assert(stats.filtered_out == 0);
+        total += stats;
+    }
+    assert(total.hops() > total.hops_per_level[0]);
+
+    // filtered out candidates are counted
+    PickEvenIds filter;
+    hnswlib::SearchStats filter_stats;
+    alg_hnsw.searchKnn(query.data(), k, &filter, &filter_stats);
+    assert(filter_stats.filtered_out > 0);
+
+    // per-thread aggregation
+    hnswlib::SearchStatsAggregator aggregator;
+    int num_threads = 4;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.push_back(std::thread([&] {
+            for (size_t j = 0; j < nq; ++j) {
+                hnswlib::SearchStats stats;
+                alg_hnsw.searchKnn(query.data() + j * d, k, nullptr, &stats);
+                aggregator.add(stats);
+            }
+        }));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    size_t num_searches = 0;
+    hnswlib::SearchStats collected = aggregator.collect(&num_searches);
+    assert(num_searches == num_threads * nq);
+    assert(collected.hops() == num_threads * total.hops());
+    assert(collected.distance_computations == num_threads * total.distance_computations);
+    assert(collected.visited == num_threads * total.visited);
+    assert(collected.heap_pushes == num_threads * total.heap_pushes);
+
+    // a thread which adds to short-lived aggregators does not keep their slots
+    for (int i = 0; i < 1000; i++) {
+        hnswlib::SearchStatsAggregator request_aggregator;
+        request_aggregator.add(total);
+        size_t request_searches = 0;
+        request_aggregator.collect(&request_searches);
+        assert(request_searches == 1);
+    }
+    assert(hnswlib::SearchStatsAggregator::localSlotCount() <= 2);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+std::vector<char> readFile(const std::string &path) {
+    std::ifstream input(path, std::ios::binary);
+    return std::vector<char>((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+}
+
+bool fileExists(const std::string &path) {
+    return std::ifstream(path).good();
+}
+
+// the links of a snapshot stay within its elements, its vectors are the inserted ones
+void checkSnapshot(hnswlib::HierarchicalNSW<float> &alg_snapshot, const std::vector<float> &data, size_t d) {
+    size_t count = alg_snapshot.cur_element_count;
+    for (hnswlib::tableint i = 0; i < count; i++) {
+        for (int level = 0; level <= alg_snapshot.element_levels_[i]; level++) {
+            std::vector<hnswlib::tableint> links = alg_snapshot.getConnectionsWithLock(i, level);
+            std::unordered_set<hnswlib::tableint> unique(links.begin(), links.end());
+            assert(unique.size() == links.size());
+            for (hnswlib::tableint link : links) {
+                assert(link < count && link != i);
+                assert(alg_snapshot.element_levels_[link] >= level);
+            }
+        }
+        idx_t label = alg_snapshot.getExternalLabel(i);
+        assert(memcmp(alg_snapshot.getDataByInternalId(i), data.data() + d * label, d * sizeof(float)) == 0);
+    }
+    assert(alg_snapshot.label_lookup_.size() == count);
+    assert(alg_snapshot.element_levels_[alg_snapshot.getEntryPoint().node] == alg_snapshot.getEntryPoint().level);
+}
+
+void test() {
+    int d = 16;
+    idx_t n = 10000;
+    idx_t nq = 100;
+    size_t k = 10;
+    int num_inserters = 3;
+
+    std::vector<float> data(2 * n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    for (idx_t i = 0; i < 2 * n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, 2 * n, 16, 100);
+    for (idx_t i = 0; i < n; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+    }
+
+    // snapshots are taken while other threads insert, delete and search
+    std::atomic<idx_t> next_label(n);
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_inserters; t++) {
+        threads.emplace_back([&]() {
+            idx_t label;
+            while ((label = next_label++) < 2 * n) {
+                alg_hnsw.addPoint(data.data() + d * label, label);
+                if (label % 50 == 0)
+                    alg_hnsw.markDelete(label - n);
+            }
+        });
+    }
+    threads.emplace_back([&]() {
+        while (!done) {
+            for (idx_t j = 0; j < nq; ++j)
+                alg_hnsw.searchKnn(query.data() + j * d, k);
+        }
+    });
+
+    std::string path = "snapshot_test.bin";
+    size_t num_snapshots = 0;
+    size_t last_count = 0;
+    while (next_label < 2 * n || num_snapshots < 3) {
+        alg_hnsw.saveSnapshot(path);
+        num_snapshots++;
+        assert(!fileExists(path + ".tmp"));
+
+        hnswlib::HierarchicalNSW<float> alg_snapshot(&space, path);
+        assert(alg_snapshot.cur_element_count >= last_count);
+        last_count = alg_snapshot.cur_element_count;
+        checkSnapshot(alg_snapshot, data, d);
+
+        hnswlib::BruteforceSearch<float> alg_brute(&space, last_count);
+        for (hnswlib::tableint i = 0; i < last_count; i++) {
+            if (!alg_snapshot.isMarkedDeleted(i))
+                alg_brute.addPoint(alg_snapshot.getDataByInternalId(i), alg_snapshot.getExternalLabel(i));
+        }
+        alg_snapshot.setEf(50);
+        size_t found = 0;
+        for (idx_t j = 0; j < nq; ++j) {
+            auto gt = alg_brute.searchKnn(query.data() + j * d, k);
+            auto result = alg_snapshot.searchKnn(query.data() + j * d, k);
+            std::unordered_set<idx_t> expected;
+            while (!gt.empty()) {
+                expected.insert(gt.top().second);
+                gt.pop();
+            }
+            while (!result.empty()) {
+                found += expected.count(result.top().second);
+                result.pop();
+            }
+        }
+        double recall = (double) found / (nq * k);
+        std::cout << "Snapshot of " << last_count << " elements, recall " << recall << std::endl;
+        assert(recall > 0.9);
+    }
+    done = true;
+    for (auto &thread : threads)
+        thread.join();
+    std::cout << num_snapshots << " snapshots" << std::endl;
+
+    // without concurrent operations a snapshot is the file of saveIndex
+    std::string path_saved = "snapshot_test_saved.bin";
+    alg_hnsw.saveIndex(path_saved);
+    alg_hnsw.saveSnapshot(path);
+    assert(readFile(path) == readFile(path_saved));
+    remove(path.c_str());
+    remove(path_saved.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cmath>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void testKernels() {
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_int_distribution<int> distrib(0, 255);
+
+    for (size_t dim : {1, 7, 16, 31, 32, 37, 100, 768}) {
+        std::vector<uint8_t> a(dim), b(dim);
+        std::vector<float> w(dim);
+        for (size_t i = 0; i < dim; i++) {
+            a[i] = distrib(rng);
+            b[i] = distrib(rng);
+            w[i] = distrib(rng) / 255.0f;
+        }
+        int l2 = hnswlib::SQ8L2SqrInt(a.data(), b.data(), dim);
+        int dot = hnswlib::SQ8DotInt(a.data(), b.data(), dim);
+        float l2_weighted = hnswlib::SQ8L2SqrWeighted(a.data(), b.data(), w.data(), dim);
+        float dot_weighted = hnswlib::SQ8DotWeighted(a.data(), b.data(), w.data(), dim);
+        float tolerance = 1e-4f;
+#if defined(USE_AVX2)
+        if (AVX2Capable()) {
+            assert(hnswlib::SQ8L2SqrIntAVX2(a.data(), b.data(), dim) == l2);
+            assert(hnswlib::SQ8DotIntAVX2(a.data(), b.data(), dim) == dot);
+            assert(std::abs(hnswlib::SQ8L2SqrWeightedAVX2(a.data(), b.data(), w.data(), dim) - l2_weighted) <= tolerance * l2_weighted);
+            assert(std::abs(hnswlib::SQ8DotWeightedAVX2(a.data(), b.data(), w.data(), dim) - dot_weighted) <= tolerance * dot_weighted);
+        }
+#endif
+#if defined(USE_AVX512BW)
+        if (AVX512BWCapable()) {
+            assert(hnswlib::SQ8L2SqrIntAVX512(a.data(), b.data(), dim) == l2);
+            assert(hnswlib::SQ8DotIntAVX512(a.data(), b.data(), dim) == dot);
+            assert(std::abs(hnswlib::SQ8L2SqrWeightedAVX512(a.data(), b.data(), w.data(), dim) - l2_weighted) <= tolerance * l2_weighted);
+            assert(std::abs(hnswlib::SQ8DotWeightedAVX512(a.data(), b.data(), w.data(), dim) - dot_weighted) <= tolerance * dot_weighted);
+        }
+#if defined(USE_AVX512VNNI)
+        if (AVX512VNNICapable()) {
+            assert(hnswlib::SQ8L2SqrIntAVX512VNNI(a.data(), b.data(), dim) == l2);
+            assert(hnswlib::SQ8DotIntAVX512VNNI(a.data(), b.data(), dim) == dot);
+        }
+#endif
+#endif
+    }
+}
+
+// distances on codes must match the fp32 distances of the decoded vectors
+void testDistances(hnswlib::SQ8SpaceBase &space, hnswlib::SpaceInterface<float> &reference_space,
+                   const std::vector<float> &data, size_t n, size_t dim) {
+    space.train(data.data(), n);
+    size_t code_size = space.get_data_size();
+    assert(code_size == dim + sizeof(float));
+    std::vector<char> codes(n * code_size);
+    std::vector<float> decoded(n * dim);
+    for (size_t j = 0; j < n; j++) {
+        space.encode(data.data() + j * dim, codes.data() + j * code_size);
+        space.decode(codes.data() + j * code_size, decoded.data() + j * dim);
+    }
+
+    // reconstruction error is at most half a step
+    for (size_t j = 0; j < n * dim; j++) {
+        size_t i = j % dim;
+        float step = space.getStep()[space.getStep().size() == 1 ? 0 : i];
+        assert(std::abs(decoded[j] - data[j]) <= step * 0.5f + 1e-6f);
+    }
+
+    hnswlib::DISTFUNC<float> dist = space.get_dist_func();
+    hnswlib::DISTFUNC<float> reference_dist = reference_space.get_dist_func();
+    for (size_t j = 0; j + 1 < n; j++) {
+        float d = dist(codes.data() + j * code_size, codes.data() + (j + 1) * code_size, space.get_dist_func_param());
+        float d_ref = reference_dist(decoded.data() + j * dim, decoded.data() + (j + 1) * dim,
+                                     reference_space.get_dist_func_param());
+        assert(std::abs(d - d_ref) <= 1e-3f * std::max(1.0f, std::abs(d_ref)));
+    }
+}
+
+void testSearch(size_t dim, bool per_dimension) {
+    idx_t n = 3000;
+    idx_t nq = 100;
+    size_t k = 10;
+
+    std::vector<float> data(n * dim);
+    std::vector<float> query(nq * dim);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * dim; ++i) {
+        data[i] = distrib(rng) * (1 + i % dim);
+    }
+    for (idx_t i = 0; i < nq * dim; ++i) {
+        query[i] = distrib(rng) * (1 + i % dim);
+    }
+
+    hnswlib::L2Space l2_space(dim);
+    hnswlib::L2SpaceSQ8 sq8_space(dim, per_dimension);
+    testDistances(sq8_space, l2_space, data, n, dim);
+
+    hnswlib::InnerProductSpace ip_space(dim);
+    hnswlib::InnerProductSpaceSQ8 ip_sq8_space(dim, per_dimension);
+    testDistances(ip_sq8_space, ip_space, data, n, dim);
+
+    // recall of the quantized index against exact fp32 search
+    hnswlib::BruteforceSearch<float> alg_brute(&l2_space, n);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&sq8_space, n);
+    std::vector<char> code(sq8_space.get_data_size());
+    for (size_t i = 0; i < n; ++i) {
+        alg_brute.addPoint(data.data() + dim * i, i);
+        sq8_space.encode(data.data() + dim * i, code.data());
+        alg_hnsw.addPoint(code.data(), i);
+    }
+    alg_hnsw.setEf(100);
+
+    size_t correct = 0;
+    for (size_t j = 0; j < nq; ++j) {
+        auto gt = alg_brute.searchKnnCloserFirst(query.data() + dim * j, k);
+        sq8_space.encode(query.data() + dim * j, code.data());
+        auto res = alg_hnsw.searchKnnCloserFirst(code.data(), k);
+        for (auto &r : res) {
+            for (auto &g : gt) {
+                if (r.second == g.second)
+                    correct++;
+            }
+        }
+    }
+    float recall = (float) correct / (nq * k);
+    std::cout << "SQ8 dim " << dim << (per_dimension ? " per dimension" : " global") << " recall: " << recall << "\n";
+    assert(recall > 0.9f);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testKernels();
+    testSearch(16, false);
+    testSearch(37, true);
+    testSearch(64, true);
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -106,12 +106,13 @@ std::vector<datatype> load_batch(std::string path, int size) {
 template <typename d_type>
 static float
 test_approx(std::vector<float> &queries, size_t qsize, hnswlib::HierarchicalNSW<d_type> &appr_alg, size_t vecdim,
-            std::vector<std::unordered_set<hnswlib::labeltype>> &answers, size_t K) {
+            std::vector<std::unordered_set<hnswlib::labeltype>> &answers, size_t K, hnswlib::SearchStats &stats) {
     size_t correct = 0;
     size_t total = 0;
 
     for (int i = 0; i < qsize; i++) {
-        std::priority_queue<std::pair<d_type, hnswlib::labeltype>> result = appr_alg.searchKnn((char *)(queries.data() + vecdim * i), K);
+        std::priority_queue<std::pair<d_type, hnswlib::labeltype>> result =
+            appr_alg.searchKnn((char *)(queries.data() + vecdim * i), K, nullptr, &stats);
         total += K;
         while (result.size()) {
             if (answers[i].find(result.top().second) != answers[i].end()) {
@@ -150,14 +151,13 @@ test_vs_recall(
     for (size_t ef : efs) {
         appr_alg.setEf(ef);
 
-        appr_alg.metric_hops = 0;
-        appr_alg.metric_distance_computations = 0;
+        hnswlib::SearchStats stats;
         StopW stopw = StopW();
 
-        float recall = test_approx<float>(queries, qsize, appr_alg, vecdim, answers, k);
+        float recall = test_approx<float>(queries, qsize, appr_alg, vecdim, answers, k, stats);
         float time_us_per_query = stopw.getElapsedTimeMicro() / qsize;
-        float distance_comp_per_query =  appr_alg.metric_distance_computations / (1.0f * qsize);
-        float hops_per_query =  appr_alg.metric_hops / (1.0f * qsize);
+        float distance_comp_per_query =  stats.distance_computations / (1.0f * qsize);
+        float hops_per_query =  stats.hops() / (1.0f * qsize);
 
         std::cout << ef << "\t" << recall << "\t" << time_us_per_query << "us \t" << hops_per_query << "\t" << distance_comp_per_query << "\n";
         if (recall > 0.99) {
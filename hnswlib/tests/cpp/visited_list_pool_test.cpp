@@ -0,0 +1,137 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void testPool() {
+    hnswlib::VisitedListPool pool(1, 100, 2);
+    hnswlib::VisitedList *first = pool.getFreeVisitedList();
+    hnswlib::VisitedList *second = pool.getFreeVisitedList();
+    assert(first != second);
+    assert(pool.tryGetFreeVisitedList() == nullptr);
+    assert(pool.getNumLists() == 2);
+
+    // a released list is handed out again, reset
+    first->mass[5] = first->curV;
+    pool.releaseVisitedList(first);
+    hnswlib::VisitedList *again = pool.getFreeVisitedList();
+    assert(again == first);
+    assert(again->mass[5] != again->curV);
+    pool.releaseVisitedList(again);
+    pool.releaseVisitedList(second);
+}
+
+
+void testSharedLimit() {
+    // the dense lists and the hash sets of an index count against one limit
+    auto limit = std::make_shared<hnswlib::VisitedSetLimit>(2);
+    hnswlib::VisitedListPool list_pool(1, 100, limit);
+    hnswlib::VisitedHashSetPool set_pool(0, 100, limit);
+    hnswlib::VisitedList *list = list_pool.getFreeVisitedList();
+    hnswlib::VisitedHashSet *set = set_pool.getFreeVisitedList();
+    assert(list_pool.tryGetFreeVisitedList() == nullptr);
+    assert(set_pool.tryGetFreeVisitedList() == nullptr);
+    assert(limit->getNumSets() == 2);
+
+    // a free set of the other pool is freed to make room
+    set_pool.releaseVisitedList(set);
+    hnswlib::VisitedList *second = list_pool.tryGetFreeVisitedList();
+    assert(second != nullptr);
+    assert(set_pool.getNumLists() == 0);
+    assert(limit->getNumSets() == 2);
+
+    // insertions take a set beyond the limit
+    set = set_pool.tryGetFreeVisitedList(true);
+    assert(set != nullptr);
+    assert(limit->getNumSets() == 3);
+    set_pool.releaseVisitedList(set);
+    list_pool.releaseVisitedList(second);
+    list_pool.releaseVisitedList(list);
+}
+
+void testLimitedSearch() {
+    int d = 16;
+    idx_t n = 2000;
+    idx_t nq = 100;
+    size_t k = 10;
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    alg_hnsw.setMaxVisitedLists(2);
+    int num_threads = 4;
+    std::vector<std::thread> insert_threads;
+    for (int t = 0; t < num_threads; t++) {
+        insert_threads.push_back(std::thread([&, t] {
+            for (size_t i = t; i < n; i += num_threads) {
+                alg_hnsw.addPoint(data.data() + d * i, i);
+            }
+        }));
+    }
+    for (auto &thread : insert_threads) {
+        thread.join();
+    }
+    assert(alg_hnsw.visited_list_pool_->getNumLists() <= 2);
+
+    std::vector<std::vector<std::pair<float, idx_t>>> expected(nq);
+    for (size_t j = 0; j < nq; ++j) {
+        expected[j] = alg_hnsw.searchKnnCloserFirst(query.data() + j * d, k);
+    }
+
+    // batches larger than the limit must neither deadlock nor change the results
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.push_back(std::thread([&] {
+            auto results = alg_hnsw.searchKnnBatch(query.data(), nq, k, nullptr, 8);
+            for (size_t j = 0; j < nq; ++j) {
+                auto &res = results[j];
+                assert(res.size() == expected[j].size());
+                for (size_t i = expected[j].size(); i > 0; i--) {
+                    assert(res.top() == expected[j][i - 1]);
+                    res.pop();
+                }
+            }
+        }));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    assert(alg_hnsw.visited_list_pool_->getNumLists() <= 2);
+
+    // the limit is kept after resizing
+    alg_hnsw.resizeIndex(2 * n);
+    alg_hnsw.searchKnnBatch(query.data(), nq, k, nullptr, 8);
+    assert(alg_hnsw.visited_list_pool_->getNumLists() <= 2);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testPool();
+    testSharedLimit();
+    testLimitedSearch();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <set>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class PickDivisibleIds : public hnswlib::BaseFilterFunctor {
+    unsigned int divisor = 1;
+
+ public:
+    explicit PickDivisibleIds(unsigned int divisor) : divisor(divisor) {}
+
+    bool operator()(idx_t label) {
+        return label % divisor == 0;
+    }
+};
+
+void testHashSet() {
+    hnswlib::VisitedHashSet visited;
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_int_distribution<unsigned int> distrib(0, 999999);
+
+    // several rounds, the table grows in the first ones and is reused afterwards
+    for (int round = 0; round < 5; round++) {
+        visited.reset();
+        std::set<unsigned int> expected;
+        for (int i = 0; i < 20000; i++) {
+            unsigned int id = distrib(rng);
+            bool first_visit = visited.visit(id);
+            bool inserted = expected.insert(id).second;
+            assert(first_visit == inserted);
+        }
+        assert(visited.size() == expected.size());
+        for (unsigned int id : expected) {
+            bool first_visit = visited.visit(id);
+            assert(!first_visit);
+        }
+    }
+    assert(visited.capacity() >= 2 * visited.size());
+
+    // the epoch wraps around
+    for (int i = 0; i < 70000; i++) {
+        visited.reset();
+        bool first_visit = visited.visit(i);
+        bool second_visit = visited.visit(i);
+        assert(first_visit && !second_visit);
+    }
+    visited.reset();
+    bool first_visit = visited.visit(1);
+    assert(first_visit);
+}
+
+void testSearch() {
+    int d = 16;
+    idx_t n = 3000;
+    idx_t nq = 100;
+    size_t k = 10;
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    for (size_t i = 0; i < n; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+    }
+    for (idx_t label = 0; label < n; label += 13) {
+        alg_hnsw.markDelete(label);
+    }
+    alg_hnsw.setEf(200);
+
+    // the visited set implementation must not change the results
+    PickDivisibleIds filter(3);
+    hnswlib::HierarchicalNSW<float>::SearchContext context;
+    std::vector<std::pair<float, idx_t>> result(k);
+    for (size_t j = 0; j < nq; ++j) {
+        const void* p = query.data() + j * d;
+        for (hnswlib::BaseFilterFunctor* f : {(hnswlib::BaseFilterFunctor*) nullptr, (hnswlib::BaseFilterFunctor*) &filter}) {
+            alg_hnsw.setVisitedSetType(hnswlib::VisitedSetType::Dense);
+            auto res_dense = alg_hnsw.searchKnnCloserFirst(p, k, f);
+            hnswlib::EpsilonSearchStopCondition<float> stop_condition(0.5, 1, 100);
+            auto res_epsilon_dense = alg_hnsw.searchStopConditionClosest(p, stop_condition, f);
+
+            alg_hnsw.setVisitedSetType(hnswlib::VisitedSetType::Hash);
+            auto res_hash = alg_hnsw.searchKnnCloserFirst(p, k, f);
+            assert(res_hash == res_dense);
+            hnswlib::EpsilonSearchStopCondition<float> stop_condition_hash(0.5, 1, 100);
+            auto res_epsilon_hash = alg_hnsw.searchStopConditionClosest(p, stop_condition_hash, f);
+            assert(res_epsilon_hash == res_epsilon_dense);
+
+            size_t num_results = alg_hnsw.searchKnn(p, k, context, result.data(), f);
+            assert(num_results == res_dense.size());
+            for (size_t i = 0; i < num_results; i++) {
+                assert(result[i] == res_dense[i]);
+            }
+        }
+    }
+    assert(context.visited_set != nullptr);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testHashSet();
+    testSearch();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,45 @@
+import unittest
+
+import numpy as np
+
+import hnswlib
+
+
+class RandomSelfTestCase(unittest.TestCase):
+    def testHalfPrecisionRecall(self):
+        dim = 32
+        num_elements = 5000
+        num_queries = 50
+        k = 10
+
+        data = np.float32(np.random.random((num_elements, dim)))
+        query_data = np.float32(np.random.random((num_queries, dim)))
+
+        for metric in ['l2', 'cosine']:
+            bf_index = hnswlib.BFIndex(space=metric, dim=dim)
+            bf_index.init_index(max_elements=num_elements)
+            bf_index.add_items(data)
+            labels_bf, _ = bf_index.knn_query(query_data, k)
+
+            recalls = {}
+            for suffix in ['', '_f16', '_bf16']:
+                # the vectors are converted from fp32 when stored, queries stay fp32
+                p = hnswlib.Index(space=metric + suffix, dim=dim)
+                p.init_index(max_elements=num_elements, ef_construction=100, M=16)
+                p.set_ef(100)
+                p.add_items(data)
+                labels, _ = p.knn_query(query_data, k)
+
+                correct = 0
+                for i in range(num_queries):
+                    correct += len(np.intersect1d(labels[i], labels_bf[i]))
+                recalls[suffix] = float(correct) / (k * num_queries)
+                print("%s recall is :" % (metric + suffix), recalls[suffix])
+
+            # the rounding of the stored components costs little recall
+            self.assertGreater(recalls['_f16'], recalls[''] - 0.05)
+            self.assertGreater(recalls['_bf16'], recalls[''] - 0.1)
+
+    def testUnknownSuffix(self):
+        with self.assertRaises(RuntimeError):
+            hnswlib.Index(space='l2_f8', dim=16)